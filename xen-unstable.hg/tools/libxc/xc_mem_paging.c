@@ -99,6 +99,110 @@ int xc_mem_paging_load(xc_interface *xch, domid_t domain_id,
     return rc;
 }
 
+static int xc_mem_paging_batch_memop(xc_interface *xch, domid_t domain_id,
+                                     unsigned int op, unsigned long gfn,
+                                     unsigned int nr, void *buffer,
+                                     unsigned int *done)
+{
+    xen_mem_paging_batch_op_t mpb;
+    unsigned int total = 0;
+    int rc = 0;
+
+    while ( total < nr )
+    {
+        memset(&mpb, 0, sizeof(mpb));
+
+        mpb.op      = op;
+        mpb.domain  = domain_id;
+        mpb.gfn     = gfn + total;
+        mpb.nr_gfns = nr - total;
+        mpb.buffer  = buffer ?
+            (unsigned long)buffer + ((unsigned long)total << XC_PAGE_SHIFT) : 0;
+
+        rc = do_memory_op(xch, XENMEM_paging_batch_op, &mpb, sizeof(mpb));
+        total += mpb.nr_done;
+
+        /* Stop on error, otherwise Xen was preempted and we go again */
+        if ( rc < 0 )
+            break;
+
+        /* Xen must make progress, or we would spin forever */
+        if ( mpb.nr_done == 0 )
+        {
+            errno = EIO;
+            rc = -1;
+            break;
+        }
+    }
+
+    if ( done )
+        *done = total;
+
+    return rc < 0 ? -1 : 0;
+}
+
+int xc_mem_paging_nominate_batch(xc_interface *xch, domid_t domain_id,
+                                 unsigned long gfn, unsigned int nr,
+                                 unsigned int *done)
+{
+    return xc_mem_paging_batch_memop(xch, domain_id,
+                                     XENMEM_paging_op_nominate_batch,
+                                     gfn, nr, NULL, done);
+}
+
+int xc_mem_paging_evict_batch(xc_interface *xch, domid_t domain_id,
+                              unsigned long gfn, unsigned int nr,
+                              unsigned int *done)
+{
+    return xc_mem_paging_batch_memop(xch, domain_id,
+                                     XENMEM_paging_op_evict_batch,
+                                     gfn, nr, NULL, done);
+}
+
+int xc_mem_paging_load_batch(xc_interface *xch, domid_t domain_id,
+                             unsigned long gfn, unsigned int nr,
+                             void *buffer, unsigned int *done)
+{
+    size_t len = (size_t)nr << XC_PAGE_SHIFT;
+    int rc, old_errno;
+
+    if ( done )
+        *done = 0;
+
+    if ( !buffer || !nr )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ( ((unsigned long) buffer) & (XC_PAGE_SIZE - 1) )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ( mlock(buffer, len) )
+        return -1;
+
+    rc = xc_mem_paging_batch_memop(xch, domain_id,
+                                   XENMEM_paging_op_prep_batch,
+                                   gfn, nr, buffer, done);
+
+    old_errno = errno;
+    munlock(buffer, len);
+    errno = old_errno;
+
+    return rc;
+}
+
+int xc_mem_paging_coalesce(xc_interface *xch, domid_t domain_id,
+                           unsigned long gfn, unsigned int nr)
+{
+    return xc_mem_paging_batch_memop(xch, domain_id,
+                                     XENMEM_paging_op_coalesce,
+                                     gfn, nr, NULL, NULL);
+}
+
 
 /*
  * Local variables:
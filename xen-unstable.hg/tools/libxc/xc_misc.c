@@ -336,6 +336,80 @@ int xc_getcpuinfo(xc_interface *xch, int max_cpus,
     return rc;
 }
 
+int xc_sched_latency_get(xc_interface *xch, uint32_t domid, int max_vcpus,
+                         int reset, xc_sched_latency_t *lat, int *nr_vcpus)
+{
+    int rc;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BOUNCE(lat, max_vcpus*sizeof(*lat), XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( xc_hypercall_bounce_pre(xch, lat) )
+        return -1;
+
+    sysctl.cmd = XEN_SYSCTL_sched_latency;
+    sysctl.u.sched_latency.domid = domid;
+    sysctl.u.sched_latency.flags = reset ? XEN_SYSCTL_SCHED_LAT_reset : 0;
+    sysctl.u.sched_latency.nr_vcpus = max_vcpus;
+    set_xen_guest_handle(sysctl.u.sched_latency.vcpus, lat);
+
+    rc = do_sysctl(xch, &sysctl);
+
+    xc_hypercall_bounce_post(xch, lat);
+
+    if ( nr_vcpus )
+        *nr_vcpus = sysctl.u.sched_latency.nr_vcpus;
+
+    return rc;
+}
+
+int xc_evtchn_stats_get(xc_interface *xch, uint32_t domid, int reset,
+                        evtchn_port_t *start_port, int max_ports,
+                        xc_evtchn_stats_t *stats, int *nr_ports)
+{
+    int rc;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BOUNCE(stats, max_ports*sizeof(*stats), XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( xc_hypercall_bounce_pre(xch, stats) )
+        return -1;
+
+    sysctl.cmd = XEN_SYSCTL_evtchn_op;
+    sysctl.u.evtchn_op.cmd = XEN_SYSCTL_EVTCHNOP_get_stats;
+    sysctl.u.evtchn_op.domid = domid;
+    sysctl.u.evtchn_op.flags = reset ? XEN_SYSCTL_EVTCHN_reset : 0;
+    sysctl.u.evtchn_op.u.get_stats.start_port = *start_port;
+    sysctl.u.evtchn_op.u.get_stats.nr_ports = max_ports;
+    set_xen_guest_handle(sysctl.u.evtchn_op.u.get_stats.stats, stats);
+
+    rc = do_sysctl(xch, &sysctl);
+
+    xc_hypercall_bounce_post(xch, stats);
+
+    if ( rc == 0 )
+        *start_port = sysctl.u.evtchn_op.u.get_stats.start_port;
+    if ( nr_ports )
+        *nr_ports = sysctl.u.evtchn_op.u.get_stats.nr_ports;
+
+    return rc;
+}
+
+int xc_evtchn_set_ratelimit(xc_interface *xch, uint32_t domid,
+                            evtchn_port_t port, uint32_t period_us,
+                            uint32_t burst)
+{
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_evtchn_op;
+    sysctl.u.evtchn_op.cmd = XEN_SYSCTL_EVTCHNOP_set_ratelimit;
+    sysctl.u.evtchn_op.domid = domid;
+    sysctl.u.evtchn_op.flags = 0;
+    sysctl.u.evtchn_op.u.set_ratelimit.port = port;
+    sysctl.u.evtchn_op.u.set_ratelimit.period_us = period_us;
+    sysctl.u.evtchn_op.u.set_ratelimit.burst = burst;
+
+    return do_sysctl(xch, &sysctl);
+}
+
 
 int xc_hvm_set_pci_intx_level(
     xc_interface *xch, domid_t dom,
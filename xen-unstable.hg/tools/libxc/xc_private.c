@@ -442,6 +442,33 @@ int xc_mmuext_op(
     return ret;
 }
 
+int xc_multicall(
+    xc_interface *xch,
+    multicall_entry_t *calls,
+    unsigned int nr_calls)
+{
+    DECLARE_HYPERCALL;
+    DECLARE_HYPERCALL_BOUNCE(calls, nr_calls*sizeof(*calls), XC_HYPERCALL_BUFFER_BOUNCE_BOTH);
+    long ret = -EINVAL;
+
+    if ( xc_hypercall_bounce_pre(xch, calls) )
+    {
+        PERROR("Could not bounce memory for multicall hypercall");
+        goto out1;
+    }
+
+    hypercall.op     = __HYPERVISOR_multicall;
+    hypercall.arg[0] = HYPERCALL_BUFFER_AS_ARG(calls);
+    hypercall.arg[1] = (unsigned long)nr_calls;
+
+    ret = do_xen_hypercall(xch, &hypercall);
+
+    xc_hypercall_bounce_post(xch, calls);
+
+ out1:
+    return ret;
+}
+
 static int flush_mmu_updates(xc_interface *xch, struct xc_mmu *mmu)
 {
     int err = 0;
@@ -703,6 +703,26 @@ int xc_sched_credit2_domain_set(xc_interface *xch,
 int xc_sched_credit2_domain_get(xc_interface *xch,
                                uint32_t domid,
                                struct xen_domctl_sched_credit2 *sdom);
+int xc_sched_credit2_params_set(xc_interface *xch,
+                               uint32_t cpupool_id,
+                               struct xen_sysctl_credit2_schedule *schedule);
+int xc_sched_credit2_params_get(xc_interface *xch,
+                               uint32_t cpupool_id,
+                               struct xen_sysctl_credit2_schedule *schedule);
+
+/* sdom->vcpuid selects the vcpu for get as well as set */
+int xc_sched_rt_domain_set(xc_interface *xch,
+                           uint32_t domid,
+                           struct xen_domctl_sched_rt *sdom);
+int xc_sched_rt_domain_get(xc_interface *xch,
+                           uint32_t domid,
+                           struct xen_domctl_sched_rt *sdom);
+int xc_sched_rt_params_set(xc_interface *xch,
+                           uint32_t cpupool_id,
+                           struct xen_sysctl_rt_schedule *schedule);
+int xc_sched_rt_params_get(xc_interface *xch,
+                           uint32_t cpupool_id,
+                           struct xen_sysctl_rt_schedule *schedule);
 
 int
 xc_sched_arinc653_schedule_set(
@@ -916,6 +936,26 @@ int xc_evtchn_reset(xc_interface *xch,
 typedef struct evtchn_status xc_evtchn_status_t;
 int xc_evtchn_status(xc_interface *xch, xc_evtchn_status_t *status);
 
+/*
+ * Read the statistics of the ports of domid in use, starting at
+ * *start_port, into up to max_ports records of stats, zeroing the counters
+ * in Xen if reset is set.  On return *nr_ports holds the number of records
+ * written and *start_port the port to continue from, or 0 once all ports
+ * have been read.  See XEN_SYSCTL_evtchn_op.
+ */
+typedef xen_sysctl_evtchn_stats_t xc_evtchn_stats_t;
+int xc_evtchn_stats_get(xc_interface *xch, uint32_t domid, int reset,
+                        evtchn_port_t *start_port, int max_ports,
+                        xc_evtchn_stats_t *stats, int *nr_ports);
+
+/*
+ * Let at most burst sends on a port of domid through per period_us
+ * microseconds, coalescing the rest; a period of 0 removes the limit.
+ */
+int xc_evtchn_set_ratelimit(xc_interface *xch, uint32_t domid,
+                            evtchn_port_t port, uint32_t period_us,
+                            uint32_t burst);
+
 /*
  * Return a handle to the event channel driver, or -1 on failure, in which case
  * errno will be set appropriately.
@@ -1027,6 +1067,15 @@ typedef xen_sysctl_cpuinfo_t xc_cpuinfo_t;
 int xc_getcpuinfo(xc_interface *xch, int max_cpus,
                   xc_cpuinfo_t *info, int *nr_cpus); 
 
+/*
+ * Read the wakeup and runqueue wait histograms of up to max_vcpus vcpus of
+ * domid into lat[vcpu_id], zeroing them in Xen if reset is set.  See
+ * XEN_SYSCTL_sched_latency for the bucket layout.
+ */
+typedef xen_sysctl_sched_latency_vcpu_t xc_sched_latency_t;
+int xc_sched_latency_get(xc_interface *xch, uint32_t domid, int max_vcpus,
+                         int reset, xc_sched_latency_t *lat, int *nr_vcpus);
+
 int xc_domain_setmaxmem(xc_interface *xch,
                         uint32_t domid,
                         unsigned int max_memkb);
@@ -1264,6 +1313,14 @@ int xc_clear_domain_page(xc_interface *xch, uint32_t domid,
 int xc_mmuext_op(xc_interface *xch, struct mmuext_op *op, unsigned int nr_ops,
                  domid_t dom);
 
+/*
+ * Issue nr_calls hypercalls with one HYPERVISOR_multicall, writing the
+ * result of each back to calls[i].result.  Pointer arguments of the calls
+ * must point into hypercall buffers (see xc_hypercall_buffer_alloc()).
+ */
+int xc_multicall(xc_interface *xch, multicall_entry_t *calls,
+                 unsigned int nr_calls);
+
 /* System wide memory properties */
 long xc_maximum_ram_page(xc_interface *xch);
 
@@ -1919,6 +1976,29 @@ int xc_mem_paging_prep(xc_interface *xch, domid_t domain_id, unsigned long gfn);
 int xc_mem_paging_load(xc_interface *xch, domid_t domain_id, 
                         unsigned long gfn, void *buffer);
 
+/*
+ * Batched paging operations on nr contiguous gfns starting at gfn.
+ * On failure -1 is returned with errno set for the gfn at offset *done,
+ * all gfns before it have been processed successfully.
+ * xc_mem_paging_load_batch() expects nr page-aligned pages in buffer.
+ */
+int xc_mem_paging_nominate_batch(xc_interface *xch, domid_t domain_id,
+                                 unsigned long gfn, unsigned int nr,
+                                 unsigned int *done);
+int xc_mem_paging_evict_batch(xc_interface *xch, domid_t domain_id,
+                              unsigned long gfn, unsigned int nr,
+                              unsigned int *done);
+int xc_mem_paging_load_batch(xc_interface *xch, domid_t domain_id,
+                             unsigned long gfn, unsigned int nr,
+                             void *buffer, unsigned int *done);
+/*
+ * Map 2M aligned ranges in [gfn, gfn + nr) with superpages again where
+ * paging or sharing left them fully populated with private pages.  gfn and
+ * nr must be multiples of 512.  Works without a pager attached.
+ */
+int xc_mem_paging_coalesce(xc_interface *xch, domid_t domain_id,
+                           unsigned long gfn, unsigned int nr);
+
 /** 
  * Access tracking operations.
  * Supported only on Intel EPT 64 bit processors.
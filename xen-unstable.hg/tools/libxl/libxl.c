@@ -4342,6 +4342,58 @@ int libxl_sched_credit_params_set(libxl_ctx *ctx, uint32_t poolid,
     return 0;
 }
 
+int libxl_sched_credit2_params_get(libxl_ctx *ctx, uint32_t poolid,
+                                   libxl_sched_credit2_params *scinfo)
+{
+    struct xen_sysctl_credit2_schedule sparam;
+    int rc;
+
+    rc = xc_sched_credit2_params_get(ctx->xch, poolid, &sparam);
+    if (rc != 0) {
+        LIBXL__LOG_ERRNO(ctx, LIBXL__LOG_ERROR, "getting sched credit2 param");
+        return ERROR_FAIL;
+    }
+
+    scinfo->runqueue = sparam.runqueue;
+    scinfo->numa_balance = !!sparam.numa_balance;
+
+    return 0;
+}
+
+int libxl_sched_credit2_params_set(libxl_ctx *ctx, uint32_t poolid,
+                                   libxl_sched_credit2_params *scinfo)
+{
+    struct xen_sysctl_credit2_schedule sparam;
+    int rc;
+
+    if (scinfo->runqueue < LIBXL_CREDIT2_RUNQUEUE_CORE
+        || scinfo->runqueue > LIBXL_CREDIT2_RUNQUEUE_ALL) {
+        LIBXL__LOG(ctx, LIBXL__LOG_ERROR, "Invalid runqueue arrangement %d",
+                   scinfo->runqueue);
+        return ERROR_INVAL;
+    }
+
+    sparam.runqueue = scinfo->runqueue;
+    sparam.numa_balance = scinfo->numa_balance;
+
+    rc = xc_sched_credit2_params_set(ctx->xch, poolid, &sparam);
+    if ( rc < 0 ) {
+        if (errno == EBUSY)
+            LIBXL__LOG(ctx, LIBXL__LOG_ERROR, "Runqueue arrangement of"
+                       " cpupool %u can only be changed while it has no cpus",
+                       poolid);
+        else
+            LIBXL__LOG_ERRNO(ctx, LIBXL__LOG_ERROR,
+                             "setting sched credit2 param");
+        return ERROR_FAIL;
+    }
+
+    scinfo->runqueue = sparam.runqueue;
+    scinfo->numa_balance = !!sparam.numa_balance;
+
+    return 0;
+}
+
 static int sched_credit2_domain_get(libxl__gc *gc, uint32_t domid,
                                     libxl_domain_sched_params *scinfo)
 {
@@ -4357,6 +4409,7 @@ static int sched_credit2_domain_get(libxl__gc *gc, uint32_t domid,
     libxl_domain_sched_params_init(scinfo);
     scinfo->sched = LIBXL_SCHEDULER_CREDIT2;
     scinfo->weight = sdom.weight;
+    scinfo->gang = sdom.gang == XEN_DOMCTL_CREDIT2_GANG_ON;
 
     return 0;
 }
@@ -4382,6 +4435,12 @@ static int sched_credit2_domain_set(libxl__gc *gc, uint32_t domid,
         sdom.weight = scinfo->weight;
     }
 
+    if (scinfo->gang != LIBXL_DOMAIN_SCHED_PARAM_GANG_DEFAULT)
+        sdom.gang = scinfo->gang ? XEN_DOMCTL_CREDIT2_GANG_ON
+                                 : XEN_DOMCTL_CREDIT2_GANG_OFF;
+    else
+        sdom.gang = XEN_DOMCTL_CREDIT2_GANG_KEEP;
+
     rc = xc_sched_credit2_domain_set(CTX->xch, domid, &sdom);
     if ( rc < 0 ) {
         LOGE(ERROR, "setting domain sched credit2");
@@ -4391,6 +4450,178 @@ static int sched_credit2_domain_set(libxl__gc *gc, uint32_t domid,
     return 0;
 }
 
+int libxl_sched_rt_params_get(libxl_ctx *ctx, uint32_t poolid,
+                              libxl_sched_rt_params *scinfo)
+{
+    struct xen_sysctl_rt_schedule sparam;
+    int rc;
+
+    rc = xc_sched_rt_params_get(ctx->xch, poolid, &sparam);
+    if (rc != 0) {
+        LIBXL__LOG_ERRNO(ctx, LIBXL__LOG_ERROR, "getting sched rt param");
+        return ERROR_FAIL;
+    }
+
+    scinfo->mode = sparam.mode;
+    scinfo->reserved = sparam.reserved;
+
+    return 0;
+}
+
+int libxl_sched_rt_params_set(libxl_ctx *ctx, uint32_t poolid,
+                              libxl_sched_rt_params *scinfo)
+{
+    struct xen_sysctl_rt_schedule sparam;
+    int rc;
+
+    if (scinfo->mode < LIBXL_RT_MODE_GLOBAL
+        || scinfo->mode > LIBXL_RT_MODE_PARTITIONED) {
+        LIBXL__LOG(ctx, LIBXL__LOG_ERROR, "Invalid rt mode %d", scinfo->mode);
+        return ERROR_INVAL;
+    }
+
+    sparam.mode = scinfo->mode;
+    sparam.reserved = 0;
+
+    rc = xc_sched_rt_params_set(ctx->xch, poolid, &sparam);
+    if ( rc < 0 ) {
+        if (errno == EBUSY)
+            LIBXL__LOG(ctx, LIBXL__LOG_ERROR, "rt mode of cpupool %u can"
+                       " only be changed while it has no cpus", poolid);
+        else
+            LIBXL__LOG_ERRNO(ctx, LIBXL__LOG_ERROR, "setting sched rt param");
+        return ERROR_FAIL;
+    }
+
+    scinfo->mode = sparam.mode;
+    scinfo->reserved = sparam.reserved;
+
+    return 0;
+}
+
+static int sched_rt_vcpu_set(libxl__gc *gc, uint32_t domid, uint32_t vcpuid,
+                             int period, int budget)
+{
+    struct xen_domctl_sched_rt sdom;
+    int rc;
+
+    if ((period != 0 || budget != 0)
+        && (period < XEN_DOMCTL_SCHED_RT_PERIOD_MIN
+            || period > XEN_DOMCTL_SCHED_RT_PERIOD_MAX
+            || budget < XEN_DOMCTL_SCHED_RT_BUDGET_MIN
+            || budget > period)) {
+        LOG(ERROR, "rt period must be within %d to %d us and budget at"
+            " least %d us and no more than the period, or both 0",
+            XEN_DOMCTL_SCHED_RT_PERIOD_MIN, XEN_DOMCTL_SCHED_RT_PERIOD_MAX,
+            XEN_DOMCTL_SCHED_RT_BUDGET_MIN);
+        return ERROR_INVAL;
+    }
+
+    sdom.vcpuid = vcpuid;
+    sdom.period = period;
+    sdom.budget = budget;
+    sdom.misses = 0;
+
+    rc = xc_sched_rt_domain_set(CTX->xch, domid, &sdom);
+    if ( rc < 0 ) {
+        if (errno == ENOSPC)
+            LOG(ERROR, "Not enough unreserved cpu time for %d/%d us",
+                budget, period);
+        else
+            LOGE(ERROR, "setting domain sched rt");
+        return ERROR_FAIL;
+    }
+
+    return 0;
+}
+
+static int sched_rt_domain_get(libxl__gc *gc, uint32_t domid,
+                               libxl_domain_sched_params *scinfo)
+{
+    struct xen_domctl_sched_rt sdom;
+    int rc;
+
+    sdom.vcpuid = XEN_DOMCTL_SCHED_RT_ALL_VCPUS;
+    rc = xc_sched_rt_domain_get(CTX->xch, domid, &sdom);
+    if (rc != 0) {
+        LOGE(ERROR, "getting domain sched rt");
+        return ERROR_FAIL;
+    }
+
+    libxl_domain_sched_params_init(scinfo);
+    scinfo->sched = LIBXL_SCHEDULER_RT;
+    scinfo->period = sdom.period;
+    scinfo->budget = sdom.budget;
+
+    return 0;
+}
+
+static int sched_rt_domain_set(libxl__gc *gc, uint32_t domid,
+                               const libxl_domain_sched_params *scinfo)
+{
+    struct xen_domctl_sched_rt sdom;
+    int period, budget;
+    int rc;
+
+    if (scinfo->period == LIBXL_DOMAIN_SCHED_PARAM_PERIOD_DEFAULT
+        && scinfo->budget == LIBXL_DOMAIN_SCHED_PARAM_BUDGET_DEFAULT)
+        return 0;
+
+    sdom.vcpuid = XEN_DOMCTL_SCHED_RT_ALL_VCPUS;
+    rc = xc_sched_rt_domain_get(CTX->xch, domid, &sdom);
+    if (rc != 0) {
+        LOGE(ERROR, "getting domain sched rt");
+        return ERROR_FAIL;
+    }
+
+    period = sdom.period;
+    budget = sdom.budget;
+    if (scinfo->period != LIBXL_DOMAIN_SCHED_PARAM_PERIOD_DEFAULT)
+        period = scinfo->period;
+    if (scinfo->budget != LIBXL_DOMAIN_SCHED_PARAM_BUDGET_DEFAULT)
+        budget = scinfo->budget;
+
+    return sched_rt_vcpu_set(gc, domid, XEN_DOMCTL_SCHED_RT_ALL_VCPUS,
+                             period, budget);
+}
+
+int libxl_sched_rt_vcpu_params_get(libxl_ctx *ctx, uint32_t domid,
+                                   libxl_sched_rt_vcpu_params *params)
+{
+    GC_INIT(ctx);
+    struct xen_domctl_sched_rt sdom;
+    int rc;
+
+    sdom.vcpuid = params->vcpuid;
+    rc = xc_sched_rt_domain_get(CTX->xch, domid, &sdom);
+    if (rc != 0) {
+        LOGE(ERROR, "getting sched rt params of vcpu %d", params->vcpuid);
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+    params->period = sdom.period;
+    params->budget = sdom.budget;
+    params->misses = sdom.misses;
+
+ out:
+    GC_FREE;
+    return rc;
+}
+
+int libxl_sched_rt_vcpu_params_set(libxl_ctx *ctx, uint32_t domid,
+                                   const libxl_sched_rt_vcpu_params *params)
+{
+    GC_INIT(ctx);
+    int rc;
+
+    rc = sched_rt_vcpu_set(gc, domid, params->vcpuid,
+                           params->period, params->budget);
+
+    GC_FREE;
+    return rc;
+}
+
 static int sched_sedf_domain_get(libxl__gc *gc, uint32_t domid,
                                  libxl_domain_sched_params *scinfo)
 {
@@ -4481,6 +4712,9 @@ int libxl_domain_sched_params_set(libxl_ctx *ctx, uint32_t domid,
     case LIBXL_SCHEDULER_ARINC653:
         ret=sched_arinc653_domain_set(gc, domid, scinfo);
         break;
+    case LIBXL_SCHEDULER_RT:
+        ret=sched_rt_domain_set(gc, domid, scinfo);
+        break;
     default:
         LOG(ERROR, "Unknown scheduler");
         ret=ERROR_INVAL;
@@ -4511,6 +4745,9 @@ int libxl_domain_sched_params_get(libxl_ctx *ctx, uint32_t domid,
     case LIBXL_SCHEDULER_CREDIT2:
         ret=sched_credit2_domain_get(gc, domid, scinfo);
         break;
+    case LIBXL_SCHEDULER_RT:
+        ret=sched_rt_domain_get(gc, domid, scinfo);
+        break;
     default:
         LOG(ERROR, "Unknown scheduler");
         ret=ERROR_INVAL;
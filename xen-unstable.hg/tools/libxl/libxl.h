@@ -74,6 +74,28 @@
  */
 #define LIBXL_HAVE_FIRMWARE_PASSTHROUGH 1
 
+/*
+ * LIBXL_HAVE_SCHED_CREDIT2_PARAMS indicates that the per-cpupool
+ * credit2 runqueue arrangement can be read and set with
+ * libxl_sched_credit2_params_{get,set}.
+ */
+#define LIBXL_HAVE_SCHED_CREDIT2_PARAMS 1
+
+/*
+ * LIBXL_HAVE_SCHED_CREDIT2_GANG indicates that libxl_domain_sched_params
+ * has a 'gang' field, asking credit2 to co-schedule the domain's vcpus.
+ */
+#define LIBXL_HAVE_SCHED_CREDIT2_GANG 1
+
+/*
+ * LIBXL_HAVE_SCHED_RT indicates that the real-time scheduler is supported:
+ * libxl_domain_sched_params has a 'budget' field (with 'period', both in
+ * microseconds for it), per-vcpu reservations can be read and set with
+ * libxl_sched_rt_vcpu_params_{get,set} and the per-cpupool mode with
+ * libxl_sched_rt_params_{get,set}.
+ */
+#define LIBXL_HAVE_SCHED_RT 1
+
 /*
  * libxl ABI compatibility
  *
@@ -877,6 +899,16 @@ int libxl_sched_credit_params_get(libxl_ctx *ctx, uint32_t poolid,
                                   libxl_sched_credit_params *scinfo);
 int libxl_sched_credit_params_set(libxl_ctx *ctx, uint32_t poolid,
                                   libxl_sched_credit_params *scinfo);
+/* The runqueue arrangement can only be changed while the pool has no cpus */
+int libxl_sched_credit2_params_get(libxl_ctx *ctx, uint32_t poolid,
+                                   libxl_sched_credit2_params *scinfo);
+int libxl_sched_credit2_params_set(libxl_ctx *ctx, uint32_t poolid,
+                                   libxl_sched_credit2_params *scinfo);
+/* The mode can only be changed while the pool has no cpus */
+int libxl_sched_rt_params_get(libxl_ctx *ctx, uint32_t poolid,
+                              libxl_sched_rt_params *scinfo);
+int libxl_sched_rt_params_set(libxl_ctx *ctx, uint32_t poolid,
+                              libxl_sched_rt_params *scinfo);
 
 /* Scheduler Per-domain parameters */
 
@@ -886,12 +918,21 @@ int libxl_sched_credit_params_set(libxl_ctx *ctx, uint32_t poolid,
 #define LIBXL_DOMAIN_SCHED_PARAM_SLICE_DEFAULT     -1
 #define LIBXL_DOMAIN_SCHED_PARAM_LATENCY_DEFAULT   -1
 #define LIBXL_DOMAIN_SCHED_PARAM_EXTRATIME_DEFAULT -1
+#define LIBXL_DOMAIN_SCHED_PARAM_GANG_DEFAULT      -1
+#define LIBXL_DOMAIN_SCHED_PARAM_BUDGET_DEFAULT    -1
 
 int libxl_domain_sched_params_get(libxl_ctx *ctx, uint32_t domid,
                                   libxl_domain_sched_params *params);
 int libxl_domain_sched_params_set(libxl_ctx *ctx, uint32_t domid,
                                   const libxl_domain_sched_params *params);
 
+/* rt only: the reservation of one vcpu.  Setting it fails if it doesn't
+ * fit next to those of the other vcpus in the pool. */
+int libxl_sched_rt_vcpu_params_get(libxl_ctx *ctx, uint32_t domid,
+                                   libxl_sched_rt_vcpu_params *params);
+int libxl_sched_rt_vcpu_params_set(libxl_ctx *ctx, uint32_t domid,
+                                   const libxl_sched_rt_vcpu_params *params);
+
 int libxl_send_trigger(libxl_ctx *ctx, uint32_t domid,
                        libxl_trigger trigger, uint32_t vcpuid);
 int libxl_send_sysrq(libxl_ctx *ctx, uint32_t domid, char sysrq);
@@ -678,6 +678,10 @@ static void parse_config_data(const char *config_source,
         b_info->sched_params.latency = l;
     if (!xlu_cfg_get_long (config, "extratime", &l, 0))
         b_info->sched_params.extratime = l;
+    if (!xlu_cfg_get_long (config, "gang", &l, 0))
+        b_info->sched_params.gang = l;
+    if (!xlu_cfg_get_long (config, "budget", &l, 0))
+        b_info->sched_params.budget = l;
 
     if (!xlu_cfg_get_long (config, "vcpus", &l, 0)) {
         b_info->max_vcpus = l;
@@ -4838,6 +4842,51 @@ static int sched_credit_pool_output(uint32_t poolid)
     return 0;
 }
 
+static int sched_credit2_params_set(int poolid,
+                                    libxl_sched_credit2_params *scinfo)
+{
+    int rc;
+
+    rc = libxl_sched_credit2_params_set(ctx, poolid, scinfo);
+    if (rc)
+        fprintf(stderr, "libxl_sched_credit2_params_set failed.\n");
+
+    return rc;
+}
+
+static int sched_credit2_params_get(int poolid,
+                                    libxl_sched_credit2_params *scinfo)
+{
+    int rc;
+
+    rc = libxl_sched_credit2_params_get(ctx, poolid, scinfo);
+    if (rc)
+        fprintf(stderr, "libxl_sched_credit2_params_get failed.\n");
+
+    return rc;
+}
+
+static int sched_credit2_pool_output(uint32_t poolid)
+{
+    libxl_sched_credit2_params scparam;
+    char *poolname;
+    int rc;
+
+    poolname = libxl_cpupoolid_to_name(ctx, poolid);
+    rc = sched_credit2_params_get(poolid, &scparam);
+    if (rc) {
+        printf("Cpupool %s: [sched params unavailable]\n",
+               poolname);
+    } else {
+        printf("Cpupool %s: runqueue=%s numa_balance=%d\n",
+               poolname,
+               libxl_credit2_runqueue_to_string(scparam.runqueue),
+               scparam.numa_balance);
+    }
+    free(poolname);
+    return 0;
+}
+
 static int sched_credit2_domain_output(
     int domid)
 {
@@ -4846,22 +4895,104 @@ static int sched_credit2_domain_output(
     int rc;
 
     if (domid < 0) {
-        printf("%-33s %4s %6s\n", "Name", "ID", "Weight");
+        printf("%-33s %4s %6s %4s\n", "Name", "ID", "Weight", "Gang");
         return 0;
     }
     rc = sched_domain_get(LIBXL_SCHEDULER_CREDIT2, domid, &scinfo);
     if (rc)
         return rc;
     domname = libxl_domid_to_name(ctx, domid);
-    printf("%-33s %4d %6d\n",
+    printf("%-33s %4d %6d %4d\n",
         domname,
         domid,
-        scinfo.weight);
+        scinfo.weight,
+        scinfo.gang);
     free(domname);
     libxl_domain_sched_params_dispose(&scinfo);
     return 0;
 }
 
+static int sched_rt_params_set(int poolid, libxl_sched_rt_params *scinfo)
+{
+    int rc;
+
+    rc = libxl_sched_rt_params_set(ctx, poolid, scinfo);
+    if (rc)
+        fprintf(stderr, "libxl_sched_rt_params_set failed.\n");
+
+    return rc;
+}
+
+static int sched_rt_params_get(int poolid, libxl_sched_rt_params *scinfo)
+{
+    int rc;
+
+    rc = libxl_sched_rt_params_get(ctx, poolid, scinfo);
+    if (rc)
+        fprintf(stderr, "libxl_sched_rt_params_get failed.\n");
+
+    return rc;
+}
+
+static int sched_rt_pool_output(uint32_t poolid)
+{
+    libxl_sched_rt_params scparam;
+    char *poolname;
+    int rc;
+
+    poolname = libxl_cpupoolid_to_name(ctx, poolid);
+    rc = sched_rt_params_get(poolid, &scparam);
+    if (rc) {
+        printf("Cpupool %s: [sched params unavailable]\n",
+               poolname);
+    } else {
+        printf("Cpupool %s: mode=%s reserved=%d.%03d cpus\n",
+               poolname,
+               libxl_rt_mode_to_string(scparam.mode),
+               scparam.reserved / 1000, scparam.reserved % 1000);
+    }
+    free(poolname);
+    return 0;
+}
+
+/* One line per vcpu; best effort ones show a period and budget of 0 */
+static int sched_rt_domain_output(
+    int domid)
+{
+    char *domname;
+    libxl_dominfo info;
+    libxl_sched_rt_vcpu_params vparam;
+    unsigned int v;
+    int rc;
+
+    if (domid < 0) {
+        printf("%-33s %4s %4s %9s %9s %7s\n", "Name", "ID", "VCPU",
+               "Period", "Budget", "Misses");
+        return 0;
+    }
+    rc = libxl_domain_info(ctx, &info, domid);
+    if (rc) {
+        fprintf(stderr, "libxl_domain_info failed.\n");
+        return rc;
+    }
+    domname = libxl_domid_to_name(ctx, domid);
+    for (v = 0; v <= info.vcpu_max_id; v++) {
+        vparam.vcpuid = v;
+        if (libxl_sched_rt_vcpu_params_get(ctx, domid, &vparam))
+            continue;
+        printf("%-33s %4d %4u %9d %9d %7d\n",
+            domname,
+            domid,
+            v,
+            vparam.period,
+            vparam.budget,
+            vparam.misses);
+    }
+    free(domname);
+    libxl_dominfo_dispose(&info);
+    return 0;
+}
+
 static int sched_sedf_domain_output(
     int domid)
 {
@@ -5088,16 +5219,24 @@ int main_sched_credit2(int argc, char **argv)
     const char *dom = NULL;
     const char *cpupool = NULL;
     int weight = 256, opt_w = 0;
+    int gang = 0, opt_g = 0;
+    int opt_s = 0;
+    libxl_credit2_runqueue runqueue = 0;
+    int opt_R = 0, numa_balance = 0, opt_n = 0;
     int opt, rc;
     static struct option opts[] = {
         {"domain", 1, 0, 'd'},
         {"weight", 1, 0, 'w'},
+        {"gang", 1, 0, 'g'},
         {"cpupool", 1, 0, 'p'},
+        {"schedparam", 0, 0, 's'},
+        {"runqueue", 1, 0, 'R'},
+        {"numa_balance", 1, 0, 'n'},
         COMMON_LONG_OPTS,
         {0, 0, 0, 0}
     };
 
-    SWITCH_FOREACH_OPT(opt, "d:w:p:h", opts, "sched-credit2", 0) {
+    SWITCH_FOREACH_OPT(opt, "d:w:g:p:R:n:hs", opts, "sched-credit2", 0) {
     case 'd':
         dom = optarg;
         break;
@@ -5105,30 +5244,83 @@ int main_sched_credit2(int argc, char **argv)
         weight = strtol(optarg, NULL, 10);
         opt_w = 1;
         break;
+    case 'g':
+        gang = strtol(optarg, NULL, 10);
+        opt_g = 1;
+        break;
     case 'p':
         cpupool = optarg;
         break;
+    case 's':
+        opt_s = 1;
+        break;
+    case 'R':
+        if (libxl_credit2_runqueue_from_string(optarg, &runqueue)) {
+            fprintf(stderr, "Invalid runqueue arrangement '%s', must be "
+                    "one of core, socket, node or all.\n", optarg);
+            return 1;
+        }
+        opt_R = 1;
+        break;
+    case 'n':
+        numa_balance = strtol(optarg, NULL, 10);
+        opt_n = 1;
+        break;
     }
 
-    if (cpupool && (dom || opt_w)) {
-        fprintf(stderr, "Specifying a cpupool is not allowed with other "
-                "options.\n");
+    if ((cpupool || opt_s) && (dom || opt_w || opt_g)) {
+        fprintf(stderr, "Specifying a cpupool or schedparam is not "
+                "allowed with domain options.\n");
         return 1;
     }
-    if (!dom && opt_w) {
+    if (!dom && (opt_w || opt_g)) {
         fprintf(stderr, "Must specify a domain.\n");
         return 1;
     }
+    if (!opt_s && (opt_R || opt_n)) {
+        fprintf(stderr, "Must specify schedparam to set schedule "
+                "parameter values.\n");
+        return 1;
+    }
 
-    if (!dom) { /* list all domain's credit scheduler info */
+    if (opt_s) {
+        libxl_sched_credit2_params scparam;
+        uint32_t poolid = 0;
+
+        if (cpupool) {
+            if (cpupool_qualifier_to_cpupoolid(cpupool, &poolid, NULL) ||
+                !libxl_cpupoolid_is_valid(ctx, poolid)) {
+                fprintf(stderr, "unknown cpupool \'%s\'\n", cpupool);
+                return -ERROR_FAIL;
+            }
+        }
+
+        if (!opt_R && !opt_n) { /* Output scheduling parameters */
+            return -sched_credit2_pool_output(poolid);
+        } else { /* Set scheduling parameters*/
+            rc = sched_credit2_params_get(poolid, &scparam);
+            if (rc)
+                return -rc;
+
+            if (opt_R)
+                scparam.runqueue = runqueue;
+
+            if (opt_n)
+                scparam.numa_balance = !!numa_balance;
+
+            rc = sched_credit2_params_set(poolid, &scparam);
+            if (rc)
+                return -rc;
+        }
+    } else if (!dom) { /* list all domain's credit scheduler info */
         return -sched_domain_output(LIBXL_SCHEDULER_CREDIT2,
                                     sched_credit2_domain_output,
-                                    sched_default_pool_output,
+                                    sched_credit2_pool_output,
                                     cpupool);
     } else {
         uint32_t domid = find_domain(dom);
 
-        if (!opt_w) { /* output credit2 scheduler info */
+        if (!opt_w && !opt_g) { /* output credit2 scheduler info */
             sched_credit2_domain_output(-1);
             return -sched_credit2_domain_output(domid);
         } else { /* set credit2 scheduler paramaters */
@@ -5137,10 +5329,150 @@ int main_sched_credit2(int argc, char **argv)
             scinfo.sched = LIBXL_SCHEDULER_CREDIT2;
             if (opt_w)
                 scinfo.weight = weight;
+            if (opt_g)
+                scinfo.gang = !!gang;
+            rc = sched_domain_set(domid, &scinfo);
+            libxl_domain_sched_params_dispose(&scinfo);
+            if (rc)
+                return -rc;
+        }
+    }
+
+    return 0;
+}
+
+int main_sched_rt(int argc, char **argv)
+{
+    const char *dom = NULL;
+    const char *cpupool = NULL;
+    const char *vcpu = NULL;
+    int period = 0, opt_p = 0;
+    int budget = 0, opt_b = 0;
+    int opt_s = 0;
+    libxl_rt_mode mode = 0;
+    int opt_m = 0;
+    int opt, rc;
+    static struct option opts[] = {
+        {"domain", 1, 0, 'd'},
+        {"vcpu", 1, 0, 'v'},
+        {"period", 1, 0, 'p'},
+        {"budget", 1, 0, 'b'},
+        {"cpupool", 1, 0, 'c'},
+        {"schedparam", 0, 0, 's'},
+        {"mode", 1, 0, 'm'},
+        COMMON_LONG_OPTS,
+        {0, 0, 0, 0}
+    };
+
+    SWITCH_FOREACH_OPT(opt, "d:v:p:b:c:m:hs", opts, "sched-rt", 0) {
+    case 'd':
+        dom = optarg;
+        break;
+    case 'v':
+        vcpu = optarg;
+        break;
+    case 'p':
+        period = strtol(optarg, NULL, 10);
+        opt_p = 1;
+        break;
+    case 'b':
+        budget = strtol(optarg, NULL, 10);
+        opt_b = 1;
+        break;
+    case 'c':
+        cpupool = optarg;
+        break;
+    case 's':
+        opt_s = 1;
+        break;
+    case 'm':
+        if (libxl_rt_mode_from_string(optarg, &mode)) {
+            fprintf(stderr, "Invalid rt mode '%s', must be global or "
+                    "partitioned.\n", optarg);
+            return 1;
+        }
+        opt_m = 1;
+        break;
+    }
+
+    if ((cpupool || opt_s) && (dom || vcpu || opt_p || opt_b)) {
+        fprintf(stderr, "Specifying a cpupool or schedparam is not "
+                "allowed with domain options.\n");
+        return 1;
+    }
+    if (!dom && (vcpu || opt_p || opt_b)) {
+        fprintf(stderr, "Must specify a domain.\n");
+        return 1;
+    }
+    if (!opt_s && opt_m) {
+        fprintf(stderr, "Must specify schedparam to set schedule "
+                "parameter values.\n");
+        return 1;
+    }
+
+    if (opt_s) {
+        libxl_sched_rt_params scparam;
+        uint32_t poolid = 0;
+
+        if (cpupool) {
+            if (cpupool_qualifier_to_cpupoolid(cpupool, &poolid, NULL) ||
+                !libxl_cpupoolid_is_valid(ctx, poolid)) {
+                fprintf(stderr, "unknown cpupool \'%s\'\n", cpupool);
+                return -ERROR_FAIL;
+            }
+        }
+
+        if (!opt_m) { /* Output scheduling parameters */
+            return -sched_rt_pool_output(poolid);
+        } else { /* Set scheduling parameters*/
+            rc = sched_rt_params_get(poolid, &scparam);
+            if (rc)
+                return -rc;
+
+            scparam.mode = mode;
+
+            rc = sched_rt_params_set(poolid, &scparam);
+            if (rc)
+                return -rc;
+        }
+    } else if (!dom) { /* list all domain's rt scheduler info */
+        return -sched_domain_output(LIBXL_SCHEDULER_RT,
+                                    sched_rt_domain_output,
+                                    sched_rt_pool_output,
+                                    cpupool);
+    } else {
+        uint32_t domid = find_domain(dom);
+
+        if (!opt_p && !opt_b) { /* output rt scheduler info */
+            sched_rt_domain_output(-1);
+            return -sched_rt_domain_output(domid);
+        } else if (!vcpu || !strcmp(vcpu, "all")) {
+            /* set the reservation of every vcpu */
+            libxl_domain_sched_params scinfo;
+            libxl_domain_sched_params_init(&scinfo);
+            scinfo.sched = LIBXL_SCHEDULER_RT;
+            if (opt_p)
+                scinfo.period = period;
+            if (opt_b)
+                scinfo.budget = budget;
             rc = sched_domain_set(domid, &scinfo);
             libxl_domain_sched_params_dispose(&scinfo);
             if (rc)
                 return -rc;
+        } else { /* set the reservation of one vcpu */
+            libxl_sched_rt_vcpu_params vparam;
+
+            vparam.vcpuid = strtol(vcpu, NULL, 10);
+            rc = libxl_sched_rt_vcpu_params_get(ctx, domid, &vparam);
+            if (rc)
+                return -rc;
+            if (opt_p)
+                vparam.period = period;
+            if (opt_b)
+                vparam.budget = budget;
+            rc = libxl_sched_rt_vcpu_params_set(ctx, domid, &vparam);
+            if (rc)
+                return -rc;
         }
     }
 
@@ -6259,8 +6591,10 @@ int main_cpupoolcreate(int argc, char **argv)
     int n_cpus, n_nodes, i, n;
     libxl_bitmap freemap;
     libxl_bitmap cpumap;
+    libxl_bitmap nocpus;
     libxl_uuid uuid;
     libxl_cputopology *topology;
+    libxl_credit2_runqueue runqueue = 0;
     int rc = -ERROR_FAIL;
 
     SWITCH_FOREACH_OPT(opt, "hnf:", opts, "cpupool-create", 0) {
@@ -6355,6 +6689,17 @@ int main_cpupoolcreate(int argc, char **argv)
         }
     }
 
+    if (!xlu_cfg_get_string (config, "credit2_runqueue", &buf, 0)) {
+        if (sched != LIBXL_SCHEDULER_CREDIT2) {
+            fprintf(stderr, "credit2_runqueue needs sched=\"credit2\"\n");
+            goto out_cfg;
+        }
+        if (libxl_credit2_runqueue_from_string(buf, &runqueue)) {
+            fprintf(stderr, "Unknown credit2 runqueue arrangement\n");
+            goto out_cfg;
+        }
+    }
+
     if (libxl_get_freecpus(ctx, &freemap)) {
         fprintf(stderr, "libxl_get_freecpus failed\n");
         goto out_cfg;
@@ -6411,8 +6756,40 @@ int main_cpupoolcreate(int argc, char **argv)
     printf("cpupool name:   %s\n", name);
     printf("scheduler:      %s\n", libxl_scheduler_to_string(sched));
     printf("number of cpus: %d\n", n_cpus);
+    if (runqueue)
+        printf("runqueues:      per %s\n",
+               libxl_credit2_runqueue_to_string(runqueue));
 
-    if (!dryrun_only) {
+    if (!dryrun_only && runqueue) {
+        libxl_sched_credit2_params scparam;
+
+        /*
+         * The runqueue arrangement can only be changed while the pool is
+         * empty: create it without cpus, set it, then move the cpus in.
+         */
+        if (libxl_cpu_bitmap_alloc(ctx, &nocpus, 0)) {
+            fprintf(stderr, "Failed to allocate cpumap\n");
+            goto out_cfg;
+        }
+        poolid = 0;
+        ret = libxl_cpupool_create(ctx, name, sched, nocpus, &uuid, &poolid);
+        libxl_bitmap_dispose(&nocpus);
+        if (ret) {
+            fprintf(stderr, "error on creating cpupool\n");
+            goto out_cfg;
+        }
+        if (sched_credit2_params_get(poolid, &scparam))
+            goto out_cfg;
+        scparam.runqueue = runqueue;
+        if (sched_credit2_params_set(poolid, &scparam))
+            goto out_cfg;
+        libxl_for_each_set_bit(i, cpumap) {
+            if (libxl_cpupool_cpuadd(ctx, poolid, i)) {
+                fprintf(stderr, "error on adding cpu %d to cpupool\n", i);
+                goto out_cfg;
+            }
+        }
+    } else if (!dryrun_only) {
         poolid = 0;
         if (libxl_cpupool_create(ctx, name, sched, cpumap, &uuid, &poolid)) {
             fprintf(stderr, "error on creating cpupool\n");
@@ -248,10 +248,31 @@ struct cmd_spec cmd_table[] = {
     { "sched-credit2",
       &main_sched_credit2, 0, 1,
       "Get/set credit2 scheduler parameters",
-      "[-d <Domain> [-w[=WEIGHT]]] [-p CPUPOOL]",
+      "[-d <Domain> [-w[=WEIGHT]] [-g 0|1]] [-s [-R RUNQUEUE] [-n 0|1]]\n"
+      "                     [-p CPUPOOL]",
+      "-d DOMAIN, --domain=DOMAIN        Domain to modify\n"
+      "-w WEIGHT, --weight=WEIGHT        Weight (int)\n"
+      "-g 0|1,    --gang=0|1             Co-schedule the domain's vcpus\n"
+      "-s         --schedparam           Query / modify scheduler parameters\n"
+      "-R RUNQ,   --runqueue=RUNQ        Pcpus sharing a runqueue: core, socket,\n"
+      "                                  node or all (only for an empty CPUPOOL)\n"
+      "-n 0|1,    --numa_balance=0|1     Weight balancing by NUMA node distance\n"
+      "-p CPUPOOL, --cpupool=CPUPOOL     Restrict output to CPUPOOL"
+    },
+    { "sched-rt",
+      &main_sched_rt, 0, 1,
+      "Get/set real-time scheduler parameters",
+      "[-d <Domain> [-v VCPU|all] [-p PERIOD] [-b BUDGET]] [-s [-m MODE]]\n"
+      "                [-c CPUPOOL]",
       "-d DOMAIN, --domain=DOMAIN     Domain to modify\n"
-      "-w WEIGHT, --weight=WEIGHT     Weight (int)\n"
-      "-p CPUPOOL, --cpupool=CPUPOOL  Restrict output to CPUPOOL"
+      "-v VCPU,   --vcpu=VCPU         Vcpu to modify (default: all)\n"
+      "-p US,     --period=US         Period (microseconds)\n"
+      "-b US,     --budget=US         Cpu time each period (microseconds);\n"
+      "                               period and budget 0 for best effort\n"
+      "-s         --schedparam        Query / modify scheduler parameters\n"
+      "-m MODE,   --mode=MODE         global or partitioned EDF\n"
+      "                               (only for an empty CPUPOOL)\n"
+      "-c CPUPOOL, --cpupool=CPUPOOL  Restrict output to CPUPOOL"
     },
     { "sched-sedf",
       &main_sched_sedf, 0, 1,
@@ -0,0 +1,633 @@
+/*
+ * xen-poolbalanced: move pcpus between cpupools following their load
+ *
+ * Every interval the daemon measures, for each managed cpupool, how busy
+ * its pcpus were (from the per-pcpu idle time) and how many vcpus were on
+ * average waiting in its runqueues (from the runqueue wait histograms of
+ * the domains in the pool, see XEN_SYSCTL_sched_latency).  When a pool
+ * has vcpus queueing and is below its maximum size, one pcpu is taken
+ * from the free pcpus or from a managed pool that has more than a pcpu
+ * to spare and is above its minimum size, and is added to the queueing
+ * pool.  After a move the daemon waits a few intervals for the averages
+ * to settle before moving anything else.
+ *
+ * Pools are only touched when named on the command line:
+ *
+ *   xen-poolbalanced Pool-0=2:8 web=1:16 3=1:4
+ *
+ * Pools are given by name (as in "xl cpupool-list") or by id.
+ *
+ * The runqueue histograms are read without resetting them; anything else
+ * resetting them (xentop -l, for one) makes the daemon underestimate the
+ * queueing in the interval it happens.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <xenctrl.h>
+#include <xenstore.h>
+
+#define MAX_POOLS       64
+
+/* Defaults, see usage() */
+#define DEF_INTERVAL    5
+#define DEF_COOLDOWN    3
+#define DEF_GROW_QUEUE  0.25
+#define DEF_SPARE       1.5
+
+/* Weight of the newest sample in the averages */
+#define EWMA_WEIGHT     0.5
+
+struct pool {
+    const char *spec;           /* name or id, as given */
+    unsigned int min, max;
+
+    /* Refreshed every interval */
+    int present;
+    uint32_t id;
+    unsigned int nr_cpus;
+    xc_cpumap_t cpumap;
+    uint64_t busy_ns;           /* pcpu time not idle */
+    uint64_t wait_ns;           /* vcpu time spent in runqueues */
+
+    /* Averaged */
+    int sampled;
+    double util;                /* busy fraction of the pool's pcpus */
+    double queue;               /* waiting vcpus per pcpu */
+};
+
+static xc_interface *xch;
+static struct xs_handle *xsh;
+static int max_cpus, cpumap_size;
+
+static struct pool pools[MAX_POOLS];
+static unsigned int nr_pools;
+
+static unsigned int interval = DEF_INTERVAL;
+static unsigned int cooldown = DEF_COOLDOWN;
+static double grow_queue = DEF_GROW_QUEUE;
+static double min_spare = DEF_SPARE;
+static int dry_run, foreground, verbose;
+
+/* Previous cumulative values of the counters the daemon takes deltas of */
+static xc_cpuinfo_t *cpuinfo, *cpuinfo_prev;
+static uint64_t dom_wait_prev[DOMID_FIRST_RESERVED];
+static uint8_t dom_seen[DOMID_FIRST_RESERVED];
+static struct timespec ts_prev;
+
+static void logmsg(int prio, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (prio == LOG_DEBUG && !verbose)
+        return;
+
+    va_start(ap, fmt);
+    if (foreground) {
+        vfprintf(stderr, fmt, ap);
+        fputc('\n', stderr);
+    } else
+        vsyslog(prio, fmt, ap);
+    va_end(ap);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options] POOL=MIN:MAX [POOL=MIN:MAX ...]\n\n"
+            "Moves pcpus between the given cpupools (by name or id) so that\n"
+            "pools with queueing vcpus grow and idle ones shrink, keeping\n"
+            "each pool between MIN and MAX pcpus.\n\n"
+            "options:\n"
+            " -i SECS   sampling interval (default %d)\n"
+            " -c N      intervals to wait after moving a pcpu (default %d)\n"
+            " -q Q      grow a pool whose vcpus queue Q deep per pcpu\n"
+            "           on average (default %.2f)\n"
+            " -s S      only take pcpus from pools with more than S idle\n"
+            "           pcpus (default %.1f)\n"
+            " -n        only report what would be moved\n"
+            " -f        stay in the foreground, log to stderr\n"
+            " -v        log the measurements of every interval\n",
+            prog, DEF_INTERVAL, DEF_COOLDOWN, DEF_GROW_QUEUE, DEF_SPARE);
+    exit(2);
+}
+
+static void daemonize(void)
+{
+    switch (fork()) {
+    case -1:
+        err(1, "fork");
+    case 0:
+        break;
+    default:
+        exit(0);
+    }
+    umask(0);
+    if (setsid() < 0)
+        err(1, "setsid");
+    if (chdir("/") < 0)
+        err(1, "chdir /");
+    if (freopen("/dev/null", "r", stdin) == NULL)
+        err(1, "reopen stdin");
+    if (freopen("/dev/null", "w", stdout) == NULL)
+        err(1, "reopen stdout");
+    if (freopen("/dev/null", "w", stderr) == NULL)
+        err(1, "reopen stderr");
+}
+
+static void parse_pool(const char *arg)
+{
+    struct pool *p;
+    char *spec, *eq;
+
+    if (nr_pools == MAX_POOLS)
+        errx(1, "too many pools");
+    p = &pools[nr_pools];
+
+    spec = strdup(arg);
+    if (!spec)
+        err(1, "strdup");
+    eq = strchr(spec, '=');
+    if (!eq || eq == spec ||
+        sscanf(eq + 1, "%u:%u", &p->min, &p->max) != 2 ||
+        p->max < p->min || p->max == 0)
+        errx(1, "bad pool specification '%s', want POOL=MIN:MAX", arg);
+    *eq = '\0';
+    p->spec = spec;
+
+    p->cpumap = calloc(cpumap_size, 1);
+    if (!p->cpumap)
+        err(1, "calloc");
+
+    nr_pools++;
+}
+
+static int cpumap_test(const xc_cpumap_t map, int cpu)
+{
+    return map[cpu / 8] & (1 << (cpu % 8));
+}
+
+/* Does @spec name the pool with id @id? */
+static int pool_matches(const char *spec, uint32_t id)
+{
+    char path[64], *name, *end;
+    unsigned int len;
+    unsigned long val;
+    int match;
+
+    val = strtoul(spec, &end, 10);
+    if (*end == '\0')
+        return val == id;
+
+    if (!xsh)
+        return 0;
+    snprintf(path, sizeof(path), "/local/pool/%u/name", id);
+    name = xs_read(xsh, XBT_NULL, path, &len);
+    if (!name)
+        return 0;
+    match = !strcmp(name, spec);
+    free(name);
+
+    return match;
+}
+
+/*
+ * Work out which cpupool each managed pool is and which pcpus it has.
+ * Returns the number of pcpus that are in no pool.
+ */
+static unsigned int scan_pools(void)
+{
+    xc_cpupoolinfo_t *info;
+    xc_cpumap_t freemap;
+    uint32_t id = 0;
+    unsigned int i, nr_free = 0;
+    int cpu;
+
+    for (i = 0; i < nr_pools; i++)
+        pools[i].present = 0;
+
+    while ((info = xc_cpupool_getinfo(xch, id)) != NULL) {
+        for (i = 0; i < nr_pools; i++) {
+            struct pool *p = &pools[i];
+
+            if (p->present || !pool_matches(p->spec, info->cpupool_id))
+                continue;
+            if (p->sampled && p->id != info->cpupool_id)
+                p->sampled = 0;
+            p->present = 1;
+            p->id = info->cpupool_id;
+            memcpy(p->cpumap, info->cpumap, cpumap_size);
+            p->nr_cpus = 0;
+            for (cpu = 0; cpu < max_cpus; cpu++)
+                if (cpumap_test(p->cpumap, cpu))
+                    p->nr_cpus++;
+            break;
+        }
+        id = info->cpupool_id + 1;
+        xc_cpupool_infofree(xch, info);
+    }
+
+    freemap = xc_cpupool_freeinfo(xch);
+    if (freemap) {
+        for (cpu = 0; cpu < max_cpus; cpu++)
+            if (cpumap_test(freemap, cpu))
+                nr_free++;
+        free(freemap);
+    }
+
+    return nr_free;
+}
+
+/* Estimated runqueue wait time of a histogram bucket, in ns */
+static uint64_t bucket_ns(unsigned int b)
+{
+    uint64_t lo;
+
+    if (b == 0)
+        return 512;
+    lo = 1ULL << (b + 9);
+    return b == XEN_SYSCTL_SCHED_LAT_BUCKETS - 1 ? lo : lo + lo / 2;
+}
+
+/* Runqueue wait of all vcpus of a domain so far, in ns */
+static int domain_wait(const xc_dominfo_t *info, uint64_t *wait)
+{
+    xc_sched_latency_t *lat;
+    int nr_vcpus = info->max_vcpu_id + 1, v;
+    unsigned int b;
+
+    lat = calloc(nr_vcpus, sizeof(*lat));
+    if (!lat)
+        return -1;
+    if (xc_sched_latency_get(xch, info->domid, nr_vcpus, 0, lat,
+                             &nr_vcpus) < 0) {
+        free(lat);
+        return -1;
+    }
+
+    *wait = 0;
+    for (v = 0; v < nr_vcpus; v++)
+        for (b = 0; b < XEN_SYSCTL_SCHED_LAT_BUCKETS; b++)
+            *wait += lat[v].runq[b] * bucket_ns(b);
+
+    free(lat);
+    return 0;
+}
+
+static struct pool *pool_by_id(uint32_t id)
+{
+    unsigned int i;
+
+    for (i = 0; i < nr_pools; i++)
+        if (pools[i].present && pools[i].id == id)
+            return &pools[i];
+    return NULL;
+}
+
+/* Attribute the busy and queueing time of the last interval to the pools */
+static int sample(uint64_t *elapsed)
+{
+    static uint8_t seen[DOMID_FIRST_RESERVED];
+    xc_dominfo_t info[64];
+    xc_cpuinfo_t *tmp;
+    struct timespec ts;
+    struct pool *p;
+    uint32_t domid = 0;
+    uint64_t wait;
+    unsigned int i;
+    int nr, cpu, n;
+
+    for (i = 0; i < nr_pools; i++)
+        pools[i].busy_ns = pools[i].wait_ns = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    *elapsed = (ts.tv_sec - ts_prev.tv_sec) * 1000000000ULL +
+               ts.tv_nsec - ts_prev.tv_nsec;
+    ts_prev = ts;
+
+    if (xc_getcpuinfo(xch, max_cpus, cpuinfo, &nr) < 0) {
+        logmsg(LOG_ERR, "getting pcpu idle times failed: %s",
+               strerror(errno));
+        return -1;
+    }
+    for (i = 0; i < nr_pools; i++) {
+        p = &pools[i];
+        if (!p->present)
+            continue;
+        for (cpu = 0; cpu < nr; cpu++) {
+            uint64_t idle = cpuinfo[cpu].idletime - cpuinfo_prev[cpu].idletime;
+
+            if (cpumap_test(p->cpumap, cpu) && idle < *elapsed)
+                p->busy_ns += *elapsed - idle;
+        }
+    }
+    tmp = cpuinfo_prev;
+    cpuinfo_prev = cpuinfo;
+    cpuinfo = tmp;
+
+    memset(seen, 0, sizeof(seen));
+    while ((n = xc_domain_getinfo(xch, domid, 64, info)) > 0) {
+        for (i = 0; i < n; i++) {
+            domid = info[i].domid;
+            if (domid >= DOMID_FIRST_RESERVED || info[i].dying ||
+                domain_wait(&info[i], &wait) < 0)
+                continue;
+            seen[domid] = 1;
+            /* A new domain, or one that reused the id of a dead one */
+            if (dom_seen[domid] && wait >= dom_wait_prev[domid]) {
+                p = pool_by_id(info[i].cpupool);
+                if (p)
+                    p->wait_ns += wait - dom_wait_prev[domid];
+            }
+            dom_wait_prev[domid] = wait;
+        }
+        domid++;
+        if (n < 64)
+            break;
+    }
+    memcpy(dom_seen, seen, sizeof(dom_seen));
+
+    return 0;
+}
+
+static void update_averages(uint64_t elapsed)
+{
+    unsigned int i;
+
+    for (i = 0; i < nr_pools; i++) {
+        struct pool *p = &pools[i];
+        double util, queue;
+
+        if (!p->present || !p->nr_cpus) {
+            p->sampled = 0;
+            continue;
+        }
+
+        util = (double)p->busy_ns / elapsed / p->nr_cpus;
+        queue = (double)p->wait_ns / elapsed / p->nr_cpus;
+        if (util > 1.0)
+            util = 1.0;
+
+        if (p->sampled) {
+            p->util += EWMA_WEIGHT * (util - p->util);
+            p->queue += EWMA_WEIGHT * (queue - p->queue);
+        } else {
+            p->util = util;
+            p->queue = queue;
+            p->sampled = 1;
+        }
+
+        logmsg(LOG_DEBUG, "pool %s (%u): %u pcpus, %.0f%% busy, "
+               "%.2f queued per pcpu (now %.0f%%, %.2f)", p->spec, p->id,
+               p->nr_cpus, p->util * 100, p->queue, util * 100, queue);
+    }
+}
+
+/* Idle pcpus of a pool, the measure of what it can give away */
+static double spare(const struct pool *p)
+{
+    return p->nr_cpus * (1.0 - p->util);
+}
+
+static int wants_cpu(const struct pool *p)
+{
+    if (!p->present || p->nr_cpus >= p->max)
+        return 0;
+    if (p->nr_cpus < p->min)
+        return 1;
+    return p->sampled && p->queue >= grow_queue;
+}
+
+static int can_give_cpu(const struct pool *p)
+{
+    if (!p->present || p->nr_cpus <= p->min)
+        return 0;
+    if (p->nr_cpus > p->max)
+        return 1;
+    return p->sampled && p->queue < grow_queue / 4 && spare(p) > min_spare;
+}
+
+/*
+ * Take a pcpu out of @from (highest numbered first, as "xl cpupool-cpu-remove"
+ * would) or out of the free pcpus, and put it into @to.
+ */
+static int move_cpu(struct pool *from, struct pool *to)
+{
+    int cpu;
+
+    if (!from) {
+        if (dry_run) {
+            logmsg(LOG_INFO, "would add a free pcpu to pool %s", to->spec);
+            return 0;
+        }
+        if (xc_cpupool_addcpu(xch, to->id, -1) < 0) {
+            logmsg(LOG_ERR, "adding a free pcpu to pool %s failed: %s",
+                   to->spec, strerror(errno));
+            return -1;
+        }
+        logmsg(LOG_INFO, "added a free pcpu to pool %s", to->spec);
+        return 0;
+    }
+
+    for (cpu = max_cpus - 1; cpu >= 0; cpu--) {
+        if (!cpumap_test(from->cpumap, cpu))
+            continue;
+        if (dry_run) {
+            logmsg(LOG_INFO, "would move pcpu %d from pool %s to pool %s",
+                   cpu, from->spec, to->spec);
+            return 0;
+        }
+        /* Busy while vcpus pinned to it can't go elsewhere: try another. */
+        if (xc_cpupool_removecpu(xch, from->id, cpu) < 0) {
+            if (errno == EBUSY)
+                continue;
+            logmsg(LOG_ERR, "removing pcpu %d from pool %s failed: %s",
+                   cpu, from->spec, strerror(errno));
+            return -1;
+        }
+        if (xc_cpupool_addcpu(xch, to->id, cpu) < 0) {
+            logmsg(LOG_ERR, "adding pcpu %d to pool %s failed: %s",
+                   cpu, to->spec, strerror(errno));
+            /* Don't leave it unused. */
+            xc_cpupool_addcpu(xch, from->id, cpu);
+            return -1;
+        }
+        logmsg(LOG_INFO, "moved pcpu %d from pool %s (%.0f%% busy) to "
+               "pool %s (%.2f queued per pcpu)", cpu, from->spec,
+               from->util * 100, to->spec, to->queue);
+        return 0;
+    }
+
+    logmsg(LOG_WARNING, "no pcpu of pool %s can be removed", from->spec);
+    return -1;
+}
+
+/* Move at most one pcpu; returns whether one was moved */
+static int balance(unsigned int nr_free)
+{
+    struct pool *to = NULL, *from = NULL;
+    unsigned int i;
+
+    for (i = 0; i < nr_pools; i++) {
+        struct pool *p = &pools[i];
+
+        if (!wants_cpu(p))
+            continue;
+        /* Pools below their minimum first, then the longest queues */
+        if (!to || (p->nr_cpus < p->min) > (to->nr_cpus < to->min) ||
+            ((p->nr_cpus < p->min) == (to->nr_cpus < to->min) &&
+             p->queue > to->queue))
+            to = p;
+    }
+    if (!to)
+        return 0;
+
+    if (!nr_free) {
+        for (i = 0; i < nr_pools; i++) {
+            struct pool *p = &pools[i];
+
+            if (p == to || !can_give_cpu(p))
+                continue;
+            /* Pools above their maximum first, then the most idle */
+            if (!from || (p->nr_cpus > p->max) > (from->nr_cpus > from->max) ||
+                ((p->nr_cpus > p->max) == (from->nr_cpus > from->max) &&
+                 spare(p) > spare(from)))
+                from = p;
+        }
+        if (!from) {
+            logmsg(LOG_DEBUG, "pool %s could use a pcpu, none to spare",
+                   to->spec);
+            return 0;
+        }
+    }
+
+    return move_cpu(from, to) == 0;
+}
+
+static volatile sig_atomic_t done;
+
+static void catch_exit(int sig)
+{
+    done = 1;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int i, nr_free, wait = 0;
+    uint64_t elapsed;
+    int opt, nr;
+
+    while ((opt = getopt(argc, argv, "i:c:q:s:nfvh")) != -1) {
+        switch (opt) {
+        case 'i':
+            interval = strtoul(optarg, NULL, 0);
+            if (!interval)
+                usage(argv[0]);
+            break;
+        case 'c':
+            cooldown = strtoul(optarg, NULL, 0);
+            break;
+        case 'q':
+            grow_queue = strtod(optarg, NULL);
+            if (grow_queue <= 0)
+                usage(argv[0]);
+            break;
+        case 's':
+            min_spare = strtod(optarg, NULL);
+            break;
+        case 'n':
+            dry_run = 1;
+            break;
+        case 'f':
+            foreground = 1;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind == argc)
+        usage(argv[0]);
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    if (!xch)
+        errx(1, "failed to open the hypervisor interface");
+    max_cpus = xc_get_max_cpus(xch);
+    cpumap_size = xc_get_cpumap_size(xch);
+    if (max_cpus <= 0 || cpumap_size <= 0)
+        errx(1, "failed to get the number of pcpus");
+
+    /* Only needed for pool names */
+    xsh = xs_open(XS_OPEN_READONLY);
+
+    for (; optind < argc; optind++)
+        parse_pool(argv[optind]);
+
+    cpuinfo = calloc(max_cpus, sizeof(*cpuinfo));
+    cpuinfo_prev = calloc(max_cpus, sizeof(*cpuinfo));
+    if (!cpuinfo || !cpuinfo_prev)
+        err(1, "calloc");
+
+    scan_pools();
+    for (i = 0; i < nr_pools; i++)
+        if (!pools[i].present)
+            warnx("pool %s does not exist (yet)", pools[i].spec);
+
+    if (!foreground) {
+        daemonize();
+        openlog("xen-poolbalanced", LOG_PID, LOG_DAEMON);
+    }
+
+    signal(SIGTERM, catch_exit);
+    signal(SIGINT, catch_exit);
+
+    /* The first sample only sets the baseline */
+    if (xc_getcpuinfo(xch, max_cpus, cpuinfo_prev, &nr) < 0)
+        err(1, "getting pcpu idle times failed");
+    clock_gettime(CLOCK_MONOTONIC, &ts_prev);
+    sample(&elapsed);
+    for (i = 0; i < nr_pools; i++)
+        pools[i].sampled = 0;
+
+    while (!done) {
+        sleep(interval);
+        if (done)
+            break;
+
+        /*
+         * Sample against the pool membership of the interval that just
+         * ended, so a pcpu moved at its start counts for its new pool.
+         */
+        if (sample(&elapsed) < 0 || !elapsed)
+            continue;
+        update_averages(elapsed);
+        nr_free = scan_pools();
+
+        if (wait) {
+            wait--;
+            continue;
+        }
+        if (balance(nr_free))
+            wait = cooldown;
+    }
+
+    if (xsh)
+        xs_close(xsh);
+    xc_interface_close(xch);
+
+    return 0;
+}
@@ -1626,6 +1626,7 @@ static PyObject *pyxc_sched_credit2_domain_set(XcObject *self,
         return NULL;
 
     sdom.weight = weight;
+    sdom.gang = XEN_DOMCTL_CREDIT2_GANG_KEEP;
 
     if ( xc_sched_credit2_domain_set(self->xc_handle, domid, &sdom) != 0 )
         return pyxc_error_to_exception(self->xc_handle);
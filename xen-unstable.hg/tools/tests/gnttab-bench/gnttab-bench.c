@@ -0,0 +1,438 @@
+/*
+ * gnttab-bench.c
+ *
+ * Grant table microbenchmark.  Run in dom0 (or any domain with gntdev and
+ * gntalloc), it grants pages to a domain and has that many threads of a
+ * backend-like consumer map and unmap them as fast as they can, for 1, 2,
+ * 4, ... threads, reporting the throughput at each thread count.  Mapping
+ * your own grants (the default, domid 0 granting to itself) exercises the
+ * same hypervisor paths a backend does, without needing a guest.
+ *
+ *   map     each thread maps a batch of its own grant refs with one
+ *           GNTTABOP_map_grant_ref and unmaps them again: this is the
+ *           maptrack handle allocation path of the mapping domain.
+ *
+ *   copy    each thread is a queue of a netback-like backend: it copies
+ *           a packet's worth of data between two batches of its own
+ *           grant refs with one GNTTABOP_copy.  All the queues work on
+ *           the grant table of the same granting domain, but never on
+ *           the same entries.
+ *
+ *   segs    like copy, but each packet arrives in COPY_FRAGS fragments,
+ *           copied with one GNTTABOP_copy_segs descriptor per packet.
+ *           Compare with copy -f COPY_FRAGS, which copies the same fragments
+ *           with one GNTTABOP_copy each.
+ *
+ * Ideally the throughput grows linearly with the threads; where it stops
+ * growing something in the hypervisor path serialises them.  "xenperf"
+ * shows the gnttab counters of the run.
+ *
+ * With -m, that many further grants stay mapped throughout, as they would
+ * in a busy backend: the cost of a map or unmap should not depend on it.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <xenctrl.h>
+
+static uint32_t domid;
+static unsigned int max_threads = 8;
+static unsigned int batch = 16;
+static unsigned int seconds = 5;
+static unsigned int held;
+
+/* Bytes per copy: a full-sized ethernet frame. */
+#define COPY_LEN 1514
+
+/* Fragments per packet with -f and in segs mode. */
+#define COPY_FRAGS 8
+static unsigned int frags = 1;
+
+static volatile int stop;
+static pthread_barrier_t start;
+
+struct worker {
+    pthread_t thread;
+    unsigned int id;
+    uint32_t *refs;         /* map: batch refs, copy: batch sources, then
+                               batch destinations */
+    uint32_t *domids;
+    uint64_t ops;
+    int err;
+};
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-d domid] [-t threads] [-b batch] [-s seconds]\n"
+            "          [-m held] [-f] [mode]\n"
+            "\n"
+            "mode is one of:\n"
+            "  map     map and unmap batches of grants (the default)\n"
+            "  copy    copy between batches of grants, one queue per thread\n"
+            "  segs    copy fragmented packets with GNTTABOP_copy_segs\n"
+            "\n"
+            " -d domid    domain the grants are made to and mapped from;\n"
+            "             it must be the domain running the benchmark\n"
+            "             (default 0)\n"
+            " -t threads  largest number of threads to run (default %u)\n"
+            " -b batch    grants per map or copy hypercall (default %u)\n"
+            " -s seconds  length of each run (default %u)\n"
+            " -m held     grants kept mapped during the runs (default 0)\n"
+            " -f          copy mode: copy each packet in %u fragments\n",
+            prog, max_threads, batch, seconds, COPY_FRAGS);
+    exit(2);
+}
+
+static void *map_worker(void *arg)
+{
+    struct worker *w = arg;
+    xc_gnttab *xcg;
+    void *addr;
+
+    xcg = xc_gnttab_open(NULL, 0);
+    if ( !xcg || xc_gnttab_set_max_grants(xcg, batch) < 0 )
+    {
+        w->err = errno;
+        pthread_barrier_wait(&start);
+        return NULL;
+    }
+
+    pthread_barrier_wait(&start);
+
+    while ( !stop )
+    {
+        addr = xc_gnttab_map_grant_refs(xcg, batch, w->domids, w->refs,
+                                        PROT_READ | PROT_WRITE);
+        if ( !addr )
+        {
+            w->err = errno;
+            break;
+        }
+        if ( xc_gnttab_munmap(xcg, addr, batch) < 0 )
+        {
+            w->err = errno;
+            break;
+        }
+        w->ops += batch;
+    }
+
+    xc_gnttab_close(xcg);
+    return NULL;
+}
+
+static void *copy_worker(void *arg)
+{
+    struct worker *w = arg;
+    xc_interface *xch;
+    gnttab_copy_t *ops;
+    unsigned int i;
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    ops = calloc(batch * frags, sizeof(*ops));
+    if ( !xch || !ops )
+    {
+        w->err = errno;
+        pthread_barrier_wait(&start);
+        goto out;
+    }
+
+    pthread_barrier_wait(&start);
+
+    while ( !stop )
+    {
+        for ( i = 0; i < batch * frags; i++ )
+        {
+            ops[i].source.u.ref = w->refs[i / frags];
+            ops[i].source.domid = domid;
+            ops[i].source.offset = (i % frags) * (COPY_LEN / frags);
+            ops[i].dest.u.ref = w->refs[batch + i / frags];
+            ops[i].dest.domid = domid;
+            ops[i].dest.offset = ops[i].source.offset;
+            ops[i].len = COPY_LEN / frags;
+            ops[i].flags = GNTCOPY_source_gref | GNTCOPY_dest_gref;
+        }
+        if ( xc_gnttab_op(xch, GNTTABOP_copy, ops, sizeof(*ops),
+                          batch * frags) < 0 )
+        {
+            w->err = errno;
+            break;
+        }
+        for ( i = 0; i < batch * frags; i++ )
+            if ( ops[i].status != GNTST_okay )
+                break;
+        if ( i < batch * frags )
+        {
+            w->err = EIO;
+            break;
+        }
+        w->ops += batch;
+    }
+
+ out:
+    free(ops);
+    if ( xch )
+        xc_interface_close(xch);
+    return NULL;
+}
+
+static void *segs_worker(void *arg)
+{
+    struct worker *w = arg;
+    xc_interface *xch;
+    gnttab_copy_segs_t *ops;
+    unsigned int i, j;
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    ops = calloc(batch, sizeof(*ops));
+    if ( !xch || !ops )
+    {
+        w->err = errno;
+        pthread_barrier_wait(&start);
+        goto out;
+    }
+
+    pthread_barrier_wait(&start);
+
+    while ( !stop )
+    {
+        for ( i = 0; i < batch; i++ )
+        {
+            ops[i].source.u.ref = w->refs[i];
+            ops[i].source.domid = domid;
+            ops[i].dest.u.ref = w->refs[batch + i];
+            ops[i].dest.domid = domid;
+            ops[i].flags = GNTCOPY_source_gref | GNTCOPY_dest_gref;
+            ops[i].nr_segs = COPY_FRAGS;
+            for ( j = 0; j < COPY_FRAGS; j++ )
+            {
+                ops[i].seg[j].source_offset = j * (COPY_LEN / COPY_FRAGS);
+                ops[i].seg[j].dest_offset = ops[i].seg[j].source_offset;
+                ops[i].seg[j].len = COPY_LEN / COPY_FRAGS;
+            }
+        }
+        if ( xc_gnttab_op(xch, GNTTABOP_copy_segs, ops, sizeof(*ops),
+                          batch) < 0 )
+        {
+            w->err = errno;
+            break;
+        }
+        for ( i = 0; i < batch; i++ )
+            if ( ops[i].status != GNTST_okay ||
+                 ops[i].nr_done != COPY_FRAGS )
+                break;
+        if ( i < batch )
+        {
+            w->err = EIO;
+            break;
+        }
+        w->ops += batch;
+    }
+
+ out:
+    free(ops);
+    if ( xch )
+        xc_interface_close(xch);
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Run @nr threads for the configured time; returns grant ops per second. */
+static double run(struct worker *workers, unsigned int nr,
+                  void *(*fn)(void *))
+{
+    unsigned int i;
+    uint64_t ops = 0;
+    double t;
+
+    stop = 0;
+    pthread_barrier_init(&start, NULL, nr + 1);
+    for ( i = 0; i < nr; i++ )
+    {
+        workers[i].ops = 0;
+        workers[i].err = 0;
+        if ( pthread_create(&workers[i].thread, NULL, fn, &workers[i]) )
+        {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+
+    pthread_barrier_wait(&start);
+    t = now();
+    sleep(seconds);
+    stop = 1;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        pthread_join(workers[i].thread, NULL);
+        if ( workers[i].err )
+        {
+            fprintf(stderr, "thread %u: %s\n", i, strerror(workers[i].err));
+            exit(1);
+        }
+        ops += workers[i].ops;
+    }
+    t = now() - t;
+    pthread_barrier_destroy(&start);
+
+    return ops / t;
+}
+
+int main(int argc, char **argv)
+{
+    const char *mode = "map";
+    void *(*fn)(void *) = map_worker;
+    struct worker *workers;
+    xc_gntshr *xgs;
+    xc_gnttab *xgt = NULL;
+    void *shared, *held_addr = NULL;
+    uint32_t *refs, *held_domids;
+    unsigned int i, j, nr, per_thread;
+    double rate, base = 0;
+    int opt;
+
+    while ( (opt = getopt(argc, argv, "d:t:b:s:m:fh")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'd':
+            domid = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            max_threads = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            batch = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            seconds = strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            held = strtoul(optarg, NULL, 0);
+            break;
+        case 'f':
+            frags = COPY_FRAGS;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if ( optind < argc )
+        mode = argv[optind++];
+    if ( optind < argc || !max_threads || !batch || !seconds )
+        usage(argv[0]);
+    if ( !strcmp(mode, "copy") )
+        fn = copy_worker;
+    else if ( !strcmp(mode, "segs") )
+        fn = segs_worker;
+    else if ( strcmp(mode, "map") )
+        usage(argv[0]);
+    per_thread = fn == map_worker ? batch : 2 * batch;
+
+    /* Every thread gets grants of its own. */
+    xgs = xc_gntshr_open(NULL, 0);
+    if ( !xgs )
+    {
+        perror("xc_gntshr_open");
+        return 1;
+    }
+    refs = calloc(max_threads * per_thread + held, sizeof(*refs));
+    workers = calloc(max_threads, sizeof(*workers));
+    held_domids = calloc(held + 1, sizeof(*held_domids));
+    if ( !refs || !workers || !held_domids )
+    {
+        perror("calloc");
+        return 1;
+    }
+    shared = xc_gntshr_share_pages(xgs, domid,
+                                   max_threads * per_thread + held, refs, 1);
+    if ( !shared )
+    {
+        perror("xc_gntshr_share_pages");
+        return 1;
+    }
+    for ( i = 0; i < max_threads; i++ )
+    {
+        workers[i].id = i;
+        workers[i].refs = &refs[i * per_thread];
+        workers[i].domids = calloc(batch, sizeof(uint32_t));
+        if ( !workers[i].domids )
+        {
+            perror("calloc");
+            return 1;
+        }
+        for ( j = 0; j < batch; j++ )
+            workers[i].domids[j] = domid;
+    }
+
+    if ( held )
+    {
+        for ( i = 0; i < held; i++ )
+            held_domids[i] = domid;
+        xgt = xc_gnttab_open(NULL, 0);
+        if ( !xgt || xc_gnttab_set_max_grants(xgt, held) < 0 )
+        {
+            perror("xc_gnttab_open");
+            return 1;
+        }
+        held_addr = xc_gnttab_map_grant_refs(xgt, held, held_domids,
+                                             &refs[max_threads * per_thread],
+                                             PROT_READ | PROT_WRITE);
+        if ( !held_addr )
+        {
+            perror("xc_gnttab_map_grant_refs");
+            return 1;
+        }
+    }
+
+    printf("%s: batches of %u grants, %u held, %u s per run\n", mode, batch,
+           held, seconds);
+    printf("%8s %14s %14s %8s\n", "threads", "grants/s", "per thread",
+           "scaling");
+    for ( nr = 1; ; nr *= 2 )
+    {
+        if ( nr > max_threads )
+            nr = max_threads;
+        rate = run(workers, nr, fn);
+        if ( nr == 1 )
+            base = rate;
+        printf("%8u %14.0f %14.0f %8.2f\n", nr, rate, rate / nr,
+               base ? rate / base : 0);
+        if ( nr == max_threads )
+            break;
+    }
+
+    if ( held )
+    {
+        xc_gnttab_munmap(xgt, held_addr, held);
+        xc_gnttab_close(xgt);
+    }
+    xc_gntshr_munmap(xgs, shared, max_threads * per_thread + held);
+    xc_gntshr_close(xgs);
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
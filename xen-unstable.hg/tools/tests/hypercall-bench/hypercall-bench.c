@@ -0,0 +1,482 @@
+/*
+ * hypercall-bench.c
+ *
+ * Hypercall fast path microbenchmark.  Run in dom0 (or any domain with
+ * privcmd, evtchn, gntdev and gntalloc), it issues the hypercalls of the
+ * hot paths through libxc as fast as it can, from one thread, and reports
+ * for each the latency per operation and the throughput.  Batched tests
+ * are run with 1, 2, 4, ... operations per hypercall, up to -b, so the
+ * fixed cost of a hypercall can be told from the cost of each operation.
+ *
+ *   version       xen_version(XENVER_version): the bare cost of a
+ *                 hypercall from user space.
+ *   multicall     that many xen_version calls in one multicall: the cost
+ *                 of the multicall dispatch per entry.
+ *   memop         memory_op(XENMEM_maximum_gpfn).
+ *   evtchn-status EVTCHNOP_status on a bound port.
+ *   evtchn-send   EVTCHNOP_send on a loopback interdomain channel, through
+ *                 the evtchn driver as a backend would.
+ *   evtchn-mc     that many EVTCHNOP_send in one multicall.
+ *   gnttab-map    map and unmap that many of our own grants.
+ *   gnttab-copy   GNTTABOP_copy of that many 64-byte chunks between our
+ *                 own grants.
+ *   mmuext        that many MMUEXT_TLB_FLUSH_LOCAL in one mmuext_op (x86).
+ *
+ * Each run prints the Xen version it was taken on.  With -c the results
+ * are printed as CSV, one line per test and batch size, for comparing
+ * runs across hypervisor versions.  Only relative numbers on the same
+ * machine are meaningful.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <xenctrl.h>
+
+static uint32_t domid;
+static unsigned int max_batch = 32;
+static unsigned int seconds = 1;
+static int csv;
+
+/* Bytes per gnttab-copy operation: small, to expose the per-op cost. */
+#define COPY_LEN 64
+
+/* Calls between two looks at the clock. */
+#define CALLS_PER_CHECK 64
+
+static xc_interface *xch;
+
+static xc_evtchn *xce;
+static evtchn_port_t lport, rport;
+
+static xc_gntshr *xgs;
+static xc_gnttab *xgt;
+static void *shared;
+static uint32_t *refs, *domids;
+static gnttab_copy_t *copies;
+
+static multicall_entry_t *calls;
+/* The argument of every EVTCHNOP_send in an evtchn-mc multicall. */
+DECLARE_HYPERCALL_BUFFER(struct evtchn_send, send);
+
+#if defined(__i386__) || defined(__x86_64__)
+static struct mmuext_op *mmuext;
+#endif
+
+struct test {
+    const char *name;
+    int batched;                /* Does op() take more than one at once? */
+    int (*setup)(void);
+    int (*op)(unsigned int nr); /* Issue nr operations; < 0 on error. */
+};
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-d domid] [-b batch] [-s seconds] [-c] [test...]\n"
+            "\n"
+            "tests are version, multicall, memop, evtchn-status,\n"
+            "evtchn-send, evtchn-mc, gnttab-map, gnttab-copy and mmuext\n"
+            "(default: all)\n"
+            "\n"
+            " -d domid    domain running the benchmark (default 0)\n"
+            " -b batch    largest number of operations per hypercall\n"
+            "             (default %u)\n"
+            " -s seconds  length of each run (default %u)\n"
+            " -c          print the results as CSV\n",
+            prog, max_batch, seconds);
+    exit(2);
+}
+
+static int setup_calls(void)
+{
+    if ( calls )
+        return 0;
+    calls = calloc(max_batch, sizeof(*calls));
+    return calls ? 0 : -1;
+}
+
+static int setup_evtchn(void)
+{
+    evtchn_port_or_error_t port;
+
+    if ( xce )
+        return 0;
+
+    xce = xc_evtchn_open(NULL, 0);
+    if ( !xce )
+        return -1;
+
+    /* Sends on rport raise lport; nobody ever unmasks it. */
+    if ( (port = xc_evtchn_bind_unbound_port(xce, domid)) < 0 )
+        goto fail;
+    lport = port;
+    if ( (port = xc_evtchn_bind_interdomain(xce, domid, lport)) < 0 )
+        goto fail;
+    rport = port;
+
+    return 0;
+
+ fail:
+    xc_evtchn_close(xce);
+    xce = NULL;
+    return -1;
+}
+
+static int setup_evtchn_mc(void)
+{
+    if ( setup_evtchn() || setup_calls() )
+        return -1;
+    if ( !send )
+    {
+        send = xc_hypercall_buffer_alloc(xch, send, sizeof(*send));
+        if ( !send )
+            return -1;
+    }
+    send->port = rport;
+    return 0;
+}
+
+static int setup_gnttab(void)
+{
+    unsigned int i;
+
+    if ( shared )
+        return 0;
+
+    if ( !refs )
+    {
+        refs = calloc(2 * max_batch, sizeof(*refs));
+        domids = calloc(max_batch, sizeof(*domids));
+        copies = calloc(max_batch, sizeof(*copies));
+        if ( !refs || !domids || !copies )
+            return -1;
+        for ( i = 0; i < max_batch; i++ )
+            domids[i] = domid;
+    }
+
+    if ( !xgs && !(xgs = xc_gntshr_open(NULL, 0)) )
+        return -1;
+    if ( !xgt )
+    {
+        xgt = xc_gnttab_open(NULL, 0);
+        if ( !xgt || xc_gnttab_set_max_grants(xgt, max_batch) < 0 )
+            return -1;
+    }
+
+    shared = xc_gntshr_share_pages(xgs, domid, 2 * max_batch, refs, 1);
+    return shared ? 0 : -1;
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+static int setup_mmuext(void)
+{
+    unsigned int i;
+
+    if ( mmuext )
+        return 0;
+    mmuext = calloc(max_batch, sizeof(*mmuext));
+    if ( !mmuext )
+        return -1;
+    for ( i = 0; i < max_batch; i++ )
+        mmuext[i].cmd = MMUEXT_TLB_FLUSH_LOCAL;
+    return 0;
+}
+#endif
+
+static int op_version(unsigned int nr)
+{
+    return xc_version(xch, XENVER_version, NULL);
+}
+
+static int op_multicall(unsigned int nr)
+{
+    unsigned int i;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        calls[i].op = __HYPERVISOR_xen_version;
+        calls[i].args[0] = XENVER_version;
+        calls[i].args[1] = 0;
+    }
+    if ( xc_multicall(xch, calls, nr) )
+        return -1;
+    for ( i = 0; i < nr; i++ )
+        if ( (long)calls[i].result < 0 )
+        {
+            errno = -(long)calls[i].result;
+            return -1;
+        }
+    return 0;
+}
+
+static int op_memop(unsigned int nr)
+{
+    return xc_domain_maximum_gpfn(xch, domid);
+}
+
+static int op_evtchn_status(unsigned int nr)
+{
+    xc_evtchn_status_t status = { .dom = DOMID_SELF, .port = rport };
+
+    return xc_evtchn_status(xch, &status);
+}
+
+static int op_evtchn_send(unsigned int nr)
+{
+    return xc_evtchn_notify(xce, rport);
+}
+
+static int op_evtchn_mc(unsigned int nr)
+{
+    unsigned int i;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        calls[i].op = __HYPERVISOR_event_channel_op;
+        calls[i].args[0] = EVTCHNOP_send;
+        calls[i].args[1] = HYPERCALL_BUFFER_AS_ARG(send);
+    }
+    if ( xc_multicall(xch, calls, nr) )
+        return -1;
+    for ( i = 0; i < nr; i++ )
+        if ( calls[i].result )
+        {
+            errno = -(long)calls[i].result;
+            return -1;
+        }
+    return 0;
+}
+
+static int op_gnttab_map(unsigned int nr)
+{
+    void *addr;
+
+    addr = xc_gnttab_map_grant_refs(xgt, nr, domids, refs,
+                                    PROT_READ | PROT_WRITE);
+    if ( !addr )
+        return -1;
+    return xc_gnttab_munmap(xgt, addr, nr);
+}
+
+static int op_gnttab_copy(unsigned int nr)
+{
+    unsigned int i;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        copies[i].source.u.ref = refs[i];
+        copies[i].source.domid = domid;
+        copies[i].source.offset = 0;
+        copies[i].dest.u.ref = refs[max_batch + i];
+        copies[i].dest.domid = domid;
+        copies[i].dest.offset = 0;
+        copies[i].len = COPY_LEN;
+        copies[i].flags = GNTCOPY_source_gref | GNTCOPY_dest_gref;
+    }
+    if ( xc_gnttab_op(xch, GNTTABOP_copy, copies, sizeof(*copies), nr) < 0 )
+        return -1;
+    for ( i = 0; i < nr; i++ )
+        if ( copies[i].status != GNTST_okay )
+        {
+            errno = EIO;
+            return -1;
+        }
+    return 0;
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+static int op_mmuext(unsigned int nr)
+{
+    return xc_mmuext_op(xch, mmuext, nr, DOMID_SELF);
+}
+#endif
+
+static const struct test tests[] = {
+    { "version",       0, NULL,            op_version },
+    { "multicall",     1, setup_calls,     op_multicall },
+    { "memop",         0, NULL,            op_memop },
+    { "evtchn-status", 0, setup_evtchn,    op_evtchn_status },
+    { "evtchn-send",   0, setup_evtchn,    op_evtchn_send },
+    { "evtchn-mc",     1, setup_evtchn_mc, op_evtchn_mc },
+    { "gnttab-map",    1, setup_gnttab,    op_gnttab_map },
+    { "gnttab-copy",   1, setup_gnttab,    op_gnttab_copy },
+#if defined(__i386__) || defined(__x86_64__)
+    { "mmuext",        1, setup_mmuext,    op_mmuext },
+#endif
+};
+
+#define NR_TESTS (sizeof(tests) / sizeof(tests[0]))
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Run @t with @nr operations per call for the configured time. */
+static void run(const struct test *t, unsigned int nr)
+{
+    uint64_t nr_calls = 0;
+    unsigned int i;
+    double start, elapsed;
+
+    /* Warm up caches and any lazily allocated state in Xen. */
+    for ( i = 0; i < CALLS_PER_CHECK; i++ )
+        if ( t->op(nr) < 0 )
+            goto fail;
+
+    start = now();
+    do {
+        for ( i = 0; i < CALLS_PER_CHECK; i++ )
+            if ( t->op(nr) < 0 )
+                goto fail;
+        nr_calls += CALLS_PER_CHECK;
+    } while ( (elapsed = now() - start) < seconds );
+
+    if ( csv )
+        printf("%s,%u,%"PRIu64",%"PRIu64",%.1f,%.0f\n", t->name, nr,
+               nr_calls, nr_calls * nr, elapsed * 1e9 / (nr_calls * nr),
+               nr_calls * nr / elapsed);
+    else
+        printf("%-14s %6u %12.1f %12.1f %14.0f\n", t->name, nr,
+               elapsed * 1e9 / nr_calls, elapsed * 1e9 / (nr_calls * nr),
+               nr_calls * nr / elapsed);
+    fflush(stdout);
+    return;
+
+ fail:
+    fprintf(stderr, "%s (batch %u): %s\n", t->name, nr, strerror(errno));
+    exit(1);
+}
+
+static void cleanup(void)
+{
+    if ( shared )
+        xc_gntshr_munmap(xgs, shared, 2 * max_batch);
+    if ( xgt )
+        xc_gnttab_close(xgt);
+    if ( xgs )
+        xc_gntshr_close(xgs);
+    if ( xce )
+    {
+        xc_evtchn_unbind(xce, rport);
+        xc_evtchn_unbind(xce, lport);
+        xc_evtchn_close(xce);
+    }
+    if ( send )
+        xc_hypercall_buffer_free(xch, send);
+    xc_interface_close(xch);
+}
+
+int main(int argc, char **argv)
+{
+    xen_extraversion_t extra;
+    const struct test *t;
+    unsigned int i, nr;
+    int opt, ver, arg;
+
+    while ( (opt = getopt(argc, argv, "d:b:s:ch")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'd':
+            domid = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            max_batch = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            seconds = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            csv = 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if ( !max_batch || !seconds )
+        usage(argv[0]);
+    for ( arg = optind; arg < argc; arg++ )
+    {
+        for ( i = 0; i < NR_TESTS; i++ )
+            if ( !strcmp(argv[arg], tests[i].name) )
+                break;
+        if ( i == NR_TESTS )
+            usage(argv[0]);
+    }
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    if ( !xch )
+    {
+        perror("xc_interface_open");
+        return 1;
+    }
+
+    ver = xc_version(xch, XENVER_version, NULL);
+    if ( ver < 0 || xc_version(xch, XENVER_extraversion, &extra) < 0 )
+    {
+        perror("xc_version");
+        return 1;
+    }
+    if ( csv )
+        printf("# Xen %d.%d%s, %u s per run\n"
+               "test,batch,calls,ops,ns_per_op,ops_per_s\n",
+               ver >> 16, ver & 0xffff, extra, seconds);
+    else
+        printf("Xen %d.%d%s, %u s per run\n"
+               "%-14s %6s %12s %12s %14s\n",
+               ver >> 16, ver & 0xffff, extra, seconds,
+               "test", "batch", "ns/call", "ns/op", "ops/s");
+
+    for ( i = 0; i < NR_TESTS; i++ )
+    {
+        t = &tests[i];
+
+        if ( optind < argc )
+        {
+            for ( arg = optind; arg < argc; arg++ )
+                if ( !strcmp(argv[arg], t->name) )
+                    break;
+            if ( arg == argc )
+                continue;
+        }
+
+        if ( t->setup && t->setup() )
+        {
+            fprintf(stderr, "%s: setup failed: %s\n", t->name,
+                    strerror(errno));
+            continue;
+        }
+
+        for ( nr = 1; ; nr *= 2 )
+        {
+            if ( nr > max_batch )
+                nr = max_batch;
+            run(t, nr);
+            if ( !t->batched || nr == max_batch )
+                break;
+        }
+    }
+
+    cleanup();
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
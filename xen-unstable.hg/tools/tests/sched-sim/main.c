@@ -0,0 +1,1076 @@
+/******************************************************************************
+ * main.c
+ *
+ * Workload description, replay and reporting for the scheduler simulator.
+ *
+ * A workload is a small text file (or one of the built-in ones):
+ *
+ *   cpus 4                 number of pcpus (default 4)
+ *   sockets 2              spread them over this many sockets (default 1)
+ *   threads 2              SMT threads per core (default 1)
+ *   nodes 2                NUMA nodes, must divide sockets (default sockets)
+ *   distance 21            SLIT distance between nodes (default 20)
+ *   refill CORE SOCKET NODE
+ *                          cache refill time in us after moving to another
+ *                          core, socket or node (default 10 30 60)
+ *   duration 10000         simulated time, in ms (default 10000)
+ *   seed 1                 random seed for the jitter (default 1)
+ *   domain NAME [id=N] [vcpus=N] [weight=N] [cap=N]
+ *               [run=US] [sleep=US] [jitter=PCT] [sync=US] [gang=0|1]
+ *               [ple=US] [period=US budget=US] [wss=PCT]
+ *   trace FILE             replay bursts for traced domains from FILE
+ *
+ * A domain without "sleep" is CPU bound.  Otherwise each vcpu runs for
+ * "run" us of CPU time, blocks for "sleep" us, and so on, both varied by
+ * +/- "jitter" percent.  A CPU bound domain with "sync" is a parallel
+ * job: each vcpu does "sync" us of work (+/- "jitter"), then spins at a
+ * barrier until all its siblings have got there too.  "gang" asks the
+ * scheduler to co-schedule the domain's vcpus.  With "ple" a vcpu yields
+ * every "ple" us it spends spinning, as on a pause-loop exit.  "period"
+ * and "budget" are the reservation of each vcpu under the rt scheduler;
+ * domains without one get one derived from their weight (see
+ * rt_reservations()).  "wss" scales the refill times for the domain, in
+ * percent: how much cache its working set fills.  Trace files hold one
+ * burst per line:
+ *
+ *   TIME_US DOMID VCPU RUN_US
+ *
+ * meaning that vcpu wakes at TIME_US (or as soon as its previous burst is
+ * done) and wants RUN_US of CPU before blocking again.  xentrace2sim.awk
+ * produces this from xentrace_format output.
+ */
+
+#include <getopt.h>
+#include <ctype.h>
+#include "sched-sim.h"
+
+static const struct scheduler *schedulers[] = {
+    &sched_credit_def,
+    &sched_credit2_def,
+    &sched_sedf_def,
+    &sched_rt_def,
+};
+
+static const struct {
+    const char *name;
+    const char *desc;
+    const char *config;
+} builtins[] = {
+#define PARALLEL(opts)                                                       \
+      "cpus 8\n"                                                             \
+      "sockets 2\n"                                                          \
+      "domain par1 vcpus=4 weight=256 sync=300 jitter=20" opts "\n"          \
+      "domain par2 vcpus=4 weight=256 sync=300 jitter=20" opts "\n"          \
+      "domain hog  vcpus=4 weight=256\n"
+    { "cpu-bound", "CPU hogs with weights 1:2:4",
+      "cpus 4\n"
+      "domain small  vcpus=4 weight=256\n"
+      "domain medium vcpus=4 weight=512\n"
+      "domain large  vcpus=4 weight=1024\n" },
+    { "mixed", "CPU hogs sharing two sockets with I/O and latency bound guests",
+      "cpus 4\n"
+      "sockets 2\n"
+      "domain hog1    vcpus=4 weight=256\n"
+      "domain hog2    vcpus=4 weight=256\n"
+      "domain io      vcpus=2 weight=256 run=200 sleep=2000 jitter=50\n"
+      "domain latency vcpus=1 weight=256 run=50 sleep=500 jitter=50\n" },
+    { "cap", "A capped domain next to an uncapped one (credit only)",
+      "cpus 2\n"
+      "domain capped vcpus=2 weight=256 cap=50\n"
+      "domain free   vcpus=2 weight=256\n" },
+    { "numa2", "Mixed load on 2 sockets / 2 nodes, 4 cores x 2 threads each",
+      "cpus 16\n"
+      "sockets 2\n"
+      "threads 2\n"
+      "distance 21\n"
+      "domain hog1    vcpus=8 weight=256\n"
+      "domain hog2    vcpus=4 weight=512\n"
+      "domain io      vcpus=8 weight=256 run=300 sleep=1500 jitter=50\n"
+      "domain latency vcpus=4 weight=256 run=50 sleep=500 jitter=50\n" },
+    { "numa4", "Mixed load on 4 sockets / 4 nodes, 4 cores x 2 threads each",
+      "cpus 32\n"
+      "sockets 4\n"
+      "threads 2\n"
+      "distance 21\n"
+      "domain hog1    vcpus=16 weight=256\n"
+      "domain hog2    vcpus=8  weight=512\n"
+      "domain io      vcpus=16 weight=256 run=300 sleep=1500 jitter=50\n"
+      "domain latency vcpus=8  weight=256 run=50 sleep=500 jitter=50\n" },
+    { "parallel", "Two barrier-synchronised SMP jobs next to a CPU hog",
+      PARALLEL("") },
+    { "parallel-gang", "As parallel, with the SMP jobs gang scheduled",
+      PARALLEL(" gang=1") },
+    { "parallel-ple", "As parallel, with pause-loop exits while spinning",
+      PARALLEL(" ple=10") },
+    { "nf", "Packet processing guests with rt reservations next to CPU hogs",
+      "cpus 4\n"
+      "domain nf1  vcpus=2 weight=256 run=30 sleep=170 jitter=50 period=200 "
+      "budget=60\n"
+      "domain nf2  vcpus=2 weight=256 run=30 sleep=170 jitter=50 period=200 "
+      "budget=60\n"
+      "domain hog1 vcpus=4 weight=256\n"
+      "domain hog2 vcpus=4 weight=512\n" },
+    { "sparse", "Fewer busy vcpus than pcpus, next to I/O bound guests",
+      "cpus 8\n"
+      "sockets 2\n"
+      "domain hog1    vcpus=2 weight=256\n"
+      "domain hog2    vcpus=2 weight=512\n"
+      "domain io      vcpus=2 weight=256 run=200 sleep=2000 jitter=50\n"
+      "domain latency vcpus=1 weight=256 run=50 sleep=500 jitter=50\n" },
+    { "memory", "Cache hungry guests next to light ones on 2 sockets",
+      "cpus 8\n"
+      "sockets 2\n"
+      "domain db    vcpus=4 weight=256 run=1000 sleep=200 jitter=50 wss=2000\n"
+      "domain web   vcpus=4 weight=256 run=200 sleep=200 jitter=50 wss=50\n"
+      "domain batch vcpus=4 weight=256 wss=500\n"
+      "domain io    vcpus=2 weight=256 run=200 sleep=2000 jitter=50\n" },
+#undef PARALLEL
+};
+
+struct sim_domain *sim_domains;
+
+static struct sim_topology topo = {
+    .cpus = 4, .sockets = 1, .threads = 1, .distance = 20,
+    .refill = { [SIM_MIGR_CORE]   = MICROSECS(10),
+                [SIM_MIGR_SOCKET] = MICROSECS(30),
+                [SIM_MIGR_NODE]   = MICROSECS(60) },
+};
+static unsigned long duration_ms = 10000;
+static unsigned long long seed = 1;
+static const char *trace_file;
+
+/*
+ * Deterministic randomness, so that runs are repeatable
+ */
+
+static unsigned long long sim_rand(void)
+{
+    /* xorshift64* */
+    seed ^= seed >> 12;
+    seed ^= seed << 25;
+    seed ^= seed >> 27;
+    return seed * 2685821657736338717ULL;
+}
+
+static s_time_t jitter(s_time_t t, unsigned int pct)
+{
+    s_time_t range = t * pct / 100;
+
+    if ( range > 0 )
+        t += (s_time_t)(sim_rand() % (2 * range + 1)) - range;
+
+    return t > MICROSECS(1) ? t : MICROSECS(1);
+}
+
+/*
+ * Workload parsing
+ */
+
+static void fail(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    fprintf(stderr, "sched-sim: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    exit(2);
+}
+
+static struct sim_domain *find_domain(unsigned int id)
+{
+    struct sim_domain *sdom;
+
+    for ( sdom = sim_domains; sdom != NULL; sdom = sdom->next )
+        if ( sdom->id == id )
+            return sdom;
+
+    return NULL;
+}
+
+static void parse_domain(char *args, const char *where)
+{
+    struct sim_domain *sdom = xzalloc(struct sim_domain), **psd;
+    static unsigned int next_id = 1;
+    char *tok, *val;
+
+    BUG_ON(sdom == NULL);
+    sdom->id = next_id;
+    sdom->nr_vcpus = 1;
+    sdom->weight = 256;
+    sdom->wss = 100;
+
+    if ( (tok = strtok(args, " \t")) == NULL )
+        fail("%s: domain needs a name", where);
+    snprintf(sdom->name, sizeof(sdom->name), "%s", tok);
+
+    while ( (tok = strtok(NULL, " \t")) != NULL )
+    {
+        unsigned long n;
+
+        if ( (val = strchr(tok, '=')) == NULL )
+            fail("%s: expected key=value, got '%s'", where, tok);
+        *val++ = '\0';
+        n = strtoul(val, NULL, 0);
+
+        if ( !strcmp(tok, "id") )
+            sdom->id = n;
+        else if ( !strcmp(tok, "vcpus") )
+            sdom->nr_vcpus = n;
+        else if ( !strcmp(tok, "weight") )
+            sdom->weight = n;
+        else if ( !strcmp(tok, "cap") )
+            sdom->cap = n;
+        else if ( !strcmp(tok, "run") )
+            sdom->run = MICROSECS(n);
+        else if ( !strcmp(tok, "sleep") )
+            sdom->sleep = MICROSECS(n);
+        else if ( !strcmp(tok, "jitter") )
+            sdom->jitter = n;
+        else if ( !strcmp(tok, "wss") )
+            sdom->wss = n;
+        else if ( !strcmp(tok, "sync") )
+            sdom->sync = MICROSECS(n);
+        else if ( !strcmp(tok, "gang") )
+            sdom->gang = !!n;
+        else if ( !strcmp(tok, "ple") )
+            sdom->ple = MICROSECS(n);
+        else if ( !strcmp(tok, "period") )
+            sdom->period = MICROSECS(n);
+        else if ( !strcmp(tok, "budget") )
+            sdom->budget = MICROSECS(n);
+        else
+            fail("%s: unknown domain parameter '%s'", where, tok);
+    }
+
+    if ( sdom->nr_vcpus == 0 || sdom->nr_vcpus > NR_CPUS )
+        fail("%s: bad vcpu count for %s", where, sdom->name);
+    if ( sdom->id == 0 || sdom->id >= DOMID_FIRST_RESERVED ||
+         find_domain(sdom->id) )
+        fail("%s: bad or duplicate id for %s", where, sdom->name);
+    if ( sdom->sleep && !sdom->run )
+        fail("%s: %s sleeps but never runs", where, sdom->name);
+    if ( sdom->sync && sdom->sleep )
+        fail("%s: %s is parallel, so must be CPU bound", where, sdom->name);
+    if ( sdom->ple && !sdom->sync )
+        fail("%s: %s never spins, so can't exit on pause loops", where,
+             sdom->name);
+    if ( !sdom->period != !sdom->budget || sdom->budget > sdom->period )
+        fail("%s: %s needs a period and a budget no larger than it", where,
+             sdom->name);
+    next_id = sdom->id + 1;
+
+    for ( psd = &sim_domains; *psd != NULL; psd = &(*psd)->next )
+        continue;
+    *psd = sdom;
+}
+
+static void parse_config(const char *text, const char *name)
+{
+    char *buf = strdup(text), *line, *save = NULL, where[256];
+    unsigned int lineno = 0;
+
+    BUG_ON(buf == NULL);
+
+    for ( line = strtok_r(buf, "\n", &save); line != NULL;
+          line = strtok_r(NULL, "\n", &save) )
+    {
+        char *key, *rest;
+
+        lineno++;
+        snprintf(where, sizeof(where), "%s:%u", name, lineno);
+
+        if ( (rest = strchr(line, '#')) != NULL )
+            *rest = '\0';
+        key = line + strspn(line, " \t");
+        if ( *key == '\0' )
+            continue;
+        rest = key + strcspn(key, " \t");
+        if ( *rest != '\0' )
+            *rest++ = '\0';
+        rest += strspn(rest, " \t");
+
+        if ( !strcmp(key, "cpus") )
+            topo.cpus = strtoul(rest, NULL, 0);
+        else if ( !strcmp(key, "sockets") )
+            topo.sockets = strtoul(rest, NULL, 0);
+        else if ( !strcmp(key, "threads") )
+            topo.threads = strtoul(rest, NULL, 0);
+        else if ( !strcmp(key, "nodes") )
+            topo.nodes = strtoul(rest, NULL, 0);
+        else if ( !strcmp(key, "distance") )
+            topo.distance = strtoul(rest, NULL, 0);
+        else if ( !strcmp(key, "refill") )
+        {
+            unsigned long core, socket, node;
+
+            if ( sscanf(rest, "%lu %lu %lu", &core, &socket, &node) != 3 )
+                fail("%s: refill wants CORE SOCKET NODE", where);
+            topo.refill[SIM_MIGR_CORE] = MICROSECS(core);
+            topo.refill[SIM_MIGR_SOCKET] = MICROSECS(socket);
+            topo.refill[SIM_MIGR_NODE] = MICROSECS(node);
+        }
+        else if ( !strcmp(key, "duration") )
+            duration_ms = strtoul(rest, NULL, 0);
+        else if ( !strcmp(key, "seed") )
+            seed = strtoull(rest, NULL, 0);
+        else if ( !strcmp(key, "trace") )
+            trace_file = strdup(strtok(rest, " \t"));
+        else if ( !strcmp(key, "domain") )
+            parse_domain(rest, where);
+        else
+            fail("%s: unknown keyword '%s'", where, key);
+    }
+
+    if ( topo.cpus == 0 || topo.cpus > NR_CPUS )
+        fail("%s: cpus must be between 1 and %u", name, NR_CPUS);
+    if ( topo.sockets == 0 || topo.sockets > topo.cpus )
+        fail("%s: bad socket count", name);
+    if ( topo.threads == 0 || topo.cpus % (topo.sockets * topo.threads) )
+        fail("%s: cpus must be sockets * cores * threads", name);
+    if ( topo.nodes == 0 )
+        topo.nodes = topo.sockets;
+    if ( topo.sockets % topo.nodes )
+        fail("%s: nodes must divide sockets", name);
+    if ( topo.distance < 10 )
+        fail("%s: distance must be at least 10", name);
+
+    free(buf);
+}
+
+static char *read_file(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char *buf = NULL;
+    size_t len = 0, n;
+
+    if ( f == NULL )
+        fail("%s: %s", path, strerror(errno));
+
+    do {
+        buf = realloc(buf, len + 4097);
+        BUG_ON(buf == NULL);
+        n = fread(buf + len, 1, 4096, f);
+        len += n;
+    } while ( n == 4096 );
+    buf[len] = '\0';
+
+    fclose(f);
+    return buf;
+}
+
+static int burst_cmp(const void *a, const void *b)
+{
+    const struct sim_burst *x = a, *y = b;
+
+    return (x->at > y->at) - (x->at < y->at);
+}
+
+static void load_trace(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[256];
+    unsigned int lineno = 0;
+    struct sim_domain *sdom;
+    struct vcpu *v;
+
+    if ( f == NULL )
+        fail("%s: %s", path, strerror(errno));
+
+    while ( fgets(line, sizeof(line), f) != NULL )
+    {
+        unsigned long long at, run;
+        unsigned int domid, vcpu;
+        struct sim_vcpu *sv;
+
+        lineno++;
+        if ( line[strspn(line, " \t")] == '#' ||
+             line[strspn(line, " \t\n")] == '\0' )
+            continue;
+        if ( sscanf(line, "%llu %u %u %llu", &at, &domid, &vcpu, &run) != 4 )
+            fail("%s:%u: expected TIME_US DOMID VCPU RUN_US", path, lineno);
+        if ( (sdom = find_domain(domid)) == NULL )
+            fail("%s:%u: no domain with id %u", path, lineno, domid);
+        if ( vcpu >= sdom->nr_vcpus )
+            fail("%s:%u: d%u has no vcpu %u", path, lineno, domid, vcpu);
+
+        sdom->traced = 1;
+        sv = sdom->d->vcpu[vcpu]->sim;
+        if ( (sv->nr_bursts & 255) == 0 )
+        {
+            sv->bursts = realloc(sv->bursts,
+                                 (sv->nr_bursts + 256) * sizeof(*sv->bursts));
+            BUG_ON(sv->bursts == NULL);
+        }
+        sv->bursts[sv->nr_bursts].at = MICROSECS(at);
+        sv->bursts[sv->nr_bursts].run = run ? MICROSECS(run) : MICROSECS(1);
+        sv->nr_bursts++;
+    }
+
+    fclose(f);
+
+    for ( sdom = sim_domains; sdom != NULL; sdom = sdom->next )
+        for_each_vcpu ( sdom->d, v )
+            if ( v->sim->nr_bursts )
+                qsort(v->sim->bursts, v->sim->nr_bursts,
+                      sizeof(*v->sim->bursts), burst_cmp);
+}
+
+/*
+ * Workload replay
+ */
+
+static void next_burst(struct sim_vcpu *sv)
+{
+    struct sim_domain *sdom = sv->sdom;
+
+    if ( sdom->traced )
+    {
+        struct sim_burst *b;
+
+        if ( sv->next_burst == sv->nr_bursts )
+        {
+            sv->wake_at = STIME_MAX;
+            return;
+        }
+        b = &sv->bursts[sv->next_burst++];
+        sv->wake_at = b->at > NOW() ? b->at : NOW();
+        sv->burst_left = b->run;
+    }
+    else if ( sim_cpu_bound(sdom) )
+        sv->burst_left = STIME_MAX;
+    else
+    {
+        sv->wake_at = NOW() + jitter(sdom->sleep, sdom->jitter);
+        sv->burst_left = jitter(sdom->run, sdom->jitter);
+    }
+}
+
+void sim_vcpu_burst_done(struct sim_vcpu *sv)
+{
+    next_burst(sv);
+}
+
+void sim_vcpu_barrier(struct sim_vcpu *sv)
+{
+    struct sim_domain *sdom = sv->sdom;
+    struct vcpu *v;
+
+    sv->at_barrier = 1;
+    sv->ple_left = sdom->ple;
+    if ( ++sdom->arrived < sdom->nr_vcpus )
+        return;
+
+    /* Everyone is here: on to the next phase. */
+    sdom->arrived = 0;
+    sdom->phases++;
+    for_each_vcpu ( sdom->d, v )
+    {
+        v->sim->at_barrier = 0;
+        v->sim->work_left = jitter(sdom->sync, sdom->jitter);
+    }
+}
+
+static void setup_domain(struct sim_domain *sdom)
+{
+    struct xen_domctl_scheduler_op op;
+    struct vcpu *v;
+
+    sdom->d = sim_domain_create(sdom->id, sdom->nr_vcpus);
+    sdom->d->sim = sdom;
+
+    for_each_vcpu ( sdom->d, v )
+    {
+        struct sim_vcpu *sv = xzalloc(struct sim_vcpu);
+
+        BUG_ON(sv == NULL);
+        sv->v = v;
+        sv->sdom = sdom;
+        sv->last_cpu = -1;
+        sv->wake_at = STIME_MAX;
+        v->sim = sv;
+    }
+
+    memset(&op, 0, sizeof(op));
+    op.sched_id = sim_ops.sched_id;
+    op.cmd = XEN_DOMCTL_SCHEDOP_putinfo;
+
+    switch ( sim_ops.sched_id )
+    {
+    case XEN_SCHEDULER_CREDIT:
+        op.u.credit.weight = sdom->weight;
+        op.u.credit.cap = sdom->cap;
+        break;
+    case XEN_SCHEDULER_CREDIT2:
+        op.u.credit2.weight = sdom->weight;
+        op.u.credit2.gang = sdom->gang ? XEN_DOMCTL_CREDIT2_GANG_ON
+                                       : XEN_DOMCTL_CREDIT2_GANG_OFF;
+        break;
+    case XEN_SCHEDULER_SEDF:
+        /* Weight-driven, extratime only: the closest thing to a share. */
+        op.u.sedf.weight = sdom->weight;
+        op.u.sedf.extratime = 1;
+        break;
+    case XEN_SCHEDULER_RT:
+        op.u.rt.vcpuid = XEN_DOMCTL_SCHED_RT_ALL_VCPUS;
+        op.u.rt.period = sdom->period / MICROSECS(1);
+        op.u.rt.budget = sdom->budget / MICROSECS(1);
+        break;
+    }
+
+    if ( sim_ops.sched_id != XEN_SCHEDULER_CREDIT && sdom->cap )
+    {
+        fprintf(stderr, "sched-sim: %s does not do caps, ignoring it for %s\n",
+                sim_ops.opt_name, sdom->name);
+        sdom->cap = 0;
+    }
+    if ( sim_ops.sched_id != XEN_SCHEDULER_CREDIT2 && sdom->gang )
+    {
+        fprintf(stderr, "sched-sim: %s does not gang schedule, ignoring it "
+                "for %s\n", sim_ops.opt_name, sdom->name);
+        sdom->gang = 0;
+    }
+    if ( sim_ops.sched_id != XEN_SCHEDULER_RT && sdom->period )
+    {
+        fprintf(stderr, "sched-sim: %s does not do reservations, ignoring "
+                "the one of %s\n", sim_ops.opt_name, sdom->name);
+        sdom->period = sdom->budget = 0;
+    }
+
+    if ( sim_ops.adjust && sim_ops.adjust(&sim_ops, sdom->d, &op) )
+        fail("%s rejected the parameters of %s", sim_ops.opt_name,
+             sdom->name);
+}
+
+/*
+ * The rt scheduler gives vcpus with a reservation no more than it, and
+ * those without one only what the reservations leave, so give every
+ * domain one.  Domains that sleep get twice their average use, for the
+ * jitter, over a period of one run and sleep; CPU bound and traced ones
+ * split what is left by weight, up to a pcpu per vcpu, over 10ms.
+ * The split is then scaled down until it passes admission control: on
+ * the fullest pcpu when partitioned, against m - (m - 1) * u_max for the
+ * m pcpus when global.
+ */
+#define RT_SIM_PERIOD MILLISECS(10)
+static void rt_reservations(void)
+{
+    struct xen_sysctl_scheduler_op sc;
+    struct sim_domain *sdom;
+    double left = topo.cpus, weight, util, scale = 1;
+    double fixed[NR_CPUS] = { 0 }, shared[NR_CPUS] = { 0 };
+    double fixed_max = 0, shared_max = 0;
+    unsigned int i, cpu, settled, partitioned;
+
+    memset(&sc, 0, sizeof(sc));
+    sc.cmd = XEN_SYSCTL_SCHEDOP_getinfo;
+    BUG_ON(sim_ops.adjust_global(&sim_ops, &sc));
+    partitioned = sc.u.sched_rt.mode == XEN_SYSCTL_RT_PARTITIONED;
+
+    for ( sdom = sim_domains; sdom != NULL; sdom = sdom->next )
+    {
+        if ( !sdom->period && sdom->sleep )
+        {
+            sdom->period = sdom->run + sdom->sleep;
+            util = 2.0 * sdom->run / sdom->period;
+            sdom->budget = util < 1 ? util * sdom->period : sdom->period;
+        }
+        if ( !sdom->period )
+            continue;
+        util = (double)sdom->budget / sdom->period;
+        left -= sdom->nr_vcpus * util;
+        if ( util > fixed_max )
+            fixed_max = util;
+        /* Vcpus start on pcpu (vcpu id % pcpus), see sim_domain_create() */
+        for ( i = 0; i < sdom->nr_vcpus; i++ )
+            fixed[i % topo.cpus] += util;
+    }
+
+    do {
+        settled = 1;
+        weight = 0;
+        for ( sdom = sim_domains; sdom != NULL; sdom = sdom->next )
+            if ( !sdom->period )
+                weight += sdom->weight;
+
+        for ( sdom = sim_domains; sdom != NULL; sdom = sdom->next )
+        {
+            if ( sdom->period || weight == 0 ||
+                 left * sdom->weight / weight < sdom->nr_vcpus )
+                continue;
+            sdom->period = sdom->budget = RT_SIM_PERIOD;
+            sdom->rt_split = 1;
+            for ( i = 0; i < sdom->nr_vcpus; i++ )
+                shared[i % topo.cpus] += 1;
+            shared_max = 1;
+            left -= sdom->nr_vcpus;
+            settled = 0;
+            break;
+        }
+    } while ( !settled );
+
+    for ( sdom = sim_domains; sdom != NULL; sdom = sdom->next )
+    {
+        if ( sdom->period )
+            continue;
+        util = left > 0 ? left * sdom->weight / weight / sdom->nr_vcpus : 0;
+        sdom->period = RT_SIM_PERIOD;
+        sdom->budget = util * RT_SIM_PERIOD;
+        sdom->rt_split = 1;
+        for ( i = 0; i < sdom->nr_vcpus; i++ )
+            shared[i % topo.cpus] += util;
+        if ( util > shared_max )
+            shared_max = util;
+    }
+
+    if ( partitioned )
+    {
+        for ( cpu = 0; cpu < topo.cpus; cpu++ )
+            if ( shared[cpu] > 0 && fixed[cpu] + shared[cpu] > 1 )
+            {
+                util = (1 - fixed[cpu]) / shared[cpu];
+                if ( util < scale )
+                    scale = util > 0 ? util : 0;
+            }
+    }
+    else
+    {
+        double m = topo.cpus, fixed_sum = 0, shared_sum = 0;
+
+        for ( cpu = 0; cpu < topo.cpus; cpu++ )
+        {
+            fixed_sum += fixed[cpu];
+            shared_sum += shared[cpu];
+        }
+        /* Whether u_max ends up a fixed or a split one, both must hold */
+        if ( shared_sum > 0 )
+        {
+            util = (m - fixed_sum) / (shared_sum + (m - 1) * shared_max);
+            if ( util < scale )
+                scale = util;
+            util = (m - (m - 1) * fixed_max - fixed_sum) / shared_sum;
+            if ( util < scale )
+                scale = util;
+            if ( scale < 0 )
+                scale = 0;
+        }
+    }
+
+    for ( sdom = sim_domains; sdom != NULL; sdom = sdom->next )
+        if ( sdom->rt_split )
+            sdom->budget *= scale;
+}
+
+static void start_domain(struct sim_domain *sdom)
+{
+    struct vcpu *v;
+
+    for_each_vcpu ( sdom->d, v )
+    {
+        struct sim_vcpu *sv = v->sim;
+
+        if ( sdom->traced )
+            next_burst(sv);
+        else if ( sim_cpu_bound(sdom) )
+        {
+            sv->wake_at = 0;
+            sv->burst_left = STIME_MAX;
+            if ( sdom->sync )
+                sv->work_left = jitter(sdom->sync, sdom->jitter);
+        }
+        else
+        {
+            /* Spread the first wakeups over one sleep period. */
+            sv->wake_at = sim_rand() % sdom->sleep;
+            sv->burst_left = jitter(sdom->run, sdom->jitter);
+        }
+    }
+}
+
+/*
+ * Reporting
+ */
+
+static int time_cmp(const void *a, const void *b)
+{
+    const s_time_t *x = a, *y = b;
+
+    return (*x > *y) - (*x < *y);
+}
+
+static double percentile(s_time_t *sorted, unsigned int nr, unsigned int p)
+{
+    if ( nr == 0 )
+        return 0;
+    return sorted[(unsigned long)(nr - 1) * p / 100] / 1000.0;
+}
+
+/*
+ * What each CPU bound domain should have had: the CPU left over by the
+ * others, split by weight, with nobody getting more than its vcpus (or
+ * its cap) can use.  Excess is handed round again until it settles.
+ * Under rt, it is just the reservation.
+ */
+static void entitlements(s_time_t elapsed, double *entitled)
+{
+    struct sim_domain *sdom;
+    double left = (double)elapsed * topo.cpus, weight;
+    unsigned int i, n, settled;
+
+    if ( sim_ops.sched_id == XEN_SCHEDULER_RT )
+    {
+        for ( sdom = sim_domains, i = 0; sdom != NULL; sdom = sdom->next, i++ )
+            entitled[i] = sim_cpu_bound(sdom) && sdom->period
+                ? (double)elapsed * sdom->nr_vcpus * sdom->budget /
+                  sdom->period
+                : -1;
+        return;
+    }
+
+    for ( sdom = sim_domains, n = 0; sdom != NULL; sdom = sdom->next, n++ )
+    {
+        entitled[n] = -1;
+        if ( !sim_cpu_bound(sdom) )
+        {
+            struct vcpu *v;
+
+            for_each_vcpu ( sdom->d, v )
+                left -= v->sim->runtime;
+        }
+    }
+
+    do {
+        settled = 1;
+        weight = 0;
+        for ( sdom = sim_domains, i = 0; sdom != NULL; sdom = sdom->next, i++ )
+            if ( sim_cpu_bound(sdom) && entitled[i] < 0 )
+                weight += sdom->weight;
+
+        for ( sdom = sim_domains, i = 0; sdom != NULL; sdom = sdom->next, i++ )
+        {
+            double limit = (double)elapsed * sdom->nr_vcpus;
+
+            if ( !sim_cpu_bound(sdom) || entitled[i] >= 0 || weight == 0 )
+                continue;
+            if ( sdom->cap && limit > (double)elapsed * sdom->cap / 100 )
+                limit = (double)elapsed * sdom->cap / 100;
+            if ( left * sdom->weight / weight > limit )
+            {
+                entitled[i] = limit;
+                left -= limit;
+                settled = 0;
+                break;
+            }
+        }
+    } while ( !settled );
+
+    for ( sdom = sim_domains, i = 0; sdom != NULL; sdom = sdom->next, i++ )
+        if ( sim_cpu_bound(sdom) && entitled[i] < 0 )
+            entitled[i] = weight ? left * sdom->weight / weight : 0;
+}
+
+static int report(s_time_t elapsed, const char *workload,
+                  double min_fairness, double max_p99_us)
+{
+    struct sim_domain *sdom;
+    unsigned int n, i, nr_all = 0, nr_fair = 0;
+    double *entitled, sum = 0, sum_sq = 0, jain = 1, p99;
+    s_time_t *all = NULL, total_runtime = 0, total_refill = 0;
+    unsigned long migrations = 0, migr_kind[SIM_MIGR_NR] = { 0 };
+    int rc = 0;
+
+    for ( sdom = sim_domains, n = 0; sdom != NULL; sdom = sdom->next )
+        n++;
+    entitled = xzalloc_array(double, n ? n : 1);
+    BUG_ON(entitled == NULL);
+    entitlements(elapsed, entitled);
+
+    printf("scheduler %s (%s), workload %s, %u cpus in %u socket(s), "
+           "%u node(s), %u thread(s) per core, %lu ms\n\n",
+           sim_ops.opt_name, sim_ops.name, workload, topo.cpus, topo.sockets,
+           topo.nodes, topo.threads, (unsigned long)(elapsed / MILLISECS(1)));
+    printf("%-10s %6s %4s %5s %9s %7s %7s %8s %8s %8s %8s %8s %6s %7s\n",
+           "domain", "weight", "cap", "vcpus", "cpu-ms", "share%", "fair%",
+           "wakeups", "p50-us", "p90-us", "p99-us", "max-us", "migr",
+           "refill%");
+
+    for ( sdom = sim_domains, i = 0; sdom != NULL; sdom = sdom->next, i++ )
+    {
+        s_time_t runtime = 0, refill = 0;
+        unsigned long wakeups = 0, migr = 0;
+        char fair[16] = "-";
+        struct vcpu *v;
+        unsigned int k;
+
+        for_each_vcpu ( sdom->d, v )
+        {
+            runtime += v->sim->runtime;
+            refill += v->sim->refill;
+            wakeups += v->sim->wakeups;
+            migr += v->sim->migrations;
+            for ( k = 0; k < SIM_MIGR_NR; k++ )
+                migr_kind[k] += v->sim->migr[k];
+        }
+        migrations += migr;
+        total_runtime += runtime;
+        total_refill += refill;
+
+        if ( entitled[i] > 0 )
+        {
+            double x = runtime / entitled[i];
+
+            snprintf(fair, sizeof(fair), "%.1f", 100 * x);
+            sum += x;
+            sum_sq += x * x;
+            nr_fair++;
+        }
+
+        qsort(sdom->lat, sdom->nr_lat, sizeof(*sdom->lat), time_cmp);
+        all = realloc(all, (nr_all + sdom->nr_lat + 1) * sizeof(*all));
+        BUG_ON(all == NULL);
+        memcpy(all + nr_all, sdom->lat, sdom->nr_lat * sizeof(*all));
+        nr_all += sdom->nr_lat;
+
+        printf("%-10s %6u %4u %5u %9.1f %7.2f %7s %8lu %8.1f %8.1f %8.1f "
+               "%8.1f %6lu %7.2f\n",
+               sdom->name, sdom->weight, sdom->cap, sdom->nr_vcpus,
+               runtime / 1e6, 100.0 * runtime / ((double)elapsed * topo.cpus),
+               fair, wakeups,
+               percentile(sdom->lat, sdom->nr_lat, 50),
+               percentile(sdom->lat, sdom->nr_lat, 90),
+               percentile(sdom->lat, sdom->nr_lat, 99),
+               percentile(sdom->lat, sdom->nr_lat, 100), migr,
+               runtime ? 100.0 * refill / runtime : 0);
+    }
+
+    qsort(all, nr_all, sizeof(*all), time_cmp);
+    p99 = percentile(all, nr_all, 99);
+    if ( nr_fair )
+        jain = sum_sq ? sum * sum / (nr_fair * sum_sq) : 0;
+
+    printf("\n");
+    if ( nr_fair )
+        printf("fairness: Jain index %.4f over %u CPU bound domain(s)\n",
+               jain, nr_fair);
+    printf("wakeup latency: p50 %.1f us, p90 %.1f us, p99 %.1f us, "
+           "max %.1f us (%u samples)\n",
+           percentile(all, nr_all, 50), percentile(all, nr_all, 90),
+           p99, percentile(all, nr_all, 100), nr_all);
+    printf("migrations: %lu (sibling %lu, core %lu, socket %lu, node %lu)\n",
+           migrations, migr_kind[SIM_MIGR_THREAD], migr_kind[SIM_MIGR_CORE],
+           migr_kind[SIM_MIGR_SOCKET], migr_kind[SIM_MIGR_NODE]);
+    printf("cache refill: %.1f ms, %.2f%% of CPU time\n", total_refill / 1e6,
+           total_runtime ? 100.0 * total_refill / total_runtime : 0);
+    printf("timer interrupts: %lu (%.1f/s per pcpu), %lu of them VM exits\n",
+           sim_timer_irqs, sim_timer_irqs * 1e9 / ((double)elapsed * topo.cpus),
+           sim_timer_exits);
+
+    for ( sdom = sim_domains; sdom != NULL; sdom = sdom->next )
+    {
+        s_time_t runtime = 0, spin = 0;
+        unsigned long yields = 0;
+        struct vcpu *v;
+
+        if ( !sdom->sync )
+            continue;
+        for_each_vcpu ( sdom->d, v )
+        {
+            runtime += v->sim->runtime;
+            spin += v->sim->spin;
+            yields += v->sim->yields;
+        }
+        printf("parallel %s%s: %lu phases (%.1f/s), %.2f%% of its CPU time "
+               "spinning", sdom->name, sdom->gang ? " (gang)" : "",
+               sdom->phases, sdom->phases / (elapsed / 1e9),
+               runtime ? 100.0 * spin / runtime : 0);
+        if ( sdom->ple )
+            printf(", %lu pause-loop exits", yields);
+        printf("\n");
+    }
+
+    for ( sdom = sim_domains; sim_ops.sched_id == XEN_SCHEDULER_RT &&
+                              sdom != NULL; sdom = sdom->next )
+    {
+        struct xen_domctl_scheduler_op op;
+        unsigned long misses = 0;
+        struct vcpu *v;
+
+        memset(&op, 0, sizeof(op));
+        op.sched_id = XEN_SCHEDULER_RT;
+        op.cmd = XEN_DOMCTL_SCHEDOP_getinfo;
+        for_each_vcpu ( sdom->d, v )
+        {
+            op.u.rt.vcpuid = v->vcpu_id;
+            BUG_ON(sim_ops.adjust(&sim_ops, sdom->d, &op));
+            misses += op.u.rt.misses;
+        }
+        printf("rt %s: %lu/%lu us per vcpu, %lu deadline misses\n",
+               sdom->name, (unsigned long)(sdom->budget / MICROSECS(1)),
+               (unsigned long)(sdom->period / MICROSECS(1)), misses);
+    }
+
+    if ( nr_fair && jain < min_fairness )
+    {
+        printf("FAIL: fairness %.4f below %.4f\n", jain, min_fairness);
+        rc = 1;
+    }
+    if ( max_p99_us > 0 && p99 > max_p99_us )
+    {
+        printf("FAIL: p99 wakeup latency %.1f us above %.1f us\n",
+               p99, max_p99_us);
+        rc = 1;
+    }
+
+    free(all);
+    free(entitled);
+    return rc;
+}
+
+static void usage(FILE *f)
+{
+    unsigned int i;
+
+    fprintf(f,
+            "usage: sched-sim [options]\n"
+            "  -s SCHED     scheduler to run:");
+    for ( i = 0; i < ARRAY_SIZE(schedulers); i++ )
+        fprintf(f, " %s", schedulers[i]->opt_name);
+    fprintf(f, " (default credit)\n"
+            "  -w NAME      built-in workload (default mixed)\n"
+            "  -f FILE      workload file, overrides -w\n"
+            "  -t FILE      replay bursts from a trace file\n"
+            "  -d MS        simulated time\n"
+            "  -S SEED      random seed\n"
+            "  -p NAME=VAL  set a scheduler boot parameter\n"
+            "  -F MIN       fail if the fairness index is below MIN\n"
+            "  -L US        fail if the p99 wakeup latency is above US\n"
+            "  -v           show the schedulers' printk output\n"
+            "  -h           this help\n"
+            "\nbuilt-in workloads:\n");
+    for ( i = 0; i < ARRAY_SIZE(builtins); i++ )
+        fprintf(f, "  %-10s %s\n", builtins[i].name, builtins[i].desc);
+    fprintf(f, "\nboot parameters:\n");
+    sim_list_params(f);
+}
+
+int main(int argc, char **argv)
+{
+    const struct scheduler *sched = &sched_credit_def;
+    const char *workload = "mixed", *file = NULL, *trace = NULL;
+    long duration = -1;
+    long long new_seed = -1;
+    double min_fairness = 0, max_p99_us = 0;
+    struct sim_domain *sdom;
+    unsigned int i;
+    int opt;
+
+    while ( (opt = getopt(argc, argv, "s:w:f:t:d:S:p:F:L:vh")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 's':
+            for ( i = 0; i < ARRAY_SIZE(schedulers); i++ )
+                if ( !strcmp(optarg, schedulers[i]->opt_name) )
+                    break;
+            if ( i == ARRAY_SIZE(schedulers) )
+                fail("unknown scheduler '%s'", optarg);
+            sched = schedulers[i];
+            break;
+        case 'w':
+            workload = optarg;
+            break;
+        case 'f':
+            file = optarg;
+            break;
+        case 't':
+            trace = optarg;
+            break;
+        case 'd':
+            duration = strtol(optarg, NULL, 0);
+            break;
+        case 'S':
+            new_seed = strtoll(optarg, NULL, 0);
+            break;
+        case 'p':
+        {
+            char *val = strchr(optarg, '=');
+
+            if ( val == NULL )
+                fail("-p wants NAME=VALUE");
+            *val++ = '\0';
+            if ( sim_set_param(optarg, val) )
+                fail("unknown boot parameter '%s'", optarg);
+            break;
+        }
+        case 'F':
+            min_fairness = strtod(optarg, NULL);
+            break;
+        case 'L':
+            max_p99_us = strtod(optarg, NULL);
+            break;
+        case 'v':
+            sim_verbose = 1;
+            break;
+        case 'h':
+            usage(stdout);
+            return 0;
+        default:
+            usage(stderr);
+            return 2;
+        }
+    }
+
+    if ( file != NULL )
+    {
+        char *text = read_file(file);
+
+        parse_config(text, file);
+        free(text);
+        workload = file;
+    }
+    else
+    {
+        for ( i = 0; i < ARRAY_SIZE(builtins); i++ )
+            if ( !strcmp(workload, builtins[i].name) )
+                break;
+        if ( i == ARRAY_SIZE(builtins) )
+            fail("unknown workload '%s'", workload);
+        parse_config(builtins[i].config, workload);
+    }
+
+    if ( duration >= 0 )
+        duration_ms = duration;
+    if ( new_seed >= 0 )
+        seed = new_seed;
+    if ( seed == 0 )
+        seed = 1;
+    if ( trace != NULL )
+        trace_file = trace;
+    if ( sim_domains == NULL )
+        fail("%s: no domains", workload);
+
+    sim_boot(sched, &topo);
+
+    if ( sim_ops.sched_id == XEN_SCHEDULER_RT )
+        rt_reservations();
+    for ( sdom = sim_domains; sdom != NULL; sdom = sdom->next )
+        setup_domain(sdom);
+    if ( trace_file != NULL )
+        load_trace(trace_file);
+    for ( sdom = sim_domains; sdom != NULL; sdom = sdom->next )
+        start_domain(sdom);
+
+    sim_run(MILLISECS(duration_ms));
+
+    return report(MILLISECS(duration_ms), workload, min_fairness, max_p99_us);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,122 @@
+/******************************************************************************
+ * sched-sim.h
+ *
+ * Interfaces between the simulated hypervisor (sim.c) and the workload
+ * driver (main.c).  Nothing in here is visible to the scheduler sources.
+ */
+
+#ifndef __SCHED_SIM_PRIV_H__
+#define __SCHED_SIM_PRIV_H__
+
+#include "sim.h"
+
+/* One CPU burst from a replayed trace: wake at 'at', then run for 'run'. */
+struct sim_burst {
+    s_time_t at;
+    s_time_t run;
+};
+
+/* How far a vcpu moved when it starts on a different pcpu */
+enum sim_migr {
+    SIM_MIGR_THREAD,        /* SMT sibling: caches are shared */
+    SIM_MIGR_CORE,          /* another core of the same socket */
+    SIM_MIGR_SOCKET,        /* another socket of the same node */
+    SIM_MIGR_NODE,          /* another NUMA node */
+    SIM_MIGR_NR
+};
+
+struct sim_topology {
+    unsigned int cpus;
+    unsigned int sockets;
+    unsigned int threads;   /* per core */
+    unsigned int nodes;     /* each holds sockets / nodes sockets */
+    unsigned int distance;  /* between nodes, SLIT style: local is 10 */
+    /* Time a vcpu spends refilling caches after each kind of move */
+    s_time_t     refill[SIM_MIGR_NR];
+};
+
+struct sim_vcpu {
+    struct vcpu      *v;
+    struct sim_domain *sdom;
+
+    /* Workload state */
+    s_time_t          burst_left;   /* CPU time wanted before blocking */
+    s_time_t          refill_left;  /* cache warmup before doing work */
+    s_time_t          llc_left;     /* ... of which LLC misses */
+    s_time_t          work_left;    /* parallel: work before the barrier */
+    bool_t            at_barrier;   /* parallel: spinning until siblings
+                                       get there too */
+    s_time_t          ple_left;     /* parallel: spinning left before a
+                                       pause-loop exit */
+    s_time_t          wake_at;      /* next wakeup, STIME_MAX if none */
+    struct sim_burst *bursts;       /* trace replay, NULL if synthetic */
+    unsigned int      nr_bursts, next_burst;
+
+    /* Measurements */
+    s_time_t          woken;        /* time of the last wakeup */
+    bool_t            lat_pending;  /* waiting for its first run since */
+    int               last_cpu;     /* pcpu it last ran on, -1 if never */
+    s_time_t          runtime;
+    s_time_t          refill;       /* part of runtime lost to refills */
+    s_time_t          spin;         /* part of runtime spent at barriers */
+    unsigned long     wakeups, migrations, yields;
+    unsigned long     migr[SIM_MIGR_NR];
+};
+
+struct sim_domain {
+    char              name[32];
+    struct domain    *d;
+    struct sim_domain *next;
+
+    /* Parameters */
+    unsigned int      id, nr_vcpus, weight, cap;
+    s_time_t          run, sleep;   /* synthetic burst and sleep lengths */
+    unsigned int      jitter;       /* +/- percent applied to run/sleep */
+    unsigned int      wss;          /* percent of the refill times it takes */
+    bool_t            traced;       /* bursts come from a trace file */
+    s_time_t          sync;         /* parallel: work between barriers */
+    bool_t            gang;         /* ask for gang scheduling */
+    s_time_t          ple;          /* parallel: yield after spinning this
+                                       long, 0 never */
+    s_time_t          period, budget; /* rt reservation of each vcpu */
+    bool_t            rt_split;     /* ... derived from the weight */
+
+    /* Barrier state of a parallel domain */
+    unsigned int      arrived;
+    unsigned long     phases;
+
+    /* Wakeup latency samples (ns) */
+    s_time_t         *lat;
+    unsigned int      nr_lat, max_lat;
+};
+
+#define sim_cpu_bound(sd) (!(sd)->traced && (sd)->sleep == 0)
+
+extern struct scheduler sim_ops;
+extern struct sim_domain *sim_domains;
+/* Timer interrupts taken, and how many of them interrupted a guest */
+extern unsigned long sim_timer_irqs, sim_timer_exits;
+
+int sim_set_param(const char *name, const char *val);
+void sim_list_params(FILE *f);
+
+void sim_boot(const struct scheduler *def, const struct sim_topology *topo);
+struct domain *sim_domain_create(domid_t id, unsigned int nr_vcpus);
+void sim_run(s_time_t end);
+
+/* Provided by main.c: the running vcpu finished its burst and blocks */
+void sim_vcpu_burst_done(struct sim_vcpu *sv);
+/* Provided by main.c: the running vcpu of a parallel domain got to the
+ * barrier, and spins there */
+void sim_vcpu_barrier(struct sim_vcpu *sv);
+
+#endif /* __SCHED_SIM_PRIV_H__ */
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,920 @@
+/******************************************************************************
+ * sim.c
+ *
+ * The simulated hypervisor: timers, softirqs, CPU bring-up and a copy of the
+ * generic scheduling paths from xen/common/schedule.c (schedule(),
+ * context_saved(), vcpu_wake(), vcpu_sleep_nosync(), vcpu_migrate(),
+ * do_yield()) driven by a discrete event loop.  Keep those in step with schedule.c, otherwise
+ * the simulation stops telling us anything about the real schedulers.
+ */
+
+#include "sched-sim.h"
+
+int sim_verbose;
+char keyhandler_scratch[1024];
+int tb_init_done;
+bool_t sched_smt_power_savings;
+int domlist_read_lock;
+
+int sched_ratelimit_us = SCHED_DEFAULT_RATELIMIT_US;
+integer_param("sched_ratelimit_us", sched_ratelimit_us);
+/* LLC miss counting for the schedulers, as on x86 */
+static bool_t sched_llc_pmu;
+boolean_param("sched_llc_pmu", sched_llc_pmu);
+
+unsigned int nr_cpu_ids;
+cpumask_t cpu_online_map;
+cpumask_t cpupool_free_cpus;
+cpumask_t sim_cpumask_of[NR_CPUS];
+struct cpupool *cpupool0;
+static struct cpupool pool0;
+
+unsigned int sim_cpu;
+s_time_t sim_now;
+
+DEFINE_PER_CPU(struct schedule_data, schedule_data);
+DEFINE_PER_CPU(struct scheduler *, scheduler);
+DEFINE_PER_CPU(struct cpupool *, cpupool);
+DEFINE_PER_CPU(cpumask_var_t, cpu_sibling_mask);
+DEFINE_PER_CPU(cpumask_var_t, cpu_core_mask);
+DEFINE_PER_CPU(struct vcpu *, curr_vcpu);
+
+struct vcpu *idle_vcpu[NR_CPUS];
+struct domain *domain_list;
+static struct domain *idle_domain;
+
+struct scheduler sim_ops;
+
+#define DOM2OP(_d)    (((_d)->cpupool == NULL) ? &sim_ops : ((_d)->cpupool->sched))
+#define VCPU2OP(_v)   (DOM2OP((_v)->domain))
+#define SCHED_OP(opsptr, fn, ...)                                          \
+         (( (opsptr)->fn != NULL ) ? (opsptr)->fn(opsptr, ##__VA_ARGS__ )  \
+          : (typeof((opsptr)->fn(opsptr, ##__VA_ARGS__)))0 )
+
+/*
+ * Boot parameters
+ */
+
+#define SIM_MAX_PARAMS 32
+
+static struct {
+    const char *name;
+    void *var;
+    size_t size;
+    bool_t string;
+} params[SIM_MAX_PARAMS];
+static unsigned int nr_params;
+
+void sim_register_param(const char *name, void *var, size_t size,
+                        bool_t string)
+{
+    BUG_ON(nr_params == SIM_MAX_PARAMS);
+    params[nr_params].name = name;
+    params[nr_params].var = var;
+    params[nr_params].size = size;
+    params[nr_params].string = string;
+    nr_params++;
+}
+
+int sim_set_param(const char *name, const char *str)
+{
+    unsigned int i;
+    long long val;
+
+    for ( i = 0; i < nr_params; i++ )
+    {
+        if ( strcmp(params[i].name, name) )
+            continue;
+
+        if ( params[i].string )
+        {
+            snprintf(params[i].var, params[i].size, "%s", str);
+            return 0;
+        }
+
+        val = strtoll(str, NULL, 0);
+        switch ( params[i].size )
+        {
+        case 1: *(int8_t *)params[i].var = val; break;
+        case 2: *(int16_t *)params[i].var = val; break;
+        case 4: *(int32_t *)params[i].var = val; break;
+        case 8: *(int64_t *)params[i].var = val; break;
+        default: BUG();
+        }
+        return 0;
+    }
+
+    return -ENOENT;
+}
+
+void sim_list_params(FILE *f)
+{
+    unsigned int i;
+
+    for ( i = 0; i < nr_params; i++ )
+        fprintf(f, "  %s\n", params[i].name);
+}
+
+/*
+ * Timers: a flat list, scanned for the earliest deadline.  The number of
+ * timers is small (a couple per pcpu) so this is plenty fast.
+ */
+
+static struct timer *timer_list;
+
+unsigned long sim_timer_irqs, sim_timer_exits;
+static s_time_t last_irq[NR_CPUS];
+
+void init_timer(struct timer *timer, void (*function)(void *),
+                void *data, unsigned int cpu)
+{
+    memset(timer, 0, sizeof(*timer));
+    timer->function = function;
+    timer->data = data;
+    timer->cpu = cpu;
+    timer->sim_next = timer_list;
+    timer_list = timer;
+}
+
+void set_timer(struct timer *timer, s_time_t expires)
+{
+    ASSERT(!timer->killed);
+    timer->expires = expires;
+    timer->active = 1;
+}
+
+void stop_timer(struct timer *timer)
+{
+    timer->active = 0;
+}
+
+void migrate_timer(struct timer *timer, unsigned int new_cpu)
+{
+    timer->cpu = new_cpu;
+}
+
+void kill_timer(struct timer *timer)
+{
+    struct timer **pprev;
+
+    for ( pprev = &timer_list; *pprev != NULL; pprev = &(*pprev)->sim_next )
+        if ( *pprev == timer )
+        {
+            *pprev = timer->sim_next;
+            break;
+        }
+
+    timer->active = 0;
+    timer->killed = 1;
+}
+
+static struct timer *next_timer(void)
+{
+    struct timer *t, *first = NULL;
+
+    for ( t = timer_list; t != NULL; t = t->sim_next )
+        if ( t->active && (first == NULL || t->expires < first->expires) )
+            first = t;
+
+    return first;
+}
+
+/*
+ * Softirqs
+ */
+
+static unsigned long softirq_pending[NR_CPUS];
+
+void cpu_raise_softirq(unsigned int cpu, unsigned int nr)
+{
+    set_bit(nr, &softirq_pending[cpu]);
+}
+
+void cpumask_raise_softirq(const cpumask_t *mask, unsigned int nr)
+{
+    int cpu;
+
+    for_each_cpu ( cpu, mask )
+        cpu_raise_softirq(cpu, nr);
+}
+
+/*
+ * CPU topology and notifiers
+ */
+
+static struct sim_topology topo = { .sockets = 1, .threads = 1, .nodes = 1 };
+static cpumask_t cpu_started;
+static struct notifier_block *cpu_chain;
+
+static unsigned int cpus_per_socket(void)
+{
+    return (nr_cpu_ids + topo.sockets - 1) / topo.sockets;
+}
+
+int sim_cpu_to_socket(unsigned int cpu)
+{
+    /* Like cpu_data[], the topology is only known once the CPU is up. */
+    if ( !cpumask_test_cpu(cpu, &cpu_started) )
+        return -1;
+    return cpu / cpus_per_socket();
+}
+
+/* Core ids are per socket, as on x86 */
+int sim_cpu_to_core(unsigned int cpu)
+{
+    if ( !cpumask_test_cpu(cpu, &cpu_started) )
+        return -1;
+    return (cpu % cpus_per_socket()) / topo.threads;
+}
+
+int sim_cpu_to_node(unsigned int cpu)
+{
+    return (cpu / cpus_per_socket()) / (topo.sockets / topo.nodes);
+}
+
+int sim_node_distance(int a, int b)
+{
+    return a == b ? 10 : topo.distance;
+}
+
+static enum sim_migr migr_kind(unsigned int from, unsigned int to)
+{
+    if ( sim_cpu_to_node(from) != sim_cpu_to_node(to) )
+        return SIM_MIGR_NODE;
+    if ( sim_cpu_to_socket(from) != sim_cpu_to_socket(to) )
+        return SIM_MIGR_SOCKET;
+    if ( sim_cpu_to_core(from) != sim_cpu_to_core(to) )
+        return SIM_MIGR_CORE;
+    return SIM_MIGR_THREAD;
+}
+
+void register_cpu_notifier(struct notifier_block *nb)
+{
+    struct notifier_block **pnb = &cpu_chain;
+
+    while ( *pnb != NULL )
+        pnb = &(*pnb)->next;
+    nb->next = NULL;
+    *pnb = nb;
+}
+
+static void cpu_notify(unsigned long action, unsigned int cpu)
+{
+    struct notifier_block *nb;
+
+    for ( nb = cpu_chain; nb != NULL; nb = nb->next )
+        nb->notifier_call(nb, action, (void *)(unsigned long)cpu);
+}
+
+/*
+ * The generic scheduler, following xen/common/schedule.c
+ */
+
+static void vcpu_runstate_change(
+    struct vcpu *v, int new_state, s_time_t new_entry_time)
+{
+    s_time_t delta;
+
+    ASSERT(v->runstate.state != new_state);
+    ASSERT(spin_is_locked(per_cpu(schedule_data,v->processor).schedule_lock));
+
+    delta = new_entry_time - v->runstate.state_entry_time;
+    if ( delta > 0 )
+    {
+        v->runstate.time[v->runstate.state] += delta;
+        v->runstate.state_entry_time = new_entry_time;
+    }
+
+    v->runstate.state = new_state;
+}
+
+static int sched_init_vcpu(struct vcpu *v, unsigned int processor)
+{
+    struct domain *d = v->domain;
+
+    v->processor = processor;
+    if ( is_idle_domain(d) || d->is_pinned )
+        cpumask_copy(v->cpu_affinity, cpumask_of(processor));
+    else
+        cpumask_setall(v->cpu_affinity);
+
+    /* Idle VCPUs are scheduled immediately. */
+    if ( is_idle_domain(d) )
+    {
+        per_cpu(schedule_data, v->processor).curr = v;
+        per_cpu(curr_vcpu, v->processor) = v;
+        v->is_running = 1;
+    }
+
+    v->sched_priv = SCHED_OP(DOM2OP(d), alloc_vdata, v, d->sched_priv);
+    if ( v->sched_priv == NULL )
+        return 1;
+
+    SCHED_OP(VCPU2OP(v), insert_vcpu, v);
+
+    return 0;
+}
+
+static struct vcpu *alloc_vcpu(struct domain *d, unsigned int vcpu_id,
+                               unsigned int cpu_id)
+{
+    struct vcpu *v = xzalloc(struct vcpu);
+
+    BUG_ON(v == NULL || !zalloc_cpumask_var(&v->cpu_affinity));
+
+    v->domain = d;
+    v->vcpu_id = vcpu_id;
+
+    /*
+     * Unlike Xen, guest vcpus start blocked rather than down: the first
+     * wakeup of the workload brings them up through the normal path.
+     */
+    if ( is_idle_domain(d) )
+        v->runstate.state = RUNSTATE_running;
+    else
+    {
+        v->runstate.state = RUNSTATE_offline;
+        set_bit(_VPF_blocked, &v->pause_flags);
+    }
+
+    d->vcpu[vcpu_id] = v;
+    if ( vcpu_id != 0 )
+        d->vcpu[vcpu_id - 1]->next_in_list = v;
+
+    BUG_ON(sched_init_vcpu(v, cpu_id));
+
+    return v;
+}
+
+void vcpu_sleep_nosync(struct vcpu *v)
+{
+    unsigned long flags;
+
+    vcpu_schedule_lock_irqsave(v, flags);
+
+    if ( likely(!vcpu_runnable(v)) )
+    {
+        if ( v->runstate.state == RUNSTATE_runnable )
+            vcpu_runstate_change(v, RUNSTATE_offline, NOW());
+
+        SCHED_OP(VCPU2OP(v), sleep, v);
+    }
+
+    vcpu_schedule_unlock_irqrestore(v, flags);
+}
+
+void vcpu_wake(struct vcpu *v)
+{
+    unsigned long flags;
+
+    vcpu_schedule_lock_irqsave(v, flags);
+
+    if ( likely(vcpu_runnable(v)) )
+    {
+        if ( v->runstate.state >= RUNSTATE_blocked )
+            vcpu_runstate_change(v, RUNSTATE_runnable, NOW());
+        SCHED_OP(VCPU2OP(v), wake, v);
+    }
+    else if ( !test_bit(_VPF_blocked, &v->pause_flags) )
+    {
+        if ( v->runstate.state == RUNSTATE_blocked )
+            vcpu_runstate_change(v, RUNSTATE_offline, NOW());
+    }
+
+    vcpu_schedule_unlock_irqrestore(v, flags);
+}
+
+static void vcpu_unblock(struct vcpu *v)
+{
+    if ( !test_and_clear_bit(_VPF_blocked, &v->pause_flags) )
+        return;
+
+    vcpu_wake(v);
+}
+
+void vcpu_pause_nosync(struct vcpu *v)
+{
+    atomic_inc(&v->pause_count);
+    vcpu_sleep_nosync(v);
+}
+
+void vcpu_unpause(struct vcpu *v)
+{
+    if ( atomic_dec_and_test(&v->pause_count) )
+        vcpu_wake(v);
+}
+
+static void vcpu_migrate(struct vcpu *v)
+{
+    unsigned long flags;
+    unsigned int old_cpu, new_cpu;
+    spinlock_t *old_lock, *new_lock;
+    bool_t pick_called = 0;
+
+    old_cpu = new_cpu = v->processor;
+    for ( ; ; )
+    {
+        old_lock = per_cpu(schedule_data, old_cpu).schedule_lock;
+        new_lock = per_cpu(schedule_data, new_cpu).schedule_lock;
+
+        if ( old_lock == new_lock )
+        {
+            spin_lock_irqsave(old_lock, flags);
+        }
+        else if ( old_lock < new_lock )
+        {
+            spin_lock_irqsave(old_lock, flags);
+            spin_lock(new_lock);
+        }
+        else
+        {
+            spin_lock_irqsave(new_lock, flags);
+            spin_lock(old_lock);
+        }
+
+        old_cpu = v->processor;
+        if ( old_lock == per_cpu(schedule_data, old_cpu).schedule_lock )
+        {
+            if ( pick_called &&
+                 (new_lock == per_cpu(schedule_data, new_cpu).schedule_lock) &&
+                 cpumask_test_cpu(new_cpu, v->cpu_affinity) &&
+                 cpumask_test_cpu(new_cpu, v->domain->cpupool->cpu_valid) )
+                break;
+
+            new_cpu = SCHED_OP(VCPU2OP(v), pick_cpu, v);
+            if ( (new_lock == per_cpu(schedule_data, new_cpu).schedule_lock) &&
+                 cpumask_test_cpu(new_cpu, v->domain->cpupool->cpu_valid) )
+                break;
+            pick_called = 1;
+        }
+        else
+            pick_called = 0;
+
+        if ( old_lock != new_lock )
+            spin_unlock(new_lock);
+        spin_unlock_irqrestore(old_lock, flags);
+    }
+
+    if ( v->is_running ||
+         !test_and_clear_bit(_VPF_migrating, &v->pause_flags) )
+    {
+        if ( old_lock != new_lock )
+            spin_unlock(new_lock);
+        spin_unlock_irqrestore(old_lock, flags);
+        return;
+    }
+
+    if ( VCPU2OP(v)->migrate )
+        SCHED_OP(VCPU2OP(v), migrate, v, new_cpu);
+    else
+        v->processor = new_cpu;
+
+    if ( old_lock != new_lock )
+        spin_unlock(new_lock);
+    spin_unlock_irqrestore(old_lock, flags);
+
+    vcpu_wake(v);
+}
+
+/* As do_yield(), for the vcpu running on sim_cpu: a pause-loop exit. */
+static void do_yield(struct vcpu *v)
+{
+    vcpu_schedule_lock_irq(v);
+    SCHED_OP(VCPU2OP(v), yield, v);
+    vcpu_schedule_unlock_irq(v);
+
+    raise_softirq(SCHEDULE_SOFTIRQ);
+}
+
+static void context_saved(struct vcpu *prev)
+{
+    prev->is_running = 0;
+
+    SCHED_OP(VCPU2OP(prev), context_saved, prev);
+
+    if ( unlikely(test_bit(_VPF_migrating, &prev->pause_flags)) )
+        vcpu_migrate(prev);
+}
+
+/*
+ * LLC misses: refilling the cache after moving to another socket or node
+ * takes one per SIM_LLC_MISS_NS, and a vcpu with a warm cache still spends
+ * 1% of its time on them.
+ */
+#define SIM_LLC_MISS_NS 100
+static s_time_t llc_miss_time[NR_CPUS];
+
+uint64_t arch_llc_misses(void)
+{
+    if ( !sched_llc_pmu )
+        return LLC_MISSES_UNKNOWN;
+    return llc_miss_time[sim_cpu] / SIM_LLC_MISS_NS;
+}
+
+/* Switching is instantaneous, so the previous context is saved at once. */
+static void context_switch(struct vcpu *prev, struct vcpu *next)
+{
+    unsigned int cpu = smp_processor_id();
+    struct sim_vcpu *sv = next->sim;
+
+    this_cpu(curr_vcpu) = next;
+
+    if ( sv != NULL )
+    {
+        struct sim_domain *sdom = sv->sdom;
+
+        if ( sv->last_cpu >= 0 && sv->last_cpu != cpu )
+        {
+            enum sim_migr kind = migr_kind(sv->last_cpu, cpu);
+            s_time_t refill = topo.refill[kind] * sdom->wss / 100;
+
+            sv->migrations++;
+            sv->migr[kind]++;
+            /* Whatever was still cold stays cold; this comes on top. */
+            sv->refill_left += refill;
+            if ( kind >= SIM_MIGR_SOCKET )
+                sv->llc_left += refill;
+        }
+        sv->last_cpu = cpu;
+        /* The pause-loop window starts again on every entry. */
+        sv->ple_left = sdom->ple;
+
+        if ( sv->lat_pending )
+        {
+            if ( sdom->nr_lat == sdom->max_lat )
+            {
+                sdom->max_lat = sdom->max_lat ? sdom->max_lat * 2 : 1024;
+                sdom->lat = realloc(sdom->lat,
+                                    sdom->max_lat * sizeof(*sdom->lat));
+                BUG_ON(sdom->lat == NULL);
+            }
+            sdom->lat[sdom->nr_lat++] = NOW() - sv->woken;
+            sv->lat_pending = 0;
+        }
+    }
+
+    context_saved(prev);
+}
+
+static void s_timer_fn(void *unused)
+{
+    raise_softirq(SCHEDULE_SOFTIRQ);
+}
+
+static void schedule(void)
+{
+    struct vcpu          *prev = current, *next = NULL;
+    s_time_t              now = NOW();
+    struct scheduler     *sched;
+    struct schedule_data *sd;
+    struct task_slice     next_slice;
+    int cpu = smp_processor_id();
+
+    sd = &this_cpu(schedule_data);
+
+    pcpu_schedule_lock_irq(cpu);
+
+    stop_timer(&sd->s_timer);
+
+    sched = this_cpu(scheduler);
+    next_slice = sched->do_schedule(sched, now, 0);
+
+    next = next_slice.task;
+
+    sd->curr = next;
+
+    if ( next_slice.time >= 0 ) /* -ve means no limit */
+        set_timer(&sd->s_timer, now + next_slice.time);
+
+    if ( unlikely(prev == next) )
+    {
+        pcpu_schedule_unlock_irq(cpu);
+        return;
+    }
+
+    ASSERT(prev->runstate.state == RUNSTATE_running);
+
+    vcpu_runstate_change(
+        prev,
+        (test_bit(_VPF_blocked, &prev->pause_flags) ? RUNSTATE_blocked :
+         (vcpu_runnable(prev) ? RUNSTATE_runnable : RUNSTATE_offline)),
+        now);
+    prev->last_run_time = now;
+
+    ASSERT(next->runstate.state != RUNSTATE_running);
+    vcpu_runstate_change(next, RUNSTATE_running, now);
+
+    ASSERT(!next->is_running);
+    next->is_running = 1;
+
+    pcpu_schedule_unlock_irq(cpu);
+
+    context_switch(prev, next);
+}
+
+/*
+ * Bring-up, following scheduler_init() and cpu_schedule_up()
+ */
+
+static void cpu_schedule_up(unsigned int cpu)
+{
+    struct schedule_data *sd = &per_cpu(schedule_data, cpu);
+
+    per_cpu(scheduler, cpu) = &sim_ops;
+    per_cpu(cpupool, cpu) = cpupool0;
+    spin_lock_init(&sd->_lock);
+    sd->schedule_lock = &sd->_lock;
+    sd->curr = idle_vcpu[cpu];
+    init_timer(&sd->s_timer, s_timer_fn, NULL, cpu);
+    atomic_set(&sd->urgent_count, 0);
+}
+
+void sim_boot(const struct scheduler *def, const struct sim_topology *t)
+{
+    unsigned int cpu, sib, nr_cpus = t->cpus;
+
+    BUG_ON(nr_cpus == 0 || nr_cpus > NR_CPUS);
+    BUG_ON(t->sockets == 0 || t->threads == 0 || t->nodes == 0 ||
+           t->sockets % t->nodes);
+
+    nr_cpu_ids = nr_cpus;
+    topo = *t;
+    for ( cpu = 0; cpu < nr_cpus; cpu++ )
+    {
+        cpumask_set_cpu(cpu, &sim_cpumask_of[cpu]);
+        last_irq[cpu] = -1;
+    }
+
+    sim_ops = *def;
+    if ( sim_ops.global_init && sim_ops.global_init() < 0 )
+        panic("scheduler %s failed global init\n", sim_ops.opt_name);
+
+    pool0.cpupool_id = 0;
+    pool0.sched = &sim_ops;
+    BUG_ON(!zalloc_cpumask_var(&pool0.cpu_valid));
+    cpupool0 = &pool0;
+
+    cpu_schedule_up(0);
+    if ( SCHED_OP(&sim_ops, init) )
+        panic("scheduler returned error on init\n");
+
+    idle_domain = xzalloc(struct domain);
+    idle_domain->domain_id = DOMID_IDLE;
+    idle_domain->vcpu = idle_vcpu;
+    idle_domain->max_vcpus = nr_cpus;
+
+    for ( cpu = 0; cpu < nr_cpus; cpu++ )
+    {
+        if ( cpu != 0 )
+            cpu_schedule_up(cpu);
+
+        BUG_ON(!zalloc_cpumask_var(&per_cpu(cpu_sibling_mask, cpu)));
+        BUG_ON(!zalloc_cpumask_var(&per_cpu(cpu_core_mask, cpu)));
+
+        sim_cpu = cpu;
+        alloc_vcpu(idle_domain, cpu, cpu);
+        if ( sim_ops.alloc_pdata &&
+             !(per_cpu(schedule_data, cpu).sched_priv =
+               sim_ops.alloc_pdata(&sim_ops, cpu)) )
+            BUG();
+
+        /* Now the CPU is "up": topology becomes visible, STARTING fires. */
+        cpumask_set_cpu(cpu, &cpu_started);
+        if ( cpu != 0 )
+            cpu_notify(CPU_STARTING, cpu);
+        cpumask_set_cpu(cpu, &cpu_online_map);
+        cpumask_set_cpu(cpu, pool0.cpu_valid);
+    }
+
+    for ( cpu = 0; cpu < nr_cpus; cpu++ )
+        for ( sib = 0; sib < nr_cpus; sib++ )
+        {
+            if ( sim_cpu_to_socket(sib) != sim_cpu_to_socket(cpu) )
+                continue;
+            cpumask_set_cpu(sib, per_cpu(cpu_core_mask, cpu));
+            if ( sim_cpu_to_core(sib) == sim_cpu_to_core(cpu) )
+                cpumask_set_cpu(sib, per_cpu(cpu_sibling_mask, cpu));
+        }
+
+    sim_cpu = 0;
+}
+
+struct domain *sim_domain_create(domid_t id, unsigned int nr_vcpus)
+{
+    struct domain *d = xzalloc(struct domain), **pd;
+    unsigned int i;
+
+    BUG_ON(d == NULL);
+    d->domain_id = id;
+    d->max_vcpus = nr_vcpus;
+    d->vcpu = xzalloc_array(struct vcpu *, nr_vcpus);
+    d->cpupool = cpupool0;
+    BUG_ON(d->vcpu == NULL);
+
+    if ( SCHED_OP(DOM2OP(d), init_domain, d) )
+        panic("d%d: scheduler init_domain failed\n", id);
+
+    for ( i = 0; i < nr_vcpus; i++ )
+        alloc_vcpu(d, i, i % nr_cpu_ids);
+
+    for ( pd = &domain_list; *pd != NULL; pd = &(*pd)->next_in_list )
+        continue;
+    *pd = d;
+
+    return d;
+}
+
+/*
+ * The event loop
+ */
+
+static void do_softirqs(void)
+{
+    unsigned int cpu;
+    bool_t again;
+
+    do {
+        again = 0;
+        for ( cpu = 0; cpu < nr_cpu_ids; cpu++ )
+        {
+            if ( !test_and_clear_bit(SCHEDULE_SOFTIRQ,
+                                     &softirq_pending[cpu]) )
+                continue;
+            sim_cpu = cpu;
+            schedule();
+            again = 1;
+        }
+    } while ( again );
+}
+
+/*
+ * Charge the time that passed to whatever is running on each pcpu.  Cache
+ * refills come first and don't count towards the burst.
+ */
+static void advance(s_time_t to)
+{
+    s_time_t delta = to - sim_now;
+    unsigned int cpu;
+
+    ASSERT(delta >= 0);
+
+    for ( cpu = 0; cpu < nr_cpu_ids; cpu++ )
+    {
+        struct sim_vcpu *sv = per_cpu(curr_vcpu, cpu)->sim;
+        s_time_t work = delta, refill;
+
+        if ( sv == NULL )
+            continue;
+        sv->runtime += delta;
+        refill = min(work, sv->refill_left);
+        sv->refill_left -= refill;
+        sv->refill += refill;
+        work -= refill;
+        llc_miss_time[cpu] += min(refill, sv->llc_left) + work / 100;
+        sv->llc_left -= min(refill, sv->llc_left);
+        if ( sv->burst_left != STIME_MAX )
+            sv->burst_left -= work;
+        else if ( sv->sdom->sync )
+        {
+            s_time_t done = min(work, sv->work_left);
+
+            sv->work_left -= done;
+            sv->spin += work - done;
+            sv->ple_left -= min(work - done, sv->ple_left);
+        }
+    }
+
+    sim_now = to;
+}
+
+void sim_run(s_time_t end)
+{
+    struct domain *d;
+    struct vcpu *v;
+    struct timer *t;
+    unsigned int cpu;
+    s_time_t next;
+
+    for ( ; ; )
+    {
+        do_softirqs();
+
+        next = end;
+
+        if ( (t = next_timer()) != NULL && t->expires < next )
+            next = t->expires;
+
+        for ( cpu = 0; cpu < nr_cpu_ids; cpu++ )
+        {
+            struct sim_vcpu *sv;
+
+            v = per_cpu(curr_vcpu, cpu);
+            sv = v->sim;
+            if ( sv != NULL && sv->burst_left != STIME_MAX &&
+                 !test_bit(_VPF_blocked, &v->pause_flags) &&
+                 sim_now + sv->refill_left + sv->burst_left < next )
+                next = sim_now + sv->refill_left + sv->burst_left;
+            if ( sv != NULL && sv->sdom->sync && !sv->at_barrier &&
+                 sim_now + sv->refill_left + sv->work_left < next )
+                next = sim_now + sv->refill_left + sv->work_left;
+            if ( sv != NULL && sv->at_barrier && sv->sdom->ple &&
+                 sim_now + sv->refill_left + sv->ple_left < next )
+                next = sim_now + sv->refill_left + sv->ple_left;
+        }
+
+        for_each_domain ( d )
+            for_each_vcpu ( d, v )
+                if ( v->sim->wake_at < next )
+                    next = v->sim->wake_at;
+
+        if ( next < sim_now )
+            next = sim_now;
+        advance(next);
+        if ( sim_now >= end )
+            break;
+
+        /*
+         * Bursts that completed: the vcpu blocks, as in do_block().  It may
+         * already be flagged for migration, which doesn't stop it running.
+         */
+        for ( cpu = 0; cpu < nr_cpu_ids; cpu++ )
+        {
+            v = per_cpu(curr_vcpu, cpu);
+            if ( v->sim == NULL || v->sim->burst_left > 0 ||
+                 test_bit(_VPF_blocked, &v->pause_flags) )
+                continue;
+            sim_cpu = cpu;
+            set_bit(_VPF_blocked, &v->pause_flags);
+            raise_softirq(SCHEDULE_SOFTIRQ);
+            sim_vcpu_burst_done(v->sim);
+        }
+
+        /* Parallel vcpus that got to the barrier (they keep running). */
+        for ( cpu = 0; cpu < nr_cpu_ids; cpu++ )
+        {
+            struct sim_vcpu *sv = per_cpu(curr_vcpu, cpu)->sim;
+
+            if ( sv != NULL && sv->sdom->sync && !sv->at_barrier &&
+                 sv->work_left == 0 )
+                sim_vcpu_barrier(sv);
+        }
+
+        /* ... and those that spun there long enough for a pause-loop exit. */
+        for ( cpu = 0; cpu < nr_cpu_ids; cpu++ )
+        {
+            struct sim_vcpu *sv = per_cpu(curr_vcpu, cpu)->sim;
+
+            if ( sv == NULL || !sv->at_barrier || !sv->sdom->ple ||
+                 sv->ple_left > 0 )
+                continue;
+            sv->ple_left = sv->sdom->ple;
+            sv->yields++;
+            sim_cpu = cpu;
+            do_yield(sv->v);
+        }
+
+        /*
+         * Expired timers, earliest first.  The timers of a pcpu that
+         * expire together take one interrupt, which is a VM exit as well
+         * if a guest is running there.
+         */
+        while ( (t = next_timer()) != NULL && t->expires <= sim_now )
+        {
+            t->active = 0;
+            sim_cpu = t->cpu;
+            if ( last_irq[t->cpu] != t->expires )
+            {
+                last_irq[t->cpu] = t->expires;
+                sim_timer_irqs++;
+                if ( per_cpu(curr_vcpu, t->cpu)->sim != NULL )
+                    sim_timer_exits++;
+            }
+            t->function(t->data);
+        }
+
+        /* Wakeups that are due. */
+        for_each_domain ( d )
+            for_each_vcpu ( d, v )
+            {
+                struct sim_vcpu *sv = v->sim;
+
+                if ( sv->wake_at > sim_now )
+                    continue;
+                sv->wake_at = STIME_MAX;
+                sv->woken = sim_now;
+                sv->lat_pending = 1;
+                sv->wakeups++;
+                sim_cpu = v->processor;
+                vcpu_unblock(v);
+            }
+    }
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,691 @@
+/******************************************************************************
+ * sim.h
+ *
+ * Userspace stand-ins for the hypervisor interfaces used by the schedulers
+ * in xen/common/sched_*.c.  Every scheduler source file is compiled with
+ * this header force-included and with include/ (a tree of empty headers)
+ * ahead of everything else, so the scheduler code builds unmodified.
+ *
+ * The simulation is strictly single threaded: locks only check for
+ * recursion, "per-cpu" data is an array indexed by sim_cpu, and time only
+ * moves when the event loop in sim.c advances it.
+ */
+
+#ifndef __SCHED_SIM_H__
+#define __SCHED_SIM_H__
+
+#define __XEN_TOOLS__ 1
+
+#include <stdio.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+#include "../../../xen/include/public/xen.h"
+#include "../../../xen/include/public/vcpu.h"
+#include "../../../xen/include/public/domctl.h"
+#include "../../../xen/include/public/sysctl.h"
+#include "../../../xen/include/public/trace.h"
+
+/* Types and compiler helpers */
+
+typedef int8_t   s8;
+typedef uint8_t  u8;
+typedef int16_t  s16;
+typedef uint16_t u16;
+typedef int32_t  s32;
+typedef uint32_t u32;
+typedef int64_t  s64;
+typedef uint64_t u64;
+typedef char     bool_t;
+typedef s64      s_time_t;
+#define PRI_stime PRId64
+
+#define __init
+#define __initdata
+#define __read_mostly
+#define __cacheline_aligned
+
+#define likely(x)   __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+#define min(x, y) ((x) < (y) ? (x) : (y))
+#define max(x, y) ((x) > (y) ? (x) : (y))
+#define min_t(type, x, y) ((type)(x) < (type)(y) ? (type)(x) : (type)(y))
+#define max_t(type, x, y) ((type)(x) > (type)(y) ? (type)(x) : (type)(y))
+
+#define container_of(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define barrier()  __asm__ __volatile__ ( "" : : : "memory" )
+#define smp_mb()   barrier()
+#define smp_rmb()  barrier()
+#define smp_wmb()  barrier()
+#define cpu_relax() barrier()
+
+/* Diagnostics */
+
+#define printk(fmt, args...) \
+    do { if ( sim_verbose ) printf(fmt, ## args); } while ( 0 )
+#define gdprintk(lvl, fmt, args...) printk(fmt, ## args)
+#define dprintk(lvl, fmt, args...)  printk(fmt, ## args)
+#define XENLOG_INFO    ""
+#define XENLOG_WARNING ""
+#define XENLOG_ERR     ""
+
+#define BUG() \
+    do { fprintf(stderr, "BUG at %s:%d\n", __FILE__, __LINE__); \
+         abort(); } while ( 0 )
+#define BUG_ON(p)  do { if ( unlikely(p) ) BUG(); } while ( 0 )
+#define ASSERT(p) \
+    do { if ( unlikely(!(p)) ) { \
+         fprintf(stderr, "Assertion '%s' failed at %s:%d\n", \
+                 #p, __FILE__, __LINE__); \
+         abort(); } } while ( 0 )
+#define WARN_ON(p) \
+    do { if ( unlikely(p) ) \
+         fprintf(stderr, "WARNING at %s:%d\n", __FILE__, __LINE__); \
+    } while ( 0 )
+#define WARN() WARN_ON(1)
+#define panic(fmt, args...) \
+    do { fprintf(stderr, fmt, ## args); abort(); } while ( 0 )
+
+extern int sim_verbose;
+extern char keyhandler_scratch[1024];
+
+/* Boot parameters are collected so they can be set from the command line */
+
+void sim_register_param(const char *name, void *var, size_t size,
+                        bool_t string);
+
+#define __sim_param(_name, _var, _str)                                  \
+    static void __attribute__((constructor)) __sim_param_##_var(void)  \
+    { sim_register_param(_name, &_var, sizeof(_var), _str); }
+#define integer_param(_name, _var) __sim_param(_name, _var, 0)
+#define boolean_param(_name, _var) __sim_param(_name, _var, 0)
+#define string_param(_name, _var)  __sim_param(_name, _var, 1)
+
+/* Tracing and performance counters compile away */
+
+extern int tb_init_done;
+
+static inline void sim_trace(u32 event, ...) { }
+#define TRACE_0D(e)          sim_trace(e)
+#define TRACE_1D(e, a...)    sim_trace(e, ## a)
+#define TRACE_2D(e, a...)    sim_trace(e, ## a)
+#define TRACE_3D(e, a...)    sim_trace(e, ## a)
+#define TRACE_4D(e, a...)    sim_trace(e, ## a)
+#define TRACE_5D(e, a...)    sim_trace(e, ## a)
+static inline void trace_var(u32 event, int cycles, int extra,
+                             const void *extra_data) { }
+static inline void __trace_var(u32 event, int cycles, int extra,
+                               const void *extra_data) { }
+
+#define perfc_incr(x)            ((void)0)
+#define SCHED_STAT_CRANK(x)      ((void)0)
+
+/* Memory allocation */
+
+#define xzalloc(type)           ((type *)calloc(1, sizeof(type)))
+#define xzalloc_array(type, n)  ((type *)calloc((n), sizeof(type)))
+#define xmalloc(type)           ((type *)malloc(sizeof(type)))
+#define xmalloc_array(type, n)  ((type *)malloc((n) * sizeof(type)))
+#define xfree(p)                free(p)
+
+/* Bit operations */
+
+#define BITS_PER_LONG     (sizeof(long) * 8)
+#define BITS_TO_LONGS(n)  (((n) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+static inline void set_bit(int nr, volatile void *addr)
+{
+    ((unsigned long *)addr)[nr / BITS_PER_LONG] |= 1UL << (nr % BITS_PER_LONG);
+}
+
+static inline void clear_bit(int nr, volatile void *addr)
+{
+    ((unsigned long *)addr)[nr / BITS_PER_LONG] &=
+        ~(1UL << (nr % BITS_PER_LONG));
+}
+
+static inline int test_bit(int nr, const volatile void *addr)
+{
+    return (((const unsigned long *)addr)[nr / BITS_PER_LONG] >>
+            (nr % BITS_PER_LONG)) & 1;
+}
+
+static inline int test_and_set_bit(int nr, volatile void *addr)
+{
+    int old = test_bit(nr, addr);
+    set_bit(nr, addr);
+    return old;
+}
+
+static inline int test_and_clear_bit(int nr, volatile void *addr)
+{
+    int old = test_bit(nr, addr);
+    clear_bit(nr, addr);
+    return old;
+}
+
+/* Atomics */
+
+typedef struct { int counter; } atomic_t;
+#define ATOMIC_INIT(i)           { (i) }
+#define atomic_read(v)           ((v)->counter)
+#define atomic_set(v, i)         ((v)->counter = (i))
+#define atomic_add(i, v)         ((v)->counter += (i))
+#define atomic_sub(i, v)         ((v)->counter -= (i))
+#define atomic_inc(v)            ((v)->counter++)
+#define atomic_dec(v)            ((v)->counter--)
+#define atomic_dec_and_test(v)   (--(v)->counter == 0)
+#define atomic_inc_and_test(v)   (++(v)->counter == 0)
+
+#define cmpxchg(p, o, n) __sync_val_compare_and_swap(p, o, n)
+
+/* Locks: one thread, so only check that nobody takes a lock twice */
+
+typedef struct { int held; } spinlock_t;
+typedef struct { int held; } rwlock_t;
+
+#define SPIN_LOCK_UNLOCKED { 0 }
+#define DEFINE_SPINLOCK(l) spinlock_t l = SPIN_LOCK_UNLOCKED
+#define spin_lock_init(l)  ((l)->held = 0)
+#define rwlock_init(l)     ((l)->held = 0)
+
+static inline void spin_lock(spinlock_t *l)
+{
+    ASSERT(!l->held);
+    l->held = 1;
+}
+
+static inline void spin_unlock(spinlock_t *l)
+{
+    ASSERT(l->held);
+    l->held = 0;
+}
+
+static inline int spin_trylock(spinlock_t *l)
+{
+    if ( l->held )
+        return 0;
+    l->held = 1;
+    return 1;
+}
+
+#define spin_is_locked(l)                 ((l)->held)
+#define spin_lock_irq(l)                  spin_lock(l)
+#define spin_unlock_irq(l)                spin_unlock(l)
+#define spin_lock_irqsave(l, f)           ((f) = 0, spin_lock(l))
+#define spin_unlock_irqrestore(l, f)      ((void)(f), spin_unlock(l))
+#define read_lock(l)                      spin_lock((spinlock_t *)(l))
+#define read_unlock(l)                    spin_unlock((spinlock_t *)(l))
+#define write_lock(l)                     spin_lock((spinlock_t *)(l))
+#define write_unlock(l)                   spin_unlock((spinlock_t *)(l))
+#define write_lock_irqsave(l, f)          ((f) = 0, write_lock(l))
+#define write_unlock_irqrestore(l, f)     ((void)(f), write_unlock(l))
+
+#define local_irq_disable()      ((void)0)
+#define local_irq_enable()       ((void)0)
+#define local_irq_save(f)        ((f) = 0)
+#define local_irq_restore(f)     ((void)(f))
+#define ASSERT_NOT_IN_ATOMIC()   ((void)0)
+
+#define rcu_read_lock(l)         ((void)(l))
+#define rcu_read_unlock(l)       ((void)(l))
+extern int domlist_read_lock;
+
+/* Lists */
+
+struct list_head {
+    struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+#define LIST_HEAD(name) struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+    list->next = list->prev = list;
+}
+
+static inline void __list_add(struct list_head *new, struct list_head *prev,
+                              struct list_head *next)
+{
+    next->prev = new;
+    new->next = next;
+    new->prev = prev;
+    prev->next = new;
+}
+
+static inline void list_add(struct list_head *new, struct list_head *head)
+{
+    __list_add(new, head, head->next);
+}
+
+static inline void list_add_tail(struct list_head *new,
+                                 struct list_head *head)
+{
+    __list_add(new, head->prev, head);
+}
+
+static inline void list_del(struct list_head *entry)
+{
+    entry->next->prev = entry->prev;
+    entry->prev->next = entry->next;
+    entry->next = entry->prev = NULL;
+}
+
+static inline void list_del_init(struct list_head *entry)
+{
+    entry->next->prev = entry->prev;
+    entry->prev->next = entry->next;
+    INIT_LIST_HEAD(entry);
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+    return head->next == head;
+}
+
+static inline void list_splice_init(struct list_head *list,
+                                    struct list_head *head)
+{
+    if ( !list_empty(list) )
+    {
+        struct list_head *first = list->next, *last = list->prev;
+
+        first->prev = head;
+        last->next = head->next;
+        head->next->prev = last;
+        head->next = first;
+        INIT_LIST_HEAD(list);
+    }
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+#define list_first_entry(ptr, type, member) \
+    list_entry((ptr)->next, type, member)
+#define list_for_each(pos, head) \
+    for ( pos = (head)->next; pos != (head); pos = pos->next )
+#define list_for_each_safe(pos, n, head) \
+    for ( pos = (head)->next, n = pos->next; pos != (head); \
+          pos = n, n = pos->next )
+#define list_for_each_entry(pos, head, member)                          \
+    for ( pos = list_entry((head)->next, typeof(*pos), member);         \
+          &pos->member != (head);                                       \
+          pos = list_entry(pos->member.next, typeof(*pos), member) )
+#define list_for_each_entry_safe(pos, n, head, member)                  \
+    for ( pos = list_entry((head)->next, typeof(*pos), member),         \
+          n = list_entry(pos->member.next, typeof(*pos), member);       \
+          &pos->member != (head);                                       \
+          pos = n, n = list_entry(n->member.next, typeof(*n), member) )
+
+/* CPUs and cpumasks */
+
+#define NR_CPUS 64
+
+typedef struct cpumask { unsigned long bits[BITS_TO_LONGS(NR_CPUS)]; } cpumask_t;
+typedef cpumask_t *cpumask_var_t;
+
+extern unsigned int nr_cpu_ids;
+extern cpumask_t cpu_online_map;
+#define cpu_possible_map cpu_online_map
+
+static inline void cpumask_set_cpu(int cpu, cpumask_t *m)
+{
+    set_bit(cpu, m->bits);
+}
+
+static inline void cpumask_clear_cpu(int cpu, cpumask_t *m)
+{
+    clear_bit(cpu, m->bits);
+}
+
+static inline int cpumask_test_cpu(int cpu, const cpumask_t *m)
+{
+    return test_bit(cpu, m->bits);
+}
+
+static inline int cpumask_test_and_set_cpu(int cpu, cpumask_t *m)
+{
+    return test_and_set_bit(cpu, m->bits);
+}
+
+static inline int cpumask_test_and_clear_cpu(int cpu, cpumask_t *m)
+{
+    return test_and_clear_bit(cpu, m->bits);
+}
+
+static inline void cpumask_clear(cpumask_t *m)
+{
+    memset(m, 0, sizeof(*m));
+}
+
+static inline void cpumask_setall(cpumask_t *m)
+{
+    unsigned int cpu;
+
+    cpumask_clear(m);
+    for ( cpu = 0; cpu < nr_cpu_ids; cpu++ )
+        cpumask_set_cpu(cpu, m);
+}
+
+#define __cpumask_op(_name, _expr)                                      \
+static inline void cpumask_##_name(cpumask_t *d, const cpumask_t *a,    \
+                                   const cpumask_t *b)                  \
+{                                                                       \
+    unsigned int i;                                                     \
+    for ( i = 0; i < BITS_TO_LONGS(NR_CPUS); i++ )                      \
+        d->bits[i] = (_expr);                                           \
+}
+__cpumask_op(and,    a->bits[i] & b->bits[i])
+__cpumask_op(or,     a->bits[i] | b->bits[i])
+__cpumask_op(xor,    a->bits[i] ^ b->bits[i])
+__cpumask_op(andnot, a->bits[i] & ~b->bits[i])
+#undef __cpumask_op
+
+static inline void cpumask_copy(cpumask_t *d, const cpumask_t *s)
+{
+    *d = *s;
+}
+
+static inline int cpumask_weight(const cpumask_t *m)
+{
+    unsigned int i, w = 0;
+
+    for ( i = 0; i < BITS_TO_LONGS(NR_CPUS); i++ )
+        w += __builtin_popcountl(m->bits[i]);
+    return w;
+}
+
+static inline int cpumask_empty(const cpumask_t *m)
+{
+    return cpumask_weight(m) == 0;
+}
+
+static inline int cpumask_equal(const cpumask_t *a, const cpumask_t *b)
+{
+    return !memcmp(a, b, sizeof(*a));
+}
+
+static inline int cpumask_intersects(const cpumask_t *a, const cpumask_t *b)
+{
+    unsigned int i;
+
+    for ( i = 0; i < BITS_TO_LONGS(NR_CPUS); i++ )
+        if ( a->bits[i] & b->bits[i] )
+            return 1;
+    return 0;
+}
+
+static inline int cpumask_subset(const cpumask_t *a, const cpumask_t *b)
+{
+    unsigned int i;
+
+    for ( i = 0; i < BITS_TO_LONGS(NR_CPUS); i++ )
+        if ( a->bits[i] & ~b->bits[i] )
+            return 0;
+    return 1;
+}
+
+static inline int cpumask_next(int n, const cpumask_t *m)
+{
+    for ( n++; n < (int)nr_cpu_ids; n++ )
+        if ( cpumask_test_cpu(n, m) )
+            return n;
+    return nr_cpu_ids;
+}
+
+static inline int cpumask_first(const cpumask_t *m)
+{
+    return cpumask_next(-1, m);
+}
+
+static inline int cpumask_last(const cpumask_t *m)
+{
+    int cpu, last = nr_cpu_ids;
+
+    for ( cpu = 0; cpu < (int)nr_cpu_ids; cpu++ )
+        if ( cpumask_test_cpu(cpu, m) )
+            last = cpu;
+    return last;
+}
+
+static inline int cpumask_cycle(int n, const cpumask_t *m)
+{
+    int nxt = cpumask_next(n, m);
+
+    if ( nxt == (int)nr_cpu_ids )
+        nxt = cpumask_first(m);
+    return nxt;
+}
+
+static inline int cpumask_any(const cpumask_t *m)
+{
+    return cpumask_first(m);
+}
+
+static inline int cpumask_scnprintf(char *buf, int len, const cpumask_t *m)
+{
+    int i, n = 0;
+
+    buf[0] = '\0';
+    for ( i = BITS_TO_LONGS(NR_CPUS) - 1; i >= 0 && n < len; i-- )
+        n += snprintf(buf + n, len - n, "%lx", m->bits[i]);
+    return n;
+}
+
+static inline int zalloc_cpumask_var(cpumask_var_t *m)
+{
+    return (*m = calloc(1, sizeof(cpumask_t))) != NULL;
+}
+#define alloc_cpumask_var(m) zalloc_cpumask_var(m)
+#define free_cpumask_var(m)  free(m)
+
+extern cpumask_t sim_cpumask_of[NR_CPUS];
+#define cpumask_of(cpu) (&sim_cpumask_of[cpu])
+
+#define for_each_cpu(cpu, mask)                  \
+    for ( (cpu) = cpumask_first(mask);           \
+          (cpu) < (int)nr_cpu_ids;               \
+          (cpu) = cpumask_next(cpu, mask) )
+#define for_each_online_cpu(cpu) for_each_cpu(cpu, &cpu_online_map)
+#define for_each_possible_cpu(cpu) for_each_online_cpu(cpu)
+#define num_online_cpus() cpumask_weight(&cpu_online_map)
+
+/* Per-cpu data is a plain array, "this" cpu is whatever sim.c says */
+
+extern unsigned int sim_cpu;
+#define smp_processor_id() (sim_cpu)
+
+#define DECLARE_PER_CPU(type, name) extern __typeof__(type) per_cpu__##name[NR_CPUS]
+#define DEFINE_PER_CPU(type, name)  __typeof__(type) per_cpu__##name[NR_CPUS]
+#define per_cpu(name, cpu)          (per_cpu__##name[cpu])
+#define this_cpu(name)              per_cpu(name, smp_processor_id())
+
+DECLARE_PER_CPU(cpumask_var_t, cpu_sibling_mask);
+DECLARE_PER_CPU(cpumask_var_t, cpu_core_mask);
+
+/* Topology set up by sim.c; -1 until the CPU has been started */
+int sim_cpu_to_socket(unsigned int cpu);
+int sim_cpu_to_core(unsigned int cpu);
+#define cpu_to_socket(cpu) sim_cpu_to_socket(cpu)
+#define cpu_to_core(cpu)   sim_cpu_to_core(cpu)
+
+/* NUMA: like the SRAT, known before any CPU is started */
+int sim_cpu_to_node(unsigned int cpu);
+int sim_node_distance(int a, int b);
+#define cpu_to_node(cpu)       sim_cpu_to_node(cpu)
+#define __node_distance(a, b)  sim_node_distance(a, b)
+
+/* CPU notifiers */
+
+struct notifier_block {
+    int (*notifier_call)(struct notifier_block *, unsigned long, void *);
+    struct notifier_block *next;
+    int priority;
+};
+
+#define NOTIFY_DONE 0x0000
+#define NOTIFY_OK   0x0001
+#define NOTIFY_STOP_MASK 0x8000
+#define NOTIFY_BAD  (NOTIFY_STOP_MASK | 0x0002)
+
+static inline int notifier_from_errno(int err)
+{
+    return err ? (NOTIFY_STOP_MASK | (NOTIFY_OK - err)) : NOTIFY_DONE;
+}
+
+#define CPU_UP_PREPARE   (0x0001)
+#define CPU_UP_CANCELED  (0x0002)
+#define CPU_STARTING     (0x0003)
+#define CPU_ONLINE       (0x0004)
+#define CPU_DOWN_PREPARE (0x0005)
+#define CPU_DOWN_FAILED  (0x0006)
+#define CPU_DYING        (0x0007)
+#define CPU_DEAD         (0x0008)
+
+void register_cpu_notifier(struct notifier_block *nb);
+
+/* Time and timers */
+
+extern s_time_t sim_now;
+#define NOW()           (sim_now)
+#define SECONDS(_s)     ((s_time_t)((_s)  * 1000000000ULL))
+#define MILLISECS(_ms)  ((s_time_t)((_ms) * 1000000ULL))
+#define MICROSECS(_us)  ((s_time_t)((_us) * 1000ULL))
+#define STIME_MAX       ((s_time_t)((uint64_t)~0ull >> 1))
+
+struct timer {
+    s_time_t expires;
+    void (*function)(void *);
+    void *data;
+    unsigned int cpu;
+    bool_t active;
+    bool_t killed;
+    struct timer *sim_next;       /* all initialised timers */
+};
+
+void init_timer(struct timer *timer, void (*function)(void *),
+                void *data, unsigned int cpu);
+void set_timer(struct timer *timer, s_time_t expires);
+void stop_timer(struct timer *timer);
+void migrate_timer(struct timer *timer, unsigned int new_cpu);
+void kill_timer(struct timer *timer);
+
+static inline int active_timer(struct timer *timer)
+{
+    return timer->active;
+}
+
+/* Softirqs */
+
+enum {
+    TIMER_SOFTIRQ = 0,
+    SCHEDULE_SOFTIRQ,
+    NR_SOFTIRQS
+};
+
+void cpu_raise_softirq(unsigned int cpu, unsigned int nr);
+void cpumask_raise_softirq(const cpumask_t *mask, unsigned int nr);
+#define raise_softirq(nr) cpu_raise_softirq(smp_processor_id(), nr)
+
+/* Domains and vcpus: only what the schedulers look at, plus sim state */
+
+struct domain;
+struct cpupool;
+struct sim_vcpu;
+struct sim_domain;
+
+struct vcpu {
+    int               vcpu_id;
+    int               processor;
+    struct vcpu_runstate_info runstate;
+    struct vcpu      *next_in_list;
+    struct domain    *domain;
+    void             *sched_priv;
+    s_time_t          last_run_time;
+    bool_t            is_running;
+    bool_t            is_urgent;
+    unsigned long     pause_flags;
+    atomic_t          pause_count;
+    cpumask_var_t     cpu_affinity;
+
+    struct sim_vcpu  *sim;
+};
+
+struct domain {
+    domid_t           domain_id;
+    unsigned int      max_vcpus;
+    struct vcpu     **vcpu;
+    struct domain    *next_in_list;
+    void             *sched_priv;
+    struct cpupool   *cpupool;
+    bool_t            is_pinned;
+    atomic_t          pause_count;
+
+    struct sim_domain *sim;
+};
+
+#define _VPF_blocked         0
+#define VPF_blocked          (1UL<<_VPF_blocked)
+#define _VPF_down            1
+#define VPF_down             (1UL<<_VPF_down)
+#define _VPF_migrating       3
+#define VPF_migrating        (1UL<<_VPF_migrating)
+
+extern struct vcpu *idle_vcpu[NR_CPUS];
+extern bool_t sched_smt_power_savings;
+extern struct domain *domain_list;
+
+DECLARE_PER_CPU(struct vcpu *, curr_vcpu);
+#define current (this_cpu(curr_vcpu))
+
+#define is_idle_domain(d) ((d)->domain_id == DOMID_IDLE)
+#define is_idle_vcpu(v)   (is_idle_domain((v)->domain))
+
+static inline int vcpu_runnable(struct vcpu *v)
+{
+    return !(v->pause_flags |
+             atomic_read(&v->pause_count) |
+             atomic_read(&v->domain->pause_count));
+}
+
+#define for_each_domain(d) \
+    for ( (d) = domain_list; (d) != NULL; (d) = (d)->next_in_list )
+#define for_each_domain_in_cpupool(d, c) \
+    for ( (d) = domain_list; (d) != NULL; (d) = (d)->next_in_list ) \
+        if ( (d)->cpupool != (c) ) continue; else
+#define for_each_vcpu(d, v) \
+    for ( (v) = (d)->vcpu ? (d)->vcpu[0] : NULL; \
+          (v) != NULL; (v) = (v)->next_in_list )
+
+void vcpu_pause_nosync(struct vcpu *v);
+void vcpu_unpause(struct vcpu *v);
+void vcpu_sleep_nosync(struct vcpu *v);
+void vcpu_wake(struct vcpu *v);
+
+static inline void __dump_execstate(void *unused) { }
+#define dump_execution_state() ((void)0)
+
+#include "../../../xen/include/xen/sched-if.h"
+
+#endif /* __SCHED_SIM_H__ */
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
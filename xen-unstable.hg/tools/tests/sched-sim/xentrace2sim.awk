@@ -0,0 +1,67 @@
+#!/usr/bin/awk -f
+#
+# Turn the runstate records of a trace into bursts for sched-sim:
+#
+#   xentrace -e 0x0002f000 trace.bin
+#   xentrace_format formats < trace.bin | \
+#       awk -v mhz=2400 -f xentrace2sim.awk > bursts.txt
+#
+# mhz is the TSC frequency.  Each output line is
+#
+#   TIME_US DOMID VCPU RUN_US
+#
+# i.e. the vcpu woke at TIME_US and ran for RUN_US before blocking again.
+# Domain ids are kept as they are, so the workload file must declare the
+# same ids.  The idle domain and vcpus that never block are dropped.
+
+function hex(s,    i, c, n) {
+    n = 0
+    s = tolower(s)
+    sub(/^0x/, "", s)
+    for ( i = 1; i <= length(s); i++ ) {
+        c = index("0123456789abcdef", substr(s, i, 1))
+        if ( c == 0 )
+            break
+        n = n * 16 + c - 1
+    }
+    return n
+}
+
+BEGIN {
+    if ( mhz <= 0 ) {
+        print "xentrace2sim.awk: set the TSC frequency with -v mhz=N" > "/dev/stderr"
+        exit 1
+    }
+}
+
+/_to_/ && /dom:vcpu/ {
+    tsc = $2 + 0
+    for ( i = 3; i <= NF; i++ )
+        if ( $i ~ /_to_/ )
+            ev = $i
+    dv = hex($(NF - 1))
+    dom = int(dv / 65536)
+    vcpu = dv % 65536
+    if ( dom == 32767 )
+        next
+    if ( !started ) {
+        t0 = tsc
+        started = 1
+    }
+    k = dom " " vcpu
+
+    if ( ev ~ /^(blocked|offline)_to_/ && !(k in wake) ) {
+        wake[k] = tsc
+        run[k] = 0
+    }
+    if ( ev ~ /_to_running$/ )
+        start[k] = tsc
+    if ( ev ~ /^running_to_/ && (k in start) ) {
+        run[k] += tsc - start[k]
+        delete start[k]
+    }
+    if ( ev ~ /_to_blocked$/ && (k in wake) ) {
+        printf "%d %d %d %d\n", (wake[k] - t0) / mhz, dom, vcpu, run[k] / mhz
+        delete wake[k]
+    }
+}
@@ -20,9 +20,29 @@
  */
 
 
+#define _GNU_SOURCE
+
 #include <unistd.h>
+#include <fcntl.h>
+#include <libaio.h>
 #include <xc_private.h>
 
+#include "file_ops.h"
+
+struct file_aio {
+    io_context_t ctx;
+    int fd;
+    int own_fd;
+    int depth;
+    struct iocb *iocbs;
+    struct iocb **iocbp;
+    struct io_event *events;
+    /* next unused iocb, recycled once nothing is in flight */
+    int next;
+    int pending[FILE_AIO_CLASSES];
+    int errors[FILE_AIO_CLASSES];
+};
+
 static int file_op(int fd, void *page, int i,
                    ssize_t (*fn)(int, void *, size_t))
 {
@@ -61,6 +81,171 @@ int write_page(int fd, void *page, int i)
     return file_op(fd, page, i, &my_write);
 }
 
+/*
+ * Asynchronous page reads.
+ * The pagefile is reopened with O_DIRECT where possible so io_submit()
+ * does not block on buffered reads.  If the kernel does not provide AIO,
+ * reads are done synchronously on the given fd.
+ */
+struct file_aio *file_aio_init(const char *filename, int fd, int depth)
+{
+    struct file_aio *aio;
+    int rc;
+
+    aio = calloc(1, sizeof(*aio));
+    if ( !aio )
+        return NULL;
+
+    aio->fd = fd;
+    aio->depth = depth;
+    aio->iocbs = calloc(depth, sizeof(*aio->iocbs));
+    aio->iocbp = calloc(depth, sizeof(*aio->iocbp));
+    aio->events = calloc(depth, sizeof(*aio->events));
+    if ( !aio->iocbs || !aio->iocbp || !aio->events )
+        goto err;
+
+    rc = io_setup(depth, &aio->ctx);
+    if ( rc < 0 )
+    {
+        /* Fall back to synchronous reads */
+        aio->ctx = 0;
+        return aio;
+    }
+
+    fd = open(filename, O_RDONLY | O_DIRECT);
+    if ( fd >= 0 )
+    {
+        aio->fd = fd;
+        aio->own_fd = 1;
+    }
+
+    return aio;
+
+ err:
+    file_aio_teardown(aio);
+    return NULL;
+}
+
+void file_aio_teardown(struct file_aio *aio)
+{
+    if ( !aio )
+        return;
+
+    if ( aio->ctx )
+        io_destroy(aio->ctx);
+    if ( aio->own_fd )
+        close(aio->fd);
+
+    free(aio->events);
+    free(aio->iocbp);
+    free(aio->iocbs);
+    free(aio);
+}
+
+int file_aio_read(struct file_aio *aio, void **pages, int *slots, int num,
+                  int class)
+{
+    struct iocb *iocb;
+    int i, rc, submitted = 0;
+
+    if ( !aio->ctx )
+    {
+        for ( i = 0; i < num; i++ )
+            if ( read_page(aio->fd, pages[i], slots[i]) < 0 )
+                return -1;
+        return 0;
+    }
+
+    if ( aio->next + num > aio->depth )
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    for ( i = 0; i < num; i++ )
+    {
+        iocb = &aio->iocbs[aio->next + i];
+        io_prep_pread(iocb, aio->fd, pages[i], PAGE_SIZE,
+                      (long long)slots[i] << PAGE_SHIFT);
+        iocb->data = (void *)(unsigned long)class;
+        aio->iocbp[aio->next + i] = iocb;
+    }
+
+    while ( submitted < num )
+    {
+        rc = io_submit(aio->ctx, num - submitted,
+                       &aio->iocbp[aio->next + submitted]);
+        if ( rc == -EAGAIN || rc == -EINTR )
+            continue;
+        if ( rc <= 0 )
+        {
+            /* Already submitted reads still have to be reaped */
+            aio->pending[class] += submitted;
+            aio->next += submitted;
+            errno = rc ? -rc : EIO;
+            return -1;
+        }
+        submitted += rc;
+    }
+
+    aio->pending[class] += num;
+    aio->next += num;
+
+    return 0;
+}
+
+/*
+ * Without a kernel AIO context reads are synchronous, and on a buffered
+ * descriptor io_submit() itself blocks until the data has been read.
+ */
+int file_aio_async(struct file_aio *aio)
+{
+    return aio->ctx && aio->own_fd;
+}
+
+int file_aio_wait(struct file_aio *aio, int class)
+{
+    struct io_event *ev;
+    unsigned long c;
+    int i, rc;
+
+    while ( aio->pending[class] > 0 )
+    {
+        rc = io_getevents(aio->ctx, 1, aio->depth, aio->events, NULL);
+        if ( rc == -EINTR )
+            continue;
+        if ( rc < 0 )
+        {
+            errno = -rc;
+            return -1;
+        }
+
+        for ( i = 0; i < rc; i++ )
+        {
+            ev = &aio->events[i];
+            c = (unsigned long)ev->data;
+            aio->pending[c]--;
+            if ( (long)ev->res != PAGE_SIZE )
+                aio->errors[c]++;
+        }
+    }
+
+    for ( c = 0; c < FILE_AIO_CLASSES; c++ )
+        if ( aio->pending[c] )
+            break;
+    if ( c == FILE_AIO_CLASSES )
+        aio->next = 0;
+
+    if ( aio->errors[class] )
+    {
+        aio->errors[class] = 0;
+        errno = EIO;
+        return -1;
+    }
+
+    return 0;
+}
+
 
 /*
  * Local variables:
@@ -28,6 +28,24 @@
 int read_page(int fd, void *page, int i);
 int write_page(int fd, void *page, int i);
 
+/* Reads are accounted per class, so demand reads can be waited for
+ * without also waiting for outstanding read-ahead. */
+#define FILE_AIO_DEMAND     0
+#define FILE_AIO_PREFETCH   1
+#define FILE_AIO_CLASSES    2
+
+struct file_aio;
+
+struct file_aio *file_aio_init(const char *filename, int fd, int depth);
+void file_aio_teardown(struct file_aio *aio);
+/* Queue reads of slots[0..num) into pages[0..num) */
+int file_aio_read(struct file_aio *aio, void **pages, int *slots, int num,
+                  int class);
+/* Wait until all queued reads of the given class have completed */
+int file_aio_wait(struct file_aio *aio, int class);
+/* Whether file_aio_read() returns before the reads complete */
+int file_aio_async(struct file_aio *aio);
+
 
 #endif
 
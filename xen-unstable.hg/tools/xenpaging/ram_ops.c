@@ -0,0 +1,256 @@
+/******************************************************************************
+ *
+ * Compressed in-memory page store.
+ *
+ * Evicted pages are deflated into dom0 memory up to a configured limit.
+ * Zero pages take no space beyond their bookkeeping, pages which do not
+ * compress well are left to the pagefile.  Once the limit is reached, the
+ * pages stored longest ago can be spilled to the pagefile to make room.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include <zlib.h>
+#include <xc_private.h>
+
+#include "ram_ops.h"
+
+/* Pages which do not shrink below this are not worth keeping in RAM */
+#define RAM_MAX_COMPRESSED ((PAGE_SIZE * 3) / 4)
+/* Small deflate window, a page is all there is to look back into */
+#define RAM_WINDOW_BITS    12
+
+struct ram_page {
+    /* Stored pages, oldest first */
+    struct ram_page *prev, *next;
+    unsigned long gfn;
+    uint32_t len;
+    unsigned char data[];
+};
+
+struct ram_store {
+    struct ram_page **pages;
+    struct ram_page *oldest, *newest;
+    unsigned long max_pages;
+    size_t limit;
+    size_t used;
+    z_stream deflate;
+    z_stream inflate;
+    unsigned char buf[RAM_MAX_COMPRESSED];
+};
+
+static int page_is_zero(const void *page)
+{
+    const unsigned long *p = page;
+    int i;
+
+    for ( i = 0; i < PAGE_SIZE / sizeof(*p); i++ )
+        if ( p[i] )
+            return 0;
+
+    return 1;
+}
+
+struct ram_store *ram_store_init(unsigned long max_pages, size_t limit)
+{
+    struct ram_store *rs;
+
+    rs = calloc(1, sizeof(*rs));
+    if ( !rs )
+        return NULL;
+
+    rs->max_pages = max_pages;
+    rs->limit = limit;
+    rs->pages = calloc(max_pages, sizeof(*rs->pages));
+    if ( !rs->pages )
+        goto err;
+
+    /* Raw deflate, no header or checksum per page */
+    if ( deflateInit2(&rs->deflate, Z_BEST_SPEED, Z_DEFLATED,
+                      -RAM_WINDOW_BITS, 8, Z_DEFAULT_STRATEGY) != Z_OK )
+        goto err;
+
+    if ( inflateInit2(&rs->inflate, -RAM_WINDOW_BITS) != Z_OK )
+    {
+        deflateEnd(&rs->deflate);
+        goto err;
+    }
+
+    return rs;
+
+ err:
+    free(rs->pages);
+    free(rs);
+    return NULL;
+}
+
+void ram_store_teardown(struct ram_store *rs)
+{
+    unsigned long gfn;
+
+    if ( !rs )
+        return;
+
+    for ( gfn = 0; gfn < rs->max_pages; gfn++ )
+        free(rs->pages[gfn]);
+
+    deflateEnd(&rs->deflate);
+    inflateEnd(&rs->inflate);
+    free(rs->pages);
+    free(rs);
+}
+
+int ram_store_page(struct ram_store *rs, unsigned long gfn, void *page)
+{
+    struct ram_page *rp;
+    uint32_t len = 0;
+    int rc;
+
+    if ( gfn >= rs->max_pages || rs->pages[gfn] )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ( !page_is_zero(page) )
+    {
+        deflateReset(&rs->deflate);
+        rs->deflate.next_in = page;
+        rs->deflate.avail_in = PAGE_SIZE;
+        rs->deflate.next_out = rs->buf;
+        rs->deflate.avail_out = sizeof(rs->buf);
+
+        /* Running out of output space means the page compresses badly */
+        rc = deflate(&rs->deflate, Z_FINISH);
+        if ( rc != Z_STREAM_END )
+            return RAM_STORE_BADLY;
+
+        len = rs->deflate.total_out;
+    }
+
+    if ( rs->used + sizeof(*rp) + len > rs->limit )
+        return RAM_STORE_FULL;
+
+    rp = malloc(sizeof(*rp) + len);
+    if ( !rp )
+        return RAM_STORE_BADLY;
+
+    rp->gfn = gfn;
+    rp->len = len;
+    memcpy(rp->data, rs->buf, len);
+    rs->pages[gfn] = rp;
+    rs->used += sizeof(*rp) + len;
+
+    rp->prev = rs->newest;
+    rp->next = NULL;
+    if ( rs->newest )
+        rs->newest->next = rp;
+    else
+        rs->oldest = rp;
+    rs->newest = rp;
+
+    return 0;
+}
+
+int ram_load_page(struct ram_store *rs, unsigned long gfn, void *page)
+{
+    struct ram_page *rp;
+    int rc;
+
+    if ( gfn >= rs->max_pages || !rs->pages[gfn] )
+    {
+        errno = ENOENT;
+        return -1;
+    }
+
+    rp = rs->pages[gfn];
+    if ( rp->len == 0 )
+    {
+        memset(page, 0, PAGE_SIZE);
+        return 0;
+    }
+
+    inflateReset(&rs->inflate);
+    rs->inflate.next_in = rp->data;
+    rs->inflate.avail_in = rp->len;
+    rs->inflate.next_out = page;
+    rs->inflate.avail_out = PAGE_SIZE;
+
+    rc = inflate(&rs->inflate, Z_FINISH);
+    if ( rc != Z_STREAM_END || rs->inflate.total_out != PAGE_SIZE )
+    {
+        errno = EIO;
+        return -1;
+    }
+
+    return 0;
+}
+
+void ram_drop_page(struct ram_store *rs, unsigned long gfn)
+{
+    struct ram_page *rp;
+
+    if ( gfn >= rs->max_pages || !rs->pages[gfn] )
+        return;
+
+    rp = rs->pages[gfn];
+    rs->used -= sizeof(*rp) + rp->len;
+    rs->pages[gfn] = NULL;
+
+    if ( rp->prev )
+        rp->prev->next = rp->next;
+    else
+        rs->oldest = rp->next;
+    if ( rp->next )
+        rp->next->prev = rp->prev;
+    else
+        rs->newest = rp->prev;
+
+    free(rp);
+}
+
+int ram_oldest_page(struct ram_store *rs, unsigned long *gfn)
+{
+    if ( !rs->oldest )
+    {
+        errno = ENOENT;
+        return -1;
+    }
+
+    *gfn = rs->oldest->gfn;
+
+    return 0;
+}
+
+int ram_has_page(struct ram_store *rs, unsigned long gfn)
+{
+    return gfn < rs->max_pages && rs->pages[gfn] != NULL;
+}
+
+size_t ram_store_used(struct ram_store *rs)
+{
+    return rs->used;
+}
+
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End: 
+ */
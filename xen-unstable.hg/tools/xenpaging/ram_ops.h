@@ -0,0 +1,55 @@
+/******************************************************************************
+ * tools/xenpaging/ram_ops.h
+ *
+ * Compressed in-memory page store.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#ifndef __RAM_OPS_H__
+#define __RAM_OPS_H__
+
+
+struct ram_store;
+
+/* Why ram_store_page() did not take a page */
+#define RAM_STORE_BADLY 1   /* It does not compress well */
+#define RAM_STORE_FULL  2   /* It would go over the limit */
+
+struct ram_store *ram_store_init(unsigned long max_pages, size_t limit);
+void ram_store_teardown(struct ram_store *rs);
+/* Returns 0 if stored, RAM_STORE_* if the page does not fit, < 0 on error */
+int ram_store_page(struct ram_store *rs, unsigned long gfn, void *page);
+/* Copies the page out, it stays in the store until dropped */
+int ram_load_page(struct ram_store *rs, unsigned long gfn, void *page);
+void ram_drop_page(struct ram_store *rs, unsigned long gfn);
+/* Finds the page stored longest ago, the first to spill to the pagefile */
+int ram_oldest_page(struct ram_store *rs, unsigned long *gfn);
+int ram_has_page(struct ram_store *rs, unsigned long gfn);
+size_t ram_store_used(struct ram_store *rs);
+
+
+#endif
+
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End: 
+ */
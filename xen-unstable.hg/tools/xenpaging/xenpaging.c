@@ -34,6 +34,7 @@
 
 #include "xc_bitops.h"
 #include "file_ops.h"
+#include "ram_ops.h"
 #include "policy.h"
 #include "xenpaging.h"
 
@@ -180,17 +181,17 @@ static int xenpaging_get_tot_pages(struct xenpaging *paging)
     return domain_info.tot_pages;
 }
 
-static void *init_page(void)
+static void *init_pages(int num)
 {
     void *buffer;
 
     /* Allocated page memory */
-    errno = posix_memalign(&buffer, PAGE_SIZE, PAGE_SIZE);
+    errno = posix_memalign(&buffer, PAGE_SIZE, PAGE_SIZE * num);
     if ( errno != 0 )
         return NULL;
 
     /* Lock buffer in memory so it can't be paged out */
-    if ( mlock(buffer, PAGE_SIZE) < 0 )
+    if ( mlock(buffer, PAGE_SIZE * num) < 0 )
     {
         free(buffer);
         buffer = NULL;
@@ -210,6 +211,8 @@ static void usage(void)
     printf(" -f <file>      --pagefile=<file>        pagefile to use. This option is required.\n");
     printf(" -m <max_memkb> --max_memkb=<max_memkb>  maximum amount of memory to handle.\n");
     printf(" -r <num>       --mru_size=<num>         number of paged-in pages to keep in memory.\n");
+    printf(" -z <kib>       --ram_tier=<kib>         keep up to <kib> of compressed pages in memory, spilling the oldest to the pagefile.\n");
+    printf(" -p <num>       --prefetch=<num>         max number of pages to read ahead on sequential page-in, 0 disables.\n");
     printf(" -v             --verbose                enable debug output.\n");
     printf(" -h             --help                   this output.\n");
 }
@@ -217,13 +220,15 @@ static void usage(void)
 static int xenpaging_getopts(struct xenpaging *paging, int argc, char *argv[])
 {
     int ch;
-    static const char sopts[] = "hvd:f:m:r:";
+    static const char sopts[] = "hvd:f:m:r:p:z:";
     static const struct option lopts[] = {
         {"help", 0, NULL, 'h'},
         {"verbose", 0, NULL, 'v'},
         {"domain", 1, NULL, 'd'},
         {"pagefile", 1, NULL, 'f'},
         {"mru_size", 1, NULL, 'm'},
+        {"prefetch", 1, NULL, 'p'},
+        {"ram_tier", 1, NULL, 'z'},
         { }
     };
 
@@ -243,6 +248,16 @@ static int xenpaging_getopts(struct xenpaging *paging, int argc, char *argv[])
         case 'r':
             paging->policy_mru_size = atoi(optarg);
             break;
+        case 'p':
+            paging->prefetch_max = atoi(optarg);
+            if ( paging->prefetch_max < 0 ||
+                 paging->prefetch_max > XENPAGING_PREFETCH_MAX )
+                paging->prefetch_max = XENPAGING_PREFETCH_MAX;
+            break;
+        case 'z':
+            /* KiB to bytes */
+            paging->ram_limit = strtoul(optarg, NULL, 0) << 10;
+            break;
         case 'v':
             paging->debug = 1;
             break;
@@ -288,6 +303,8 @@ static struct xenpaging *xenpaging_init(int argc, char *argv[])
     if ( !paging )
         goto err;
 
+    paging->prefetch_max = XENPAGING_PREFETCH_MAX;
+
     /* Get cmdline options and domain_id */
     if ( xenpaging_getopts(paging, argc, argv) )
         goto err;
@@ -446,6 +463,14 @@ static struct xenpaging *xenpaging_init(int argc, char *argv[])
         PERROR("Error allocating bitmap");
         goto err;
     }
+
+    /* Allocate bitmap for tracking superpage ranges to rebuild */
+    paging->coalesce_bitmap = bitmap_alloc((paging->max_pages >> XENPAGING_SUPERPAGE_ORDER) + 1);
+    if ( !paging->coalesce_bitmap )
+    {
+        PERROR("Error allocating bitmap");
+        goto err;
+    }
     DPRINTF("max_pages = %d\n", paging->max_pages);
 
     /* Allocate indicies for pagefile slots */
@@ -454,6 +479,25 @@ static struct xenpaging *xenpaging_init(int argc, char *argv[])
     if ( !paging->slot_to_gfn || !paging->gfn_to_slot )
         goto err;
 
+    /* Set up the compressed RAM tier */
+    if ( paging->ram_limit )
+    {
+        paging->ram = ram_store_init(paging->max_pages, paging->ram_limit);
+        if ( !paging->ram )
+        {
+            PERROR("Error initialising RAM tier");
+            goto err;
+        }
+        DPRINTF("ram_tier = %zu KiB\n", paging->ram_limit >> 10);
+
+        paging->spill_buffer = init_pages(1);
+        if ( !paging->spill_buffer )
+        {
+            PERROR("Creating page aligned spill buffer");
+            goto err;
+        }
+    }
+
     /* Allocate stack for known free slots in pagefile */
     paging->free_slot_stack = calloc(paging->max_pages, sizeof(*paging->free_slot_stack));
     if ( !paging->free_slot_stack )
@@ -467,13 +511,20 @@ static struct xenpaging *xenpaging_init(int argc, char *argv[])
         goto err;
     }
 
-    paging->paging_buffer = init_page();
+    paging->paging_buffer = init_pages(XENPAGING_BATCH_SIZE);
     if ( !paging->paging_buffer )
     {
         PERROR("Creating page aligned load buffer");
         goto err;
     }
 
+    paging->prefetch_buffer = init_pages(XENPAGING_PREFETCH_MAX);
+    if ( !paging->prefetch_buffer )
+    {
+        PERROR("Creating page aligned prefetch buffer");
+        goto err;
+    }
+
     /* Open file */
     paging->fd = open(filename, O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR);
     if ( paging->fd < 0 )
@@ -482,6 +533,15 @@ static struct xenpaging *xenpaging_init(int argc, char *argv[])
         goto err;
     }
 
+    /* Set up asynchronous page-in */
+    paging->aio = file_aio_init(filename, paging->fd,
+                                XENPAGING_BATCH_SIZE + XENPAGING_PREFETCH_MAX);
+    if ( !paging->aio )
+    {
+        PERROR("Error initialising asynchronous I/O");
+        goto err;
+    }
+
     return paging;
 
  err:
@@ -493,9 +553,19 @@ static struct xenpaging *xenpaging_init(int argc, char *argv[])
             xc_interface_close(xch);
         if ( paging->paging_buffer )
         {
-            munlock(paging->paging_buffer, PAGE_SIZE);
+            munlock(paging->paging_buffer, PAGE_SIZE * XENPAGING_BATCH_SIZE);
             free(paging->paging_buffer);
         }
+        if ( paging->prefetch_buffer )
+        {
+            munlock(paging->prefetch_buffer, PAGE_SIZE * XENPAGING_PREFETCH_MAX);
+            free(paging->prefetch_buffer);
+        }
+        if ( paging->spill_buffer )
+        {
+            munlock(paging->spill_buffer, PAGE_SIZE);
+            free(paging->spill_buffer);
+        }
 
         if ( paging->mem_event.ring_page )
         {
@@ -504,9 +574,11 @@ static struct xenpaging *xenpaging_init(int argc, char *argv[])
 
         free(dom_path);
         free(watch_target_tot_pages);
+        ram_store_teardown(paging->ram);
         free(paging->free_slot_stack);
         free(paging->slot_to_gfn);
         free(paging->gfn_to_slot);
+        free(paging->coalesce_bitmap);
         free(paging->bitmap);
         free(paging);
     }
@@ -592,149 +664,427 @@ static void put_response(struct mem_event *mem_event, mem_event_response_t *rsp)
     RING_PUSH_RESPONSES(back_ring);
 }
 
-/* Evict a given gfn
+/* Apply a batched paging op to all gfns in gfns[] which have ok[] set.
+ * The array is split into runs of contiguous gfns, one hypercall each.
+ * For XENMEM_paging_op_prep_batch, buffer holds one page per gfns[] entry.
+ * Busy gfns, and gfns which are not paged out on prep, get their ok[]
+ * entry cleared.
  * Returns < 0 on fatal error
- * Returns 0 on successful evict
- * Returns > 0 if gfn can not be evicted
+ * Returns 0 otherwise
  */
-static int xenpaging_evict_page(struct xenpaging *paging, unsigned long gfn, int slot)
+static int xenpaging_batch_op(struct xenpaging *paging, int op,
+                              unsigned long *gfns, char *ok, int num,
+                              void *buffer)
 {
     xc_interface *xch = paging->xc_handle;
-    void *page;
-    xen_pfn_t victim = gfn;
-    int ret;
-
-    DECLARE_DOMCTL;
+    domid_t domain_id = paging->mem_event.domain_id;
+    unsigned int done;
+    unsigned char oom = 0;
+    int i = 0, n, ret;
 
-    /* Nominate page */
-    ret = xc_mem_paging_nominate(xch, paging->mem_event.domain_id, gfn);
-    if ( ret < 0 )
+    while ( i < num )
     {
-        /* unpageable gfn is indicated by EBUSY */
-        if ( errno == EBUSY )
-            ret = 1;
-        else
-            PERROR("Error nominating page %lx", gfn);
-        goto out;
-    }
+        if ( !ok[i] )
+        {
+            i++;
+            continue;
+        }
 
-    /* Map page */
-    page = xc_map_foreign_pages(xch, paging->mem_event.domain_id, PROT_READ, &victim, 1);
-    if ( page == NULL )
-    {
-        PERROR("Error mapping page %lx", gfn);
-        ret = -1;
-        goto out;
-    }
+        /* Find the run of contiguous gfns starting at i */
+        for ( n = 1; i + n < num && ok[i + n] && gfns[i + n] == gfns[i] + n; n++ )
+            ;
 
-    /* Copy page */
-    ret = write_page(paging->fd, page, slot);
-    if ( ret < 0 )
-    {
-        PERROR("Error copying page %lx", gfn);
-        munmap(page, PAGE_SIZE);
-        ret = -1;
-        goto out;
-    }
+        switch ( op )
+        {
+        case XENMEM_paging_op_nominate_batch:
+            ret = xc_mem_paging_nominate_batch(xch, domain_id, gfns[i], n, &done);
+            break;
+        case XENMEM_paging_op_evict_batch:
+            ret = xc_mem_paging_evict_batch(xch, domain_id, gfns[i], n, &done);
+            break;
+        default:
+            ret = xc_mem_paging_load_batch(xch, domain_id, gfns[i], n,
+                                           buffer + ((size_t)i << PAGE_SHIFT),
+                                           &done);
+            break;
+        }
 
-    /* Release page */
-    munmap(page, PAGE_SIZE);
+        i += done;
+        if ( ret == 0 )
+            continue;
 
-    /* Tell Xen to evict page */
-    ret = xc_mem_paging_evict(xch, paging->mem_event.domain_id, gfn);
-    if ( ret < 0 )
-    {
-        /* A gfn in use is indicated by EBUSY */
-        if ( errno == EBUSY )
+        /* gfns[i] is the one which failed */
+        if ( op != XENMEM_paging_op_prep_batch )
         {
-                ret = 1;
-                DPRINTF("Nominated page %lx busy", gfn);
-        } else
-            PERROR("Error evicting page %lx", gfn);
-        goto out;
+            /* unpageable or in use gfn is indicated by EBUSY */
+            if ( errno == EBUSY )
+            {
+                DPRINTF("Page %lx busy\n", gfns[i]);
+                ok[i++] = 0;
+                continue;
+            }
+        }
+        /* gfn is no longer paged out, e.g. dropped by the guest */
+        else if ( errno == ENOENT )
+        {
+            DPRINTF("Page %lx not paged out\n", gfns[i]);
+            ok[i++] = 0;
+            continue;
+        }
+        else if ( errno == ENOMEM && !interrupted )
+        {
+            if ( oom++ == 0 )
+                DPRINTF("ENOMEM while preparing gfn %lx\n", gfns[i]);
+            sleep(1);
+            continue;
+        }
+
+        PERROR("Error in paging op %d for page %lx", op, gfns[i]);
+        return -1;
     }
 
-    DPRINTF("evict_page > gfn %lx pageslot %d\n", gfn, slot);
-    /* Notify policy of page being paged out */
-    policy_notify_paged_out(gfn);
+    return 0;
+}
+
+/* Update bookkeeping for a gfn whose content is back in the guest */
+static void xenpaging_paged_in(struct xenpaging *paging, unsigned long gfn)
+{
+    int slot = paging->gfn_to_slot[gfn];
 
-    /* Update index */
-    paging->slot_to_gfn[slot] = gfn;
-    paging->gfn_to_slot[gfn] = slot;
+    /*
+     * Do not add gfn to mru list if the target is lower than mru size.
+     * This allows page-out of these gfns if the target grows again.
+     */
+    if (paging->num_paged_out > paging->policy_mru_size)
+        policy_notify_paged_in(gfn);
+    else
+        policy_notify_paged_in_nomru(gfn);
 
-    /* Record number of evicted pages */
-    paging->num_paged_out++;
+    /* Record number of resumed pages */
+    paging->num_paged_out--;
 
-    ret = 0;
+    /* The superpage this gfn belongs to may be rebuilt once idle */
+    if ( paging->coalesce_bitmap )
+        set_bit(gfn >> XENPAGING_SUPERPAGE_ORDER, paging->coalesce_bitmap);
 
- out:
-    return ret;
+    if ( slot == XENPAGING_SLOT_RAM )
+    {
+        ram_drop_page(paging->ram, gfn);
+        return;
+    }
+
+    /* Clear this pagefile slot */
+    paging->slot_to_gfn[slot] = 0;
+
+    /* Record this free slot */
+    paging->free_slot_stack[paging->stack_count++] = slot;
 }
 
-static int xenpaging_resume_page(struct xenpaging *paging, mem_event_response_t *rsp, int notify_policy)
+static void xenpaging_resume_page(struct xenpaging *paging, mem_event_response_t *rsp, int notify_policy)
 {
     /* Put the page info on the ring */
     put_response(&paging->mem_event, rsp);
 
     /* Notify policy of page being paged in */
     if ( notify_policy )
+        xenpaging_paged_in(paging, rsp->gfn);
+}
+
+struct xenpaging_load {
+    unsigned long gfn;
+    int slot;
+};
+
+static int load_cmp(const void *a, const void *b)
+{
+    const struct xenpaging_load *la = a, *lb = b;
+
+    return la->gfn < lb->gfn ? -1 : la->gfn > lb->gfn;
+}
+
+/* Read the pages of loads[] into consecutive pages of buffer
+ * Pages kept in the RAM tier are decompressed right away, the others are
+ * queued for asynchronous reads from the pagefile.
+ * Returns < 0 on error
+ * Returns 0 otherwise
+ */
+static int xenpaging_read_pages(struct xenpaging *paging,
+                                struct xenpaging_load *loads, int num,
+                                void *buffer, int class)
+{
+    void *pages[XENPAGING_BATCH_SIZE];
+    int slots[XENPAGING_BATCH_SIZE];
+    void *page;
+    int i, n = 0;
+
+    for ( i = 0; i < num; i++ )
     {
-        /*
-         * Do not add gfn to mru list if the target is lower than mru size.
-         * This allows page-out of these gfns if the target grows again.
-         */
-        if (paging->num_paged_out > paging->policy_mru_size)
-            policy_notify_paged_in(rsp->gfn);
-        else
-            policy_notify_paged_in_nomru(rsp->gfn);
+        page = buffer + ((size_t)i << PAGE_SHIFT);
+        if ( loads[i].slot == XENPAGING_SLOT_RAM )
+        {
+            if ( ram_load_page(paging->ram, loads[i].gfn, page) < 0 )
+                return -1;
+            continue;
+        }
+        pages[n] = page;
+        slots[n] = loads[i].slot;
+        n++;
+    }
 
-       /* Record number of resumed pages */
-       paging->num_paged_out--;
+    return file_aio_read(paging->aio, pages, slots, n, class);
+}
+
+/* Pick paged-out gfns following a sequential page-in stream
+ * The read-ahead window doubles on each sequential batch, up to
+ * prefetch_max, and collapses once the pattern turns random.
+ * Only gfns in the pagefile are read ahead, and only if the reads can be
+ * queued without blocking, since they are issued before the faulting
+ * vcpus are resumed.
+ * Returns the number of gfns to read ahead
+ */
+static int xenpaging_prefetch_choose(struct xenpaging *paging,
+                                     struct xenpaging_load *loads, int num_loads,
+                                     struct xenpaging_load *prefetch)
+{
+    unsigned long gfn, last = paging->prefetch_last_gfn;
+    int i, window, num = 0, sequential = 0;
+
+    if ( !paging->prefetch_max || !num_loads ||
+         !file_aio_async(paging->aio) )
+        return 0;
+
+    /* loads[] is sorted by gfn */
+    for ( i = 0; i < num_loads; i++ )
+    {
+        gfn = loads[i].gfn;
+        if ( gfn > last && gfn <= last + paging->prefetch_window + 1 )
+            sequential = 1;
+        last = gfn;
+    }
+
+    if ( !sequential )
+    {
+        paging->prefetch_window = 0;
+        paging->prefetch_last_gfn = last;
+        return 0;
     }
 
-    /* Tell Xen page is ready */
-    return xc_evtchn_notify(paging->mem_event.xce_handle, paging->mem_event.port);
+    window = paging->prefetch_window ? paging->prefetch_window * 2 : 4;
+    if ( window > paging->prefetch_max )
+        window = paging->prefetch_max;
+    paging->prefetch_window = window;
+    paging->prefetch_last_gfn = last + window;
+
+    for ( gfn = last + 1; gfn <= last + window && gfn < paging->max_pages; gfn++ )
+    {
+        if ( !test_bit(gfn, paging->bitmap) ||
+             paging->gfn_to_slot[gfn] == XENPAGING_SLOT_RAM )
+            continue;
+        prefetch[num].gfn = gfn;
+        prefetch[num].slot = paging->gfn_to_slot[gfn];
+        num++;
+    }
+
+    return num;
 }
 
-static int xenpaging_populate_page(struct xenpaging *paging, unsigned long gfn, int i)
+/* Load pages which were read ahead
+ * Guest did not ask for them yet, so there is no response to send.
+ * Returns < 0 on fatal error
+ * Returns 0 otherwise
+ */
+static int xenpaging_prefetch_load(struct xenpaging *paging,
+                                   struct xenpaging_load *prefetch, int num)
 {
     xc_interface *xch = paging->xc_handle;
-    int ret;
-    unsigned char oom = 0;
+    unsigned long gfns[XENPAGING_PREFETCH_MAX];
+    char ok[XENPAGING_PREFETCH_MAX];
+    int i;
 
-    DPRINTF("populate_page < gfn %lx pageslot %d\n", gfn, i);
+    for ( i = 0; i < num; i++ )
+    {
+        gfns[i] = prefetch[i].gfn;
+        ok[i] = 1;
+    }
+
+    if ( xenpaging_batch_op(paging, XENMEM_paging_op_prep_batch, gfns, ok,
+                            num, paging->prefetch_buffer) < 0 )
+    {
+        ERROR("Error prefetching %d pages", num);
+        return -1;
+    }
 
-    /* Read page */
-    ret = read_page(paging->fd, paging->paging_buffer, i);
-    if ( ret != 0 )
+    for ( i = 0; i < num; i++ )
     {
-        PERROR("Error reading page");
-        goto out;
+        /* A dropped gfn is handled once its request arrives */
+        if ( !ok[i] )
+            continue;
+
+        DPRINTF("prefetch_page < gfn %lx pageslot %d\n", gfns[i], prefetch[i].slot);
+        clear_bit(gfns[i], paging->bitmap);
+        xenpaging_paged_in(paging, gfns[i]);
     }
 
-    do
+    return 0;
+}
+
+/* Handle a batch of requests from the ring
+ * Pages are read from the pagefile and loaded in gfn order, so that runs
+ * of contiguous gfns need a single hypercall. Xen is notified once.
+ * Returns < 0 on fatal error
+ * Returns 0 otherwise
+ */
+static int xenpaging_handle_requests(struct xenpaging *paging)
+{
+    xc_interface *xch = paging->xc_handle;
+    mem_event_request_t reqs[XENPAGING_BATCH_SIZE], *req;
+    mem_event_response_t rsp;
+    struct xenpaging_load loads[XENPAGING_BATCH_SIZE];
+    unsigned long gfns[XENPAGING_BATCH_SIZE];
+    char ok[XENPAGING_BATCH_SIZE];
+    char paged_out[XENPAGING_BATCH_SIZE];
+    struct xenpaging_load prefetch[XENPAGING_PREFETCH_MAX];
+    int i, num = 0, num_loads = 0, num_prefetch;
+    int slot;
+
+    while ( num < XENPAGING_BATCH_SIZE &&
+            RING_HAS_UNCONSUMED_REQUESTS(&paging->mem_event.back_ring) )
+        get_request(&paging->mem_event, &reqs[num++]);
+
+    for ( i = 0; i < num; i++ )
     {
-        /* Tell Xen to allocate a page for the domain */
-        ret = xc_mem_paging_load(xch, paging->mem_event.domain_id, gfn, paging->paging_buffer);
-        if ( ret < 0 )
+        req = &reqs[i];
+
+        if ( req->gfn > paging->max_pages )
         {
-            if ( errno == ENOMEM )
+            ERROR("Requested gfn %"PRIx64" higher than max_pages %x\n", req->gfn, paging->max_pages);
+            return -1;
+        }
+
+        /* Check if the page has already been paged in */
+        paged_out[i] = test_and_clear_bit(req->gfn, paging->bitmap);
+        if ( !paged_out[i] )
+        {
+            DPRINTF("page %s populated (domain = %d; vcpu = %d;"
+                    " gfn = %"PRIx64"; paused = %d; evict_fail = %d)\n",
+                    req->flags & MEM_EVENT_FLAG_EVICT_FAIL ? "not" : "already",
+                    paging->mem_event.domain_id, req->vcpu_id, req->gfn,
+                    !!(req->flags & MEM_EVENT_FLAG_VCPU_PAUSED) ,
+                    !!(req->flags & MEM_EVENT_FLAG_EVICT_FAIL) );
+            continue;
+        }
+
+        /* Find where in the paging file to read from */
+        slot = paging->gfn_to_slot[req->gfn];
+
+        /* Sanity check */
+        if ( slot == XENPAGING_SLOT_RAM )
+        {
+            if ( !ram_has_page(paging->ram, req->gfn) )
             {
-                if ( oom++ == 0 )
-                    DPRINTF("ENOMEM while preparing gfn %lx\n", gfn);
-                sleep(1);
-                continue;
+                ERROR("Expected gfn %"PRIx64" in RAM tier\n", req->gfn);
+                return -1;
             }
-            PERROR("Error loading %lx during page-in", gfn);
-            ret = -1;
-            break;
         }
+        else if ( paging->slot_to_gfn[slot] != req->gfn )
+        {
+            ERROR("Expected gfn %"PRIx64" in slot %d, but found gfn %lx\n", req->gfn, slot, paging->slot_to_gfn[slot]);
+            return -1;
+        }
+
+        if ( req->flags & MEM_EVENT_FLAG_DROP_PAGE )
+        {
+            DPRINTF("drop_page ^ gfn %"PRIx64" pageslot %d\n", req->gfn, slot);
+            /* Notify policy of page being dropped */
+            policy_notify_dropped(req->gfn);
+            continue;
+        }
+
+        loads[num_loads].gfn = req->gfn;
+        loads[num_loads].slot = slot;
+        num_loads++;
     }
-    while ( ret && !interrupted );
 
+    /* Read pages, with read-ahead queued behind them */
+    qsort(loads, num_loads, sizeof(*loads), load_cmp);
+    for ( i = 0; i < num_loads; i++ )
+    {
+        DPRINTF("populate_page < gfn %lx pageslot %d\n", loads[i].gfn, loads[i].slot);
+        gfns[i] = loads[i].gfn;
+        ok[i] = 1;
+    }
+    num_prefetch = xenpaging_prefetch_choose(paging, loads, num_loads, prefetch);
 
- out:
-    return ret;
+    if ( xenpaging_read_pages(paging, loads, num_loads, paging->paging_buffer,
+                              FILE_AIO_DEMAND) < 0 )
+    {
+        PERROR("Error reading %d pages", num_loads);
+        return -1;
+    }
+    if ( xenpaging_read_pages(paging, prefetch, num_prefetch,
+                              paging->prefetch_buffer, FILE_AIO_PREFETCH) < 0 )
+    {
+        PERROR("Error reading ahead %d pages", num_prefetch);
+        return -1;
+    }
+    if ( file_aio_wait(paging->aio, FILE_AIO_DEMAND) < 0 )
+    {
+        PERROR("Error reading %d pages", num_loads);
+        return -1;
+    }
+
+    /* Tell Xen to allocate pages for the domain */
+    if ( xenpaging_batch_op(paging, XENMEM_paging_op_prep_batch, gfns, ok,
+                            num_loads, paging->paging_buffer) < 0 )
+    {
+        ERROR("Error populating %d pages", num_loads);
+        return -1;
+    }
+    for ( i = 0; i < num_loads; i++ )
+    {
+        if ( !ok[i] )
+        {
+            ERROR("Error populating page %lx", gfns[i]);
+            return -1;
+        }
+    }
+
+    for ( i = 0; i < num; i++ )
+    {
+        req = &reqs[i];
+
+        /* Prepare the response */
+        rsp.gfn = req->gfn;
+        rsp.vcpu_id = req->vcpu_id;
+        rsp.flags = req->flags;
+
+        if ( paged_out[i] )
+            xenpaging_resume_page(paging, &rsp, 1);
+        /* Tell Xen to resume the vcpu */
+        else if (( req->flags & MEM_EVENT_FLAG_VCPU_PAUSED ) || ( req->flags & MEM_EVENT_FLAG_EVICT_FAIL ))
+            xenpaging_resume_page(paging, &rsp, 0);
+    }
+
+    /* Tell Xen pages are ready */
+    if ( xc_evtchn_notify(paging->mem_event.xce_handle, paging->mem_event.port) < 0 )
+    {
+        PERROR("Error resuming %d pages", num);
+        return -1;
+    }
+
+    /* Guest is running again, now finish the read-ahead */
+    if ( num_prefetch )
+    {
+        if ( file_aio_wait(paging->aio, FILE_AIO_PREFETCH) < 0 )
+        {
+            PERROR("Error reading ahead %d pages", num_prefetch);
+            return -1;
+        }
+        if ( xenpaging_prefetch_load(paging, prefetch, num_prefetch) < 0 )
+            return -1;
+    }
+
+    return 0;
 }
 
 /* Trigger a page-in for a batch of pages */
@@ -758,109 +1108,285 @@ static void resume_pages(struct xenpaging *paging, int num_pages)
         page_in_trigger();
 }
 
-/* Evict one gfn and write it to the given slot
+/*
+ * Evicting pages splits the guest's superpage mappings, and paging them back
+ * in only restores 4k mappings.  Once a range touched by page-in contains no
+ * paged-out gfn anymore, ask Xen to map it with a superpage again.  The guest
+ * is paused briefly for every range, so only a few are handled per round.
+ */
+static void coalesce_superpages(struct xenpaging *paging)
+{
+    xc_interface *xch = paging->xc_handle;
+    unsigned long nr = 1UL << XENPAGING_SUPERPAGE_ORDER;
+    unsigned long range, gfn, i;
+    int num = 0;
+
+    for ( range = 0; (range << XENPAGING_SUPERPAGE_ORDER) < paging->max_pages; range++ )
+    {
+        if ( !test_bit(range, paging->coalesce_bitmap) )
+            continue;
+
+        gfn = range << XENPAGING_SUPERPAGE_ORDER;
+
+        /* Skip ranges which are still partly paged out */
+        for ( i = 0; i < nr && gfn + i < paging->max_pages; i++ )
+            if ( test_bit(gfn + i, paging->bitmap) )
+                break;
+        if ( i < nr && gfn + i < paging->max_pages )
+            continue;
+
+        clear_bit(range, paging->coalesce_bitmap);
+
+        if ( xc_mem_paging_coalesce(xch, paging->mem_event.domain_id, gfn, nr) < 0 )
+        {
+            /* No superpage support for this guest, stop trying */
+            if ( errno == EOPNOTSUPP )
+            {
+                DPRINTF("superpage coalescing not supported\n");
+                free(paging->coalesce_bitmap);
+                paging->coalesce_bitmap = NULL;
+                return;
+            }
+            PERROR("Error coalescing gfns %lx-%lx", gfn, gfn + nr - 1);
+        }
+
+        if ( ++num == XENPAGING_COALESCE_MAX )
+            break;
+    }
+}
+
+/* Evict a batch of pages and write them to free slots in the paging file
+ * Victims are nominated, mapped with a single foreign mapping and evicted
+ * in runs of contiguous gfns.
+ * Returns < 0 on fatal error
+ * Returns 0 if no gfn can be evicted
+ * Returns > 0 on successful evict
+ */
+/* Move the page stored longest ago in the RAM tier to a free pagefile slot
+ * slot is evict_pages() scan position for free slots.
  * Returns < 0 on fatal error
- * Returns 0 on successful evict
- * Returns > 0 if no gfn can be evicted
+ * Returns > 0 if there is nothing to spill or no pagefile slot is free
+ * Returns 0 otherwise
  */
-static int evict_victim(struct xenpaging *paging, int slot)
+static int spill_ram_page(struct xenpaging *paging, int *slot)
 {
     xc_interface *xch = paging->xc_handle;
     unsigned long gfn;
+    int spill_slot;
+
+    /* Pages of the batch being evicted are not indexed yet, leave them */
+    if ( ram_oldest_page(paging->ram, &gfn) < 0 ||
+         !test_bit(gfn, paging->bitmap) )
+        return 1;
+
+    if ( paging->stack_count > 0 )
+        spill_slot = paging->free_slot_stack[--paging->stack_count];
+    else
+    {
+        while ( *slot < paging->max_pages && paging->slot_to_gfn[*slot] )
+            (*slot)++;
+        if ( *slot >= paging->max_pages )
+            return 1;
+        spill_slot = (*slot)++;
+    }
+
+    if ( ram_load_page(paging->ram, gfn, paging->spill_buffer) < 0 )
+    {
+        PERROR("Error loading page %lx from RAM tier", gfn);
+        return -1;
+    }
+
+    if ( write_page(paging->fd, paging->spill_buffer, spill_slot) < 0 )
+    {
+        PERROR("Error copying page %lx", gfn);
+        return -1;
+    }
+
+    DPRINTF("spill_page > gfn %lx pageslot %d\n", gfn, spill_slot);
+    ram_drop_page(paging->ram, gfn);
+    paging->slot_to_gfn[spill_slot] = gfn;
+    paging->gfn_to_slot[gfn] = spill_slot;
+
+    return 0;
+}
+
+static int evict_pages(struct xenpaging *paging, int num_pages)
+{
+    xc_interface *xch = paging->xc_handle;
     static int num_paged_out;
-    int ret;
+    unsigned long gfns[XENPAGING_BATCH_SIZE];
+    xen_pfn_t victims[XENPAGING_BATCH_SIZE];
+    int slots[XENPAGING_BATCH_SIZE];
+    char ok[XENPAGING_BATCH_SIZE];
+    char from_stack[XENPAGING_BATCH_SIZE];
+    unsigned long gfn;
+    void *page;
+    int i, k, num = 0, num_mapped = 0, num_evicted = 0;
+    int slot = 0;
+    int rc, spill;
+
+    if ( num_pages > XENPAGING_BATCH_SIZE )
+        num_pages = XENPAGING_BATCH_SIZE;
 
-    do
+    /* Choose victims, each with a pagefile slot to fall back on */
+    while ( num < num_pages )
     {
+        /*
+         * A page stays nominated until the guest touches it again, so
+         * only nominate pages that can certainly be evicted.
+         */
+        if ( paging->stack_count > 0 )
+        {
+            slots[num] = paging->free_slot_stack[--paging->stack_count];
+            from_stack[num] = 1;
+        }
+        else
+        {
+            /* Scan all slots for remainders */
+            while ( slot < paging->max_pages && paging->slot_to_gfn[slot] )
+                slot++;
+            if ( slot >= paging->max_pages )
+                break;
+            slots[num] = slot++;
+            from_stack[num] = 0;
+        }
+
         gfn = policy_choose_victim(paging);
-        if ( gfn == INVALID_MFN )
+        if ( gfn == INVALID_MFN || interrupted )
         {
+            /* Return unused slot */
+            if ( from_stack[num] )
+                paging->free_slot_stack[paging->stack_count++] = slots[num];
+
             /* If the number did not change after last flush command then
              * the command did not reach qemu yet, or qemu still processes
              * the command, or qemu has nothing to release.
              * Right now there is no need to issue the command again.
              */
-            if ( num_paged_out != paging->num_paged_out )
+            if ( gfn == INVALID_MFN && num_paged_out != paging->num_paged_out )
             {
                 DPRINTF("Flushing qemu cache\n");
                 xenpaging_mem_paging_flush_ioemu_cache(paging);
                 num_paged_out = paging->num_paged_out;
             }
-            ret = ENOSPC;
-            goto out;
-        }
-
-        if ( interrupted )
-        {
-            ret = EINTR;
-            goto out;
+            break;
         }
 
-        ret = xenpaging_evict_page(paging, gfn, slot);
-        if ( ret < 0 )
-            goto out;
+        gfns[num] = gfn;
+        ok[num] = 1;
+        num++;
     }
-    while ( ret );
 
-    if ( test_and_set_bit(gfn, paging->bitmap) )
-        ERROR("Page %lx has been evicted before", gfn);
+    /* Nominate pages */
+    if ( xenpaging_batch_op(paging, XENMEM_paging_op_nominate_batch,
+                            gfns, ok, num, NULL) < 0 )
+        return -1;
 
-    ret = 0;
+    for ( i = 0; i < num; i++ )
+        if ( ok[i] )
+            victims[num_mapped++] = gfns[i];
 
- out:
-    return ret;
-}
+    if ( num_mapped == 0 )
+        return 0;
 
-/* Evict a batch of pages and write them to a free slot in the paging file
- * Returns < 0 on fatal error
- * Returns 0 if no gfn can be evicted
- * Returns > 0 on successful evict
- */
-static int evict_pages(struct xenpaging *paging, int num_pages)
-{
-    xc_interface *xch = paging->xc_handle;
-    int rc, slot, num = 0;
+    /* Map all nominated pages at once */
+    page = xc_map_foreign_pages(xch, paging->mem_event.domain_id, PROT_READ,
+                                victims, num_mapped);
+    if ( page == NULL )
+    {
+        PERROR("Error mapping %d pages", num_mapped);
+        return -1;
+    }
 
-    /* Reuse known free slots */
-    while ( paging->stack_count > 0 && num < num_pages )
+    /* Copy pages to the RAM tier, or else to their pagefile slots */
+    for ( k = 0, i = 0; i < num; i++ )
     {
-        slot = paging->free_slot_stack[--paging->stack_count];
-        rc = evict_victim(paging, slot);
-        if ( rc )
+        if ( !ok[i] )
+            continue;
+
+        rc = spill = 0;
+        if ( paging->ram )
         {
-            num = rc < 0 ? -1 : num;
-            return num;
+            rc = ram_store_page(paging->ram, gfns[i],
+                                page + ((size_t)k << PAGE_SHIFT));
+            /* Make room by moving the oldest pages on to the pagefile */
+            while ( rc == RAM_STORE_FULL &&
+                    (spill = spill_ram_page(paging, &slot)) == 0 )
+                rc = ram_store_page(paging->ram, gfns[i],
+                                    page + ((size_t)k << PAGE_SHIFT));
+            if ( spill < 0 )
+            {
+                munmap(page, PAGE_SIZE * num_mapped);
+                return -1;
+            }
         }
-        num++;
-    }
 
-    /* Scan all slots slots for remainders */
-    for ( slot = 0; slot < paging->max_pages && num < num_pages; slot++ )
-    {
-        /* Slot is allocated */
-        if ( paging->slot_to_gfn[slot] )
+        if ( paging->ram && rc == 0 )
+        {
+            /* A scanned slot is still free in slot_to_gfn */
+            if ( from_stack[i] )
+                paging->free_slot_stack[paging->stack_count++] = slots[i];
+            slots[i] = XENPAGING_SLOT_RAM;
+            k++;
             continue;
+        }
 
-        rc = evict_victim(paging, slot);
-        if ( rc )
+        if ( write_page(paging->fd, page + ((size_t)k << PAGE_SHIFT),
+                        slots[i]) < 0 )
         {
-            num = rc < 0 ? -1 : num;
-            break;
+            PERROR("Error copying page %lx", gfns[i]);
+            munmap(page, PAGE_SIZE * num_mapped);
+            return -1;
         }
+        k++;
+    }
 
-        num++;
+    /* Release pages */
+    munmap(page, PAGE_SIZE * num_mapped);
+
+    /* Tell Xen to evict pages */
+    if ( xenpaging_batch_op(paging, XENMEM_paging_op_evict_batch,
+                            gfns, ok, num, NULL) < 0 )
+        return -1;
+
+    for ( i = 0; i < num; i++ )
+    {
+        if ( !ok[i] )
+        {
+            /* Return unused slot */
+            if ( slots[i] == XENPAGING_SLOT_RAM )
+                ram_drop_page(paging->ram, gfns[i]);
+            else if ( slots[i] >= 0 && from_stack[i] )
+                paging->free_slot_stack[paging->stack_count++] = slots[i];
+            continue;
+        }
+
+        DPRINTF("evict_page > gfn %lx pageslot %d\n", gfns[i], slots[i]);
+        /* Notify policy of page being paged out */
+        policy_notify_paged_out(gfns[i]);
+
+        /* Update index */
+        if ( slots[i] >= 0 )
+            paging->slot_to_gfn[slots[i]] = gfns[i];
+        paging->gfn_to_slot[gfns[i]] = slots[i];
+
+        /* Record number of evicted pages */
+        paging->num_paged_out++;
+
+        if ( test_and_set_bit(gfns[i], paging->bitmap) )
+            ERROR("Page %lx has been evicted before", gfns[i]);
+
+        num_evicted++;
     }
-    return num;
+
+    return num_evicted;
 }
 
 int main(int argc, char *argv[])
 {
     struct sigaction act;
     struct xenpaging *paging;
-    mem_event_request_t req;
-    mem_event_response_t rsp;
     int num, prev_num = 0;
-    int slot;
     int tot_pages;
     int rc;
     xc_interface *xch;
@@ -908,84 +1434,8 @@ int main(int argc, char *argv[])
             /* Indicate possible error */
             rc = 1;
 
-            get_request(&paging->mem_event, &req);
-
-            if ( req.gfn > paging->max_pages )
-            {
-                ERROR("Requested gfn %"PRIx64" higher than max_pages %lx\n", req.gfn, paging->max_pages);
+            if ( xenpaging_handle_requests(paging) < 0 )
                 goto out;
-            }
-
-            /* Check if the page has already been paged in */
-            if ( test_and_clear_bit(req.gfn, paging->bitmap) )
-            {
-                /* Find where in the paging file to read from */
-                slot = paging->gfn_to_slot[req.gfn];
-
-                /* Sanity check */
-                if ( paging->slot_to_gfn[slot] != req.gfn )
-                {
-                    ERROR("Expected gfn %"PRIx64" in slot %d, but found gfn %lx\n", req.gfn, slot, paging->slot_to_gfn[slot]);
-                    goto out;
-                }
-
-                if ( req.flags & MEM_EVENT_FLAG_DROP_PAGE )
-                {
-                    DPRINTF("drop_page ^ gfn %"PRIx64" pageslot %d\n", req.gfn, slot);
-                    /* Notify policy of page being dropped */
-                    policy_notify_dropped(req.gfn);
-                }
-                else
-                {
-                    /* Populate the page */
-                    if ( xenpaging_populate_page(paging, req.gfn, slot) < 0 )
-                    {
-                        ERROR("Error populating page %"PRIx64"", req.gfn);
-                        goto out;
-                    }
-                }
-
-                /* Prepare the response */
-                rsp.gfn = req.gfn;
-                rsp.vcpu_id = req.vcpu_id;
-                rsp.flags = req.flags;
-
-                if ( xenpaging_resume_page(paging, &rsp, 1) < 0 )
-                {
-                    PERROR("Error resuming page %"PRIx64"", req.gfn);
-                    goto out;
-                }
-
-                /* Clear this pagefile slot */
-                paging->slot_to_gfn[slot] = 0;
-
-                /* Record this free slot */
-                paging->free_slot_stack[paging->stack_count++] = slot;
-            }
-            else
-            {
-                DPRINTF("page %s populated (domain = %d; vcpu = %d;"
-                        " gfn = %"PRIx64"; paused = %d; evict_fail = %d)\n",
-                        req.flags & MEM_EVENT_FLAG_EVICT_FAIL ? "not" : "already",
-                        paging->mem_event.domain_id, req.vcpu_id, req.gfn,
-                        !!(req.flags & MEM_EVENT_FLAG_VCPU_PAUSED) ,
-                        !!(req.flags & MEM_EVENT_FLAG_EVICT_FAIL) );
-
-                /* Tell Xen to resume the vcpu */
-                if (( req.flags & MEM_EVENT_FLAG_VCPU_PAUSED ) || ( req.flags & MEM_EVENT_FLAG_EVICT_FAIL ))
-                {
-                    /* Prepare the response */
-                    rsp.gfn = req.gfn;
-                    rsp.vcpu_id = req.vcpu_id;
-                    rsp.flags = req.flags;
-
-                    if ( xenpaging_resume_page(paging, &rsp, 0) < 0 )
-                    {
-                        PERROR("Error resuming page %"PRIx64"", req.gfn);
-                        goto out;
-                    }
-                }
-            }
         }
 
         /* If interrupted, write all pages back into the guest */
@@ -1030,10 +1480,10 @@ int main(int argc, char *argv[])
                 prev_num = num;
             }
             /* Limit the number of evicts to be able to process page-in requests */
-            if ( num > 42 )
+            if ( num > XENPAGING_BATCH_SIZE )
             {
                 paging->use_poll_timeout = 0;
-                num = 42;
+                num = XENPAGING_BATCH_SIZE;
             }
             if ( evict_pages(paging, num) < 0 )
                 goto out;
@@ -1055,6 +1505,11 @@ int main(int argc, char *argv[])
             paging->use_poll_timeout = 1;
         }
 
+        /* Rebuild superpages once no more page-out is pending */
+        if ( paging->coalesce_bitmap &&
+             (paging->target_tot_pages == 0 || tot_pages <= paging->target_tot_pages) )
+            coalesce_superpages(paging);
+
     }
 
     /* No error */
@@ -1063,6 +1518,8 @@ int main(int argc, char *argv[])
     DPRINTF("xenpaging got signal %d\n", interrupted);
 
  out:
+    file_aio_teardown(paging->aio);
+    ram_store_teardown(paging->ram);
     close(paging->fd);
     unlink_pagefile();
 
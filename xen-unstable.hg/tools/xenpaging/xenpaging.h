@@ -30,6 +30,17 @@
 #include <xen/mem_event.h>
 
 #define XENPAGING_PAGEIN_QUEUE_SIZE 64
+/* Max number of gfns evicted or loaded with a single batched operation */
+#define XENPAGING_BATCH_SIZE 256
+/* Max number of gfns read ahead of a sequential page-in stream */
+#define XENPAGING_PREFETCH_MAX 64
+/* gfns per superpage, and max number of superpages rebuilt per idle round */
+#define XENPAGING_SUPERPAGE_ORDER 9
+#define XENPAGING_COALESCE_MAX 16
+
+/* gfn_to_slot values which are not pagefile slots */
+#define XENPAGING_SLOT_NONE (-1)
+#define XENPAGING_SLOT_RAM  (-2)
 
 struct mem_event {
     domid_t domain_id;
@@ -45,20 +56,35 @@ struct xenpaging {
     struct xs_handle *xs_handle;
 
     unsigned long *bitmap;
+    /* superpage ranges with gfns paged in since the last coalescing */
+    unsigned long *coalesce_bitmap;
 
     unsigned long *slot_to_gfn;
     int *gfn_to_slot;
 
+    /* XENPAGING_BATCH_SIZE pages to stage page-in data */
     void *paging_buffer;
+    /* XENPAGING_PREFETCH_MAX pages to stage read-ahead data */
+    void *prefetch_buffer;
 
     struct mem_event mem_event;
     int fd;
+    struct file_aio *aio;
+    /* optional compressed RAM tier in front of the pagefile */
+    struct ram_store *ram;
+    size_t ram_limit;
+    /* one page to stage pages spilled from the RAM tier */
+    void *spill_buffer;
     /* number of pages for which data structures were allocated */
     int max_pages;
     int num_paged_out;
     int target_tot_pages;
     int policy_mru_size;
     int use_poll_timeout;
+    /* read-ahead state for sequential page-in */
+    int prefetch_max;
+    int prefetch_window;
+    unsigned long prefetch_last_gfn;
     int debug;
     int stack_count;
     int *free_slot_stack;
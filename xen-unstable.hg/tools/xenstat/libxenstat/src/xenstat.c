@@ -54,12 +54,18 @@ typedef struct xenstat_collector {
 
 static int  xenstat_collect_vcpus(xenstat_node * node);
 static int  xenstat_collect_xen_version(xenstat_node * node);
+static int  xenstat_collect_sched_lat(xenstat_node * node);
+static int  xenstat_collect_evtchns(xenstat_node * node);
 static void xenstat_free_vcpus(xenstat_node * node);
 static void xenstat_free_networks(xenstat_node * node);
 static void xenstat_free_xen_version(xenstat_node * node);
 static void xenstat_free_vbds(xenstat_node * node);
+static void xenstat_free_sched_lat(xenstat_node * node);
+static void xenstat_free_evtchns(xenstat_node * node);
 static void xenstat_uninit_vcpus(xenstat_handle * handle);
 static void xenstat_uninit_xen_version(xenstat_handle * handle);
+static void xenstat_uninit_sched_lat(xenstat_handle * handle);
+static void xenstat_uninit_evtchns(xenstat_handle * handle);
 static char *xenstat_get_domain_name(xenstat_handle * handle, unsigned int domain_id);
 static void xenstat_prune_domain(xenstat_node *node, unsigned int entry);
 
@@ -71,7 +77,11 @@ static xenstat_collector collectors[] = {
 	{ XENSTAT_XEN_VERSION, xenstat_collect_xen_version,
 	  xenstat_free_xen_version, xenstat_uninit_xen_version },
 	{ XENSTAT_VBD, xenstat_collect_vbds,
-	  xenstat_free_vbds, xenstat_uninit_vbds }
+	  xenstat_free_vbds, xenstat_uninit_vbds },
+	{ XENSTAT_SCHED_LAT, xenstat_collect_sched_lat,
+	  xenstat_free_sched_lat, xenstat_uninit_sched_lat },
+	{ XENSTAT_EVTCHN, xenstat_collect_evtchns,
+	  xenstat_free_evtchns, xenstat_uninit_evtchns }
 };
 
 #define NUM_COLLECTORS (sizeof(collectors)/sizeof(xenstat_collector))
@@ -259,6 +269,9 @@ xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags)
 			domain->networks = NULL;
 			domain->num_vbds = 0;
 			domain->vbds = NULL;
+			domain->vcpu_sched_lat = NULL;
+			domain->num_evtchns = 0;
+			domain->evtchns = NULL;
 			domain_get_tmem_stats(handle,domain);
 
 			domain++;
@@ -703,6 +716,352 @@ unsigned long long xenstat_vbd_wr_sects(xenstat_vbd * vbd)
 	return vbd->wr_sects;
 }
 
+/*
+ * Scheduler latency functions
+ */
+
+/* Collect the latency histograms of every VCPU */
+static int xenstat_collect_sched_lat(xenstat_node * node)
+{
+	unsigned int i, vcpu, b, inc_index;
+	xc_sched_latency_t *buf = NULL;
+	int nr_vcpus;
+
+	for (i = 0; i < node->num_domains; i+=inc_index) {
+		xenstat_domain *domain = &node->domains[i];
+		xenstat_sched_lat *sum = &domain->sched_lat;
+		xc_sched_latency_t *tmp;
+
+		inc_index = 1; /* default is to increment to next domain */
+
+		tmp = realloc(buf, domain->num_vcpus * sizeof(*buf));
+		if (tmp == NULL) {
+			free(buf);
+			return 0;
+		}
+		buf = tmp;
+
+		if (xc_sched_latency_get(node->handle->xc_handle, domain->id,
+					 domain->num_vcpus, 0, buf,
+					 &nr_vcpus) != 0) {
+			if (errno == ENOMEM) {
+				/* fatal error */
+				free(buf);
+				return 0;
+			}
+			if (errno == ESRCH) {
+				/* domain is gone - remove from list */
+				xenstat_prune_domain(node, i);
+				inc_index = 0;
+			}
+			/* otherwise (e.g. not permitted) leave it out */
+			continue;
+		}
+
+		domain->vcpu_sched_lat = calloc(domain->num_vcpus,
+						sizeof(xenstat_sched_lat));
+		if (domain->vcpu_sched_lat == NULL) {
+			free(buf);
+			return 0;
+		}
+
+		memset(sum, 0, sizeof(*sum));
+		for (vcpu = 0; vcpu < nr_vcpus; vcpu++) {
+			xenstat_sched_lat *lat = &domain->vcpu_sched_lat[vcpu];
+
+			for (b = 0; b < XENSTAT_SCHED_LAT_BUCKETS; b++) {
+				lat->wake[b] = buf[vcpu].wake[b];
+				lat->runq[b] = buf[vcpu].runq[b];
+				sum->wake[b] += lat->wake[b];
+				sum->runq[b] += lat->runq[b];
+			}
+			lat->wake_max = buf[vcpu].wake_max;
+			lat->runq_max = buf[vcpu].runq_max;
+			if (lat->wake_max > sum->wake_max)
+				sum->wake_max = lat->wake_max;
+			if (lat->runq_max > sum->runq_max)
+				sum->runq_max = lat->runq_max;
+		}
+	}
+
+	free(buf);
+	return 1;
+}
+
+/* Free latency information */
+static void xenstat_free_sched_lat(xenstat_node * node)
+{
+	unsigned int i;
+	for (i = 0; i < node->num_domains; i++)
+		free(node->domains[i].vcpu_sched_lat);
+}
+
+/* Free latency information in handle - nothing to do */
+static void xenstat_uninit_sched_lat(xenstat_handle * handle)
+{
+}
+
+xenstat_sched_lat *xenstat_domain_sched_lat(xenstat_domain * domain)
+{
+	if (domain->vcpu_sched_lat)
+		return &domain->sched_lat;
+	return NULL;
+}
+
+xenstat_sched_lat *xenstat_domain_vcpu_sched_lat(xenstat_domain * domain,
+						 unsigned int vcpu)
+{
+	if (domain->vcpu_sched_lat && vcpu < domain->num_vcpus)
+		return &domain->vcpu_sched_lat[vcpu];
+	return NULL;
+}
+
+/* Get the number of buckets in each histogram */
+unsigned int xenstat_sched_lat_num_buckets(void)
+{
+	return XENSTAT_SCHED_LAT_BUCKETS;
+}
+
+/* Get the upper bound of a bucket: 1024ns for the first, doubling after */
+unsigned long long xenstat_sched_lat_bucket_ns(unsigned int bucket)
+{
+	if (bucket >= XENSTAT_SCHED_LAT_BUCKETS - 1)
+		return 0;
+	return 1024ULL << bucket;
+}
+
+unsigned long long xenstat_sched_lat_wake(xenstat_sched_lat * lat,
+					  unsigned int bucket)
+{
+	if (bucket < XENSTAT_SCHED_LAT_BUCKETS)
+		return lat->wake[bucket];
+	return 0;
+}
+
+unsigned long long xenstat_sched_lat_runq(xenstat_sched_lat * lat,
+					  unsigned int bucket)
+{
+	if (bucket < XENSTAT_SCHED_LAT_BUCKETS)
+		return lat->runq[bucket];
+	return 0;
+}
+
+unsigned long long xenstat_sched_lat_wake_max_ns(xenstat_sched_lat * lat)
+{
+	return lat->wake_max;
+}
+
+unsigned long long xenstat_sched_lat_runq_max_ns(xenstat_sched_lat * lat)
+{
+	return lat->runq_max;
+}
+
+static unsigned long long sched_lat_pct(const unsigned long long *hist,
+					unsigned long long max,
+					unsigned int pct)
+{
+	unsigned long long total = 0, seen = 0;
+	unsigned int b;
+
+	for (b = 0; b < XENSTAT_SCHED_LAT_BUCKETS; b++)
+		total += hist[b];
+	if (total == 0)
+		return 0;
+
+	for (b = 0; b < XENSTAT_SCHED_LAT_BUCKETS - 1; b++) {
+		seen += hist[b];
+		if (seen * 100 >= total * pct)
+			break;
+	}
+
+	/* The bucket bound can be looser than the longest wait itself */
+	if (b == XENSTAT_SCHED_LAT_BUCKETS - 1 ||
+	    xenstat_sched_lat_bucket_ns(b) > max)
+		return max;
+	return xenstat_sched_lat_bucket_ns(b);
+}
+
+unsigned long long xenstat_sched_lat_wake_pct_ns(xenstat_sched_lat * lat,
+						 unsigned int pct)
+{
+	return sched_lat_pct(lat->wake, lat->wake_max, pct);
+}
+
+unsigned long long xenstat_sched_lat_runq_pct_ns(xenstat_sched_lat * lat,
+						 unsigned int pct)
+{
+	return sched_lat_pct(lat->runq, lat->runq_max, pct);
+}
+
+/*
+ * Event channel functions
+ */
+
+#define EVTCHN_STATS_BATCH 256
+
+/* Collect the statistics of every event channel in use */
+static int xenstat_collect_evtchns(xenstat_node * node)
+{
+	unsigned int i, j, inc_index;
+	xc_evtchn_stats_t *buf;
+
+	buf = malloc(EVTCHN_STATS_BATCH * sizeof(*buf));
+	if (buf == NULL)
+		return 0;
+
+	for (i = 0; i < node->num_domains; i+=inc_index) {
+		xenstat_domain *domain = &node->domains[i];
+		xenstat_evtchn *sum = &domain->evtchn;
+		evtchn_port_t port = 0;
+		int nr_ports, rc;
+
+		inc_index = 1; /* default is to increment to next domain */
+		memset(sum, 0, sizeof(*sum));
+
+		do {
+			xenstat_evtchn *tmp;
+
+			rc = xc_evtchn_stats_get(node->handle->xc_handle,
+						 domain->id, 0, &port,
+						 EVTCHN_STATS_BATCH, buf,
+						 &nr_ports);
+			if (rc != 0)
+				break;
+			if (nr_ports == 0)
+				continue;
+
+			tmp = realloc(domain->evtchns,
+				      (domain->num_evtchns + nr_ports) *
+				      sizeof(xenstat_evtchn));
+			if (tmp == NULL) {
+				free(buf);
+				return 0;
+			}
+			domain->evtchns = tmp;
+
+			for (j = 0; j < nr_ports; j++) {
+				xenstat_evtchn *evtchn =
+					&domain->evtchns[domain->num_evtchns++];
+
+				evtchn->port = buf[j].port;
+				evtchn->status = buf[j].status;
+				evtchn->vcpu = buf[j].vcpu;
+				evtchn->rl_period_us = buf[j].rl_period_us;
+				evtchn->rl_burst = buf[j].rl_burst;
+				evtchn->sent = buf[j].sent;
+				evtchn->raised = buf[j].raised;
+				evtchn->coalesced = buf[j].coalesced;
+				evtchn->deferred = buf[j].deferred;
+
+				sum->sent += evtchn->sent;
+				sum->raised += evtchn->raised;
+				sum->coalesced += evtchn->coalesced;
+				sum->deferred += evtchn->deferred;
+			}
+		} while (port != 0);
+
+		if (rc != 0) {
+			if (errno == ENOMEM) {
+				/* fatal error */
+				free(buf);
+				return 0;
+			}
+			if (errno == ESRCH) {
+				/* domain is gone - remove from list */
+				free(domain->evtchns);
+				xenstat_prune_domain(node, i);
+				inc_index = 0;
+				continue;
+			}
+			/* otherwise (e.g. not permitted) leave it out */
+			free(domain->evtchns);
+			domain->evtchns = NULL;
+			domain->num_evtchns = 0;
+		}
+	}
+
+	free(buf);
+	return 1;
+}
+
+/* Free event channel information */
+static void xenstat_free_evtchns(xenstat_node * node)
+{
+	unsigned int i;
+	for (i = 0; i < node->num_domains; i++)
+		free(node->domains[i].evtchns);
+}
+
+/* Free event channel information in handle - nothing to do */
+static void xenstat_uninit_evtchns(xenstat_handle * handle)
+{
+}
+
+xenstat_evtchn *xenstat_domain_evtchn(xenstat_domain * domain)
+{
+	if (domain->evtchns)
+		return &domain->evtchn;
+	return NULL;
+}
+
+unsigned int xenstat_domain_num_evtchns(xenstat_domain * domain)
+{
+	return domain->num_evtchns;
+}
+
+xenstat_evtchn *xenstat_domain_evtchn_port(xenstat_domain * domain,
+					   unsigned int evtchn)
+{
+	if (domain->evtchns && evtchn < domain->num_evtchns)
+		return &domain->evtchns[evtchn];
+	return NULL;
+}
+
+unsigned int xenstat_evtchn_port(xenstat_evtchn * evtchn)
+{
+	return evtchn->port;
+}
+
+unsigned int xenstat_evtchn_status(xenstat_evtchn * evtchn)
+{
+	return evtchn->status;
+}
+
+unsigned int xenstat_evtchn_vcpu(xenstat_evtchn * evtchn)
+{
+	return evtchn->vcpu;
+}
+
+unsigned int xenstat_evtchn_rl_period_us(xenstat_evtchn * evtchn)
+{
+	return evtchn->rl_period_us;
+}
+
+unsigned int xenstat_evtchn_rl_burst(xenstat_evtchn * evtchn)
+{
+	return evtchn->rl_burst;
+}
+
+unsigned long long xenstat_evtchn_sent(xenstat_evtchn * evtchn)
+{
+	return evtchn->sent;
+}
+
+unsigned long long xenstat_evtchn_raised(xenstat_evtchn * evtchn)
+{
+	return evtchn->raised;
+}
+
+unsigned long long xenstat_evtchn_coalesced(xenstat_evtchn * evtchn)
+{
+	return evtchn->coalesced;
+}
+
+unsigned long long xenstat_evtchn_deferred(xenstat_evtchn * evtchn)
+{
+	return evtchn->deferred;
+}
+
 /*
  * Tmem functions
  */
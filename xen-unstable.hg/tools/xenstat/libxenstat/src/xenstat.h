@@ -28,6 +28,8 @@ typedef struct xenstat_vcpu xenstat_vcpu;
 typedef struct xenstat_network xenstat_network;
 typedef struct xenstat_vbd xenstat_vbd;
 typedef struct xenstat_tmem xenstat_tmem;
+typedef struct xenstat_sched_lat xenstat_sched_lat;
+typedef struct xenstat_evtchn xenstat_evtchn;
 
 /* Initialize the xenstat library.  Returns a handle to be used with
  * subsequent calls to the xenstat library, or NULL if an error occurs. */
@@ -42,6 +44,10 @@ void xenstat_uninit(xenstat_handle * handle);
 #define XENSTAT_XEN_VERSION 0x4
 #define XENSTAT_VBD 0x8
 #define XENSTAT_ALL (XENSTAT_VCPU|XENSTAT_NETWORK|XENSTAT_XEN_VERSION|XENSTAT_VBD)
+/* Scheduler latency histograms; not part of XENSTAT_ALL */
+#define XENSTAT_SCHED_LAT 0x10
+/* Event channel statistics; not part of XENSTAT_ALL */
+#define XENSTAT_EVTCHN 0x20
 
 /* Get all available information about a node */
 xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags);
@@ -136,6 +142,25 @@ xenstat_vbd *xenstat_domain_vbd(xenstat_domain * domain,
 /* Get the tmem information for a given domain */
 xenstat_tmem *xenstat_domain_tmem(xenstat_domain * domain);
 
+/* Get the scheduler latency histograms of a domain, summed over its VCPUs.
+ * Returns NULL if they were not collected. */
+xenstat_sched_lat *xenstat_domain_sched_lat(xenstat_domain * domain);
+
+/* Get the scheduler latency histograms of one VCPU of a domain */
+xenstat_sched_lat *xenstat_domain_vcpu_sched_lat(xenstat_domain * domain,
+						 unsigned int vcpu);
+
+/* Get the event channel statistics of a domain, summed over its ports.
+ * Returns NULL if they were not collected or no port is in use. */
+xenstat_evtchn *xenstat_domain_evtchn(xenstat_domain * domain);
+
+/* Get the number of event channels in use by a domain */
+unsigned int xenstat_domain_num_evtchns(xenstat_domain * domain);
+
+/* Get the statistics of the evtchn-th event channel in use by a domain */
+xenstat_evtchn *xenstat_domain_evtchn_port(xenstat_domain * domain,
+					   unsigned int evtchn);
+
 /*
  * VCPU functions - extract information from a xenstat_vcpu
  */
@@ -193,6 +218,56 @@ unsigned long long xenstat_vbd_wr_reqs(xenstat_vbd * vbd);
 unsigned long long xenstat_vbd_rd_sects(xenstat_vbd * vbd);
 unsigned long long xenstat_vbd_wr_sects(xenstat_vbd * vbd);
 
+/*
+ * Scheduler latency functions - extract information from a
+ * xenstat_sched_lat.  The "wake" histogram counts the time from a VCPU
+ * being woken until it runs, the "runq" histogram every wait for a CPU,
+ * including those after a preemption.
+ */
+
+/* Get the number of buckets in each histogram */
+unsigned int xenstat_sched_lat_num_buckets(void);
+
+/* Get the upper bound (in ns) of a bucket; the last bucket has none and
+ * returns 0 */
+unsigned long long xenstat_sched_lat_bucket_ns(unsigned int bucket);
+
+/* Get the number of waits that fell in a bucket */
+unsigned long long xenstat_sched_lat_wake(xenstat_sched_lat * lat,
+					  unsigned int bucket);
+unsigned long long xenstat_sched_lat_runq(xenstat_sched_lat * lat,
+					  unsigned int bucket);
+
+/* Get the longest wait seen (in ns) */
+unsigned long long xenstat_sched_lat_wake_max_ns(xenstat_sched_lat * lat);
+unsigned long long xenstat_sched_lat_runq_max_ns(xenstat_sched_lat * lat);
+
+/* Get an upper bound (in ns) on the given percentile of the waits: the
+ * bound of the bucket it falls in, or the longest wait for the last one */
+unsigned long long xenstat_sched_lat_wake_pct_ns(xenstat_sched_lat * lat,
+						 unsigned int pct);
+unsigned long long xenstat_sched_lat_runq_pct_ns(xenstat_sched_lat * lat,
+						 unsigned int pct);
+
+/*
+ * Event channel functions - extract information from a xenstat_evtchn.
+ * "sent" counts sends on the port, "raised" events raised on it from any
+ * source, "coalesced" those that found it already pending and "deferred"
+ * sends held back by its rate limit.  The port, status, VCPU and rate
+ * limit of a domain's sum are 0.
+ */
+unsigned int xenstat_evtchn_port(xenstat_evtchn * evtchn);
+/* Get the binding of the port (EVTCHNSTAT_*) */
+unsigned int xenstat_evtchn_status(xenstat_evtchn * evtchn);
+unsigned int xenstat_evtchn_vcpu(xenstat_evtchn * evtchn);
+/* Get the rate limit of the port; a period of 0 means there is none */
+unsigned int xenstat_evtchn_rl_period_us(xenstat_evtchn * evtchn);
+unsigned int xenstat_evtchn_rl_burst(xenstat_evtchn * evtchn);
+unsigned long long xenstat_evtchn_sent(xenstat_evtchn * evtchn);
+unsigned long long xenstat_evtchn_raised(xenstat_evtchn * evtchn);
+unsigned long long xenstat_evtchn_coalesced(xenstat_evtchn * evtchn);
+unsigned long long xenstat_evtchn_deferred(xenstat_evtchn * evtchn);
+
 /*
  * Tmem functions - extract tmem information
  */
@@ -59,6 +59,27 @@ struct xenstat_tmem {
 	unsigned long long succ_pers_gets;
 };
 
+#define XENSTAT_SCHED_LAT_BUCKETS XEN_SYSCTL_SCHED_LAT_BUCKETS
+
+struct xenstat_sched_lat {
+	unsigned long long wake[XENSTAT_SCHED_LAT_BUCKETS];
+	unsigned long long runq[XENSTAT_SCHED_LAT_BUCKETS];
+	unsigned long long wake_max;
+	unsigned long long runq_max;
+};
+
+struct xenstat_evtchn {
+	unsigned int port;
+	unsigned int status;
+	unsigned int vcpu;
+	unsigned int rl_period_us;
+	unsigned int rl_burst;
+	unsigned long long sent;
+	unsigned long long raised;
+	unsigned long long coalesced;
+	unsigned long long deferred;
+};
+
 struct xenstat_domain {
 	unsigned int id;
 	char *name;
@@ -74,6 +95,11 @@ struct xenstat_domain {
 	unsigned int num_vbds;
 	xenstat_vbd *vbds;
 	xenstat_tmem tmem_stats;
+	xenstat_sched_lat sched_lat;	/* Sum over vcpu_sched_lat */
+	xenstat_sched_lat *vcpu_sched_lat; /* Array of length num_vcpus */
+	xenstat_evtchn evtchn;		/* Sum over evtchns */
+	unsigned int num_evtchns;
+	xenstat_evtchn *evtchns;	/* Array of length num_evtchns */
 };
 
 struct xenstat_vcpu {
@@ -199,6 +199,8 @@ static int enter_state(u32 state)
     mcheck_init(&boot_cpu_data, 0);
     write_cr4(cr4);
 
+    llc_pmu_resume();
+
     printk(XENLOG_INFO "Finishing wakeup from ACPI S%d state.\n", state);
 
     if ( (state == ACPI_STATE_S3) && error )
@@ -0,0 +1,153 @@
+/******************************************************************************
+ * llc_pmu.c
+ *
+ * Count the last level cache misses of every pcpu for the schedulers'
+ * cache footprint estimates (see arch_llc_misses() in xen/sched-if.h).
+ *
+ * This takes the last general purpose counter of Intel's architectural
+ * performance monitoring and counts the architectural "LLC Misses" event
+ * in it, in guest and hypervisor context alike.  vpmu hands all counters
+ * to guests, so the two can't be used together.  While xenoprof owns the
+ * PMU the counts are meaningless, which only skews the estimates.  The
+ * counting is therefore off unless asked for with "sched_llc_pmu".
+ */
+
+#include <xen/config.h>
+#include <xen/cpu.h>
+#include <xen/init.h>
+#include <xen/lib.h>
+#include <xen/notifier.h>
+#include <xen/percpu.h>
+#include <xen/sched.h>
+#include <xen/sched-if.h>
+#include <asm/msr.h>
+#include <asm/processor.h>
+#include <asm/hvm/vpmu.h>
+
+static bool_t __initdata opt_sched_llc_pmu;
+boolean_param("sched_llc_pmu", opt_sched_llc_pmu);
+
+#define ARCH_PERFMON_LLC_MISSES         0x412e  /* umask 0x41, event 0x2e */
+#define ARCH_PERFMON_LLC_MISSES_ABSENT  (1u << 4) /* in CPUID 0xa EBX */
+#define EVNTSEL_USR                     (1u << 16)
+#define EVNTSEL_OS                      (1u << 17)
+#define EVNTSEL_EN                      (1u << 22)
+
+static bool_t __read_mostly llc_pmu_enabled;
+static unsigned int __read_mostly llc_pmu_ctr;
+static bool_t __read_mostly llc_pmu_global_ctrl;
+static uint64_t __read_mostly llc_pmu_mask;
+
+/* The counter is narrower than 64 bits: accumulate what it counted. */
+static DEFINE_PER_CPU(uint64_t, llc_pmu_last);
+static DEFINE_PER_CPU(uint64_t, llc_pmu_total);
+
+uint64_t arch_llc_misses(void)
+{
+    uint64_t val;
+
+    if ( !llc_pmu_enabled )
+        return LLC_MISSES_UNKNOWN;
+
+    rdmsrl(MSR_P6_PERFCTR0 + llc_pmu_ctr, val);
+    this_cpu(llc_pmu_total) += (val - this_cpu(llc_pmu_last)) & llc_pmu_mask;
+    this_cpu(llc_pmu_last) = val;
+
+    return this_cpu(llc_pmu_total);
+}
+
+static void llc_pmu_start(void)
+{
+    uint64_t global;
+
+    wrmsrl(MSR_P6_EVNTSEL0 + llc_pmu_ctr, 0);
+    wrmsrl(MSR_P6_PERFCTR0 + llc_pmu_ctr, 0);
+    this_cpu(llc_pmu_last) = 0;
+    wrmsrl(MSR_P6_EVNTSEL0 + llc_pmu_ctr,
+           ARCH_PERFMON_LLC_MISSES | EVNTSEL_USR | EVNTSEL_OS | EVNTSEL_EN);
+
+    if ( llc_pmu_global_ctrl )
+    {
+        rdmsrl(MSR_CORE_PERF_GLOBAL_CTRL, global);
+        wrmsrl(MSR_CORE_PERF_GLOBAL_CTRL, global | (1ULL << llc_pmu_ctr));
+    }
+}
+
+/*
+ * S3 loses the counter setup.  The APs get it back at CPU_STARTING as they
+ * are brought up again, but the BSP doesn't go through that.
+ */
+void llc_pmu_resume(void)
+{
+    if ( llc_pmu_enabled )
+        llc_pmu_start();
+}
+
+static int llc_pmu_cpu_callback(
+    struct notifier_block *nfb, unsigned long action, void *hcpu)
+{
+    if ( action == CPU_STARTING )
+        llc_pmu_start();
+
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block llc_pmu_nfb = {
+    .notifier_call = llc_pmu_cpu_callback
+};
+
+static int __init llc_pmu_init(void)
+{
+    unsigned int eax, ebx, ecx, edx, version, counters;
+
+    if ( !opt_sched_llc_pmu )
+        return 0;
+
+    if ( opt_vpmu_enabled )
+    {
+        printk(XENLOG_WARNING "sched_llc_pmu: not available with vpmu\n");
+        return 0;
+    }
+
+    if ( boot_cpu_data.x86_vendor != X86_VENDOR_INTEL ||
+         !cpu_has_arch_perfmon )
+    {
+        printk(XENLOG_WARNING
+               "sched_llc_pmu: no architectural performance monitoring\n");
+        return 0;
+    }
+
+    cpuid(0xa, &eax, &ebx, &ecx, &edx);
+    version = eax & 0xff;
+    counters = (eax >> 8) & 0xff;
+    /* Counter 0 may be the NMI watchdog's */
+    if ( version == 0 || counters < 2 || ((eax >> 24) & 0xff) <= 4 ||
+         (ebx & ARCH_PERFMON_LLC_MISSES_ABSENT) )
+    {
+        printk(XENLOG_WARNING "sched_llc_pmu: no LLC miss event\n");
+        return 0;
+    }
+
+    llc_pmu_ctr = counters - 1;
+    llc_pmu_global_ctrl = version >= 2;
+    llc_pmu_mask = (1ULL << ((eax >> 16) & 0xff)) - 1;
+
+    llc_pmu_start();
+    register_cpu_notifier(&llc_pmu_nfb);
+    llc_pmu_enabled = 1;
+
+    printk(XENLOG_INFO "sched_llc_pmu: counting LLC misses in counter %u\n",
+           llc_pmu_ctr);
+
+    return 0;
+}
+presmp_initcall(llc_pmu_init);
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
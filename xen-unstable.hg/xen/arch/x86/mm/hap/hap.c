@@ -698,7 +698,12 @@ hap_write_p2m_entry(struct vcpu *v, unsigned long gfn, l1_pgentry_t *p,
     safe_write_pte(p, new);
     if ( (old_flags & _PAGE_PRESENT)
          && (level == 1 || (level == 2 && (old_flags & _PAGE_PSE))) )
-             flush_tlb_mask(d->domain_dirty_cpumask);
+    {
+        if ( p2m_batch_active(p2m_get_hostp2m(d)) )
+            p2m_get_hostp2m(d)->batch.need_flush = 1;
+        else
+            flush_tlb_mask(d->domain_dirty_cpumask);
+    }
 
     paging_unlock(d);
 
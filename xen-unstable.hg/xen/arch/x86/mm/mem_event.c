@@ -458,6 +458,9 @@ int do_mem_event_op(int op, uint32_t domain, void *arg)
         case XENMEM_paging_op:
             ret = mem_paging_memop(d, (xen_mem_event_op_t *) arg);
             break;
+        case XENMEM_paging_batch_op:
+            ret = mem_paging_batch_memop(d, (xen_mem_paging_batch_op_t *) arg);
+            break;
         case XENMEM_access_op:
             ret = mem_access_memop(d, (xen_mem_event_op_t *) arg);
             break;
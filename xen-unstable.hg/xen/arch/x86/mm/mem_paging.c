@@ -21,10 +21,68 @@
  */
 
 
+#include <xen/event.h>
 #include <asm/p2m.h>
 #include <asm/mem_event.h>
 
 
+static int mem_paging_batch(struct domain *d, xen_mem_paging_batch_op_t *mec)
+{
+    unsigned long gfn;
+    uint64_t buffer;
+    int ret = 0;
+
+    if ( mec->gfn + mec->nr_gfns < mec->gfn )
+        return -EINVAL;
+
+    for ( mec->nr_done = 0; mec->nr_done < mec->nr_gfns; mec->nr_done++ )
+    {
+        /* Caller picks up the remainder with a fresh hypercall. */
+        if ( mec->nr_done && hypercall_preempt_check() )
+            break;
+
+        gfn = mec->gfn + mec->nr_done;
+
+        switch ( mec->op )
+        {
+        case XENMEM_paging_op_nominate_batch:
+            ret = p2m_mem_paging_nominate(d, gfn);
+            break;
+
+        case XENMEM_paging_op_evict_batch:
+            ret = p2m_mem_paging_evict(d, gfn);
+            break;
+
+        case XENMEM_paging_op_prep_batch:
+            buffer = mec->buffer;
+            if ( buffer )
+                buffer += (uint64_t)mec->nr_done << PAGE_SHIFT;
+            ret = p2m_mem_paging_prep(d, gfn, buffer);
+            break;
+        }
+
+        if ( ret )
+            break;
+    }
+
+    return ret;
+}
+
+static int mem_paging_coalesce(struct domain *d,
+                               xen_mem_paging_batch_op_t *mec)
+{
+    unsigned long done = 0;
+    int ret;
+
+    domain_pause(d);
+    ret = p2m_coalesce_range(d, mec->gfn, mec->nr_gfns, &done);
+    domain_unpause(d);
+
+    mec->nr_done = done;
+
+    return ret;
+}
+
 int mem_paging_memop(struct domain *d, xen_mem_event_op_t *mec)
 {
     if ( unlikely(!d->mem_event->paging.ring_page) )
@@ -59,6 +117,29 @@ int mem_paging_memop(struct domain *d, xen_mem_event_op_t *mec)
     }
 }
 
+int mem_paging_batch_memop(struct domain *d, xen_mem_paging_batch_op_t *mpb)
+{
+    mpb->nr_done = 0;
+
+    /* Undoes the work of both pager and sharing, needs no ring */
+    if ( mpb->op == XENMEM_paging_op_coalesce )
+        return mem_paging_coalesce(d, mpb);
+
+    if ( unlikely(!d->mem_event->paging.ring_page) )
+        return -ENODEV;
+
+    switch ( mpb->op )
+    {
+    case XENMEM_paging_op_nominate_batch:
+    case XENMEM_paging_op_evict_batch:
+    case XENMEM_paging_op_prep_batch:
+        return mem_paging_batch(d, mpb);
+
+    default:
+        return -ENOSYS;
+    }
+}
+
 
 /*
  * Local variables:
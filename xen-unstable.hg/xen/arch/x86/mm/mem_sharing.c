@@ -1267,6 +1267,7 @@ int relinquish_shared_pages(struct domain *d)
         return 0;
 
     p2m_lock(p2m);
+    p2m_batch_begin(p2m);
     for (gfn = p2m->next_shared_gfn_to_relinquish; 
          gfn < p2m->max_mapped_pfn; gfn++ )
     {
@@ -1297,6 +1298,7 @@ int relinquish_shared_pages(struct domain *d)
         }
     }
 
+    p2m_batch_end(p2m);
     p2m_unlock(p2m);
     return rc;
 }
@@ -441,7 +441,13 @@ out:
     unmap_domain_page(table);
 
     if ( needs_sync )
-        ept_sync_domain(p2m);
+    {
+        /* The flush and the freeing of old tables below wait for the batch */
+        if ( p2m_batch_active(p2m) )
+            p2m->batch.need_flush = 1;
+        else
+            ept_sync_domain(p2m);
+    }
 
     /* For non-nested p2m, may need to change VT-d page table.*/
     if ( rv && !p2m_is_nestedp2m(p2m) && iommu_enabled &&
@@ -521,6 +521,11 @@ p2m_pod_decrease_reservation(struct domain *d,
     if ( unlikely(d->is_dying) )
         goto out_unlock;
 
+    /* Pages stolen below go straight into the cache, and a superpage is
+     * zero-checked right after unmapping it: neither may be left reachable
+     * through translations a caller's p2m batch would flush only later. */
+    p2m_batch_suspend(p2m);
+
 recount:
     pod = nonpod = ram = 0;
 
@@ -547,7 +552,7 @@ recount:
 
     /* No populate-on-demand?  Don't need to steal anything?  Then we're done!*/
     if(!pod && !steal_for_cache)
-        goto out_unlock;
+        goto out_resume;
 
     if ( !nonpod )
     {
@@ -623,6 +628,9 @@ out_entry_check:
         p2m_pod_set_cache_target(p2m, p2m->pod.entry_count, 0/*can't preempt*/);
     }
 
+out_resume:
+    p2m_batch_resume(p2m);
+
 out_unlock:
     pod_unlock(p2m);
     gfn_unlock(p2m, gpfn, order);
@@ -65,6 +65,7 @@ static int p2m_initialise(struct domain *d, struct p2m_domain *p2m)
     mm_lock_init(&p2m->pod.lock);
     INIT_LIST_HEAD(&p2m->np2m_list);
     INIT_PAGE_LIST_HEAD(&p2m->pages);
+    INIT_PAGE_LIST_HEAD(&p2m->batch.ptps);
     INIT_PAGE_LIST_HEAD(&p2m->pod.super);
     INIT_PAGE_LIST_HEAD(&p2m->pod.single);
 
@@ -365,11 +366,107 @@ void p2m_free_ptp(struct p2m_domain *p2m, struct page_info *pg)
     ASSERT(p2m->domain->arch.paging.free_page);
 
     page_list_del(pg, &p2m->pages);
+
+    /* Stale translations may still point into it until the batch flush */
+    if ( p2m_batch_active(p2m) )
+    {
+        page_list_add_tail(pg, &p2m->batch.ptps);
+        return;
+    }
+
     p2m->domain->arch.paging.free_page(p2m->domain, pg);
 
     return;
 }
 
+/* Issue the flush a batch has been deferring, then release what was held
+ * back waiting for it. */
+static void p2m_batch_flush(struct p2m_domain *p2m)
+{
+    struct domain *d = p2m->domain;
+    struct page_info *pg;
+    unsigned int i;
+
+    p2m_lock(p2m);
+
+    if ( p2m->batch.need_flush )
+    {
+        if ( hap_enabled(d) && cpu_has_vmx )
+            ept_sync_domain(p2m);
+        else
+            flush_tlb_mask(d->domain_dirty_cpumask);
+        p2m->batch.need_flush = 0;
+    }
+
+    while ( (pg = page_list_remove_head(&p2m->batch.ptps)) != NULL )
+        d->arch.paging.free_page(d, pg);
+
+    p2m_unlock(p2m);
+
+    for ( i = 0; i < p2m->batch.nr_pages; i++ )
+        put_page(p2m->batch.pages[i]);
+    p2m->batch.nr_pages = 0;
+}
+
+void p2m_batch_begin(struct p2m_domain *p2m)
+{
+    /* Someone else is batching: our updates simply flush as they go */
+    if ( p2m->batch.owner != current &&
+         cmpxchg(&p2m->batch.owner, NULL, current) != NULL )
+        return;
+
+    p2m->batch.depth++;
+}
+
+void p2m_batch_end(struct p2m_domain *p2m)
+{
+    if ( p2m->batch.owner != current )
+        return;
+
+    ASSERT(p2m->batch.depth);
+    if ( --p2m->batch.depth )
+        return;
+
+    ASSERT(!p2m->batch.suspended);
+    p2m_batch_flush(p2m);
+
+    ASSERT(page_list_empty(&p2m->batch.ptps));
+    smp_wmb();
+    p2m->batch.owner = NULL;
+}
+
+void p2m_batch_suspend(struct p2m_domain *p2m)
+{
+    if ( p2m->batch.owner != current )
+        return;
+
+    if ( !p2m->batch.suspended++ )
+        p2m_batch_flush(p2m);
+}
+
+void p2m_batch_resume(struct p2m_domain *p2m)
+{
+    if ( p2m->batch.owner != current )
+        return;
+
+    ASSERT(p2m->batch.suspended);
+    p2m->batch.suspended--;
+}
+
+void p2m_batch_put_page(struct p2m_domain *p2m, struct page_info *page)
+{
+    if ( !p2m_batch_active(p2m) )
+    {
+        put_page(page);
+        return;
+    }
+
+    if ( p2m->batch.nr_pages == P2M_BATCH_PAGES )
+        p2m_batch_flush(p2m);
+
+    p2m->batch.pages[p2m->batch.nr_pages++] = page;
+}
+
 // Allocate a new p2m table for a domain.
 //
 // The structure of the p2m table is that of a pagetable for xen (i.e. it is
@@ -742,6 +839,7 @@ void p2m_change_type_range(struct domain *d,
 
     p2m_lock(p2m);
     p2m->defer_nested_flush = 1;
+    p2m_batch_begin(p2m);
 
     for ( gfn = start; gfn < end; gfn++ )
     {
@@ -750,12 +848,217 @@ void p2m_change_type_range(struct domain *d,
             set_p2m_entry(p2m, gfn, mfn, PAGE_ORDER_4K, nt, p2m->default_access);
     }
 
+    p2m_batch_end(p2m);
     p2m->defer_nested_flush = 0;
     if ( nestedhvm_enabled(d) )
         p2m_flush_nestedp2m(d);
     p2m_unlock(p2m);
 }
 
+/* Only the guest's allocation reference and ours, and no type references */
+static int p2m_coalesce_page_private(struct page_info *page)
+{
+    return ((page->count_info & (PGC_count_mask | PGC_allocated)) ==
+            (2 | PGC_allocated)) &&
+           ((page->u.inuse.type_info & PGT_count_mask) == 0);
+}
+
+/*
+ * p2m_coalesce_superpage - Rebuild a 2M mapping for a fragmented range
+ * @p2m: host p2m, locked by the caller
+ * @gfn: first gfn of a 2M aligned range
+ *
+ * Sharing and paging operate on 4k entries and split superpages as they
+ * go, but nothing ever puts them back together.  Once every gfn in the
+ * range is plain, private RAM again with identical access rights, the
+ * range can be mapped with a single entry.  If the backing mfns happen to
+ * be contiguous and aligned the entries are merged in place.  Otherwise the
+ * contents are moved into a freshly allocated 2M extent, provided the
+ * guest holds the only reference to each of the old pages.  Moving pages
+ * requires the domain to be paused by the caller, and is refused while
+ * the domain has a device assigned that may DMA into the old pages.
+ *
+ * Returns 1 if the range was promoted, 0 if it is not eligible (including
+ * when it already is a superpage, no 2M extent is available, or someone
+ * else took a reference to an old page meanwhile) or a negative errno
+ * value.
+ */
+static int p2m_coalesce_superpage(struct p2m_domain *p2m, unsigned long gfn)
+{
+    struct domain *d = p2m->domain;
+    struct page_info *pg = NULL, *page;
+    unsigned long *old = NULL, base = 0, new, i, j;
+    unsigned int order;
+    p2m_type_t t;
+    p2m_access_t a, base_a = p2m->default_access;
+    mfn_t mfn;
+    int contig = 1;
+    int rc = 0;
+
+    ASSERT(p2m_locked_by_me(p2m));
+
+    for ( i = 0; i < (1UL << PAGE_ORDER_2M); i++ )
+    {
+        order = PAGE_ORDER_4K;
+        mfn = p2m->get_entry(p2m, gfn + i, &t, &a, 0, &order);
+
+        if ( t != p2m_ram_rw || !mfn_valid(mfn) || is_iomem_page(mfn_x(mfn)) )
+            return 0;
+
+        if ( i == 0 )
+        {
+            if ( order >= PAGE_ORDER_2M )
+                return 0;
+            base = mfn_x(mfn);
+            base_a = a;
+            if ( base & ((1UL << PAGE_ORDER_2M) - 1) )
+                contig = 0;
+        }
+        else if ( a != base_a )
+            return 0;
+
+        if ( mfn_x(mfn) != base + i )
+            contig = 0;
+    }
+
+    if ( contig )
+        return set_p2m_entry(p2m, gfn, _mfn(base), PAGE_ORDER_2M,
+                             p2m_ram_rw, base_a) ? 1 : -ENOMEM;
+
+    if ( need_iommu(d) )
+        return 0;
+
+    old = xmalloc_array(unsigned long, 1UL << PAGE_ORDER_2M);
+    if ( old == NULL )
+        return -ENOMEM;
+
+    /* Hold every old page and make sure nobody else does. */
+    for ( i = 0; i < (1UL << PAGE_ORDER_2M); i++ )
+    {
+        old[i] = mfn_x(p2m->get_entry(p2m, gfn + i, &t, &a, 0, NULL));
+        page = mfn_to_page(_mfn(old[i]));
+        if ( !get_page(page, d) )
+            goto out_put;
+
+        if ( !p2m_coalesce_page_private(page) )
+        {
+            put_page(page);
+            goto out_put;
+        }
+    }
+
+    /*
+     * Allocate without an owner, so the extent is not checked against
+     * max_pages while the old pages are still counted.  A fragmented heap
+     * only means this range stays as it is.
+     */
+    pg = alloc_domheap_pages(NULL, PAGE_ORDER_2M, 0);
+    if ( pg == NULL )
+        goto out_put;
+
+    new = mfn_x(page_to_mfn(pg));
+    for ( j = 0; j < (1UL << PAGE_ORDER_2M); j++ )
+        copy_domain_page(new + j, old[j]);
+
+    /*
+     * Hand the extent to the guest uncounted, and account for it here
+     * instead; the old pages drop out of tot_pages once they are freed.
+     */
+    if ( assign_pages(d, pg, PAGE_ORDER_2M, MEMF_no_refcount) )
+    {
+        free_domheap_pages(pg, PAGE_ORDER_2M);
+        goto out_put;
+    }
+    spin_lock(&d->page_alloc_lock);
+    domain_adjust_tot_pages(d, 1UL << PAGE_ORDER_2M);
+    spin_unlock(&d->page_alloc_lock);
+
+    /*
+     * Pausing does not stop foreign mappers, and get_page_from_gfn() does
+     * not take the p2m lock, so somebody may have picked up an old page
+     * since it was checked above.
+     */
+    for ( j = 0; j < (1UL << PAGE_ORDER_2M); j++ )
+        if ( !p2m_coalesce_page_private(mfn_to_page(_mfn(old[j]))) )
+            break;
+
+    if ( j < (1UL << PAGE_ORDER_2M) ||
+         !set_p2m_entry(p2m, gfn, _mfn(new), PAGE_ORDER_2M,
+                        p2m_ram_rw, base_a) )
+    {
+        rc = (j < (1UL << PAGE_ORDER_2M)) ? 0 : -ENOMEM;
+        for ( j = 0; j < (1UL << PAGE_ORDER_2M); j++ )
+            if ( test_and_clear_bit(_PGC_allocated, &pg[j].count_info) )
+                put_page(&pg[j]);
+        goto out_put;
+    }
+
+    for ( j = 0; j < (1UL << PAGE_ORDER_2M); j++ )
+    {
+        set_gpfn_from_mfn(new + j, gfn + j);
+        set_gpfn_from_mfn(old[j], INVALID_M2P_ENTRY);
+
+        /*
+         * Drop the guest's reference.  Scrub only if ours is the last one
+         * left; either way the final put_page() frees the page.
+         */
+        page = mfn_to_page(_mfn(old[j]));
+        if ( test_and_clear_bit(_PGC_allocated, &page->count_info) )
+            put_page(page);
+        if ( (page->count_info & PGC_count_mask) == 1 )
+            scrub_one_page(page);
+    }
+
+    rc = 1;
+
+ out_put:
+    while ( i-- )
+        put_page(mfn_to_page(_mfn(old[i])));
+    xfree(old);
+    return rc;
+}
+
+/**
+ * p2m_coalesce_range - Promote fragmented 2M ranges back to superpages
+ * @d: guest domain, paused by the caller
+ * @start: first gfn, 2M aligned
+ * @nr: number of gfns, a multiple of 2M
+ * @done: in/out number of gfns already processed
+ *
+ * Walks [start + *done, start + nr) in 2M steps and stops early if a
+ * preemption is pending, leaving the caller to resume at *done.
+ */
+int p2m_coalesce_range(struct domain *d, unsigned long start,
+                       unsigned long nr, unsigned long *done)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    int rc = 0;
+
+    if ( !hap_enabled(d) || !hvm_hap_has_2mb(d) || !opt_hap_2mb )
+        return -EOPNOTSUPP;
+
+    if ( ((start | nr) & ((1UL << PAGE_ORDER_2M) - 1)) || start + nr < start )
+        return -EINVAL;
+
+    p2m_lock(p2m);
+
+    while ( *done < nr )
+    {
+        rc = p2m_coalesce_superpage(p2m, start + *done);
+        if ( rc < 0 )
+            break;
+        rc = 0;
+
+        *done += 1UL << PAGE_ORDER_2M;
+        if ( *done < nr && hypercall_preempt_check() )
+            break;
+    }
+
+    p2m_unlock(p2m);
+
+    return rc;
+}
+
 
 
 int
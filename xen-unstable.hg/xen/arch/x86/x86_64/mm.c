@@ -1102,6 +1102,17 @@ long subarch_memory_op(int op, XEN_GUEST_HANDLE_PARAM(void) arg)
             return -EFAULT;
         break;
     }
+    case XENMEM_paging_batch_op:
+    {
+        xen_mem_paging_batch_op_t mpb;
+        if ( copy_from_guest(&mpb, arg, 1) )
+            return -EFAULT;
+        rc = do_mem_event_op(op, mpb.domain, (void *) &mpb);
+        /* Progress is reported even on failure. */
+        if ( __copy_to_guest(arg, &mpb, 1) )
+            return -EFAULT;
+        break;
+    }
     case XENMEM_sharing_op:
     {
         xen_mem_sharing_op_t mso;
@@ -32,6 +32,7 @@ CHECK_gnttab_unmap_and_replace;
 DEFINE_XEN_GUEST_HANDLE(gnttab_setup_table_compat_t);
 DEFINE_XEN_GUEST_HANDLE(gnttab_transfer_compat_t);
 DEFINE_XEN_GUEST_HANDLE(gnttab_copy_compat_t);
+DEFINE_XEN_GUEST_HANDLE(gnttab_copy_segs_compat_t);
 
 #define xen_gnttab_dump_table gnttab_dump_table
 CHECK_gnttab_dump_table;
@@ -94,6 +95,10 @@ int compat_grant_table_op(unsigned int cmd,
     CASE(copy);
 #endif
 
+#ifndef CHECK_gnttab_copy_segs
+    CASE(copy_segs);
+#endif
+
 #ifndef CHECK_gnttab_dump_table
     CASE(dump_table);
 #endif
@@ -122,12 +127,14 @@ int compat_grant_table_op(unsigned int cmd,
             struct gnttab_setup_table *setup;
             struct gnttab_transfer *xfer;
             struct gnttab_copy *copy;
+            struct gnttab_copy_segs *copy_segs;
             struct gnttab_get_status_frames *get_status;
         } nat;
         union {
             struct compat_gnttab_setup_table setup;
             struct compat_gnttab_transfer xfer;
             struct compat_gnttab_copy copy;
+            struct compat_gnttab_copy_segs copy_segs;
             struct compat_gnttab_get_status_frames get_status;
         } cmp;
 
@@ -267,6 +274,52 @@ int compat_grant_table_op(unsigned int cmd,
             }
             break;
 
+        case GNTTABOP_copy_segs:
+            for ( n = 0; n < COMPAT_ARG_XLAT_SIZE / sizeof(*nat.copy_segs) && i < count && rc == 0; ++i, ++n )
+            {
+                if ( unlikely(__copy_from_guest_offset(&cmp.copy_segs, cmp_uop, i, 1)) )
+                    rc = -EFAULT;
+                else
+                {
+                    enum XLAT_gnttab_copy_segs_source_u source_u;
+                    enum XLAT_gnttab_copy_segs_dest_u dest_u;
+
+                    if ( cmp.copy_segs.flags & GNTCOPY_source_gref )
+                        source_u = XLAT_gnttab_copy_segs_source_u_ref;
+                    else
+                        source_u = XLAT_gnttab_copy_segs_source_u_gmfn;
+                    if ( cmp.copy_segs.flags & GNTCOPY_dest_gref )
+                        dest_u = XLAT_gnttab_copy_segs_dest_u_ref;
+                    else
+                        dest_u = XLAT_gnttab_copy_segs_dest_u_gmfn;
+                    XLAT_gnttab_copy_segs(nat.copy_segs + n, &cmp.copy_segs);
+                }
+            }
+            if ( rc == 0 )
+                rc = gnttab_copy_segs(guest_handle_cast(nat.uop, gnttab_copy_segs_t), n);
+            if ( rc > 0 )
+            {
+                ASSERT(rc < n);
+                i -= n - rc;
+                n = rc;
+            }
+            if ( rc >= 0 )
+            {
+                XEN_GUEST_HANDLE_PARAM(gnttab_copy_segs_compat_t) copy_segs;
+
+                copy_segs = guest_handle_cast(cmp_uop, gnttab_copy_segs_compat_t);
+                guest_handle_add_offset(copy_segs, i);
+                cnt_uop = guest_handle_cast(copy_segs, void);
+                while ( n-- )
+                {
+                    guest_handle_add_offset(copy_segs, -1);
+                    if ( __copy_field_to_guest(copy_segs, nat.copy_segs + n, status) ||
+                         __copy_field_to_guest(copy_segs, nat.copy_segs + n, nr_done) )
+                        rc = -EFAULT;
+                }
+            }
+            break;
+
         case GNTTABOP_get_status_frames: {
             unsigned int max_frame_list_size_in_pages =
                 (COMPAT_ARG_XLAT_SIZE - sizeof(*nat.get_status)) /
@@ -122,6 +122,8 @@ struct vcpu *alloc_vcpu(
 
     spin_lock_init(&v->virq_lock);
 
+    grant_table_init_vcpu(v);
+
     tasklet_init(&v->continue_hypercall_tasklet, NULL, 0);
 
     if ( !zalloc_cpumask_var(&v->cpu_affinity) ||
@@ -559,6 +561,9 @@ void __domain_crash_synchronous(void)
 
     vcpu_end_shutdown_deferral(current);
 
+    /* This vcpu won't get back to the end of its (multi)call. */
+    gnttab_flush_deferred_unmaps();
+
     for ( ; ; )
         do_softirq();
 }
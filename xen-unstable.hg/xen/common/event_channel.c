@@ -21,15 +21,18 @@
 #include <xen/errno.h>
 #include <xen/sched.h>
 #include <xen/event.h>
+#include <xen/event_fifo.h>
 #include <xen/irq.h>
 #include <xen/iocap.h>
 #include <xen/compat.h>
 #include <xen/guest_access.h>
 #include <xen/keyhandler.h>
+#include <xen/timer.h>
 #include <asm/current.h>
 
 #include <public/xen.h>
 #include <public/event_channel.h>
+#include <public/sysctl.h>
 #include <xsm/xsm.h>
 
 #define ERROR_EXIT(_errno)                                          \
@@ -94,7 +97,48 @@ static uint8_t get_xen_consumer(xen_event_channel_notification_t fn)
 /* Get the notification function for a given Xen-bound event channel. */
 #define xen_notification_fn(e) (xen_consumers[(e)->xen_consumer-1])
 
-static void evtchn_set_pending(struct vcpu *v, int port);
+/*
+ * Each channel has a lock of its own, which protects its state, binding
+ * and notify VCPU against the send paths: those take only the lock of the
+ * channel they send on, not the domain's event_lock.  Binding, closing and
+ * rebinding take the domain's event_lock (for port allocation and the
+ * PIRQ/VIRQ tables) and then the lock of every channel they change, both
+ * ends of an interdomain channel together.  PIRQs and VIRQs raise events
+ * from IRQ context, so the channel locks are IRQ-safe.
+ */
+static unsigned long double_evtchn_lock(struct evtchn *lchn,
+                                        struct evtchn *rchn)
+{
+    unsigned long flags;
+
+    if ( lchn > rchn )
+    {
+        struct evtchn *tmp = lchn;
+
+        lchn = rchn;
+        rchn = tmp;
+    }
+
+    spin_lock_irqsave(&lchn->lock, flags);
+    if ( lchn != rchn )
+        spin_lock(&rchn->lock);
+
+    return flags;
+}
+
+static void double_evtchn_unlock(struct evtchn *lchn, struct evtchn *rchn,
+                                 unsigned long flags)
+{
+    if ( lchn != rchn )
+        spin_unlock(&lchn->lock);
+    spin_unlock_irqrestore(&rchn->lock, flags);
+}
+
+/* Called with the lock of the channel, or of its interdomain peer, held. */
+static void evtchn_set_pending(struct vcpu *v, int port)
+{
+    evtchn_port_set_pending(v, evtchn_from_port(v->domain, port));
+}
 
 static int virq_is_global(uint32_t virq)
 {
@@ -121,37 +165,84 @@ static int virq_is_global(uint32_t virq)
 }
 
 
+static struct evtchn *alloc_evtchn_bucket(struct domain *d, unsigned int port)
+{
+    struct evtchn *chn;
+    unsigned int i;
+
+    chn = xzalloc_array(struct evtchn, EVTCHNS_PER_BUCKET);
+    if ( !chn )
+        return NULL;
+
+    for ( i = 0; i < EVTCHNS_PER_BUCKET; i++ )
+    {
+        if ( xsm_alloc_security_evtchn(&chn[i]) )
+        {
+            while ( i-- )
+                xsm_free_security_evtchn(&chn[i]);
+            xfree(chn);
+            return NULL;
+        }
+        chn[i].port = port + i;
+        spin_lock_init(&chn[i].lock);
+    }
+
+    return chn;
+}
+
+static void free_evtchn_bucket(struct domain *d, struct evtchn *bucket)
+{
+    unsigned int i;
+
+    if ( !bucket )
+        return;
+
+    for ( i = 0; i < EVTCHNS_PER_BUCKET; i++ )
+        xsm_free_security_evtchn(&bucket[i]);
+
+    xfree(bucket);
+}
+
 static int get_free_port(struct domain *d)
 {
     struct evtchn *chn;
+    struct evtchn **grp;
     int            port;
-    int            i, j;
 
     if ( d->is_dying )
         return -EINVAL;
 
     for ( port = 0; port_is_valid(d, port); port++ )
-        if ( evtchn_from_port(d, port)->state == ECS_FREE )
+    {
+        chn = evtchn_from_port(d, port);
+        if ( chn->state == ECS_FREE && !evtchn_port_is_busy(d, chn) )
+        {
+            memset(&chn->stats, 0, sizeof(chn->stats));
+            evtchn_port_init(d, chn);
             return port;
+        }
+    }
 
     if ( port == MAX_EVTCHNS(d) )
         return -ENOSPC;
 
-    chn = xzalloc_array(struct evtchn, EVTCHNS_PER_BUCKET);
+    if ( unlikely(group_from_port(d, port) == NULL) )
+    {
+        grp = xzalloc_array(struct evtchn *, BUCKETS_PER_GROUP);
+        if ( unlikely(grp == NULL) )
+            return -ENOMEM;
+        /* Lock-free readers (port_is_valid()) may see the group early. */
+        smp_wmb();
+        group_from_port(d, port) = grp;
+    }
+
+    chn = alloc_evtchn_bucket(d, port);
     if ( unlikely(chn == NULL) )
         return -ENOMEM;
+    smp_wmb();
     bucket_from_port(d, port) = chn;
 
-    for ( i = 0; i < EVTCHNS_PER_BUCKET; i++ )
-    {
-        if ( xsm_alloc_security_evtchn(&chn[i]) )
-        {
-            for ( j = 0; j < i; j++ )
-                xsm_free_security_evtchn(&chn[j]);
-            xfree(chn);
-            return -ENOMEM;
-        }
-    }
+    evtchn_port_init(d, chn);
 
     return port;
 }
@@ -163,6 +254,7 @@ static long evtchn_alloc_unbound(evtchn_alloc_unbound_t *alloc)
     struct domain *d;
     int            port;
     domid_t        dom = alloc->dom;
+    unsigned long  flags;
     long           rc;
 
     d = rcu_lock_domain_by_any_id(dom);
@@ -179,10 +271,14 @@ static long evtchn_alloc_unbound(evtchn_alloc_unbound_t *alloc)
     if ( rc )
         goto out;
 
+    spin_lock_irqsave(&chn->lock, flags);
+
     chn->state = ECS_UNBOUND;
     if ( (chn->u.unbound.remote_domid = alloc->remote_dom) == DOMID_SELF )
         chn->u.unbound.remote_domid = current->domain->domain_id;
 
+    spin_unlock_irqrestore(&chn->lock, flags);
+
     alloc->port = port;
 
  out:
@@ -199,6 +295,7 @@ static long evtchn_bind_interdomain(evtchn_bind_interdomain_t *bind)
     struct domain *ld = current->domain, *rd;
     int            lport, rport = bind->remote_port;
     domid_t        rdom = bind->remote_dom;
+    unsigned long  flags;
     long           rc;
 
     if ( rdom == DOMID_SELF )
@@ -235,12 +332,14 @@ static long evtchn_bind_interdomain(evtchn_bind_interdomain_t *bind)
     if ( rc )
         goto out;
 
+    flags = double_evtchn_lock(lchn, rchn);
+
     lchn->u.interdomain.remote_dom  = rd;
-    lchn->u.interdomain.remote_port = (u16)rport;
+    lchn->u.interdomain.remote_port = rport;
     lchn->state                     = ECS_INTERDOMAIN;
     
     rchn->u.interdomain.remote_dom  = ld;
-    rchn->u.interdomain.remote_port = (u16)lport;
+    rchn->u.interdomain.remote_port = lport;
     rchn->state                     = ECS_INTERDOMAIN;
 
     /*
@@ -249,6 +348,8 @@ static long evtchn_bind_interdomain(evtchn_bind_interdomain_t *bind)
      */
     evtchn_set_pending(ld->vcpu[lchn->notify_vcpu_id], lport);
 
+    double_evtchn_unlock(lchn, rchn, flags);
+
     bind->local_port = lport;
 
  out:
@@ -268,6 +369,7 @@ static long evtchn_bind_virq(evtchn_bind_virq_t *bind)
     struct vcpu   *v;
     struct domain *d = current->domain;
     int            port, virq = bind->virq, vcpu = bind->vcpu;
+    unsigned long  flags;
     long           rc = 0;
 
     if ( (virq < 0) || (virq >= ARRAY_SIZE(v->virq_to_evtchn)) )
@@ -289,10 +391,15 @@ static long evtchn_bind_virq(evtchn_bind_virq_t *bind)
         ERROR_EXIT(port);
 
     chn = evtchn_from_port(d, port);
+
+    spin_lock_irqsave(&chn->lock, flags);
+
     chn->state          = ECS_VIRQ;
     chn->notify_vcpu_id = vcpu;
     chn->u.virq         = virq;
 
+    spin_unlock_irqrestore(&chn->lock, flags);
+
     v->virq_to_evtchn[virq] = bind->port = port;
 
  out:
@@ -307,6 +414,7 @@ static long evtchn_bind_ipi(evtchn_bind_ipi_t *bind)
     struct evtchn *chn;
     struct domain *d = current->domain;
     int            port, vcpu = bind->vcpu;
+    unsigned long  flags;
     long           rc = 0;
 
     if ( (vcpu < 0) || (vcpu >= d->max_vcpus) ||
@@ -319,9 +427,14 @@ static long evtchn_bind_ipi(evtchn_bind_ipi_t *bind)
         ERROR_EXIT(port);
 
     chn = evtchn_from_port(d, port);
+
+    spin_lock_irqsave(&chn->lock, flags);
+
     chn->state          = ECS_IPI;
     chn->notify_vcpu_id = vcpu;
 
+    spin_unlock_irqrestore(&chn->lock, flags);
+
     bind->port = port;
 
  out:
@@ -363,6 +476,7 @@ static long evtchn_bind_pirq(evtchn_bind_pirq_t *bind)
     struct vcpu   *v = d->vcpu[0];
     struct pirq   *info;
     int            port, pirq = bind->pirq;
+    unsigned long  flags;
     long           rc;
 
     if ( (pirq < 0) || (pirq >= d->nr_pirqs) )
@@ -396,10 +510,14 @@ static long evtchn_bind_pirq(evtchn_bind_pirq_t *bind)
         goto out;
     }
 
+    spin_lock_irqsave(&chn->lock, flags);
+
     chn->state  = ECS_PIRQ;
     chn->u.pirq.irq = pirq;
     link_pirq_port(port, chn, v);
 
+    spin_unlock_irqrestore(&chn->lock, flags);
+
     bind->port = port;
 
 #ifdef CONFIG_X86
@@ -414,12 +532,65 @@ static long evtchn_bind_pirq(evtchn_bind_pirq_t *bind)
 }
 
 
+/*
+ * Per-port rate limit on sends (XEN_SYSCTL_EVTCHNOP_set_ratelimit).  It is
+ * allocated when first set on a bound port and freed when removed or when
+ * the port is closed, and is only looked at under the channel's lock.
+ */
+struct evtchn_ratelimit {
+    struct domain *domain;
+    struct evtchn *chn;
+    struct timer   timer;      /* Raises the coalesced notification. */
+    s_time_t       period;
+    unsigned int   burst;
+    s_time_t       window;     /* Start of the current period. */
+    unsigned int   count;      /* Sends let through in this period. */
+    bool_t         deferred;   /* A notification waits for the timer. */
+};
+
+static void evtchn_ratelimit_free(struct evtchn_ratelimit *rl)
+{
+    if ( rl == NULL )
+        return;
+
+    /* The timer takes the channel's lock, so no lock may be held here. */
+    kill_timer(&rl->timer);
+    xfree(rl);
+}
+
+/*
+ * Called with the domain's event lock and the channel's lock held.  Returns
+ * the port's rate limit, which the caller frees with evtchn_ratelimit_free()
+ * once it has dropped the locks.
+ */
+static struct evtchn_ratelimit *free_evtchn(struct domain *d,
+                                            struct evtchn *chn)
+{
+    struct evtchn_ratelimit *rl = chn->ratelimit;
+
+    /* Clear pending event to avoid unexpected behavior on re-bind. */
+    evtchn_port_clear_pending(d, chn);
+
+    /* Reset binding to vcpu0 when the channel is freed. */
+    chn->state          = ECS_FREE;
+    chn->notify_vcpu_id = 0;
+
+    /* The rate limit goes with the binding, along with any held back send. */
+    chn->ratelimit = NULL;
+
+    xsm_evtchn_close_post(chn);
+
+    return rl;
+}
+
 static long __evtchn_close(struct domain *d1, int port1)
 {
     struct domain *d2 = NULL;
     struct vcpu   *v;
     struct evtchn *chn1, *chn2;
+    struct evtchn_ratelimit *rl = NULL;
     int            port2;
+    unsigned long  flags;
     long           rc = 0;
 
  again:
@@ -520,22 +691,24 @@ static long __evtchn_close(struct domain *d1, int port1)
         BUG_ON(chn2->state != ECS_INTERDOMAIN);
         BUG_ON(chn2->u.interdomain.remote_dom != d1);
 
+        flags = double_evtchn_lock(chn1, chn2);
+
         chn2->state = ECS_UNBOUND;
         chn2->u.unbound.remote_domid = d1->domain_id;
-        break;
+
+        rl = free_evtchn(d1, chn1);
+
+        double_evtchn_unlock(chn1, chn2, flags);
+
+        goto out;
 
     default:
         BUG();
     }
 
-    /* Clear pending event to avoid unexpected behavior on re-bind. */
-    clear_bit(port1, &shared_info(d1, evtchn_pending));
-
-    /* Reset binding to vcpu0 when the channel is freed. */
-    chn1->state          = ECS_FREE;
-    chn1->notify_vcpu_id = 0;
-
-    xsm_evtchn_close_post(chn1);
+    spin_lock_irqsave(&chn1->lock, flags);
+    rl = free_evtchn(d1, chn1);
+    spin_unlock_irqrestore(&chn1->lock, flags);
 
  out:
     if ( d2 != NULL )
@@ -547,6 +720,8 @@ static long __evtchn_close(struct domain *d1, int port1)
 
     spin_unlock(&d1->event_lock);
 
+    evtchn_ratelimit_free(rl);
+
     return rc;
 }
 
@@ -556,28 +731,117 @@ static long evtchn_close(evtchn_close_t *close)
     return __evtchn_close(current->domain, close->port);
 }
 
-int evtchn_send(struct domain *d, unsigned int lport)
+/* Raise a send on a bound port.  Called with the channel's lock held. */
+static void evtchn_deliver(struct domain *ld, struct evtchn *lchn)
 {
-    struct evtchn *lchn, *rchn;
-    struct domain *ld = d, *rd;
+    struct evtchn *rchn;
+    struct domain *rd;
     struct vcpu   *rvcpu;
-    int            rport, ret = 0;
+    int            rport;
+
+    switch ( lchn->state )
+    {
+    case ECS_INTERDOMAIN:
+        rd    = lchn->u.interdomain.remote_dom;
+        rport = lchn->u.interdomain.remote_port;
+        rchn  = evtchn_from_port(rd, rport);
+        rvcpu = rd->vcpu[rchn->notify_vcpu_id];
+        if ( consumer_is_xen(rchn) )
+            (*xen_notification_fn(rchn))(rvcpu, rport);
+        else
+            evtchn_set_pending(rvcpu, rport);
+        break;
+    case ECS_IPI:
+        evtchn_set_pending(ld->vcpu[lchn->notify_vcpu_id], lchn->port);
+        break;
+    }
+}
 
-    spin_lock(&ld->event_lock);
+/*
+ * Let at most rl->burst sends through per period; later ones are coalesced
+ * into one notification raised by the timer at the end of the period.
+ * Returns 1 if the send was held back.  Called with the channel's lock held.
+ */
+static bool_t evtchn_ratelimit(struct evtchn *chn)
+{
+    struct evtchn_ratelimit *rl = chn->ratelimit;
+    s_time_t now = NOW();
 
-    if ( unlikely(!port_is_valid(ld, lport)) )
+    if ( rl->deferred )
+        goto defer;
+
+    if ( now - rl->window >= rl->period )
     {
-        spin_unlock(&ld->event_lock);
-        return -EINVAL;
+        rl->window = now;
+        rl->count = 0;
+    }
+
+    if ( rl->count < rl->burst )
+    {
+        rl->count++;
+        return 0;
+    }
+
+    rl->deferred = 1;
+    set_timer(&rl->timer, rl->window + rl->period);
+
+ defer:
+    chn->stats.deferred++;
+    return 1;
+}
+
+static void evtchn_ratelimit_fn(void *data)
+{
+    struct evtchn_ratelimit *rl = data;
+    struct evtchn *chn = rl->chn;
+    unsigned long flags;
+
+    spin_lock_irqsave(&chn->lock, flags);
+
+    if ( chn->ratelimit == rl && rl->deferred )
+    {
+        rl->deferred = 0;
+        /* The coalesced notification counts against the next period. */
+        rl->window = NOW();
+        rl->count = 1;
+        evtchn_deliver(rl->domain, chn);
     }
 
+    spin_unlock_irqrestore(&chn->lock, flags);
+}
+
+static void evtchn_ratelimit_clear(struct evtchn *chn)
+{
+    struct evtchn_ratelimit *rl;
+    unsigned long flags;
+
+    spin_lock_irqsave(&chn->lock, flags);
+    rl = chn->ratelimit;
+    chn->ratelimit = NULL;
+    spin_unlock_irqrestore(&chn->lock, flags);
+
+    evtchn_ratelimit_free(rl);
+}
+
+int evtchn_send(struct domain *d, unsigned int lport)
+{
+    struct evtchn *lchn;
+    struct domain *ld = d;
+    int            ret = 0;
+    unsigned long  flags;
+
+    if ( unlikely(!port_is_valid(ld, lport)) )
+        return -EINVAL;
+
     lchn = evtchn_from_port(ld, lport);
 
+    spin_lock_irqsave(&lchn->lock, flags);
+
     /* Guest cannot send via a Xen-attached event channel. */
     if ( unlikely(consumer_is_xen(lchn)) )
     {
-        spin_unlock(&ld->event_lock);
-        return -EINVAL;
+        ret = -EINVAL;
+        goto out;
     }
 
     ret = xsm_evtchn_send(XSM_HOOK, ld, lchn);
@@ -587,17 +851,11 @@ int evtchn_send(struct domain *d, unsigned int lport)
     switch ( lchn->state )
     {
     case ECS_INTERDOMAIN:
-        rd    = lchn->u.interdomain.remote_dom;
-        rport = lchn->u.interdomain.remote_port;
-        rchn  = evtchn_from_port(rd, rport);
-        rvcpu = rd->vcpu[rchn->notify_vcpu_id];
-        if ( consumer_is_xen(rchn) )
-            (*xen_notification_fn(rchn))(rvcpu, rport);
-        else
-            evtchn_set_pending(rvcpu, rport);
-        break;
     case ECS_IPI:
-        evtchn_set_pending(ld->vcpu[lchn->notify_vcpu_id], lport);
+        lchn->stats.sent++;
+        if ( unlikely(lchn->ratelimit != NULL) && evtchn_ratelimit(lchn) )
+            break;
+        evtchn_deliver(ld, lchn);
         break;
     case ECS_UNBOUND:
         /* silently drop the notification */
@@ -607,33 +865,16 @@ int evtchn_send(struct domain *d, unsigned int lport)
     }
 
 out:
-    spin_unlock(&ld->event_lock);
+    spin_unlock_irqrestore(&lchn->lock, flags);
 
     return ret;
 }
 
-static void evtchn_set_pending(struct vcpu *v, int port)
+void evtchn_check_pollers(struct domain *d, unsigned int port)
 {
-    struct domain *d = v->domain;
-    int vcpuid;
-
-    /*
-     * The following bit operations must happen in strict order.
-     * NB. On x86, the atomic bit operations also act as memory barriers.
-     * There is therefore sufficiently strict ordering for this architecture --
-     * others may require explicit memory barriers.
-     */
-
-    if ( test_and_set_bit(port, &shared_info(d, evtchn_pending)) )
-        return;
+    struct vcpu *v;
+    unsigned int vcpuid;
 
-    if ( !test_bit        (port, &shared_info(d, evtchn_mask)) &&
-         !test_and_set_bit(port / BITS_PER_EVTCHN_WORD(d),
-                           &vcpu_info(v, evtchn_pending_sel)) )
-    {
-        vcpu_mark_events_pending(v);
-    }
-    
     /* Check if some VCPU might be polling for this event. */
     if ( likely(bitmap_empty(d->poll_mask, d->max_vcpus)) )
         return;
@@ -662,6 +903,7 @@ void send_guest_vcpu_virq(struct vcpu *v, uint32_t virq)
 {
     unsigned long flags;
     int port;
+    struct evtchn *chn;
 
     ASSERT(!virq_is_global(virq));
 
@@ -671,7 +913,10 @@ void send_guest_vcpu_virq(struct vcpu *v, uint32_t virq)
     if ( unlikely(port == 0) )
         goto out;
 
+    chn = evtchn_from_port(v->domain, port);
+    spin_lock(&chn->lock);
     evtchn_set_pending(v, port);
+    spin_unlock(&chn->lock);
 
  out:
     spin_unlock_irqrestore(&v->virq_lock, flags);
@@ -700,7 +945,9 @@ static void send_guest_global_virq(struct domain *d, uint32_t virq)
         goto out;
 
     chn = evtchn_from_port(d, port);
+    spin_lock(&chn->lock);
     evtchn_set_pending(d->vcpu[chn->notify_vcpu_id], port);
+    spin_unlock(&chn->lock);
 
  out:
     spin_unlock_irqrestore(&v->virq_lock, flags);
@@ -710,6 +957,7 @@ void send_guest_pirq(struct domain *d, const struct pirq *pirq)
 {
     int port;
     struct evtchn *chn;
+    unsigned long flags;
 
     /*
      * PV guests: It should not be possible to race with __evtchn_close(). The
@@ -724,7 +972,9 @@ void send_guest_pirq(struct domain *d, const struct pirq *pirq)
     }
 
     chn = evtchn_from_port(d, port);
+    spin_lock_irqsave(&chn->lock, flags);
     evtchn_set_pending(d->vcpu[chn->notify_vcpu_id], port);
+    spin_unlock_irqrestore(&chn->lock, flags);
 }
 
 static struct domain *global_virq_handlers[NR_VIRQS] __read_mostly;
@@ -861,6 +1111,7 @@ long evtchn_bind_vcpu(unsigned int port, unsigned int vcpu_id)
 {
     struct domain *d = current->domain;
     struct evtchn *chn;
+    unsigned long  flags;
     long           rc = 0;
 
     if ( (vcpu_id >= d->max_vcpus) || (d->vcpu[vcpu_id] == NULL) )
@@ -883,6 +1134,8 @@ long evtchn_bind_vcpu(unsigned int port, unsigned int vcpu_id)
         goto out;
     }
 
+    spin_lock_irqsave(&chn->lock, flags);
+
     switch ( chn->state )
     {
     case ECS_VIRQ:
@@ -909,6 +1162,8 @@ long evtchn_bind_vcpu(unsigned int port, unsigned int vcpu_id)
         break;
     }
 
+    spin_unlock_irqrestore(&chn->lock, flags);
+
  out:
     spin_unlock(&d->event_lock);
 
@@ -919,28 +1174,49 @@ long evtchn_bind_vcpu(unsigned int port, unsigned int vcpu_id)
 int evtchn_unmask(unsigned int port)
 {
     struct domain *d = current->domain;
-    struct vcpu   *v;
+    struct evtchn *chn;
+    unsigned long flags;
 
     ASSERT(spin_is_locked(&d->event_lock));
 
     if ( unlikely(!port_is_valid(d, port)) )
         return -EINVAL;
 
-    v = d->vcpu[evtchn_from_port(d, port)->notify_vcpu_id];
+    chn = evtchn_from_port(d, port);
 
-    /*
-     * These operations must happen in strict order. Based on
-     * include/xen/event.h:evtchn_set_pending(). 
-     */
-    if ( test_and_clear_bit(port, &shared_info(d, evtchn_mask)) &&
-         test_bit          (port, &shared_info(d, evtchn_pending)) &&
-         !test_and_set_bit (port / BITS_PER_EVTCHN_WORD(d),
-                            &vcpu_info(v, evtchn_pending_sel)) )
+    spin_lock_irqsave(&chn->lock, flags);
+    evtchn_port_unmask(d, chn);
+    spin_unlock_irqrestore(&chn->lock, flags);
+
+    return 0;
+}
+
+
+static long evtchn_set_priority(const struct evtchn_set_priority *set_priority)
+{
+    struct domain *d = current->domain;
+    unsigned int port = set_priority->port;
+    struct evtchn *chn;
+    unsigned long flags;
+    long rc;
+
+    spin_lock(&d->event_lock);
+
+    if ( !port_is_valid(d, port) )
     {
-        vcpu_mark_events_pending(v);
+        spin_unlock(&d->event_lock);
+        return -EINVAL;
     }
 
-    return 0;
+    chn = evtchn_from_port(d, port);
+
+    spin_lock_irqsave(&chn->lock, flags);
+    rc = evtchn_port_set_priority(d, chn, set_priority->priority);
+    spin_unlock_irqrestore(&chn->lock, flags);
+
+    spin_unlock(&d->event_lock);
+
+    return rc;
 }
 
 
@@ -958,10 +1234,48 @@ static long evtchn_reset(evtchn_reset_t *r)
     if ( rc )
         goto out;
 
+    /*
+     * A running domain could bind new ports while the old ones are being
+     * closed, so another domain's ports may only be reset while it is
+     * paused.
+     */
+    if ( d != current->domain && !d->is_paused_by_controller )
+    {
+        rc = -EINVAL;
+        goto out;
+    }
+
     for ( i = 0; port_is_valid(d, i); i++ )
         (void)__evtchn_close(d, i);
 
-    rc = 0;
+    spin_lock(&d->event_lock);
+
+    /*
+     * Ports bound since they were closed above (by another vcpu, or by
+     * the peer of an interdomain channel) must not outlive the reset:
+     * after a switch back to the 2-level ABI they may lie beyond its
+     * bitmaps.  Xen's own ports stay, unless the ABI changes under them.
+     */
+    for ( i = 0; port_is_valid(d, i); i++ )
+    {
+        struct evtchn *chn = evtchn_from_port(d, i);
+
+        if ( chn->state != ECS_FREE && chn->state != ECS_RESERVED &&
+             (!consumer_is_xen(chn) || d->evtchn_fifo) )
+        {
+            rc = -EAGAIN;
+            break;
+        }
+    }
+
+    if ( !rc && d->evtchn_fifo )
+    {
+        /* Back to the 2-level ABI the domain started with. */
+        evtchn_2l_init(d);
+        evtchn_fifo_destroy(d);
+    }
+
+    spin_unlock(&d->event_lock);
 
 out:
     rcu_unlock_domain(d);
@@ -1078,6 +1392,32 @@ long do_event_channel_op(int cmd, XEN_GUEST_HANDLE_PARAM(void) arg)
         break;
     }
 
+    case EVTCHNOP_init_control: {
+        struct evtchn_init_control init_control;
+        if ( copy_from_guest(&init_control, arg, 1) != 0 )
+            return -EFAULT;
+        rc = evtchn_fifo_init_control(&init_control);
+        if ( !rc && __copy_to_guest(arg, &init_control, 1) )
+            rc = -EFAULT;
+        break;
+    }
+
+    case EVTCHNOP_expand_array: {
+        struct evtchn_expand_array expand_array;
+        if ( copy_from_guest(&expand_array, arg, 1) != 0 )
+            return -EFAULT;
+        rc = evtchn_fifo_expand_array(&expand_array);
+        break;
+    }
+
+    case EVTCHNOP_set_priority: {
+        struct evtchn_set_priority set_priority;
+        if ( copy_from_guest(&set_priority, arg, 1) != 0 )
+            return -EFAULT;
+        rc = evtchn_set_priority(&set_priority);
+        break;
+    }
+
     default:
         rc = -ENOSYS;
         break;
@@ -1094,6 +1434,7 @@ int alloc_unbound_xen_event_channel(
     struct evtchn *chn;
     struct domain *d = local_vcpu->domain;
     int            port, rc;
+    unsigned long  flags;
 
     spin_lock(&d->event_lock);
 
@@ -1103,11 +1444,15 @@ int alloc_unbound_xen_event_channel(
 
     rc = xsm_evtchn_unbound(XSM_TARGET, d, chn, remote_domid);
 
+    spin_lock_irqsave(&chn->lock, flags);
+
     chn->state = ECS_UNBOUND;
     chn->xen_consumer = get_xen_consumer(notification_fn);
     chn->notify_vcpu_id = local_vcpu->vcpu_id;
     chn->u.unbound.remote_domid = !rc ? remote_domid : DOMID_INVALID;
 
+    spin_unlock_irqrestore(&chn->lock, flags);
+
  out:
     spin_unlock(&d->event_lock);
 
@@ -1145,33 +1490,34 @@ void notify_via_xen_event_channel(struct domain *ld, int lport)
     struct evtchn *lchn, *rchn;
     struct domain *rd;
     int            rport;
-
-    spin_lock(&ld->event_lock);
+    unsigned long  flags;
 
     if ( unlikely(ld->is_dying) )
-    {
-        spin_unlock(&ld->event_lock);
         return;
-    }
 
     ASSERT(port_is_valid(ld, lport));
     lchn = evtchn_from_port(ld, lport);
-    ASSERT(consumer_is_xen(lchn));
+
+    spin_lock_irqsave(&lchn->lock, flags);
 
     if ( likely(lchn->state == ECS_INTERDOMAIN) )
     {
+        ASSERT(consumer_is_xen(lchn));
+        lchn->stats.sent++;
         rd    = lchn->u.interdomain.remote_dom;
         rport = lchn->u.interdomain.remote_port;
         rchn  = evtchn_from_port(rd, rport);
         evtchn_set_pending(rd->vcpu[rchn->notify_vcpu_id], rport);
     }
 
-    spin_unlock(&ld->event_lock);
+    spin_unlock_irqrestore(&lchn->lock, flags);
 }
 
 
 int evtchn_init(struct domain *d)
 {
+    evtchn_2l_init(d);
+
     spin_lock_init(&d->event_lock);
     if ( get_free_port(d) != 0 )
         return -EINVAL;
@@ -1203,14 +1549,10 @@ void evtchn_destroy(struct domain *d)
         (void)__evtchn_close(d, i);
     }
 
-    /* Free all event-channel buckets. */
+    /* The guest pages of the FIFO ABI must go before the domain's memory. */
     spin_lock(&d->event_lock);
-    for ( i = 0; i < NR_EVTCHN_BUCKETS; i++ )
-    {
-        xsm_free_security_evtchn(d->evtchn[i]);
-        xfree(d->evtchn[i]);
-        d->evtchn[i] = NULL;
-    }
+    evtchn_2l_init(d);
+    evtchn_fifo_destroy(d);
     spin_unlock(&d->event_lock);
 
     clear_global_virq_handlers(d);
@@ -1219,6 +1561,23 @@ void evtchn_destroy(struct domain *d)
 
 void evtchn_destroy_final(struct domain *d)
 {
+    unsigned int i, j;
+
+    /*
+     * The buckets stay around until now: the send paths look ports up
+     * without the domain's event lock, and may still do so while the
+     * domain is dying.
+     */
+    for ( i = 0; i < NR_EVTCHN_GROUPS; i++ )
+    {
+        if ( !d->evtchn_group[i] )
+            continue;
+        for ( j = 0; j < BUCKETS_PER_GROUP; j++ )
+            free_evtchn_bucket(d, d->evtchn_group[i][j]);
+        xfree(d->evtchn_group[i]);
+        d->evtchn_group[i] = NULL;
+    }
+
 #if MAX_VIRT_CPUS > BITS_PER_LONG
     xfree(d->poll_mask);
     d->poll_mask = NULL;
@@ -1226,6 +1585,195 @@ void evtchn_destroy_final(struct domain *d)
 }
 
 
+static uint8_t evtchn_stat_status(const struct evtchn *chn)
+{
+    switch ( chn->state )
+    {
+    case ECS_UNBOUND:
+        return EVTCHNSTAT_unbound;
+    case ECS_INTERDOMAIN:
+        return EVTCHNSTAT_interdomain;
+    case ECS_PIRQ:
+        return EVTCHNSTAT_pirq;
+    case ECS_VIRQ:
+        return EVTCHNSTAT_virq;
+    case ECS_IPI:
+        return EVTCHNSTAT_ipi;
+    default:
+        return EVTCHNSTAT_closed;
+    }
+}
+
+static long evtchn_get_stats(struct domain *d, struct xen_sysctl_evtchn_op *op)
+{
+    struct xen_sysctl_evtchn_stats st;
+    unsigned int port = op->u.get_stats.start_port, nr = 0, scanned = 0;
+    long rc = 0;
+
+    spin_lock(&d->event_lock);
+
+    for ( ; port_is_valid(d, port) && nr < op->u.get_stats.nr_ports;
+          port++, scanned++ )
+    {
+        struct evtchn *chn = evtchn_from_port(d, port);
+        unsigned long flags;
+
+        /* Closed ports cost a scan too; resuming at port makes progress. */
+        if ( scanned && !(scanned & 0xff) && hypercall_preempt_check() )
+            break;
+
+        spin_lock_irqsave(&chn->lock, flags);
+
+        if ( (chn->state == ECS_FREE || chn->state == ECS_RESERVED) &&
+             chn->ratelimit == NULL )
+        {
+            spin_unlock_irqrestore(&chn->lock, flags);
+            continue;
+        }
+
+        memset(&st, 0, sizeof(st));
+        st.port      = port;
+        st.status    = evtchn_stat_status(chn);
+        st.vcpu      = chn->notify_vcpu_id;
+        st.sent      = chn->stats.sent;
+        st.raised    = chn->stats.raised;
+        st.coalesced = chn->stats.coalesced;
+        st.deferred  = chn->stats.deferred;
+        if ( chn->ratelimit )
+        {
+            st.rl_period_us = chn->ratelimit->period / MICROSECS(1);
+            st.rl_burst     = chn->ratelimit->burst;
+        }
+        if ( op->flags & XEN_SYSCTL_EVTCHN_reset )
+            memset(&chn->stats, 0, sizeof(chn->stats));
+
+        spin_unlock_irqrestore(&chn->lock, flags);
+
+        if ( copy_to_guest_offset(op->u.get_stats.stats, nr, &st, 1) )
+        {
+            rc = -EFAULT;
+            break;
+        }
+        nr++;
+    }
+
+    spin_unlock(&d->event_lock);
+
+    op->u.get_stats.nr_ports = nr;
+    op->u.get_stats.start_port = port_is_valid(d, port) ? port : 0;
+
+    return rc;
+}
+
+static long evtchn_set_ratelimit(struct domain *d, unsigned int port,
+                                 uint32_t period_us, uint32_t burst)
+{
+    struct evtchn *chn;
+    struct evtchn_ratelimit *rl = NULL;
+    struct vcpu *v;
+    unsigned long flags;
+    long rc = 0;
+
+    if ( period_us && !burst )
+        return -EINVAL;
+
+    if ( period_us && (rl = xzalloc(struct evtchn_ratelimit)) == NULL )
+        return -ENOMEM;
+
+    spin_lock(&d->event_lock);
+
+    if ( d->is_dying )
+    {
+        rc = -ESRCH;
+        goto out;
+    }
+
+    if ( !port_is_valid(d, port) )
+    {
+        rc = -EINVAL;
+        goto out;
+    }
+
+    chn = evtchn_from_port(d, port);
+
+    if ( !period_us )
+    {
+        evtchn_ratelimit_clear(chn);
+        goto out;
+    }
+
+    spin_lock_irqsave(&chn->lock, flags);
+
+    /* Only bound ports have a rate limit, see free_evtchn() */
+    if ( chn->state == ECS_FREE || chn->state == ECS_RESERVED )
+    {
+        spin_unlock_irqrestore(&chn->lock, flags);
+        rc = -EINVAL;
+        goto out;
+    }
+
+    if ( chn->ratelimit == NULL )
+    {
+        rl->domain = d;
+        rl->chn = chn;
+        /* Run the timer where the notified vcpu is, if it has one yet. */
+        v = d->vcpu ? d->vcpu[chn->notify_vcpu_id] : NULL;
+        init_timer(&rl->timer, evtchn_ratelimit_fn, rl,
+                   v ? v->processor : smp_processor_id());
+        chn->ratelimit = rl;
+        rl = NULL;
+    }
+    chn->ratelimit->period = MICROSECS(period_us);
+    chn->ratelimit->burst = burst;
+
+    spin_unlock_irqrestore(&chn->lock, flags);
+
+ out:
+    spin_unlock(&d->event_lock);
+
+    xfree(rl);
+
+    return rc;
+}
+
+long evtchn_sysctl(struct xen_sysctl_evtchn_op *op)
+{
+    struct domain *d;
+    long rc;
+
+    d = rcu_lock_domain_by_id(op->domid);
+    if ( d == NULL )
+        return -ESRCH;
+
+    switch ( op->cmd )
+    {
+    case XEN_SYSCTL_EVTCHNOP_get_stats:
+        rc = -EINVAL;
+        if ( op->flags & ~XEN_SYSCTL_EVTCHN_reset )
+            break;
+        rc = evtchn_get_stats(d, op);
+        break;
+
+    case XEN_SYSCTL_EVTCHNOP_set_ratelimit:
+        rc = -EINVAL;
+        if ( op->flags )
+            break;
+        rc = evtchn_set_ratelimit(d, op->u.set_ratelimit.port,
+                                  op->u.set_ratelimit.period_us,
+                                  op->u.set_ratelimit.burst);
+        break;
+
+    default:
+        rc = -ENOSYS;
+        break;
+    }
+
+    rcu_unlock_domain(d);
+
+    return rc;
+}
+
+
 void evtchn_move_pirqs(struct vcpu *v)
 {
     struct domain *d = v->domain;
@@ -1250,9 +1798,10 @@ static void domain_dump_evtchn_info(struct domain *d)
 
     bitmap_scnlistprintf(keyhandler_scratch, sizeof(keyhandler_scratch),
                          d->poll_mask, d->max_vcpus);
-    printk("Event channel information for domain %d:\n"
+    printk("Event channel information for domain %d (%s ABI):\n"
            "Polling vCPUs: {%s}\n"
-           "    port [p/m]\n", d->domain_id, keyhandler_scratch);
+           "    port [p/m/s]\n", d->domain_id,
+           d->evtchn_fifo ? "FIFO" : "2-level", keyhandler_scratch);
 
     spin_lock(&d->event_lock);
 
@@ -1267,10 +1816,12 @@ static void domain_dump_evtchn_info(struct domain *d)
         if ( chn->state == ECS_FREE )
             continue;
 
-        printk("    %4u [%d/%d]: s=%d n=%d x=%d",
+        printk("    %4u [%d/%d/",
                port,
-               !!test_bit(port, &shared_info(d, evtchn_pending)),
-               !!test_bit(port, &shared_info(d, evtchn_mask)),
+               !!evtchn_port_is_pending(d, chn),
+               !!evtchn_port_is_masked(d, chn));
+        evtchn_port_print_state(d, chn);
+        printk("]: s=%d n=%d x=%d",
                chn->state, chn->notify_vcpu_id, chn->xen_consumer);
 
         switch ( chn->state )
@@ -37,6 +37,7 @@
 #include <xen/iommu.h>
 #include <xen/paging.h>
 #include <xen/keyhandler.h>
+#include <xen/multicall.h>
 #include <xsm/xsm.h>
 #include <asm/flushtlb.h>
 
@@ -78,12 +79,33 @@ struct gnttab_unmap_common {
     u16 flags;
     unsigned long frame;
     struct grant_mapping *map;
+    struct domain *ld;
     struct domain *rd;
 };
 
-/* Number of unmap operations that are done between each tlb flush */
+/* Number of unmap operations that are done between preemption checks */
 #define GNTTAB_UNMAP_BATCH_SIZE 32
 
+/*
+ * An unmapped frame may only be released once no TLB can still hold a
+ * mapping of it.  Rather than flushing after every batch of unmaps, the
+ * completions are queued per cpu until the end of the hypercall, or of
+ * the multicall it is part of, and a single flush of the cpus the
+ * unmapping domain has run on covers them all.  If no host mapping was
+ * removed, nothing needs flushing at all.  Each queued unmap records the
+ * domain that did it rather than relying on current, though the queue is
+ * always emptied before that vcpu is switched out.
+ */
+#define GNTTAB_UNMAP_DEFER_SIZE 128
+
+struct gnttab_unmap_deferred {
+    unsigned int nr;
+    unsigned int nr_host;       /* Host mappings removed since the flush */
+    cpumask_t flush_mask;
+    struct gnttab_unmap_common common[GNTTAB_UNMAP_DEFER_SIZE];
+};
+static DEFINE_PER_CPU(struct gnttab_unmap_deferred, gnttab_unmap_deferred);
+
 
 #define PIN_FAIL(_lbl, _rc, _f, _a...)          \
     do {                                        \
@@ -141,12 +163,38 @@ struct active_grant_entry {
                                in the page.                           */
     unsigned      length:16; /* For sub-page grants, the length of the
                                 grant.                                */
+    spinlock_t    lock;      /* lock to protect access of this entry.
+                                see docs/misc/grant-tables.txt for
+                                locking protocol                      */
 };
 
 #define ACGNT_PER_PAGE (PAGE_SIZE / sizeof(struct active_grant_entry))
 #define active_entry(t, e) \
     ((t)->active[(e)/ACGNT_PER_PAGE][(e)%ACGNT_PER_PAGE])
 
+/*
+ * The grant table lock must be held, for reading at least, while an
+ * active entry is locked: it keeps the table from growing or changing
+ * version underneath.
+ */
+static inline struct active_grant_entry *
+active_entry_acquire(struct grant_table *t, grant_ref_t e)
+{
+    struct active_grant_entry *act;
+
+    ASSERT(rw_is_locked(&t->lock));
+
+    act = &active_entry(t, e);
+    spin_lock(&act->lock);
+
+    return act;
+}
+
+static inline void active_entry_release(struct active_grant_entry *act)
+{
+    spin_unlock(&act->lock);
+}
+
 static inline unsigned int
 num_act_frames_from_sha_frames(const unsigned int num)
 {
@@ -206,90 +254,121 @@ static int __get_paged_frame(unsigned long gfn, unsigned long *frame, struct pag
     return rc;
 }
 
-static inline void
-double_gt_lock(struct grant_table *lgt, struct grant_table *rgt)
+/*
+ * Free maptrack entries are kept on per-vcpu lists, linked through their
+ * ref fields, so that backends mapping grants from many vcpus at once
+ * don't all serialise on the grant table lock.  An entry goes back to the
+ * list of the vcpu recorded in it, whichever vcpu unmaps it.
+ */
+static inline int
+__get_maptrack_handle(
+    struct grant_table *t, struct vcpu *v)
 {
-    if ( lgt < rgt )
-    {
-        spin_lock(&lgt->lock);
-        spin_lock(&rgt->lock);
-    }
-    else
+    unsigned int h;
+
+    spin_lock(&v->maptrack_freelist_lock);
+    if ( unlikely((h = v->maptrack_head) == MAPTRACK_TAIL) )
     {
-        if ( lgt != rgt )
-            spin_lock(&rgt->lock);
-        spin_lock(&lgt->lock);
+        spin_unlock(&v->maptrack_freelist_lock);
+        return -1;
     }
-}
+    v->maptrack_head = maptrack_entry(t, h).ref;
+    spin_unlock(&v->maptrack_freelist_lock);
 
-static inline void
-double_gt_unlock(struct grant_table *lgt, struct grant_table *rgt)
-{
-    spin_unlock(&lgt->lock);
-    if ( lgt != rgt )
-        spin_unlock(&rgt->lock);
+    return h;
 }
 
-static inline int
-__get_maptrack_handle(
-    struct grant_table *t)
+/*
+ * Take a free entry from another vcpu's list, once the table can't grow.
+ * The entry then belongs to the stealing vcpu.
+ */
+static int
+steal_maptrack_handle(
+    struct grant_table *t, struct vcpu *curr)
 {
-    unsigned int h;
-    if ( unlikely((h = t->maptrack_head) == MAPTRACK_TAIL) )
-        return -1;
-    t->maptrack_head = maptrack_entry(t, h).ref;
-    return h;
+    struct domain *d = curr->domain;
+    unsigned int i = curr->vcpu_id;
+    struct vcpu *v;
+    int handle;
+
+    do {
+        if ( ++i == d->max_vcpus )
+            i = 0;
+        if ( (v = d->vcpu[i]) == NULL )
+            continue;
+        if ( (handle = __get_maptrack_handle(t, v)) != -1 )
+        {
+            perfc_incr(maptrack_steal);
+            maptrack_entry(t, handle).vcpu = curr->vcpu_id;
+            return handle;
+        }
+    } while ( i != curr->vcpu_id );
+
+    return -1;
 }
 
 static inline void
 put_maptrack_handle(
     struct grant_table *t, int handle)
 {
-    spin_lock(&t->lock);
-    maptrack_entry(t, handle).ref = t->maptrack_head;
-    t->maptrack_head = handle;
-    spin_unlock(&t->lock);
+    struct domain *d = current->domain;
+    struct vcpu *v;
+
+    ASSERT(d->grant_table == t);
+    v = d->vcpu[maptrack_entry(t, handle).vcpu];
+    spin_lock(&v->maptrack_freelist_lock);
+    maptrack_entry(t, handle).ref = v->maptrack_head;
+    v->maptrack_head = handle;
+    spin_unlock(&v->maptrack_freelist_lock);
 }
 
 static inline int
 get_maptrack_handle(
     struct grant_table *lgt)
 {
+    struct vcpu          *curr = current;
     int                   i;
     grant_handle_t        handle;
     struct grant_mapping *new_mt;
-    unsigned int          new_mt_limit, nr_frames;
+    unsigned int          nr_frames;
 
-    spin_lock(&lgt->lock);
+    handle = __get_maptrack_handle(lgt, curr);
+    if ( likely(handle != -1) )
+        return handle;
 
-    while ( unlikely((handle = __get_maptrack_handle(lgt)) == -1) )
-    {
-        nr_frames = nr_maptrack_frames(lgt);
-        if ( nr_frames >= max_nr_maptrack_frames() )
-            break;
+    spin_lock(&lgt->maptrack_lock);
 
-        new_mt = alloc_xenheap_page();
-        if ( !new_mt )
-            break;
+    nr_frames = nr_maptrack_frames(lgt);
+    if ( nr_frames >= max_nr_maptrack_frames() ||
+         (new_mt = alloc_xenheap_page()) == NULL )
+    {
+        spin_unlock(&lgt->maptrack_lock);
+        return steal_maptrack_handle(lgt, curr);
+    }
 
-        clear_page(new_mt);
+    clear_page(new_mt);
 
-        new_mt_limit = lgt->maptrack_limit + MAPTRACK_PER_PAGE;
+    /* The first new entry is ours to use, the others go on our list. */
+    handle = lgt->maptrack_limit;
+    for ( i = 0; i < MAPTRACK_PER_PAGE; i++ )
+    {
+        new_mt[i].ref = handle + i + 1;
+        new_mt[i].vcpu = curr->vcpu_id;
+    }
 
-        for ( i = 1; i < MAPTRACK_PER_PAGE; i++ )
-            new_mt[i - 1].ref = lgt->maptrack_limit + i;
-        new_mt[i - 1].ref = lgt->maptrack_head;
-        lgt->maptrack_head = lgt->maptrack_limit;
+    lgt->maptrack[nr_frames] = new_mt;
+    smp_wmb();
+    lgt->maptrack_limit = handle + MAPTRACK_PER_PAGE;
 
-        lgt->maptrack[nr_frames] = new_mt;
-        smp_wmb();
-        lgt->maptrack_limit      = new_mt_limit;
+    spin_unlock(&lgt->maptrack_lock);
 
-        gdprintk(XENLOG_INFO, "Increased maptrack size to %u frames\n",
-                 nr_frames + 1);
-    }
+    gdprintk(XENLOG_INFO, "Increased maptrack size to %u frames\n",
+             nr_frames + 1);
 
-    spin_unlock(&lgt->lock);
+    spin_lock(&curr->maptrack_freelist_lock);
+    new_mt[i - 1].ref = curr->maptrack_head;
+    curr->maptrack_head = handle + 1;
+    spin_unlock(&curr->maptrack_freelist_lock);
 
     return handle;
 }
@@ -478,23 +557,69 @@ static int _set_status(unsigned gt_version,
         return _set_status_v2(domid, readonly, mapflag, shah, act, status);
 }
 
+/*
+ * A PV domain with an IOMMU keeps its grant mapped frames mapped in the
+ * IOMMU, writable while it has a writable mapping of them.  To tell when
+ * that changes without looking at all its mappings, it keeps counts of
+ * its read-only and writable mappings of each frame, indexed by mfn.
+ * Only mappings made while the IOMMU is in use are counted, and marked
+ * as such in their maptrack entry.  Caller must hold lgt's mapcount_lock.
+ */
+struct maptrack_mfn {
+    unsigned int wrc, rdc;
+};
+
 static void mapcount(
-    struct grant_table *lgt, struct domain *rd, unsigned long mfn,
+    struct grant_table *lgt, unsigned long mfn,
     unsigned int *wrc, unsigned int *rdc)
 {
-    struct grant_mapping *map;
-    grant_handle_t handle;
+    struct maptrack_mfn *cnt = radix_tree_lookup(&lgt->maptrack_mfns, mfn);
+
+    *wrc = cnt ? cnt->wrc : 0;
+    *rdc = cnt ? cnt->rdc : 0;
+}
 
-    *wrc = *rdc = 0;
+static int mapcount_get(
+    struct grant_table *lgt, unsigned long mfn, int readonly)
+{
+    struct maptrack_mfn *cnt = radix_tree_lookup(&lgt->maptrack_mfns, mfn);
+    int rc;
 
-    for ( handle = 0; handle < lgt->maptrack_limit; handle++ )
+    if ( cnt == NULL )
     {
-        map = &maptrack_entry(lgt, handle);
-        if ( !(map->flags & (GNTMAP_device_map|GNTMAP_host_map)) ||
-             map->domid != rd->domain_id )
-            continue;
-        if ( active_entry(rd->grant_table, map->ref).frame == mfn )
-            (map->flags & GNTMAP_readonly) ? (*rdc)++ : (*wrc)++;
+        if ( (cnt = xzalloc(struct maptrack_mfn)) == NULL )
+            return -ENOMEM;
+        if ( (rc = radix_tree_insert(&lgt->maptrack_mfns, mfn, cnt)) != 0 )
+        {
+            xfree(cnt);
+            return rc;
+        }
+    }
+
+    if ( readonly )
+        cnt->rdc++;
+    else
+        cnt->wrc++;
+
+    return 0;
+}
+
+static void mapcount_put(
+    struct grant_table *lgt, unsigned long mfn, int readonly)
+{
+    struct maptrack_mfn *cnt = radix_tree_lookup(&lgt->maptrack_mfns, mfn);
+
+    ASSERT(cnt != NULL && (readonly ? cnt->rdc : cnt->wrc) != 0);
+
+    if ( readonly )
+        cnt->rdc--;
+    else
+        cnt->wrc--;
+
+    if ( cnt->wrc + cnt->rdc == 0 )
+    {
+        radix_tree_delete(&lgt->maptrack_mfns, mfn);
+        xfree(cnt);
     }
 }
 
@@ -570,7 +695,7 @@ __gnttab_map_grant_ref(
     }
 
     rgt = rd->grant_table;
-    spin_lock(&rgt->lock);
+    read_lock(&rgt->lock);
 
     if ( rgt->gt_version == 0 )
         PIN_FAIL(unlock_out, GNTST_general_error,
@@ -580,7 +705,7 @@ __gnttab_map_grant_ref(
     if ( unlikely(op->ref >= nr_grant_entries(rgt)))
         PIN_FAIL(unlock_out, GNTST_bad_gntref, "Bad ref (%d).\n", op->ref);
 
-    act = &active_entry(rgt, op->ref);
+    act = active_entry_acquire(rgt, op->ref);
     shah = shared_entry_header(rgt, op->ref);
     if (rgt->gt_version == 1) {
         sha1 = &shared_entry_v1(rgt, op->ref);
@@ -597,7 +722,7 @@ __gnttab_map_grant_ref(
          ((act->domid != ld->domain_id) ||
           (act->pin & 0x80808080U) != 0 ||
           (act->is_sub_page)) )
-        PIN_FAIL(unlock_out, GNTST_general_error,
+        PIN_FAIL(act_release_out, GNTST_general_error,
                  "Bad domain (%d != %d), or risk of counter overflow %08x, or subpage %d\n",
                  act->domid, ld->domain_id, act->pin, act->is_sub_page);
 
@@ -608,7 +733,7 @@ __gnttab_map_grant_ref(
         if ( (rc = _set_status(rgt->gt_version, ld->domain_id,
                                op->flags & GNTMAP_readonly,
                                1, shah, act, status) ) != GNTST_okay )
-             goto unlock_out;
+             goto act_release_out;
 
         if ( !act->pin )
         {
@@ -643,7 +768,8 @@ __gnttab_map_grant_ref(
 
     cache_flags = (shah->flags & (GTF_PAT | GTF_PWT | GTF_PCD) );
 
-    spin_unlock(&rgt->lock);
+    active_entry_release(act);
+    read_unlock(&rgt->lock);
 
     /* pg may be set, with a refcount included, from __get_paged_frame */
     if ( !pg )
@@ -719,45 +845,56 @@ __gnttab_map_grant_ref(
         goto undo_out;
     }
 
-    double_gt_lock(lgt, rgt);
+    mt = &maptrack_entry(lgt, handle);
+    mt->counted = 0;
 
     if ( !is_hvm_domain(ld) && need_iommu(ld) )
     {
         unsigned int wrc, rdc;
-        int err = 0;
+        int err;
         /* Shouldn't happen, because you can't use iommu in a HVM domain. */
         BUG_ON(paging_mode_translate(ld));
         /* We're not translated, so we know that gmfns and mfns are
            the same things, so the IOMMU entry is always 1-to-1. */
-        mapcount(lgt, rd, frame, &wrc, &rdc);
-        if ( (act_pin & (GNTPIN_hstw_mask|GNTPIN_devw_mask)) &&
-             !(old_pin & (GNTPIN_hstw_mask|GNTPIN_devw_mask)) )
-        {
-            if ( wrc == 0 )
-                err = iommu_map_page(ld, frame, frame,
-                                     IOMMUF_readable|IOMMUF_writable);
-        }
-        else if ( act_pin && !old_pin )
+        spin_lock(&lgt->mapcount_lock);
+        mapcount(lgt, frame, &wrc, &rdc);
+        err = mapcount_get(lgt, frame, op->flags & GNTMAP_readonly);
+        if ( !err )
         {
-            if ( (wrc + rdc) == 0 )
-                err = iommu_map_page(ld, frame, frame, IOMMUF_readable);
+            if ( (act_pin & (GNTPIN_hstw_mask|GNTPIN_devw_mask)) &&
+                 !(old_pin & (GNTPIN_hstw_mask|GNTPIN_devw_mask)) )
+            {
+                if ( wrc == 0 )
+                    err = iommu_map_page(ld, frame, frame,
+                                         IOMMUF_readable|IOMMUF_writable);
+            }
+            else if ( act_pin && !old_pin )
+            {
+                if ( (wrc + rdc) == 0 )
+                    err = iommu_map_page(ld, frame, frame, IOMMUF_readable);
+            }
+            if ( err )
+                mapcount_put(lgt, frame, op->flags & GNTMAP_readonly);
         }
+        spin_unlock(&lgt->mapcount_lock);
         if ( err )
         {
-            double_gt_unlock(lgt, rgt);
             rc = GNTST_general_error;
             goto undo_out;
         }
+        mt->counted = 1;
     }
 
     TRACE_1D(TRC_MEM_PAGE_GRANT_MAP, op->dom);
 
-    mt = &maptrack_entry(lgt, handle);
+    /*
+     * Whoever looks at a maptrack entry checks its flags before the rest,
+     * so make sure they are written last.
+     */
     mt->domid = op->dom;
     mt->ref   = op->ref;
-    mt->flags = op->flags;
-
-    double_gt_unlock(lgt, rgt);
+    smp_wmb();
+    write_atomic(&mt->flags, op->flags);
 
     op->dev_bus_addr = (u64)frame << PAGE_SHIFT;
     op->handle       = handle;
@@ -780,9 +917,9 @@ __gnttab_map_grant_ref(
         put_page(pg);
     }
 
-    spin_lock(&rgt->lock);
+    read_lock(&rgt->lock);
 
-    act = &active_entry(rgt, op->ref);
+    act = active_entry_acquire(rgt, op->ref);
     shah = shared_entry_header(rgt, op->ref);
 
     if ( op->flags & GNTMAP_device_map )
@@ -800,8 +937,11 @@ __gnttab_map_grant_ref(
     if ( !act->pin )
         gnttab_clear_flag(_GTF_reading, status);
 
+ act_release_out:
+    active_entry_release(act);
+
  unlock_out:
-    spin_unlock(&rgt->lock);
+    read_unlock(&rgt->lock);
     op->status = rc;
     put_maptrack_handle(lgt, handle);
     rcu_unlock_domain(rd);
@@ -833,12 +973,14 @@ __gnttab_unmap_common(
     struct gnttab_unmap_common *op)
 {
     domid_t          dom;
+    grant_ref_t      ref;
     struct domain   *ld, *rd;
     struct grant_table *lgt, *rgt;
     struct active_grant_entry *act;
+    struct gnttab_unmap_deferred *ud;
     s16              rc = 0;
 
-    ld = current->domain;
+    ld = op->ld = current->domain;
     lgt = ld->grant_table;
 
     op->frame = (unsigned long)(op->dev_bus_addr >> PAGE_SHIFT);
@@ -851,18 +993,18 @@ __gnttab_unmap_common(
     }
 
     op->map = &maptrack_entry(lgt, op->handle);
-    spin_lock(&lgt->lock);
 
-    if ( unlikely(!op->map->flags) )
+    /* Checked again below, under the lock of the grant it maps. */
+    if ( unlikely(!read_atomic(&op->map->flags)) )
     {
-        spin_unlock(&lgt->lock);
         gdprintk(XENLOG_INFO, "Zero flags for handle (%d).\n", op->handle);
         op->status = GNTST_bad_handle;
         return;
     }
 
+    smp_rmb();
     dom = op->map->domid;
-    spin_unlock(&lgt->lock);
+    ref = op->map->ref;
 
     if ( unlikely((rd = rcu_lock_domain_by_id(dom)) == NULL) )
     {
@@ -883,10 +1025,21 @@ __gnttab_unmap_common(
     TRACE_1D(TRC_MEM_PAGE_GRANT_UNMAP, dom);
 
     rgt = rd->grant_table;
-    double_gt_lock(lgt, rgt);
+    read_lock(&rgt->lock);
+
+    if ( unlikely(rgt->gt_version == 0) ||
+         unlikely(ref >= nr_grant_entries(rgt)) )
+    {
+        gdprintk(XENLOG_WARNING, "Unstable handle %u\n", op->handle);
+        rc = GNTST_bad_handle;
+        goto unlock_out;
+    }
+
+    act = active_entry_acquire(rgt, ref);
 
     op->flags = op->map->flags;
-    if ( unlikely(!op->flags) || unlikely(op->map->domid != dom) )
+    if ( unlikely(!op->flags) || unlikely(op->map->domid != dom) ||
+         unlikely(op->map->ref != ref) )
     {
         gdprintk(XENLOG_WARNING, "Unstable handle %u\n", op->handle);
         rc = GNTST_bad_handle;
@@ -894,7 +1047,6 @@ __gnttab_unmap_common(
     }
 
     op->rd = rd;
-    act = &active_entry(rgt, op->map->ref);
 
     if ( op->frame == 0 )
     {
@@ -930,18 +1082,36 @@ __gnttab_unmap_common(
             act->pin -= GNTPIN_hstr_inc;
         else
             act->pin -= GNTPIN_hstw_inc;
+
+        ud = &this_cpu(gnttab_unmap_deferred);
+        ud->nr_host++;
+        cpumask_or(&ud->flush_mask, &ud->flush_mask,
+                   ld->domain_dirty_cpumask);
     }
 
-    if ( !is_hvm_domain(ld) && need_iommu(ld) )
+    if ( op->map->counted || (!is_hvm_domain(ld) && need_iommu(ld)) )
     {
         unsigned int wrc, rdc;
         int err = 0;
-        BUG_ON(paging_mode_translate(ld));
-        mapcount(lgt, rd, op->frame, &wrc, &rdc);
-        if ( (wrc + rdc) == 0 )
-            err = iommu_unmap_page(ld, op->frame);
-        else if ( wrc == 0 )
-            err = iommu_map_page(ld, op->frame, op->frame, IOMMUF_readable);
+
+        spin_lock(&lgt->mapcount_lock);
+        if ( op->map->counted &&
+             !(op->map->flags & (GNTMAP_device_map|GNTMAP_host_map)) )
+        {
+            mapcount_put(lgt, op->frame, op->flags & GNTMAP_readonly);
+            op->map->counted = 0;
+        }
+        if ( !is_hvm_domain(ld) && need_iommu(ld) )
+        {
+            BUG_ON(paging_mode_translate(ld));
+            mapcount(lgt, op->frame, &wrc, &rdc);
+            if ( (wrc + rdc) == 0 )
+                err = iommu_unmap_page(ld, op->frame);
+            else if ( wrc == 0 )
+                err = iommu_map_page(ld, op->frame, op->frame,
+                                     IOMMUF_readable);
+        }
+        spin_unlock(&lgt->mapcount_lock);
         if ( err )
         {
             rc = GNTST_general_error;
@@ -954,7 +1124,9 @@ __gnttab_unmap_common(
          gnttab_mark_dirty(rd, op->frame);
 
  unmap_out:
-    double_gt_unlock(lgt, rgt);
+    active_entry_release(act);
+ unlock_out:
+    read_unlock(&rgt->lock);
     op->status = rc;
     rcu_unlock_domain(rd);
 }
@@ -962,7 +1134,7 @@ __gnttab_unmap_common(
 static void
 __gnttab_unmap_common_complete(struct gnttab_unmap_common *op)
 {
-    struct domain *ld, *rd = op->rd;
+    struct domain *ld = op->ld, *rd = op->rd;
     struct grant_table *rgt;
     struct active_grant_entry *act;
     grant_entry_header_t *sha;
@@ -980,16 +1152,14 @@ __gnttab_unmap_common_complete(struct gnttab_unmap_common *op)
         return;
     }
 
-    ld = current->domain;
-
     rcu_lock_domain(rd);
     rgt = rd->grant_table;
-    spin_lock(&rgt->lock);
+    read_lock(&rgt->lock);
 
     if ( rgt->gt_version == 0 )
-        goto unmap_out;
+        goto unlock_out;
 
-    act = &active_entry(rgt, op->map->ref);
+    act = active_entry_acquire(rgt, op->map->ref);
     sha = shared_entry_header(rgt, op->map->ref);
 
     if ( rgt->gt_version == 1 )
@@ -1049,7 +1219,9 @@ __gnttab_unmap_common_complete(struct gnttab_unmap_common *op)
         gnttab_clear_flag(_GTF_reading, status);
 
  unmap_out:
-    spin_unlock(&rgt->lock);
+    active_entry_release(act);
+ unlock_out:
+    read_unlock(&rgt->lock);
     if ( put_handle )
     {
         op->map->flags = 0;
@@ -1058,6 +1230,52 @@ __gnttab_unmap_common_complete(struct gnttab_unmap_common *op)
     rcu_unlock_domain(rd);
 }
 
+void
+gnttab_flush_deferred_unmaps(void)
+{
+    struct gnttab_unmap_deferred *ud = &this_cpu(gnttab_unmap_deferred);
+    unsigned int i;
+
+    if ( ud->nr_host )
+    {
+        flush_tlb_mask(&ud->flush_mask);
+        perfc_incr(gnttab_unmap_flush);
+        perfc_add(gnttab_unmap_flush_avoided, ud->nr_host - 1);
+        cpumask_clear(&ud->flush_mask);
+        ud->nr_host = 0;
+    }
+
+    for ( i = 0; i < ud->nr; i++ )
+        __gnttab_unmap_common_complete(&ud->common[i]);
+    ud->nr = 0;
+}
+
+bool_t
+gnttab_deferred_unmaps_pending(void)
+{
+    return this_cpu(gnttab_unmap_deferred).nr != 0;
+}
+
+/* Queue the completion of an unmap, making room if need be. */
+static struct gnttab_unmap_common *
+gnttab_defer_unmap(void)
+{
+    struct gnttab_unmap_deferred *ud = &this_cpu(gnttab_unmap_deferred);
+
+    if ( ud->nr == GNTTAB_UNMAP_DEFER_SIZE )
+        gnttab_flush_deferred_unmaps();
+
+    return &ud->common[ud->nr++];
+}
+
+/* A multicall completes the unmaps once it has run all its calls. */
+static void
+gnttab_unmap_batch_done(void)
+{
+    if ( !(current->mc_state.flags & MCSF_in_multicall) )
+        gnttab_flush_deferred_unmaps();
+}
+
 static void
 __gnttab_unmap_grant_ref(
     struct gnttab_unmap_grant_ref *op,
@@ -1080,45 +1298,38 @@ static long
 gnttab_unmap_grant_ref(
     XEN_GUEST_HANDLE_PARAM(gnttab_unmap_grant_ref_t) uop, unsigned int count)
 {
-    int i, c, partial_done, done = 0;
+    int i, c, done = 0;
     struct gnttab_unmap_grant_ref op;
-    struct gnttab_unmap_common common[GNTTAB_UNMAP_BATCH_SIZE];
 
     while ( count != 0 )
     {
         c = min(count, (unsigned int)GNTTAB_UNMAP_BATCH_SIZE);
-        partial_done = 0;
 
         for ( i = 0; i < c; i++ )
         {
             if ( unlikely(__copy_from_guest(&op, uop, 1)) )
                 goto fault;
-            __gnttab_unmap_grant_ref(&op, &(common[i]));
-            ++partial_done;
+            __gnttab_unmap_grant_ref(&op, gnttab_defer_unmap());
             if ( unlikely(__copy_field_to_guest(uop, &op, status)) )
                 goto fault;
             guest_handle_add_offset(uop, 1);
         }
 
-        flush_tlb_mask(current->domain->domain_dirty_cpumask);
-
-        for ( i = 0; i < partial_done; i++ )
-            __gnttab_unmap_common_complete(&(common[i]));
-
         count -= c;
         done += c;
 
         if (count && hypercall_preempt_check())
+        {
+            gnttab_unmap_batch_done();
             return done;
+        }
     }
-     
+
+    gnttab_unmap_batch_done();
     return 0;
 
 fault:
-    flush_tlb_mask(current->domain->domain_dirty_cpumask);
-
-    for ( i = 0; i < partial_done; i++ )
-        __gnttab_unmap_common_complete(&(common[i]));
+    gnttab_unmap_batch_done();
     return -EFAULT;
 }
 
@@ -1143,45 +1354,38 @@ static long
 gnttab_unmap_and_replace(
     XEN_GUEST_HANDLE_PARAM(gnttab_unmap_and_replace_t) uop, unsigned int count)
 {
-    int i, c, partial_done, done = 0;
+    int i, c, done = 0;
     struct gnttab_unmap_and_replace op;
-    struct gnttab_unmap_common common[GNTTAB_UNMAP_BATCH_SIZE];
 
     while ( count != 0 )
     {
         c = min(count, (unsigned int)GNTTAB_UNMAP_BATCH_SIZE);
-        partial_done = 0;
         
         for ( i = 0; i < c; i++ )
         {
             if ( unlikely(__copy_from_guest(&op, uop, 1)) )
                 goto fault;
-            __gnttab_unmap_and_replace(&op, &(common[i]));
-            ++partial_done;
+            __gnttab_unmap_and_replace(&op, gnttab_defer_unmap());
             if ( unlikely(__copy_field_to_guest(uop, &op, status)) )
                 goto fault;
             guest_handle_add_offset(uop, 1);
         }
-        
-        flush_tlb_mask(current->domain->domain_dirty_cpumask);
-        
-        for ( i = 0; i < partial_done; i++ )
-            __gnttab_unmap_common_complete(&(common[i]));
 
         count -= c;
         done += c;
 
         if (count && hypercall_preempt_check())
+        {
+            gnttab_unmap_batch_done();
             return done;
+        }
     }
 
+    gnttab_unmap_batch_done();
     return 0;
 
 fault:
-    flush_tlb_mask(current->domain->domain_dirty_cpumask);
-
-    for ( i = 0; i < partial_done; i++ )
-        __gnttab_unmap_common_complete(&(common[i]));
+    gnttab_unmap_batch_done();
     return -EFAULT;    
 }
 
@@ -1238,10 +1442,12 @@ gnttab_unpopulate_status_frames(struct domain *d, struct grant_table *gt)
 int
 gnttab_grow_table(struct domain *d, unsigned int req_nr_frames)
 {
-    /* d's grant table lock must be held by the caller */
+    /* d's grant table lock must be write locked by the caller */
 
     struct grant_table *gt = d->grant_table;
-    unsigned int i;
+    unsigned int i, j;
+
+    ASSERT(rw_is_write_locked(&gt->lock));
 
     ASSERT(req_nr_frames <= max_nr_grant_frames);
 
@@ -1256,6 +1462,8 @@ gnttab_grow_table(struct domain *d, unsigned int req_nr_frames)
         if ( (gt->active[i] = alloc_xenheap_page()) == NULL )
             goto active_alloc_failed;
         clear_page(gt->active[i]);
+        for ( j = 0; j < ACGNT_PER_PAGE; j++ )
+            spin_lock_init(&gt->active[i][j].lock);
     }
 
     /* Shared */
@@ -1343,7 +1551,7 @@ gnttab_setup_table(
     }
 
     gt = d->grant_table;
-    spin_lock(&gt->lock);
+    write_lock(&gt->lock);
 
     if ( gt->gt_version == 0 )
         gt->gt_version = 1;
@@ -1371,7 +1579,7 @@ gnttab_setup_table(
     }
 
  out3:
-    spin_unlock(&gt->lock);
+    write_unlock(&gt->lock);
  out2:
     rcu_unlock_domain(d);
  out1:
@@ -1413,13 +1621,13 @@ gnttab_query_size(
         goto query_out_unlock;
     }
 
-    spin_lock(&d->grant_table->lock);
+    read_lock(&d->grant_table->lock);
 
     op.nr_frames     = nr_grant_frames(d->grant_table);
     op.max_nr_frames = max_nr_grant_frames;
     op.status        = GNTST_okay;
 
-    spin_unlock(&d->grant_table->lock);
+    read_unlock(&d->grant_table->lock);
 
  
  query_out_unlock:
@@ -1445,7 +1653,8 @@ gnttab_prepare_for_transfer(
     union grant_combo   scombo, prev_scombo, new_scombo;
     int                 retries = 0;
 
-    spin_lock(&rgt->lock);
+    /* The shared entry is only updated with cmpxchg. */
+    read_lock(&rgt->lock);
 
     if ( rgt->gt_version == 0 )
     {
@@ -1496,11 +1705,11 @@ gnttab_prepare_for_transfer(
         scombo = prev_scombo;
     }
 
-    spin_unlock(&rgt->lock);
+    read_unlock(&rgt->lock);
     return 1;
 
  fail:
-    spin_unlock(&rgt->lock);
+    read_unlock(&rgt->lock);
     return 0;
 }
 
@@ -1656,7 +1865,7 @@ gnttab_transfer(
         TRACE_1D(TRC_MEM_PAGE_GRANT_TRANSFER, e->domain_id);
 
         /* Tell the guest about its new page frame. */
-        spin_lock(&e->grant_table->lock);
+        write_lock(&e->grant_table->lock);
 
         if ( e->grant_table->gt_version == 1 )
         {
@@ -1674,7 +1883,7 @@ gnttab_transfer(
         shared_entry_header(e->grant_table, gop.ref)->flags |=
             GTF_transfer_completed;
 
-        spin_unlock(&e->grant_table->lock);
+        write_unlock(&e->grant_table->lock);
 
         rcu_unlock_domain(e);
 
@@ -1712,9 +1921,9 @@ __release_grant_for_copy(
     released_read = 0;
     released_write = 0;
 
-    spin_lock(&rgt->lock);
+    read_lock(&rgt->lock);
 
-    act = &active_entry(rgt, gref);
+    act = active_entry_acquire(rgt, gref);
     sha = shared_entry_header(rgt, gref);
     r_frame = act->frame;
 
@@ -1753,7 +1962,8 @@ __release_grant_for_copy(
         released_read = 1;
     }
 
-    spin_unlock(&rgt->lock);
+    active_entry_release(act);
+    read_unlock(&rgt->lock);
 
     if ( td != rd )
     {
@@ -1811,7 +2021,7 @@ __acquire_grant_for_copy(
 
     *page = NULL;
 
-    spin_lock(&rgt->lock);
+    read_lock(&rgt->lock);
 
     if ( rgt->gt_version == 0 )
         PIN_FAIL(unlock_out, GNTST_general_error,
@@ -1821,7 +2031,7 @@ __acquire_grant_for_copy(
         PIN_FAIL(unlock_out, GNTST_bad_gntref,
                  "Bad grant reference %ld\n", gref);
 
-    act = &active_entry(rgt, gref);
+    act = active_entry_acquire(rgt, gref);
     shah = shared_entry_header(rgt, gref);
     if ( rgt->gt_version == 1 )
     {
@@ -1838,7 +2048,7 @@ __acquire_grant_for_copy(
 
     /* If already pinned, check the active domid and avoid refcnt overflow. */
     if ( act->pin && ((act->domid != ldom) || (act->pin & 0x80808080U) != 0) )
-        PIN_FAIL(unlock_out, GNTST_general_error,
+        PIN_FAIL(act_release_out, GNTST_general_error,
                  "Bad domain (%d != %d), or risk of counter overflow %08x\n",
                  act->domid, ldom, act->pin);
 
@@ -1849,7 +2059,7 @@ __acquire_grant_for_copy(
         if ( (rc = _set_status(rgt->gt_version, ldom,
                                readonly, 0, shah, act,
                                status) ) != GNTST_okay )
-             goto unlock_out;
+            goto act_release_out;
 
         td = rd;
         trans_gref = gref;
@@ -1880,17 +2090,26 @@ __acquire_grant_for_copy(
                 PIN_FAIL(unlock_out_clear, GNTST_general_error,
                          "transitive grant referenced bad domain %d\n",
                          trans_domid);
-            spin_unlock(&rgt->lock);
+
+            /*
+             * Both locks are dropped across the recursion: the referent
+             * may be in this very table, and a chain of transitive grants
+             * must not nest entry locks.
+             */
+            active_entry_release(act);
+            read_unlock(&rgt->lock);
 
             rc = __acquire_grant_for_copy(td, trans_gref, rd->domain_id,
                                           readonly, &grant_frame, page,
                                           &trans_page_off, &trans_length, 0);
 
-            spin_lock(&rgt->lock);
+            read_lock(&rgt->lock);
+            act = active_entry_acquire(rgt, gref);
             if ( rc != GNTST_okay ) {
                 __fixup_status_for_copy_pin(act, status);
                 rcu_unlock_domain(td);
-                spin_unlock(&rgt->lock);
+                active_entry_release(act);
+                read_unlock(&rgt->lock);
                 return rc;
             }
 
@@ -1902,7 +2121,8 @@ __acquire_grant_for_copy(
             {
                 __fixup_status_for_copy_pin(act, status);
                 rcu_unlock_domain(td);
-                spin_unlock(&rgt->lock);
+                active_entry_release(act);
+                read_unlock(&rgt->lock);
                 put_page(*page);
                 return __acquire_grant_for_copy(rd, gref, ldom, readonly,
                                                 frame, page, page_off, length,
@@ -1970,7 +2190,8 @@ __acquire_grant_for_copy(
     *length = act->length;
     *frame = act->frame;
 
-    spin_unlock(&rgt->lock);
+    active_entry_release(act);
+    read_unlock(&rgt->lock);
     return rc;
  
  unlock_out_clear:
@@ -1981,135 +2202,276 @@ __acquire_grant_for_copy(
     if ( !act->pin )
         gnttab_clear_flag(_GTF_reading, status);
 
+ act_release_out:
+    active_entry_release(act);
+
  unlock_out:
-    spin_unlock(&rgt->lock);
+    read_unlock(&rgt->lock);
     return rc;
 }
 
+/*
+ * One side of a copy: a frame of a domain, held (grant acquired, page
+ * referenced and typed, frame mapped) for as long as consecutive copies of
+ * one batch name it, so that a backend copying many fragments to or from
+ * the same page pays for it once.
+ */
+struct gnttab_copy_buf {
+    /* Guest provided. */
+    domid_t domid;
+    unsigned long ptr;              /* grant ref or gmfn */
+    bool_t is_gref;
+    bool_t read_only;
+
+    /* Held. */
+    struct domain *domain;
+    unsigned long frame;
+    struct page_info *page;
+    void *virt;
+    unsigned int off, len;          /* part of the frame that is granted */
+    bool_t have_grant, have_type;
+};
+
+struct gnttab_copy_batch {
+    struct gnttab_copy_buf src, dest;
+    bool_t checked;                 /* XSM allows copies src -> dest */
+};
+
 static void
-__gnttab_copy(
-    struct gnttab_copy *op)
+gnttab_copy_release_buf(struct gnttab_copy_buf *buf)
 {
-    struct domain *sd = NULL, *dd = NULL;
-    unsigned long s_frame, d_frame;
-    struct page_info *s_pg = NULL, *d_pg = NULL;
-    char *sp, *dp;
-    s16 rc = GNTST_okay;
-    int have_d_grant = 0, have_s_grant = 0;
-    int src_is_gref, dest_is_gref;
+    if ( buf->virt )
+    {
+        unmap_domain_page(buf->virt);
+        buf->virt = NULL;
+    }
+    if ( buf->have_type )
+    {
+        put_page_type(buf->page);
+        buf->have_type = 0;
+    }
+    if ( buf->page )
+    {
+        put_page(buf->page);
+        buf->page = NULL;
+    }
+    if ( buf->have_grant )
+    {
+        __release_grant_for_copy(buf->domain, buf->ptr, buf->read_only);
+        buf->have_grant = 0;
+    }
+    if ( buf->domain )
+    {
+        rcu_unlock_domain(buf->domain);
+        buf->domain = NULL;
+    }
+}
 
-    if ( ((op->source.offset + op->len) > PAGE_SIZE) ||
-         ((op->dest.offset + op->len) > PAGE_SIZE) )
-        PIN_FAIL(error_out, GNTST_bad_copy_arg, "copy beyond page area.\n");
+static bool_t
+gnttab_copy_buf_valid(
+    domid_t domid, unsigned long ptr, bool_t is_gref,
+    const struct gnttab_copy_buf *buf)
+{
+    return buf->domain && buf->domid == domid && buf->ptr == ptr &&
+           buf->is_gref == is_gref;
+}
 
-    src_is_gref = op->flags & GNTCOPY_source_gref;
-    dest_is_gref = op->flags & GNTCOPY_dest_gref;
+static s16
+gnttab_copy_lock_domain(
+    domid_t domid, unsigned long ptr, bool_t is_gref,
+    struct gnttab_copy_buf *buf)
+{
+    s16 rc = GNTST_okay;
 
-    if ( (op->source.domid != DOMID_SELF && !src_is_gref ) ||
-         (op->dest.domid   != DOMID_SELF && !dest_is_gref)   )
-        PIN_FAIL(error_out, GNTST_permission_denied,
+    if ( domid != DOMID_SELF && !is_gref )
+        PIN_FAIL(out, GNTST_permission_denied,
                  "only allow copy-by-mfn for DOMID_SELF.\n");
 
-    if ( op->source.domid == DOMID_SELF )
-        sd = rcu_lock_current_domain();
-    else if ( (sd = rcu_lock_domain_by_id(op->source.domid)) == NULL )
-        PIN_FAIL(error_out, GNTST_bad_domain,
-                 "couldn't find %d\n", op->source.domid);
+    if ( domid == DOMID_SELF )
+        buf->domain = rcu_lock_current_domain();
+    else if ( (buf->domain = rcu_lock_domain_by_id(domid)) == NULL )
+        PIN_FAIL(out, GNTST_bad_domain, "couldn't find %d\n", domid);
 
-    if ( op->dest.domid == DOMID_SELF )
-        dd = rcu_lock_current_domain();
-    else if ( (dd = rcu_lock_domain_by_id(op->dest.domid)) == NULL )
-        PIN_FAIL(error_out, GNTST_bad_domain,
-                 "couldn't find %d\n", op->dest.domid);
+    buf->domid = domid;
+    buf->ptr = ptr;
+    buf->is_gref = is_gref;
 
-    rc = xsm_grant_copy(XSM_HOOK, sd, dd);
-    if ( rc )
-    {
-        rc = GNTST_permission_denied;
-        goto error_out;
-    }
+ out:
+    return rc;
+}
+
+static s16
+gnttab_copy_claim_buf(struct gnttab_copy_buf *buf)
+{
+    s16 rc;
 
-    if ( src_is_gref )
+    if ( buf->is_gref )
     {
-        unsigned source_off, source_len;
-        rc = __acquire_grant_for_copy(sd, op->source.u.ref,
-                                      current->domain->domain_id, 1,
-                                      &s_frame, &s_pg,
-                                      &source_off, &source_len, 1);
+        rc = __acquire_grant_for_copy(buf->domain, buf->ptr,
+                                      current->domain->domain_id,
+                                      buf->read_only,
+                                      &buf->frame, &buf->page,
+                                      &buf->off, &buf->len, 1);
         if ( rc != GNTST_okay )
-            goto error_out;
-        have_s_grant = 1;
-        if ( op->source.offset < source_off ||
-             op->len > source_len )
-            PIN_FAIL(error_out, GNTST_general_error,
-                     "copy source out of bounds: %d < %d || %d > %d\n",
-                     op->source.offset, source_off,
-                     op->len, source_len);
+            goto out;
+        buf->have_grant = 1;
     }
     else
     {
-        rc = __get_paged_frame(op->source.u.gmfn, &s_frame, &s_pg, 1, sd);
+        rc = __get_paged_frame(buf->ptr, &buf->frame, &buf->page,
+                               buf->read_only, buf->domain);
         if ( rc != GNTST_okay )
-            PIN_FAIL(error_out, rc,
-                     "source frame %lx invalid.\n", s_frame);
+            PIN_FAIL(out, rc, "%s frame %lx invalid.\n",
+                     buf->read_only ? "source" : "destination", buf->frame);
+        buf->off = 0;
+        buf->len = PAGE_SIZE;
+    }
+
+    if ( !buf->read_only )
+    {
+        if ( !get_page_type(buf->page, PGT_writable_page) )
+        {
+            if ( !buf->domain->is_dying )
+                gdprintk(XENLOG_WARNING, "Could not get dst frame %lx\n",
+                         buf->frame);
+            rc = GNTST_general_error;
+            goto out;
+        }
+        buf->have_type = 1;
     }
 
-    if ( dest_is_gref )
+    buf->virt = map_domain_page(buf->frame);
+
+ out:
+    return rc;
+}
+
+/*
+ * Make @b hold the frames a copy names, reusing what it already holds.
+ * Whatever is not reusable is released first.
+ */
+static s16
+gnttab_copy_claim_bufs(
+    struct gnttab_copy_batch *b, unsigned int flags,
+    domid_t sdomid, unsigned long sptr, domid_t ddomid, unsigned long dptr)
+{
+    bool_t src_is_gref = !!(flags & GNTCOPY_source_gref);
+    bool_t dest_is_gref = !!(flags & GNTCOPY_dest_gref);
+    s16 rc;
+
+    if ( gnttab_copy_buf_valid(sdomid, sptr, src_is_gref, &b->src) )
+        perfc_incr(gnttab_copy_buf_hit);
+    else
     {
-        unsigned dest_off, dest_len;
-        rc = __acquire_grant_for_copy(dd, op->dest.u.ref,
-                                      current->domain->domain_id, 0,
-                                      &d_frame, &d_pg, &dest_off, &dest_len, 1);
+        gnttab_copy_release_buf(&b->src);
+        b->checked = 0;
+        rc = gnttab_copy_lock_domain(sdomid, sptr, src_is_gref, &b->src);
         if ( rc != GNTST_okay )
-            goto error_out;
-        have_d_grant = 1;
-        if ( op->dest.offset < dest_off ||
-             op->len > dest_len )
-            PIN_FAIL(error_out, GNTST_general_error,
-                     "copy dest out of bounds: %d < %d || %d > %d\n",
-                     op->dest.offset, dest_off,
-                     op->len, dest_len);
+            return rc;
     }
+
+    if ( gnttab_copy_buf_valid(ddomid, dptr, dest_is_gref, &b->dest) )
+        perfc_incr(gnttab_copy_buf_hit);
     else
     {
-        rc = __get_paged_frame(op->dest.u.gmfn, &d_frame, &d_pg, 0, dd);
+        gnttab_copy_release_buf(&b->dest);
+        b->checked = 0;
+        rc = gnttab_copy_lock_domain(ddomid, dptr, dest_is_gref, &b->dest);
         if ( rc != GNTST_okay )
-            PIN_FAIL(error_out, rc,
-                     "destination frame %lx invalid.\n", d_frame);
+            return rc;
     }
 
-    if ( !get_page_type(d_pg, PGT_writable_page) )
+    if ( !b->checked )
     {
-        if ( !dd->is_dying )
-            gdprintk(XENLOG_WARNING, "Could not get dst frame %lx\n", d_frame);
-        rc = GNTST_general_error;
-        goto error_out;
+        if ( xsm_grant_copy(XSM_HOOK, b->src.domain, b->dest.domain) )
+            return GNTST_permission_denied;
+        b->checked = 1;
+    }
+
+    if ( !b->src.virt )
+    {
+        perfc_incr(gnttab_copy_buf_miss);
+        b->src.read_only = 1;
+        rc = gnttab_copy_claim_buf(&b->src);
+        if ( rc != GNTST_okay )
+        {
+            gnttab_copy_release_buf(&b->src);
+            return rc;
+        }
+    }
+
+    if ( !b->dest.virt )
+    {
+        perfc_incr(gnttab_copy_buf_miss);
+        b->dest.read_only = 0;
+        rc = gnttab_copy_claim_buf(&b->dest);
+        if ( rc != GNTST_okay )
+        {
+            gnttab_copy_release_buf(&b->dest);
+            return rc;
+        }
     }
 
-    sp = map_domain_page(s_frame);
-    dp = map_domain_page(d_frame);
+    return GNTST_okay;
+}
+
+/* Copy @len bytes between the frames @b holds. */
+static s16
+gnttab_copy_buf_seg(
+    struct gnttab_copy_batch *b,
+    unsigned int src_off, unsigned int dest_off, unsigned int len)
+{
+    s16 rc = GNTST_okay;
+
+    if ( ((src_off + len) > PAGE_SIZE) || ((dest_off + len) > PAGE_SIZE) )
+        PIN_FAIL(out, GNTST_bad_copy_arg, "copy beyond page area.\n");
+
+    if ( src_off < b->src.off || src_off + len > b->src.off + b->src.len )
+        PIN_FAIL(out, GNTST_general_error,
+                 "copy source out of bounds: %u+%u not in %u+%u\n",
+                 src_off, len, b->src.off, b->src.len);
+
+    if ( dest_off < b->dest.off || dest_off + len > b->dest.off + b->dest.len )
+        PIN_FAIL(out, GNTST_general_error,
+                 "copy dest out of bounds: %u+%u not in %u+%u\n",
+                 dest_off, len, b->dest.off, b->dest.len);
 
-    memcpy(dp + op->dest.offset, sp + op->source.offset, op->len);
+    memcpy(b->dest.virt + dest_off, b->src.virt + src_off, len);
 
-    unmap_domain_page(dp);
-    unmap_domain_page(sp);
+    gnttab_mark_dirty(b->dest.domain, b->dest.frame);
+
+ out:
+    return rc;
+}
 
-    gnttab_mark_dirty(dd, d_frame);
+static void
+gnttab_copy_release_batch(struct gnttab_copy_batch *b)
+{
+    gnttab_copy_release_buf(&b->dest);
+    gnttab_copy_release_buf(&b->src);
+}
 
-    put_page_type(d_pg);
- error_out:
-    if ( d_pg )
-        put_page(d_pg);
-    if ( s_pg )
-        put_page(s_pg);
-    if ( have_s_grant )
-        __release_grant_for_copy(sd, op->source.u.ref, 1);
-    if ( have_d_grant )
-        __release_grant_for_copy(dd, op->dest.u.ref, 0);
-    if ( sd )
-        rcu_unlock_domain(sd);
-    if ( dd )
-        rcu_unlock_domain(dd);
+static void
+__gnttab_copy(
+    struct gnttab_copy *op, struct gnttab_copy_batch *b)
+{
+    s16 rc;
+
+    if ( ((op->source.offset + op->len) > PAGE_SIZE) ||
+         ((op->dest.offset + op->len) > PAGE_SIZE) )
+        PIN_FAIL(out, GNTST_bad_copy_arg, "copy beyond page area.\n");
+
+    rc = gnttab_copy_claim_bufs(
+        b, op->flags,
+        op->source.domid, (op->flags & GNTCOPY_source_gref) ?
+                          op->source.u.ref : op->source.u.gmfn,
+        op->dest.domid, (op->flags & GNTCOPY_dest_gref) ?
+                        op->dest.u.ref : op->dest.u.gmfn);
+    if ( rc == GNTST_okay )
+        rc = gnttab_copy_buf_seg(b, op->source.offset, op->dest.offset,
+                                 op->len);
+
+ out:
     op->status = rc;
 }
 
@@ -2119,19 +2481,99 @@ gnttab_copy(
 {
     int i;
     struct gnttab_copy op;
+    struct gnttab_copy_batch b = { .checked = 0 };
+    long rc = 0;
 
     for ( i = 0; i < count; i++ )
     {
-        if (i && hypercall_preempt_check())
-            return i;
+        if ( i && hypercall_preempt_check() )
+        {
+            rc = i;
+            break;
+        }
         if ( unlikely(__copy_from_guest(&op, uop, 1)) )
-            return -EFAULT;
-        __gnttab_copy(&op);
+        {
+            rc = -EFAULT;
+            break;
+        }
+        __gnttab_copy(&op, &b);
         if ( unlikely(__copy_field_to_guest(uop, &op, status)) )
-            return -EFAULT;
+        {
+            rc = -EFAULT;
+            break;
+        }
         guest_handle_add_offset(uop, 1);
     }
-    return 0;
+
+    gnttab_copy_release_batch(&b);
+    return rc;
+}
+
+static void
+__gnttab_copy_segs(
+    struct gnttab_copy_segs *op, struct gnttab_copy_batch *b)
+{
+    unsigned int i;
+    s16 rc;
+
+    op->nr_done = 0;
+
+    if ( op->nr_segs > GNTCOPY_MAX_SEGS )
+        PIN_FAIL(out, GNTST_bad_copy_arg, "too many segments: %u\n",
+                 op->nr_segs);
+
+    rc = gnttab_copy_claim_bufs(
+        b, op->flags,
+        op->source.domid, (op->flags & GNTCOPY_source_gref) ?
+                          op->source.u.ref : op->source.u.gmfn,
+        op->dest.domid, (op->flags & GNTCOPY_dest_gref) ?
+                        op->dest.u.ref : op->dest.u.gmfn);
+
+    for ( i = 0; rc == GNTST_okay && i < op->nr_segs; i++ )
+    {
+        rc = gnttab_copy_buf_seg(b, op->seg[i].source_offset,
+                                 op->seg[i].dest_offset, op->seg[i].len);
+        if ( rc == GNTST_okay )
+            op->nr_done++;
+    }
+
+ out:
+    op->status = rc;
+}
+
+static long
+gnttab_copy_segs(
+    XEN_GUEST_HANDLE_PARAM(gnttab_copy_segs_t) uop, unsigned int count)
+{
+    int i;
+    struct gnttab_copy_segs op;
+    struct gnttab_copy_batch b = { .checked = 0 };
+    long rc = 0;
+
+    for ( i = 0; i < count; i++ )
+    {
+        if ( i && hypercall_preempt_check() )
+        {
+            rc = i;
+            break;
+        }
+        if ( unlikely(__copy_from_guest(&op, uop, 1)) )
+        {
+            rc = -EFAULT;
+            break;
+        }
+        __gnttab_copy_segs(&op, &b);
+        if ( unlikely(__copy_field_to_guest(uop, &op, status)) ||
+             unlikely(__copy_field_to_guest(uop, &op, nr_done)) )
+        {
+            rc = -EFAULT;
+            break;
+        }
+        guest_handle_add_offset(uop, 1);
+    }
+
+    gnttab_copy_release_batch(&b);
+    return rc;
 }
 
 static long
@@ -2156,7 +2598,7 @@ gnttab_set_version(XEN_GUEST_HANDLE_PARAM(gnttab_set_version_t) uop)
     if ( gt->gt_version == op.version )
         goto out;
 
-    spin_lock(&gt->lock);
+    write_lock(&gt->lock);
     /* Make sure that the grant table isn't currently in use when we
        change the version number, except for the first 8 entries which
        are allowed to be in use (xenstore/xenconsole keeps them mapped).
@@ -2242,7 +2684,7 @@ gnttab_set_version(XEN_GUEST_HANDLE_PARAM(gnttab_set_version_t) uop)
     gt->gt_version = op.version;
 
 out_unlock:
-    spin_unlock(&gt->lock);
+    write_unlock(&gt->lock);
 
 out:
     op.version = gt->gt_version;
@@ -2298,7 +2740,7 @@ gnttab_get_status_frames(XEN_GUEST_HANDLE_PARAM(gnttab_get_status_frames_t) uop,
 
     op.status = GNTST_okay;
 
-    spin_lock(&gt->lock);
+    read_lock(&gt->lock);
 
     for ( i = 0; i < op.nr_frames; i++ )
     {
@@ -2307,7 +2749,7 @@ gnttab_get_status_frames(XEN_GUEST_HANDLE_PARAM(gnttab_get_status_frames_t) uop,
             op.status = GNTST_bad_virt_addr;
     }
 
-    spin_unlock(&gt->lock);
+    read_unlock(&gt->lock);
 out2:
     rcu_unlock_domain(d);
 out1:
@@ -2356,7 +2798,8 @@ __gnttab_swap_grant_ref(grant_ref_t ref_a, grant_ref_t ref_b)
     struct active_grant_entry *act;
     s16 rc = GNTST_okay;
 
-    spin_lock(&gt->lock);
+    /* Exclusive, so that neither entry can be pinned meanwhile. */
+    write_lock(&gt->lock);
 
     /* Bounds check on the grant refs */
     if ( unlikely(ref_a >= nr_grant_entries(d->grant_table)))
@@ -2396,7 +2839,7 @@ __gnttab_swap_grant_ref(grant_ref_t ref_a, grant_ref_t ref_b)
     }
 
 out:
-    spin_unlock(&gt->lock);
+    write_unlock(&gt->lock);
 
     rcu_unlock_domain(d);
 
@@ -2432,6 +2875,11 @@ do_grant_table_op(
     
     if ( (int)count < 0 )
         return -EINVAL;
+
+    /* Everything else must see the pins of queued unmaps dropped. */
+    if ( cmd != GNTTABOP_unmap_grant_ref &&
+         cmd != GNTTABOP_unmap_and_replace )
+        gnttab_flush_deferred_unmaps();
     
     rc = -EFAULT;
     switch ( cmd )
@@ -2516,6 +2964,20 @@ do_grant_table_op(
         }
         break;
     }
+    case GNTTABOP_copy_segs:
+    {
+        XEN_GUEST_HANDLE_PARAM(gnttab_copy_segs_t) copy =
+            guest_handle_cast(uop, gnttab_copy_segs_t);
+        if ( unlikely(!guest_handle_okay(copy, count)) )
+            goto out;
+        rc = gnttab_copy_segs(copy, count);
+        if ( rc > 0 )
+        {
+            guest_handle_add_offset(copy, rc);
+            uop = guest_handle_cast(copy, void);
+        }
+        break;
+    }
     case GNTTABOP_query_size:
     {
         rc = gnttab_query_size(
@@ -2578,13 +3040,16 @@ grant_table_create(
     struct domain *d)
 {
     struct grant_table *t;
-    int                 i;
+    int                 i, j;
 
     if ( (t = xzalloc(struct grant_table)) == NULL )
         goto no_mem_0;
 
     /* Simple stuff. */
-    spin_lock_init(&t->lock);
+    rwlock_init(&t->lock);
+    spin_lock_init(&t->maptrack_lock);
+    spin_lock_init(&t->mapcount_lock);
+    radix_tree_init(&t->maptrack_mfns);
     t->nr_grant_frames = INITIAL_NR_GRANT_FRAMES;
 
     /* Active grant table. */
@@ -2597,19 +3062,14 @@ grant_table_create(
         if ( (t->active[i] = alloc_xenheap_page()) == NULL )
             goto no_mem_2;
         clear_page(t->active[i]);
+        for ( j = 0; j < ACGNT_PER_PAGE; j++ )
+            spin_lock_init(&t->active[i][j].lock);
     }
 
-    /* Tracking of mapped foreign frames table */
+    /* Tracking of mapped foreign frames table, grown on the first map */
     if ( (t->maptrack = xzalloc_array(struct grant_mapping *,
                                       max_nr_maptrack_frames())) == NULL )
         goto no_mem_2;
-    if ( (t->maptrack[0] = alloc_xenheap_page()) == NULL )
-        goto no_mem_3;
-    clear_page(t->maptrack[0]);
-    t->maptrack_limit = MAPTRACK_PER_PAGE;
-    for ( i = 1; i < MAPTRACK_PER_PAGE; i++ )
-        t->maptrack[0][i - 1].ref = i;
-    t->maptrack[0][i - 1].ref = MAPTRACK_TAIL;
 
     /* Shared grant table. */
     if ( (t->shared_raw = xzalloc_array(void *, max_nr_grant_frames)) == NULL )
@@ -2641,7 +3101,6 @@ grant_table_create(
         free_xenheap_page(t->shared_raw[i]);
     xfree(t->shared_raw);
  no_mem_3:
-    free_xenheap_page(t->maptrack[0]);
     xfree(t->maptrack);
  no_mem_2:
     for ( i = 0;
@@ -2691,9 +3150,9 @@ gnttab_release_mappings(
         }
 
         rgt = rd->grant_table;
-        spin_lock(&rgt->lock);
+        read_lock(&rgt->lock);
 
-        act = &active_entry(rgt, ref);
+        act = active_entry_acquire(rgt, ref);
         sha = shared_entry_header(rgt, ref);
         if (rgt->gt_version == 1)
             status = &sha->flags;
@@ -2751,7 +3210,8 @@ gnttab_release_mappings(
         if ( act->pin == 0 )
             gnttab_clear_flag(_GTF_reading, status);
 
-        spin_unlock(&rgt->lock);
+        active_entry_release(act);
+        read_unlock(&rgt->lock);
 
         rcu_unlock_domain(rd);
 
@@ -2759,6 +3219,12 @@ gnttab_release_mappings(
     }
 }
 
+void
+grant_table_init_vcpu(struct vcpu *v)
+{
+    spin_lock_init(&v->maptrack_freelist_lock);
+    v->maptrack_head = MAPTRACK_TAIL;
+}
 
 void
 grant_table_destroy(
@@ -2777,6 +3243,7 @@ grant_table_destroy(
     for ( i = 0; i < nr_maptrack_frames(t); i++ )
         free_xenheap_page(t->maptrack[i]);
     xfree(t->maptrack);
+    radix_tree_destroy(&t->maptrack_mfns, xfree);
 
     for ( i = 0; i < nr_active_grant_frames(t); i++ )
         free_xenheap_page(t->active[i]);
@@ -2799,7 +3266,7 @@ static void gnttab_usage_print(struct domain *rd)
     printk("      -------- active --------       -------- shared --------\n");
     printk("[ref] localdom mfn      pin          localdom gmfn     flags\n");
 
-    spin_lock(&gt->lock);
+    read_lock(&gt->lock);
 
     if ( gt->gt_version == 0 )
         goto out;
@@ -2813,9 +3280,12 @@ static void gnttab_usage_print(struct domain *rd)
         uint16_t status;
         uint64_t frame;
 
-        act = &active_entry(gt, ref);
+        act = active_entry_acquire(gt, ref);
         if ( !act->pin )
+        {
+            active_entry_release(act);
             continue;
+        }
 
         sha = shared_entry_header(gt, ref);
 
@@ -2845,10 +3315,11 @@ static void gnttab_usage_print(struct domain *rd)
         printk("[%3d]    %5d 0x%06lx 0x%08x      %5d 0x%06"PRIx64" 0x%02x\n",
                ref, act->domid, act->frame, act->pin,
                sha->domid, frame, status);
+        active_entry_release(act);
     }
 
  out:
-    spin_unlock(&gt->lock);
+    read_unlock(&gt->lock);
 
     if ( first )
         printk("grant-table for remote domain:%5d ... "
@@ -173,7 +173,7 @@ int guest_remove_page(struct domain *d, unsigned long gmfn)
             ASSERT(mfn_valid(mfn));
             page = mfn_to_page(mfn);
             if ( test_and_clear_bit(_PGC_allocated, &page->count_info) )
-                put_page(page);
+                p2m_batch_put_page(p2m_get_hostp2m(d), page);
         }
         p2m_mem_paging_drop_page(d, gmfn, p2mt);
         return 1;
@@ -224,7 +224,12 @@ int guest_remove_page(struct domain *d, unsigned long gmfn)
 
     guest_physmap_remove_page(d, gmfn, mfn, 0);
 
+#ifdef CONFIG_X86
+    /* Keep the page until a batched p2m flush has been issued */
+    p2m_batch_put_page(p2m_get_hostp2m(d), page);
+#else
     put_page(page);
+#endif
     put_gfn(d, gmfn);
 
     return 1;
@@ -240,6 +245,11 @@ static void decrease_reservation(struct memop_args *a)
          a->extent_order > MAX_ORDER )
         return;
 
+#ifdef CONFIG_X86
+    /* Flush the TLBs once for all removed pages, not once per page */
+    p2m_batch_begin(p2m_get_hostp2m(a->domain));
+#endif
+
     for ( i = a->nr_done; i < a->nr_extents; i++ )
     {
         if ( hypercall_preempt_check() )
@@ -276,6 +286,9 @@ static void decrease_reservation(struct memop_args *a)
     }
 
  out:
+#ifdef CONFIG_X86
+    p2m_batch_end(p2m_get_hostp2m(a->domain));
+#endif
     a->nr_done = i;
 }
 
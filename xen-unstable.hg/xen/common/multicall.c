@@ -9,6 +9,7 @@
 #include <xen/sched.h>
 #include <xen/event.h>
 #include <xen/multicall.h>
+#include <xen/grant_table.h>
 #include <xen/guest_access.h>
 #include <xen/perfc.h>
 #include <xen/trace.h>
@@ -96,11 +97,13 @@ do_multicall(
     perfc_incr(calls_to_multicall);
     perfc_add(calls_from_multicall, i);
     mcs->flags = 0;
+    gnttab_flush_deferred_unmaps();
     return rc;
 
  preempted:
     perfc_add(calls_from_multicall, i);
     mcs->flags = 0;
+    gnttab_flush_deferred_unmaps();
     return hypercall_create_continuation(
         __HYPERVISOR_multicall, "hi", call_list, nr_calls-i);
 }
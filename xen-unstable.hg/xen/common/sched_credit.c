@@ -50,6 +50,14 @@
 #define CSCHED_FLAG_VCPU_YIELD     0x0002  /* VCPU yielding */
 
 
+/*
+ * Why a runnable VCPU was taken off its PCPU
+ */
+#define CSCHED_PREEMPT_NONE        0       /* it wasn't, or it woke up since */
+#define CSCHED_PREEMPT_SPIN        1       /* it yielded */
+#define CSCHED_PREEMPT_WORK        2       /* it was doing work */
+
+
 /*
  * Useful macros
  */
@@ -108,6 +116,7 @@
 #define TRC_CSCHED_STOLEN_VCPU   TRC_SCHED_CLASS_EVT(CSCHED, 4)
 #define TRC_CSCHED_PICKED_CPU    TRC_SCHED_CLASS_EVT(CSCHED, 5)
 #define TRC_CSCHED_TICKLE        TRC_SCHED_CLASS_EVT(CSCHED, 6)
+#define TRC_CSCHED_YIELD_TO      TRC_SCHED_CLASS_EVT(CSCHED, 7)
 
 
 /*
@@ -115,6 +124,10 @@
  */
 static int __read_mostly sched_credit_tslice_ms = CSCHED_DEFAULT_TSLICE_MS;
 integer_param("sched_credit_tslice_ms", sched_credit_tslice_ms);
+static bool_t __read_mostly sched_credit_directed_yield = 1;
+boolean_param("sched_credit_directed_yield", sched_credit_directed_yield);
+static bool_t __read_mostly sched_credit_tickless = 1;
+boolean_param("sched_credit_tickless", sched_credit_tickless);
 
 /*
  * Physical CPU
@@ -124,7 +137,18 @@ struct csched_pcpu {
     uint32_t runq_sort_last;
     struct timer ticker;
     unsigned int tick;
+    bool_t tick_stopped;   /* Ticker off, see csched_tick_wanted() */
     unsigned int idle_bias;
+    /* Active VCPUs whose credits this PCPU accounts for */
+    spinlock_t acct_lock;
+    struct list_head active_vcpu;
+    unsigned int acct_epoch;
+    int credit_balance;
+    unsigned int acct_nr_vcpus;
+    s_time_t acct_time;
+    /* LLC miss count and time at the last csched_schedule() */
+    uint64_t llc_misses;
+    s_time_t llc_time;
 };
 
 /*
@@ -137,8 +161,14 @@ struct csched_vcpu {
     struct vcpu *vcpu;
     atomic_t credit;
     s_time_t start_time;   /* When we were scheduled (used for credit) */
+    struct csched_pcpu *acct_spc; /* PCPU whose active list we are on */
     uint16_t flags;
     int16_t pri;
+    uint8_t preempted;     /* CSCHED_PREEMPT_*, see csched_yield_to() */
+    /* Cache footprint estimate, see csched_vcpu_llc_sample() */
+    unsigned int llc_cpu;       /* PCPU of the last sample */
+    unsigned int llc_rate;      /* LLC misses per ms staying there */
+    unsigned int llc_footprint; /* Extra misses after moving LLC */
 #ifdef CSCHED_STATS
     struct {
         int credit_last;
@@ -156,19 +186,23 @@ struct csched_vcpu {
  * Domain
  */
 struct csched_dom {
-    struct list_head active_vcpu;
     struct list_head active_sdom_elem;
     struct domain *dom;
     uint16_t active_vcpu_count;
     uint16_t weight;
     uint16_t cap;
+    /* Per-VCPU credit share and cap for accounting period acct_epoch */
+    unsigned int acct_epoch;
+    uint32_t credit_fair;
+    uint32_t credit_cap;
 };
 
 /*
  * System-wide private data
  */
 struct csched_private {
-    /* lock for the whole pluggable scheduler, nests inside cpupool_lock */
+    /* lock for the whole pluggable scheduler, nests inside cpupool_lock
+     * and inside the per-PCPU acct_lock */
     spinlock_t lock;
     struct list_head active_sdom;
     uint32_t ncpus;
@@ -180,6 +214,8 @@ struct csched_private {
     uint32_t credit;
     int credit_balance;
     uint32_t runq_sort;
+    unsigned int acct_epoch;
+    s_time_t acct_time, acct_time_max;
     unsigned ratelimit_us;
     /* Period of master and tick in milliseconds */
     unsigned tslice_ms, tick_period_us, ticks_per_tslice;
@@ -188,6 +224,8 @@ struct csched_private {
 
 static void csched_tick(void *_cpu);
 static void csched_acct(void *dummy);
+static inline void __csched_vcpu_acct_stop_locked(struct csched_private *prv,
+                                                  struct csched_vcpu *svc);
 
 static inline int
 __vcpu_on_runq(struct csched_vcpu *svc)
@@ -353,7 +391,18 @@ csched_free_pdata(const struct scheduler *ops, void *pcpu, int cpu)
     if ( spc == NULL )
         return;
 
-    spin_lock_irqsave(&prv->lock, flags);
+    spin_lock_irqsave(&spc->acct_lock, flags);
+    spin_lock(&prv->lock);
+
+    /*
+     * VCPUs accounted here start over on the next PCPU they run on.  Who
+     * finds spc through a VCPU's acct_spc holds prv->lock, so once they
+     * are all off the list below, nobody can reach it any more.
+     */
+    while ( !list_empty(&spc->active_vcpu) )
+        __csched_vcpu_acct_stop_locked(prv,
+            list_entry(spc->active_vcpu.next, struct csched_vcpu,
+                       active_vcpu_elem));
 
     prv->credit -= prv->credits_per_tslice;
     prv->ncpus--;
@@ -368,7 +417,8 @@ csched_free_pdata(const struct scheduler *ops, void *pcpu, int cpu)
     if ( prv->ncpus == 0 )
         kill_timer(&prv->master_ticker);
 
-    spin_unlock_irqrestore(&prv->lock, flags);
+    spin_unlock(&prv->lock);
+    spin_unlock_irqrestore(&spc->acct_lock, flags);
 
     xfree(spc);
 }
@@ -404,6 +454,9 @@ csched_alloc_pdata(const struct scheduler *ops, int cpu)
 
     INIT_LIST_HEAD(&spc->runq);
     spc->runq_sort_last = prv->runq_sort;
+    spin_lock_init(&spc->acct_lock);
+    INIT_LIST_HEAD(&spc->active_vcpu);
+    spc->acct_epoch = prv->acct_epoch;
     spc->idle_bias = nr_cpu_ids - 1;
     if ( per_cpu(schedule_data, cpu).sched_priv == NULL )
         per_cpu(schedule_data, cpu).sched_priv = spc;
@@ -462,18 +515,84 @@ unsigned int get_vcpu_migration_delay(void)
     return vcpu_migration_delay;
 }
 
+/*
+ * Cache footprint.  Where the PCPUs count their last level cache misses
+ * (arch_llc_misses()), every VCPU keeps running averages of the rate at
+ * which it misses while it stays on an LLC, and of how many misses more
+ * than that it takes in its first run after moving to another LLC: about
+ * the part of its working set it has to pull in again.  Moving it away is
+ * reckoned to cost CSCHED_LLC_MISS_NS per miss of that footprint.  Without
+ * counters the footprint stays 0, and only vcpu_migration_delay applies.
+ */
+#define CSCHED_LLC_AVG_SHIFT    2               /* A sample weighs 1/4 */
+#define CSCHED_LLC_MISS_NS      100             /* About a DRAM access */
+#define CSCHED_LLC_HOT_MAX      MILLISECS(10)
+
+static void
+csched_vcpu_llc_sample(struct csched_vcpu *svc, unsigned int cpu,
+                       uint64_t misses, s_time_t ns)
+{
+    uint64_t steady, avg;
+
+    if ( cpumask_test_cpu(cpu, per_cpu(cpu_core_mask, svc->llc_cpu)) )
+    {
+        avg = ((uint64_t)svc->llc_rate << CSCHED_LLC_AVG_SHIFT)
+              - svc->llc_rate + misses * MILLISECS(1) / ns;
+        svc->llc_rate = min_t(uint64_t, avg >> CSCHED_LLC_AVG_SHIFT,
+                              UINT_MAX);
+    }
+    else
+    {
+        steady = (uint64_t)svc->llc_rate * ns / MILLISECS(1);
+        avg = ((uint64_t)svc->llc_footprint << CSCHED_LLC_AVG_SHIFT)
+              - svc->llc_footprint + (misses > steady ? misses - steady : 0);
+        svc->llc_footprint = min_t(uint64_t, avg >> CSCHED_LLC_AVG_SHIFT,
+                                   UINT_MAX);
+    }
+    svc->llc_cpu = cpu;
+}
+
+/* Would moving the VCPU off its LLC now cost it its footprint there? */
 static inline int
-__csched_vcpu_is_cache_hot(struct vcpu *v)
+__csched_vcpu_llc_hot(struct vcpu *v)
+{
+    const struct csched_vcpu *svc = CSCHED_VCPU(v);
+    s_time_t hot_time = min_t(s_time_t, CSCHED_LLC_HOT_MAX,
+                              (s_time_t)svc->llc_footprint *
+                              CSCHED_LLC_MISS_NS);
+
+    return hot_time &&
+           (v->is_running || NOW() - v->last_run_time < hot_time);
+}
+
+static inline int
+__csched_vcpu_is_cache_hot(struct vcpu *v, int dest_cpu)
 {
     int hot = ((NOW() - v->last_run_time) <
                ((uint64_t)vcpu_migration_delay * 1000u));
 
+    if ( !hot &&
+         !cpumask_test_cpu(dest_cpu, per_cpu(cpu_core_mask, v->processor)) )
+        hot = __csched_vcpu_llc_hot(v);
+
     if ( hot )
         SCHED_STAT_CRANK(vcpu_hot);
 
     return hot;
 }
 
+/*
+ * Would the VCPU have carried on running?  Being kicked over to another
+ * PCPU (_VPF_migrating) doesn't mean it wanted to stop.
+ */
+static inline int
+__csched_vcpu_wants_to_run(struct vcpu *vc)
+{
+    return !((vc->pause_flags & ~VPF_migrating) |
+             atomic_read(&vc->pause_count) |
+             atomic_read(&vc->domain->pause_count));
+}
+
 static inline int
 __csched_vcpu_is_migrateable(struct vcpu *vc, int dest_cpu)
 {
@@ -482,7 +601,7 @@ __csched_vcpu_is_migrateable(struct vcpu *vc, int dest_cpu)
      * peer PCPU. Only pick up work that's allowed to run on our CPU.
      */
     return !vc->is_running &&
-           !__csched_vcpu_is_cache_hot(vc) &&
+           !__csched_vcpu_is_cache_hot(vc, dest_cpu) &&
            cpumask_test_cpu(dest_cpu, vc->cpu_affinity);
 }
 
@@ -552,6 +671,10 @@ _csched_cpu_pick(const struct scheduler *ops, struct vcpu *vc, bool_t commit)
              * Migrate only if the other core is twice as idle */
             ASSERT( !cpumask_test_cpu(nxt, per_cpu(cpu_core_mask, cpu)) );
             migrate_factor = 2;
+            /* ... or four times, if that would cost it its cache footprint */
+            if ( cpumask_test_cpu(vc->processor, per_cpu(cpu_core_mask, cpu))
+                 && __csched_vcpu_llc_hot(vc) )
+                migrate_factor = 4;
             cpumask_and(&cpu_idlers, &idlers, per_cpu(cpu_core_mask, cpu));
             cpumask_and(&nxt_idlers, &idlers, per_cpu(cpu_core_mask, nxt));
         }
@@ -589,12 +712,15 @@ csched_cpu_pick(const struct scheduler *ops, struct vcpu *vc)
 }
 
 static inline void
-__csched_vcpu_acct_start(struct csched_private *prv, struct csched_vcpu *svc)
+__csched_vcpu_acct_start(struct csched_private *prv, struct csched_vcpu *svc,
+                         unsigned int cpu)
 {
+    struct csched_pcpu * const spc = CSCHED_PCPU(cpu);
     struct csched_dom * const sdom = svc->sdom;
     unsigned long flags;
 
-    spin_lock_irqsave(&prv->lock, flags);
+    spin_lock_irqsave(&spc->acct_lock, flags);
+    spin_lock(&prv->lock);
 
     if ( list_empty(&svc->active_vcpu_elem) )
     {
@@ -602,7 +728,9 @@ __csched_vcpu_acct_start(struct csched_private *prv, struct csched_vcpu *svc)
         SCHED_STAT_CRANK(acct_vcpu_active);
 
         sdom->active_vcpu_count++;
-        list_add(&svc->active_vcpu_elem, &sdom->active_vcpu);
+        /* The PCPU it starts on takes care of its credits from now on */
+        svc->acct_spc = spc;
+        list_add(&svc->active_vcpu_elem, &spc->active_vcpu);
         /* Make weight per-vcpu */
         prv->weight += sdom->weight;
         if ( list_empty(&sdom->active_sdom_elem) )
@@ -614,9 +742,11 @@ __csched_vcpu_acct_start(struct csched_private *prv, struct csched_vcpu *svc)
     TRACE_3D(TRC_CSCHED_ACCOUNT_START, sdom->dom->domain_id,
              svc->vcpu->vcpu_id, sdom->active_vcpu_count);
 
-    spin_unlock_irqrestore(&prv->lock, flags);
+    spin_unlock(&prv->lock);
+    spin_unlock_irqrestore(&spc->acct_lock, flags);
 }
 
+/* Needs both prv->lock and the acct_lock of svc->acct_spc */
 static inline void
 __csched_vcpu_acct_stop_locked(struct csched_private *prv,
     struct csched_vcpu *svc)
@@ -632,7 +762,7 @@ __csched_vcpu_acct_stop_locked(struct csched_private *prv,
     sdom->active_vcpu_count--;
     list_del_init(&svc->active_vcpu_elem);
     prv->weight -= sdom->weight;
-    if ( list_empty(&sdom->active_vcpu) )
+    if ( sdom->active_vcpu_count == 0 )
     {
         list_del_init(&sdom->active_sdom_elem);
     }
@@ -641,6 +771,44 @@ __csched_vcpu_acct_stop_locked(struct csched_private *prv,
              svc->vcpu->vcpu_id, sdom->active_vcpu_count);
 }
 
+/*
+ * Move an active VCPU's accounting to the PCPU it now runs on, so PCPUs
+ * don't keep accounting for VCPUs which migrated away.  prv->lock keeps
+ * the old PCPU's data from being freed under our feet (see
+ * csched_free_pdata()), but the acct_locks nest outside it and can only
+ * be tried.  If that fails, or the two PCPUs are in different accounting
+ * periods, the next tick tries again.
+ */
+static void
+__csched_vcpu_acct_rehome(struct csched_private *prv, struct csched_vcpu *svc,
+                          unsigned int cpu)
+{
+    struct csched_pcpu * const spc = CSCHED_PCPU(cpu);
+    struct csched_pcpu *old;
+    unsigned long flags;
+
+    spin_lock_irqsave(&prv->lock, flags);
+
+    old = svc->acct_spc;
+    if ( !list_empty(&svc->active_vcpu_elem) && old != spc &&
+         spin_trylock(&old->acct_lock) )
+    {
+        if ( spin_trylock(&spc->acct_lock) )
+        {
+            if ( old->acct_epoch == spc->acct_epoch )
+            {
+                list_del(&svc->active_vcpu_elem);
+                list_add(&svc->active_vcpu_elem, &spc->active_vcpu);
+                svc->acct_spc = spc;
+            }
+            spin_unlock(&spc->acct_lock);
+        }
+        spin_unlock(&old->acct_lock);
+    }
+
+    spin_unlock_irqrestore(&prv->lock, flags);
+}
+
 static void
 csched_vcpu_acct(struct csched_private *prv, unsigned int cpu)
 {
@@ -674,14 +842,20 @@ csched_vcpu_acct(struct csched_private *prv, unsigned int cpu)
      */
     if ( list_empty(&svc->active_vcpu_elem) )
     {
-        __csched_vcpu_acct_start(prv, svc);
+        __csched_vcpu_acct_start(prv, svc, cpu);
     }
-    else if ( _csched_cpu_pick(ops, current, 0) != cpu )
+    else
     {
-        SCHED_VCPU_STAT_CRANK(svc, migrate_r);
-        SCHED_STAT_CRANK(migrate_running);
-        set_bit(_VPF_migrating, &current->pause_flags);
-        cpu_raise_softirq(cpu, SCHEDULE_SOFTIRQ);
+        if ( svc->acct_spc != CSCHED_PCPU(cpu) )
+            __csched_vcpu_acct_rehome(prv, svc, cpu);
+
+        if ( _csched_cpu_pick(ops, current, 0) != cpu )
+        {
+            SCHED_VCPU_STAT_CRANK(svc, migrate_r);
+            SCHED_STAT_CRANK(migrate_running);
+            set_bit(_VPF_migrating, &current->pause_flags);
+            cpu_raise_softirq(cpu, SCHEDULE_SOFTIRQ);
+        }
     }
 }
 
@@ -699,6 +873,7 @@ csched_alloc_vdata(const struct scheduler *ops, struct vcpu *vc, void *dd)
     INIT_LIST_HEAD(&svc->active_vcpu_elem);
     svc->sdom = dd;
     svc->vcpu = vc;
+    svc->llc_cpu = vc->processor;
     atomic_set(&svc->credit, 0);
     svc->flags = 0U;
     svc->pri = is_idle_domain(vc->domain) ?
@@ -740,12 +915,30 @@ csched_vcpu_remove(const struct scheduler *ops, struct vcpu *vc)
     if ( __vcpu_on_runq(svc) )
         __runq_remove(svc);
 
-    spin_lock_irqsave(&(prv->lock), flags);
+    /*
+     * The VCPU isn't running, so it can't become active behind our back.
+     * Its active list membership and acct_spc only change with prv->lock
+     * held, which also keeps acct_spc from being freed (see
+     * csched_free_pdata()).  The acct_lock nests outside prv->lock, so it
+     * can only be tried, dropping prv->lock in between.
+     */
+    spin_lock_irqsave(&prv->lock, flags);
+    while ( !list_empty(&svc->active_vcpu_elem) )
+    {
+        struct csched_pcpu * const spc = svc->acct_spc;
 
-    if ( !list_empty(&svc->active_vcpu_elem) )
-        __csched_vcpu_acct_stop_locked(prv, svc);
+        if ( spin_trylock(&spc->acct_lock) )
+        {
+            __csched_vcpu_acct_stop_locked(prv, svc);
+            spin_unlock(&spc->acct_lock);
+            break;
+        }
 
-    spin_unlock_irqrestore(&(prv->lock), flags);
+        spin_unlock_irqrestore(&prv->lock, flags);
+        cpu_relax();
+        spin_lock_irqsave(&prv->lock, flags);
+    }
+    spin_unlock_irqrestore(&prv->lock, flags);
 
     BUG_ON( sdom == NULL );
     BUG_ON( !list_empty(&svc->runq_elem) );
@@ -764,6 +957,9 @@ csched_vcpu_sleep(const struct scheduler *ops, struct vcpu *vc)
         cpu_raise_softirq(vc->processor, SCHEDULE_SOFTIRQ);
     else if ( __vcpu_on_runq(svc) )
         __runq_remove(svc);
+
+    /* Whatever it was doing, it's no use to a spinning sibling now. */
+    svc->preempted = CSCHED_PREEMPT_NONE;
 }
 
 static void
@@ -914,7 +1110,6 @@ csched_alloc_domdata(const struct scheduler *ops, struct domain *dom)
         return NULL;
 
     /* Initialize credit and weight */
-    INIT_LIST_HEAD(&sdom->active_vcpu);
     sdom->active_vcpu_count = 0;
     INIT_LIST_HEAD(&sdom->active_sdom_elem);
     sdom->dom = dom;
@@ -1003,15 +1198,142 @@ csched_runq_sort(struct csched_private *prv, unsigned int cpu)
     pcpu_schedule_unlock_irqrestore(cpu, flags);
 }
 
+/*
+ * Hand out the credits of the last accounting period to the VCPUs this
+ * PCPU accounts for, using the per-VCPU shares csched_acct() computed for
+ * their domains, and recompute their priorities.
+ *
+ * Called with spc->acct_lock held.  prv->lock is only needed to take VCPUs
+ * off the active lists, the master passes prv_locked when it catches up
+ * on behalf of a PCPU which didn't get to it.
+ */
+static void
+csched_acct_pcpu(struct csched_private *prv, struct csched_pcpu *spc,
+                 bool_t prv_locked)
+{
+    struct list_head *iter_vcpu, *next_vcpu;
+    struct csched_vcpu *svc;
+    struct csched_dom *sdom;
+    unsigned int epoch = prv->acct_epoch;
+    unsigned int nr_vcpus = 0;
+    s_time_t start = NOW();
+    uint32_t credit_fair;
+    uint32_t credit_cap;
+    int credit_balance = 0;
+    int credit;
+
+    if ( spc->acct_epoch == epoch )
+        return;
+
+    /* Read the shares only after seeing the new epoch */
+    smp_rmb();
+
+    list_for_each_safe( iter_vcpu, next_vcpu, &spc->active_vcpu )
+    {
+        svc = list_entry(iter_vcpu, struct csched_vcpu, active_vcpu_elem);
+        sdom = svc->sdom;
+        nr_vcpus++;
+
+        /* Domain only became active after the shares were computed */
+        if ( sdom->acct_epoch != epoch )
+        {
+            credit_balance += atomic_read(&svc->credit);
+            continue;
+        }
+
+        credit_fair = sdom->credit_fair;
+        credit_cap = sdom->credit_cap;
+
+        /* Increment credit */
+        atomic_add(credit_fair, &svc->credit);
+        credit = atomic_read(&svc->credit);
+
+        /*
+         * Recompute priority or, if VCPU is idling, remove it from
+         * the active list.
+         */
+        if ( credit < 0 )
+        {
+            svc->pri = CSCHED_PRI_TS_OVER;
+
+            /* Park running VCPUs of capped-out domains */
+            if ( sdom->cap != 0U &&
+                 credit < -credit_cap &&
+                 !(svc->flags & CSCHED_FLAG_VCPU_PARKED) )
+            {
+                SCHED_STAT_CRANK(vcpu_park);
+                vcpu_pause_nosync(svc->vcpu);
+                svc->flags |= CSCHED_FLAG_VCPU_PARKED;
+            }
+
+            /* Lower bound on credits */
+            if ( credit < -prv->credits_per_tslice )
+            {
+                SCHED_STAT_CRANK(acct_min_credit);
+                credit = -prv->credits_per_tslice;
+                atomic_set(&svc->credit, credit);
+            }
+        }
+        else
+        {
+            svc->pri = CSCHED_PRI_TS_UNDER;
+
+            /* Unpark any capped domains whose credits go positive */
+            if ( svc->flags & CSCHED_FLAG_VCPU_PARKED)
+            {
+                /*
+                 * It's important to unset the flag AFTER the unpause()
+                 * call to make sure the VCPU's priority is not boosted
+                 * if it is woken up here.
+                 */
+                SCHED_STAT_CRANK(vcpu_unpark);
+                vcpu_unpause(svc->vcpu);
+                svc->flags &= ~CSCHED_FLAG_VCPU_PARKED;
+            }
+
+            /* Upper bound on credits means VCPU stops earning */
+            if ( credit > prv->credits_per_tslice )
+            {
+                if ( !prv_locked )
+                    spin_lock(&prv->lock);
+                __csched_vcpu_acct_stop_locked(prv, svc);
+                if ( !prv_locked )
+                    spin_unlock(&prv->lock);
+                /* Divide credits in half, so that when it starts
+                 * accounting again, it starts a little bit "ahead" */
+                credit /= 2;
+                atomic_set(&svc->credit, credit);
+            }
+        }
+
+        SCHED_VCPU_STAT_SET(svc, credit_last, credit);
+        SCHED_VCPU_STAT_SET(svc, credit_incr, credit_fair);
+        credit_balance += credit;
+    }
+
+    spc->credit_balance = credit_balance;
+    spc->acct_nr_vcpus = nr_vcpus;
+    spc->acct_epoch = epoch;
+    spc->acct_time = NOW() - start;
+}
+
+/*
+ * The accounting master only computes each active domain's per-VCPU share
+ * of the credits, which is O(active domains).  Applying the shares to the
+ * VCPUs is left to every PCPU's csched_tick(), see csched_acct_pcpu(), and
+ * the system-wide credit balance is summed from the PCPUs' partial sums.
+ */
 static void
 csched_acct(void* dummy)
 {
     struct csched_private *prv = dummy;
     unsigned long flags;
-    struct list_head *iter_vcpu, *next_vcpu;
     struct list_head *iter_sdom, *next_sdom;
-    struct csched_vcpu *svc;
+    struct csched_pcpu *spc;
     struct csched_dom *sdom;
+    s_time_t start = NOW();
+    unsigned int cpu;
+    unsigned int epoch;
     uint32_t credit_total;
     uint32_t weight_total;
     uint32_t weight_left;
@@ -1020,11 +1342,45 @@ csched_acct(void* dummy)
     uint32_t credit_cap;
     int credit_balance;
     int credit_xtra;
-    int credit;
 
 
     spin_lock_irqsave(&prv->lock, flags);
 
+    /*
+     * Finish the last period for PCPUs which didn't get to it, e.g.
+     * because their ticker is suspended, and collect the balance.  The
+     * acct_lock nests outside prv->lock, so it can only be tried; if it is
+     * busy, drop prv->lock and try again rather than let the PCPU miss a
+     * period's credits.  Only the master changes acct_epoch.
+     */
+    credit_balance = 0;
+    for_each_cpu ( cpu, prv->cpus )
+    {
+        spc = CSCHED_PCPU(cpu);
+        while ( spc->acct_epoch != prv->acct_epoch )
+        {
+            if ( spin_trylock(&spc->acct_lock) )
+            {
+                csched_acct_pcpu(prv, spc, 1);
+                spin_unlock(&spc->acct_lock);
+                break;
+            }
+
+            SCHED_STAT_CRANK(acct_pcpu_retry);
+            spin_unlock_irqrestore(&prv->lock, flags);
+            cpu_relax();
+            spin_lock_irqsave(&prv->lock, flags);
+
+            /* It may have left the pool meanwhile, see csched_free_pdata() */
+            if ( !cpumask_test_cpu(cpu, prv->cpus) )
+                break;
+            spc = CSCHED_PCPU(cpu);
+        }
+        if ( cpumask_test_cpu(cpu, prv->cpus) )
+            credit_balance += spc->credit_balance;
+    }
+    prv->credit_balance = credit_balance;
+
     weight_total = prv->weight;
     credit_total = prv->credit;
 
@@ -1045,8 +1401,8 @@ csched_acct(void* dummy)
 
     SCHED_STAT_CRANK(acct_run);
 
+    epoch = prv->acct_epoch + 1;
     weight_left = weight_total;
-    credit_balance = 0;
     credit_xtra = 0;
     credit_cap = 0U;
 
@@ -1127,80 +1483,19 @@ csched_acct(void* dummy)
         }
 
         /* Compute fair share per VCPU */
-        credit_fair = ( credit_fair + ( sdom->active_vcpu_count - 1 )
-                      ) / sdom->active_vcpu_count;
-
-
-        list_for_each_safe( iter_vcpu, next_vcpu, &sdom->active_vcpu )
-        {
-            svc = list_entry(iter_vcpu, struct csched_vcpu, active_vcpu_elem);
-            BUG_ON( sdom != svc->sdom );
-
-            /* Increment credit */
-            atomic_add(credit_fair, &svc->credit);
-            credit = atomic_read(&svc->credit);
-
-            /*
-             * Recompute priority or, if VCPU is idling, remove it from
-             * the active list.
-             */
-            if ( credit < 0 )
-            {
-                svc->pri = CSCHED_PRI_TS_OVER;
-
-                /* Park running VCPUs of capped-out domains */
-                if ( sdom->cap != 0U &&
-                     credit < -credit_cap &&
-                     !(svc->flags & CSCHED_FLAG_VCPU_PARKED) )
-                {
-                    SCHED_STAT_CRANK(vcpu_park);
-                    vcpu_pause_nosync(svc->vcpu);
-                    svc->flags |= CSCHED_FLAG_VCPU_PARKED;
-                }
-
-                /* Lower bound on credits */
-                if ( credit < -prv->credits_per_tslice )
-                {
-                    SCHED_STAT_CRANK(acct_min_credit);
-                    credit = -prv->credits_per_tslice;
-                    atomic_set(&svc->credit, credit);
-                }
-            }
-            else
-            {
-                svc->pri = CSCHED_PRI_TS_UNDER;
-
-                /* Unpark any capped domains whose credits go positive */
-                if ( svc->flags & CSCHED_FLAG_VCPU_PARKED)
-                {
-                    /*
-                     * It's important to unset the flag AFTER the unpause()
-                     * call to make sure the VCPU's priority is not boosted
-                     * if it is woken up here.
-                     */
-                    SCHED_STAT_CRANK(vcpu_unpark);
-                    vcpu_unpause(svc->vcpu);
-                    svc->flags &= ~CSCHED_FLAG_VCPU_PARKED;
-                }
-
-                /* Upper bound on credits means VCPU stops earning */
-                if ( credit > prv->credits_per_tslice )
-                {
-                    __csched_vcpu_acct_stop_locked(prv, svc);
-                    /* Divide credits in half, so that when it starts
-                     * accounting again, it starts a little bit "ahead" */
-                    credit /= 2;
-                    atomic_set(&svc->credit, credit);
-                }
-            }
-
-            SCHED_VCPU_STAT_SET(svc, credit_last, credit);
-            SCHED_VCPU_STAT_SET(svc, credit_incr, credit_fair);
-            credit_balance += credit;
-        }
+        sdom->credit_fair = ( credit_fair + ( sdom->active_vcpu_count - 1 )
+                            ) / sdom->active_vcpu_count;
+        sdom->credit_cap = credit_cap;
+        sdom->acct_epoch = epoch;
     }
 
-    prv->credit_balance = credit_balance;
+    /* Publish the shares before the PCPUs can see the new period */
+    smp_wmb();
+    prv->acct_epoch = epoch;
+
+    prv->acct_time = NOW() - start;
+    if ( prv->acct_time > prv->acct_time_max )
+        prv->acct_time_max = prv->acct_time;
 
     spin_unlock_irqrestore(&prv->lock, flags);
 
@@ -1218,6 +1513,7 @@ csched_tick(void *_cpu)
     unsigned int cpu = (unsigned long)_cpu;
     struct csched_pcpu *spc = CSCHED_PCPU(cpu);
     struct csched_private *prv = CSCHED_PRIV(per_cpu(scheduler, cpu));
+    unsigned long flags;
 
     spc->tick++;
 
@@ -1227,6 +1523,16 @@ csched_tick(void *_cpu)
     if ( !is_idle_vcpu(current) )
         csched_vcpu_acct(prv, cpu);
 
+    /*
+     * Hand out this PCPU's part of the last accounting period's credits
+     */
+    if ( spc->acct_epoch != prv->acct_epoch )
+    {
+        spin_lock_irqsave(&spc->acct_lock, flags);
+        csched_acct_pcpu(prv, spc, 0);
+        spin_unlock_irqrestore(&spc->acct_lock, flags);
+    }
+
     /*
      * Check if runq needs to be sorted
      *
@@ -1356,6 +1662,130 @@ csched_load_balance(struct csched_private *prv, int cpu,
     return snext;
 }
 
+/*
+ * Directed yield.  A VCPU that yields is usually spinning (the guest asked
+ * to yield, or the PCPU took a pause-loop exit), and in an overcommitted
+ * SMP guest most likely on a lock held by a sibling which we preempted.
+ * Instead of just stepping aside for whatever is queued here, run such a
+ * sibling, preferring one that was doing work over one that was spinning
+ * too: with ticket locks or barriers the VCPU everybody waits for may well
+ * have been preempted while it was still waiting itself.
+ *
+ * Siblings on our own runq come first, then we try to pull one off the
+ * runq of another PCPU.  Only siblings with a priority of at least pri
+ * qualify, which the caller sets so that a domain can't use this to get
+ * ahead of others; the sibling burns its own credits as usual.
+ */
+static struct csched_vcpu *
+csched_yield_to(int cpu, struct csched_vcpu *scurr, int pri, bool_t *stolen)
+{
+    const cpumask_t *online = cpupool_scheduler_cpumask(per_cpu(cpupool, cpu));
+    struct csched_vcpu *svc, *local = NULL, *remote = NULL;
+    struct list_head *iter;
+    struct vcpu *vc;
+    int peer_cpu;
+
+    list_for_each( iter, RUNQ(cpu) )
+    {
+        svc = __runq_elem(iter);
+        if ( svc->pri < pri )
+            break;
+        if ( svc->sdom == scurr->sdom && svc != scurr &&
+             svc->preempted > (local ? local->preempted : CSCHED_PREEMPT_NONE) )
+            local = svc;
+    }
+
+    /* If this CPU is going offline we shouldn't steal work. */
+    if ( (local == NULL || local->preempted != CSCHED_PREEMPT_WORK) &&
+         likely(cpumask_test_cpu(cpu, online)) )
+    {
+        /* Racy peek, checked again below with the peer's lock held. */
+        for_each_vcpu ( scurr->vcpu->domain, vc )
+        {
+            svc = CSCHED_VCPU(vc);
+            peer_cpu = vc->processor;
+            if ( peer_cpu == cpu || svc->pri < pri ||
+                 !cpumask_test_cpu(peer_cpu, online) ||
+                 !cpumask_test_cpu(cpu, vc->cpu_affinity) )
+                continue;
+            if ( svc->preempted >
+                 (remote ? remote->preempted :
+                  local ? local->preempted : CSCHED_PREEMPT_NONE) )
+                remote = svc;
+        }
+    }
+
+    if ( remote != NULL )
+    {
+        vc = remote->vcpu;
+        peer_cpu = vc->processor;
+
+        /* As in csched_load_balance(), don't spin on the peer's lock. */
+        if ( pcpu_schedule_trylock(peer_cpu) )
+        {
+            /* Affinity may have changed since the peek, too. */
+            if ( vc->processor == peer_cpu && __vcpu_on_runq(remote) &&
+                 remote->preempted != CSCHED_PREEMPT_NONE &&
+                 remote->pri >= pri && !vc->is_running &&
+                 cpumask_test_cpu(cpu, vc->cpu_affinity) )
+            {
+                TRACE_3D(TRC_CSCHED_YIELD_TO, peer_cpu,
+                         vc->domain->domain_id, vc->vcpu_id);
+                SCHED_VCPU_STAT_CRANK(remote, migrate_q);
+                SCHED_STAT_CRANK(yield_to_remote);
+                __runq_remove(remote);
+                vc->processor = cpu;
+                pcpu_schedule_unlock(peer_cpu);
+                *stolen = 1;
+                return remote;
+            }
+            pcpu_schedule_unlock(peer_cpu);
+        }
+        else
+            SCHED_STAT_CRANK(steal_trylock_failed);
+    }
+
+    if ( local != NULL )
+    {
+        SCHED_STAT_CRANK(yield_to_local);
+        __runq_remove(local);
+        return local;
+    }
+
+    SCHED_STAT_CRANK(yield_to_none);
+    return NULL;
+}
+
+/*
+ * Whether this PCPU needs its ticker while running snext.  The tick burns
+ * the running VCPU's credits, unboosts it, puts it back on the active
+ * list, moves it if another PCPU would suit it better, and hands out the
+ * credits of the VCPUs this PCPU accounts for.  An idle PCPU needs none
+ * of that: the accounting master hands out its credits.  Nor does one
+ * with nothing queued behind a settled VCPU that is the only one it
+ * accounts for: its credits are burnt here, at the end of each timeslice,
+ * instead, and where it should run is reconsidered once anything else
+ * wants this PCPU.  This runs on every schedule, so it only looks at
+ * per-PCPU state; the list peek is racy but only ever costs a tick.
+ */
+static inline bool_t
+csched_tick_wanted(unsigned int cpu, struct csched_vcpu *snext)
+{
+    struct csched_pcpu * const spc = CSCHED_PCPU(cpu);
+
+    if ( !sched_credit_tickless )
+        return 1;
+
+    if ( is_idle_vcpu(snext->vcpu) )
+        return 0;
+
+    return !IS_RUNQ_IDLE(cpu) ||
+           snext->pri == CSCHED_PRI_TS_BOOST ||
+           snext->acct_spc != spc ||
+           spc->active_vcpu.next != &snext->active_vcpu_elem ||
+           snext->active_vcpu_elem.next != &spc->active_vcpu;
+}
+
 /*
  * This function is in the critical path. It is designed to be simple and
  * fast for the common case.
@@ -1366,15 +1796,30 @@ csched_schedule(
 {
     const int cpu = smp_processor_id();
     struct list_head * const runq = RUNQ(cpu);
+    struct csched_pcpu * const spc = CSCHED_PCPU(cpu);
     struct csched_vcpu * const scurr = CSCHED_VCPU(current);
     struct csched_private *prv = CSCHED_PRIV(ops);
-    struct csched_vcpu *snext;
+    struct csched_vcpu *snext, *syield = NULL;
     struct task_slice ret;
     s_time_t runtime, tslice;
+    const bool_t yielded = !!(scurr->flags & CSCHED_FLAG_VCPU_YIELD);
+    uint64_t llc_misses;
 
     SCHED_STAT_CRANK(schedule);
     CSCHED_VCPU_CHECK(current);
 
+    /* The LLC misses since the last time round are the current VCPU's */
+    llc_misses = arch_llc_misses();
+    if ( llc_misses != LLC_MISSES_UNKNOWN )
+    {
+        if ( !is_idle_vcpu(scurr->vcpu) && spc->llc_time &&
+             now > spc->llc_time )
+            csched_vcpu_llc_sample(scurr, cpu, llc_misses - spc->llc_misses,
+                                   now - spc->llc_time);
+        spc->llc_misses = llc_misses;
+        spc->llc_time = now;
+    }
+
     runtime = now - current->runstate.state_entry_time;
     if ( runtime < 0 ) /* Does this ever happen? */
         runtime = 0;
@@ -1394,8 +1839,11 @@ csched_schedule(
     /* Choices, choices:
      * - If we have a tasklet, we need to run the idle vcpu no matter what.
      * - If sched rate limiting is in effect, and the current vcpu has
-     *   run for less than that amount of time, continue the current one,
-     *   but with a shorter timeslice and return it immediately
+     *   run for less than that amount of time (and isn't yielding),
+     *   continue the current one, but with a shorter timeslice and
+     *   return it immediately
+     * - If the current vcpu is yielding, run a preempted sibling of it
+     *   in its place if there is one, see csched_yield_to()
      * - Otherwise, chose the one with the highest priority (which may
      *   be the one currently running)
      * - If the currently running one is TS_OVER, see if there
@@ -1404,11 +1852,13 @@ csched_schedule(
      */
 
     /* If we have schedule rate limiting enabled, check to see
-     * how long we've run for. */
+     * how long we've run for.  A yield only gets past it when
+     * sched_credit_directed_yield is on. */
     if ( !tasklet_work_scheduled
          && prv->ratelimit_us
          && vcpu_runnable(current)
          && !is_idle_vcpu(current)
+         && !(yielded && sched_credit_directed_yield)
          && runtime < MICROSECS(prv->ratelimit_us) )
     {
         snext = scurr;
@@ -1442,9 +1892,24 @@ csched_schedule(
     /*
      * Clear YIELD flag before scheduling out
      */
-    if ( scurr->flags & CSCHED_FLAG_VCPU_YIELD )
+    if ( yielded )
         scurr->flags &= ~(CSCHED_FLAG_VCPU_YIELD);
 
+    /*
+     * Directed yield: if the current VCPU is spinning on behalf of a
+     * preempted sibling, run that instead of the top of the runq.  If the
+     * top of the runq belongs to another domain, the sibling has to be
+     * more urgent than it, as it would have been the one to run next had
+     * the yielder not been in the way.  Otherwise the PCPU is the domain's
+     * to use anyway.
+     */
+    if ( yielded && !tasklet_work_scheduled && sched_credit_directed_yield &&
+         scurr->vcpu->domain->max_vcpus > 1 )
+        syield = csched_yield_to(cpu, scurr,
+                                 snext->sdom == scurr->sdom ?
+                                 CSCHED_PRI_TS_OVER : snext->pri + 1,
+                                 &ret.migrated);
+
     /*
      * SMP Load balance:
      *
@@ -1453,11 +1918,23 @@ csched_schedule(
      * urgent work... If not, csched_load_balance() will return snext, but
      * already removed from the runq.
      */
-    if ( snext->pri > CSCHED_PRI_TS_OVER )
+    if ( syield != NULL )
+        snext = syield;
+    else if ( snext->pri > CSCHED_PRI_TS_OVER )
         __runq_remove(snext);
     else
         snext = csched_load_balance(prv, cpu, snext, &ret.migrated);
 
+    /*
+     * Remember whether we are taking a runnable VCPU off the PCPU: it may
+     * hold a lock its siblings will spin on, or be next in line for it.
+     */
+    if ( snext != scurr && !is_idle_vcpu(current) )
+        scurr->preempted = !__csched_vcpu_wants_to_run(current) ?
+                           CSCHED_PREEMPT_NONE :
+                           yielded ? CSCHED_PREEMPT_SPIN : CSCHED_PREEMPT_WORK;
+    snext->preempted = CSCHED_PREEMPT_NONE;
+
     /*
      * Update idlers mask if necessary. When we're idling, other CPUs
      * will tickle us when they get extra work.
@@ -1476,6 +1953,27 @@ csched_schedule(
         snext->start_time += now;
 
 out:
+    /*
+     * Stop or restart the ticker.  A restarted one fires on the tick
+     * boundaries, like after csched_tick_resume().
+     */
+    if ( csched_tick_wanted(cpu, snext) )
+    {
+        if ( spc->tick_stopped )
+        {
+            SCHED_STAT_CRANK(tick_restart);
+            spc->tick_stopped = 0;
+            set_timer(&spc->ticker, now + MICROSECS(prv->tick_period_us)
+                      - now % MICROSECS(prv->tick_period_us));
+        }
+    }
+    else if ( !spc->tick_stopped )
+    {
+        SCHED_STAT_CRANK(tick_stop);
+        spc->tick_stopped = 1;
+        stop_timer(&spc->ticker);
+    }
+
     /*
      * Return task to run next...
      */
@@ -1502,6 +2000,8 @@ csched_dump_vcpu(struct csched_vcpu *svc)
     if ( sdom )
     {
         printk(" credit=%i [w=%u]", atomic_read(&svc->credit), sdom->weight);
+        if ( svc->llc_rate || svc->llc_footprint )
+            printk(" llc=%u/ms+%u", svc->llc_rate, svc->llc_footprint);
 #ifdef CSCHED_STATS
         printk(" (%d+%u) {a/i=%u/%u m=%u+%u (k=%u)}",
                 svc->stats.credit_last,
@@ -1533,6 +2033,9 @@ csched_dump_pcpu(const struct scheduler *ops, int cpu)
     printk(" sort=%d, sibling=%s, ", spc->runq_sort_last, cpustr);
     cpumask_scnprintf(cpustr, sizeof(cpustr), per_cpu(cpu_core_mask, cpu));
     printk("core=%s\n", cpustr);
+    printk("\tacct: epoch=%u vcpus=%u time=%"PRI_stime"ns%s\n",
+           spc->acct_epoch, spc->acct_nr_vcpus, spc->acct_time,
+           spc->tick_stopped ? " tickless" : "");
 
     /* current VCPU */
     svc = CSCHED_VCPU(curr_on_cpu(cpu));
@@ -1558,8 +2061,10 @@ csched_dump_pcpu(const struct scheduler *ops, int cpu)
 static void
 csched_dump(const struct scheduler *ops)
 {
-    struct list_head *iter_sdom, *iter_svc;
+    struct list_head *iter_svc;
     struct csched_private *prv = CSCHED_PRIV(ops);
+    struct csched_pcpu *spc;
+    unsigned int cpu;
     int loop;
     unsigned long flags;
 
@@ -1574,11 +2079,14 @@ csched_dump(const struct scheduler *ops)
            "\tcredit balance     = %d\n"
            "\tweight             = %u\n"
            "\trunq_sort          = %u\n"
+           "\tacct epoch         = %u\n"
+           "\tacct time          = %"PRI_stime"ns (max %"PRI_stime"ns)\n"
            "\tdefault-weight     = %d\n"
            "\ttslice             = %dms\n"
            "\tratelimit          = %dus\n"
            "\tcredits per msec   = %d\n"
            "\tticks per tslice   = %d\n"
+           "\ttickless           = %d\n"
            "\tmigration delay    = %uus\n",
            prv->ncpus,
            prv->master,
@@ -1586,24 +2094,28 @@ csched_dump(const struct scheduler *ops)
            prv->credit_balance,
            prv->weight,
            prv->runq_sort,
+           prv->acct_epoch,
+           prv->acct_time,
+           prv->acct_time_max,
            CSCHED_DEFAULT_WEIGHT,
            prv->tslice_ms,
            prv->ratelimit_us,
            CSCHED_CREDITS_PER_MSEC,
            prv->ticks_per_tslice,
+           sched_credit_tickless,
            vcpu_migration_delay);
 
     cpumask_scnprintf(idlers_buf, sizeof(idlers_buf), prv->idlers);
     printk("idlers: %s\n", idlers_buf);
 
+    /* The active lists only change with prv->lock held, too */
     printk("active vcpus:\n");
     loop = 0;
-    list_for_each( iter_sdom, &prv->active_sdom )
+    for_each_cpu ( cpu, prv->cpus )
     {
-        struct csched_dom *sdom;
-        sdom = list_entry(iter_sdom, struct csched_dom, active_sdom_elem);
+        spc = CSCHED_PCPU(cpu);
 
-        list_for_each( iter_svc, &sdom->active_vcpu )
+        list_for_each( iter_svc, &spc->active_vcpu )
         {
             struct csched_vcpu *svc;
             svc = list_entry(iter_svc, struct csched_vcpu, active_vcpu_elem);
@@ -1701,6 +2213,10 @@ static void csched_tick_resume(const struct scheduler *ops, unsigned int cpu)
 
     prv = CSCHED_PRIV(ops);
 
+    /* Stopped by csched_schedule(), which will restart it if need be */
+    if ( spc->tick_stopped )
+        return;
+
     set_timer(&spc->ticker, now + MICROSECS(prv->tick_period_us)
             - now % MICROSECS(prv->tick_period_us) );
 }
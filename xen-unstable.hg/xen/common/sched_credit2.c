@@ -25,6 +25,7 @@
 #include <xen/errno.h>
 #include <xen/trace.h>
 #include <xen/cpu.h>
+#include <xen/numa.h>
 
 #define d2printk(x...)
 //#define d2printk printk
@@ -54,7 +55,6 @@
  * + Immediate bug-fixes
  *  - Do per-runqueue, grab proper lock for dump debugkey
  * + Multiple sockets
- *  - Detect cpu layout and make runqueue map, one per L2 (make_runq_map())
  *  - Simple load balancer / runqueue assignment
  *  - Runqueue load measurement
  *  - Load-based load balancer
@@ -84,9 +84,16 @@
  * or equal to zero.  At that point, everyone's credits are "clipped"
  * to a small value, and a fixed credit is added to everyone.
  *
- * The plan is for all cores that share an L2 will share the same
- * runqueue.  At the moment, there is one global runqueue for all
- * cores.
+ * Which pcpus share a runqueue is chosen per cpupool: one runqueue per
+ * core, per socket (the default), per NUMA node, or a single one for
+ * the whole pool.  Load balancing between runqueues on different NUMA
+ * nodes can be discounted by the node distance, so that vcpus only
+ * leave their node (and their memory) for a real imbalance.
+ *
+ * Domains can ask for their vcpus to be gang scheduled: within a
+ * runqueue they are started together, run for a common slot and are not
+ * preempted by other vcpus meanwhile, so that an SMP guest does not spin
+ * on a lock held by a vcpu that isn't running.  See gang_open_slot().
  */
 
 /*
@@ -194,11 +201,35 @@ integer_param("credit2_balance_under", opt_underload_balance_tolerance);
 int opt_overload_balance_tolerance=-3;
 integer_param("credit2_balance_over", opt_overload_balance_tolerance);
 
+/*
+ * Runqueue arrangement for new cpupools: "core", "socket", "node" or
+ * "all".  Each cpupool can change it via sysctl while it has no pcpus.
+ */
+static char __read_mostly opt_runqueue_str[8] = "socket";
+string_param("credit2_runqueue", opt_runqueue_str);
+static unsigned int __read_mostly opt_runqueue = XEN_SYSCTL_CSCHED2_RUNQ_SOCKET;
+static const char *const runqueue_names[] = {
+    [XEN_SYSCTL_CSCHED2_RUNQ_CORE]   = "core",
+    [XEN_SYSCTL_CSCHED2_RUNQ_SOCKET] = "socket",
+    [XEN_SYSCTL_CSCHED2_RUNQ_NODE]   = "node",
+    [XEN_SYSCTL_CSCHED2_RUNQ_ALL]    = "all",
+};
+/* Weight cross-node load imbalance by the inverse of the node distance */
+static bool_t __read_mostly opt_numa_balance = 1;
+boolean_param("credit2_numa_balance", opt_numa_balance);
+#define NODE_LOCAL_DISTANCE 10
+/* How long the vcpus of a gang scheduled domain run together (us) */
+static unsigned int __read_mostly opt_gang_slice = 2000;
+integer_param("credit2_gang_slice", opt_gang_slice);
+#define CSCHED_GANG_SLICE \
+    max_t(s_time_t, MICROSECS(opt_gang_slice), 2 * CSCHED_MIN_TIMER)
+
 /*
  * Per-runqueue data
  */
 struct csched_runqueue_data {
     int id;
+    int node;             /* NUMA node of the first cpu put in here */
 
     spinlock_t lock;      /* Lock for this runqueue. */
     cpumask_t active;      /* CPUs enabled for this runqueue */
@@ -213,6 +244,11 @@ struct csched_runqueue_data {
     s_time_t load_last_update;  /* Last time average was updated */
     s_time_t avgload;           /* Decaying queue load */
     s_time_t b_avgload;         /* Decaying queue load modified by balancing */
+
+    /* Open gang slot: whose it is, when it ends, who is running it */
+    struct csched_dom *gang;
+    s_time_t gang_end;
+    cpumask_t gang_cpus;
 };
 
 /*
@@ -229,6 +265,8 @@ struct csched_private {
     struct csched_runqueue_data rqd[NR_CPUS];
 
     int load_window_shift;
+    unsigned int runqueue;   /* XEN_SYSCTL_CSCHED2_RUNQ_* */
+    bool_t numa_balance;
 };
 
 /*
@@ -266,6 +304,7 @@ struct csched_dom {
     struct domain *dom;
     uint16_t weight;
     uint16_t nr_vcpus;
+    bool_t gang;        /* Co-schedule the vcpus of this domain */
 };
 
 
@@ -472,6 +511,167 @@ __runq_remove(struct csched_vcpu *svc)
 
 void burn_credits(struct csched_runqueue_data *rqd, struct csched_vcpu *, s_time_t);
 
+/*
+ * Gang scheduling.
+ *
+ * A runqueue opens a gang slot when one of its pcpus picks a vcpu of a
+ * gang domain on its own merit, i.e. by credit.  Until the slot ends,
+ * every pcpu of the runqueue that reschedules takes another runnable vcpu
+ * of that domain ahead of anything else, other vcpus don't preempt them,
+ * and they all run until the end of the slot, so they stop together too.
+ * The slot closes early once none of them is running.
+ *
+ * Credit is burnt as usual: a gang domain gets its share all at once,
+ * not more of it.  Vcpus that are out of credit don't get pulled in, so
+ * the reset condition is only ever met by credit order.
+ */
+static inline bool_t
+gang_member(const struct csched_runqueue_data *rqd,
+            const struct csched_vcpu *svc)
+{
+    return rqd->gang != NULL && svc->sdom == rqd->gang;
+}
+
+/* Is there a slot, with enough of it left to be worth joining? */
+static inline bool_t
+gang_open(const struct csched_runqueue_data *rqd, s_time_t now)
+{
+    return rqd->gang != NULL && now + CSCHED_MIN_TIMER <= rqd->gang_end;
+}
+
+static inline void
+gang_close(struct csched_runqueue_data *rqd)
+{
+    rqd->gang = NULL;
+    cpumask_clear(&rqd->gang_cpus);
+}
+
+/*
+ * A pcpu to run one more vcpu of the slot on: an idle one if possible,
+ * else one that runs something else; @cpu first in either case.
+ */
+static int
+gang_pick_cpu(const struct csched_runqueue_data *rqd, int cpu)
+{
+    cpumask_t mask, idle;
+
+    cpumask_andnot(&mask, &rqd->active, &rqd->gang_cpus);
+    cpumask_andnot(&mask, &mask, &rqd->tickled);
+    cpumask_and(&idle, &mask, &rqd->idle);
+
+    if ( !cpumask_empty(&idle) )
+        return cpumask_test_cpu(cpu, &idle) ? cpu : cpumask_first(&idle);
+    if ( !cpumask_empty(&mask) )
+        return cpumask_test_cpu(cpu, &mask) ? cpu : cpumask_first(&mask);
+    return -1;
+}
+
+/* Open a slot for @svc, which @cpu is about to run, and kick enough
+ * other pcpus to run the rest of its domain's runnable vcpus. */
+static void
+gang_open_slot(struct csched_runqueue_data *rqd, struct csched_vcpu *svc,
+               int cpu, s_time_t now)
+{
+    struct list_head *iter;
+    int ipid;
+
+    rqd->gang = svc->sdom;
+    rqd->gang_end = now + CSCHED_GANG_SLICE;
+    cpumask_clear(&rqd->gang_cpus);
+    cpumask_set_cpu(cpu, &rqd->gang_cpus);
+    SCHED_STAT_CRANK(gang_slot);
+
+    list_for_each( iter, &rqd->runq )
+    {
+        struct csched_vcpu *peer = __runq_elem(iter);
+
+        if ( peer->credit <= CSCHED_CREDIT_RESET )
+            break;
+        if ( !gang_member(rqd, peer) )
+            continue;
+        if ( (ipid = gang_pick_cpu(rqd, cpu)) < 0 )
+            break;
+        cpumask_set_cpu(ipid, &rqd->tickled);
+        cpu_raise_softirq(ipid, SCHEDULE_SOFTIRQ);
+    }
+}
+
+/* With a slot open, run a vcpu of it rather than @snext if there is one */
+static struct csched_vcpu *
+gang_candidate(struct csched_runqueue_data *rqd, struct csched_vcpu *scurr,
+               struct csched_vcpu *snext, s_time_t now)
+{
+    struct list_head *iter;
+
+    if ( rqd->gang == NULL )
+        return snext;
+
+    if ( !gang_open(rqd, now) )
+    {
+        gang_close(rqd);
+        return snext;
+    }
+
+    if ( gang_member(rqd, snext) )
+        return snext;
+
+    if ( gang_member(rqd, scurr) && vcpu_runnable(scurr->vcpu)
+         && scurr->credit > CSCHED_CREDIT_RESET )
+        return scurr;
+
+    /* The runqueue is in credit order, so the first member is the best */
+    list_for_each( iter, &rqd->runq )
+    {
+        struct csched_vcpu *svc = __runq_elem(iter);
+
+        if ( svc->credit <= CSCHED_CREDIT_RESET )
+            break;
+        if ( gang_member(rqd, svc) )
+        {
+            SCHED_STAT_CRANK(gang_pull);
+            return svc;
+        }
+    }
+
+    return snext;
+}
+
+/* Track who runs the slot after @cpu picked @snext, opening or closing it */
+static void
+gang_update(struct csched_runqueue_data *rqd, struct csched_vcpu *snext,
+            int cpu, s_time_t now)
+{
+    if ( gang_member(rqd, snext) )
+        cpumask_set_cpu(cpu, &rqd->gang_cpus);
+    else
+    {
+        cpumask_clear_cpu(cpu, &rqd->gang_cpus);
+        if ( rqd->gang != NULL && cpumask_empty(&rqd->gang_cpus) )
+            gang_close(rqd);
+    }
+
+    if ( rqd->gang == NULL && !is_idle_vcpu(snext->vcpu)
+         && snext->sdom->gang && snext->sdom->nr_vcpus > 1 )
+        gang_open_slot(rqd, snext, cpu, now);
+}
+
+/* Close the slots of @sdom; called with the private lock held */
+static void
+gang_forget(struct csched_private *prv, struct csched_dom *sdom)
+{
+    int rqi;
+
+    for_each_cpu ( rqi, &prv->active_queues )
+    {
+        struct csched_runqueue_data *rqd = prv->rqd + rqi;
+
+        spin_lock(&rqd->lock);
+        if ( rqd->gang == sdom )
+            gang_close(rqd);
+        spin_unlock(&rqd->lock);
+    }
+}
+
 /* Check to see if the item on the runqueue is higher priority than what's
  * currently running; if so, wake up the processor */
 static /*inline*/ void
@@ -492,11 +692,23 @@ runq_tickle(const struct scheduler *ops, unsigned int cpu, struct csched_vcpu *n
     BUG_ON(new->vcpu->processor != cpu);
     BUG_ON(new->rqd != rqd);
 
+    /* A vcpu of the open gang slot goes wherever none of them runs */
+    if ( gang_member(rqd, new) && gang_open(rqd, now)
+         && new->credit > CSCHED_CREDIT_RESET )
+    {
+        ipid = gang_pick_cpu(rqd, cpu);
+        if ( ipid < 0 )
+            goto no_tickle;
+        goto tickle;
+    }
+
     /* Look at the cpu it's running on first */
     cur = CSCHED_VCPU(per_cpu(schedule_data, cpu).curr);
     burn_credits(rqd, cur, now);
 
-    if ( cur->credit < new->credit )
+    /* Vcpus of a gang slot aren't preempted until it ends */
+    if ( cur->credit < new->credit
+         && !cpumask_test_cpu(cpu, &rqd->gang_cpus) )
     {
         ipid = cpu;
         goto tickle;
@@ -516,6 +728,7 @@ runq_tickle(const struct scheduler *ops, unsigned int cpu, struct csched_vcpu *n
      * skipping cpus which have been tickled but not scheduled yet */
     cpumask_andnot(&mask, &rqd->active, &rqd->idle);
     cpumask_andnot(&mask, &mask, &rqd->tickled);
+    cpumask_andnot(&mask, &mask, &rqd->gang_cpus);
 
     for_each_cpu(i, &mask)
     {
@@ -1000,6 +1213,17 @@ csched_context_saved(const struct scheduler *ops, struct vcpu *vc)
     vcpu_schedule_unlock_irq(vc);
 }
 
+/* NUMA distance between two runqueues; 10 is local, as in the SLIT */
+static inline unsigned int
+rqd_distance(const struct csched_runqueue_data *a,
+             const struct csched_runqueue_data *b)
+{
+    unsigned int d = __node_distance(a->node, b->node);
+
+    /* Don't trust firmware to never hand out 0 */
+    return d < NODE_LOCAL_DISTANCE ? NODE_LOCAL_DISTANCE : d;
+}
+
 #define MAX_LOAD (1ULL<<60);
 static int
 choose_cpu(const struct scheduler *ops, struct vcpu *vc)
@@ -1086,6 +1310,12 @@ choose_cpu(const struct scheduler *ops, struct vcpu *vc)
         else
             continue;
 
+        /* Make runqueues on other nodes look busier, by their distance */
+        if ( prv->numa_balance && svc->rqd && rqd->node != svc->rqd->node )
+            rqd_avgload = rqd_avgload
+                * rqd_distance(svc->rqd, rqd)
+                / NODE_LOCAL_DISTANCE;
+
         if ( rqd_avgload < min_avgload )
         {
             min_avgload = rqd_avgload;
@@ -1195,6 +1425,7 @@ static void balance_load(const struct scheduler *ops, int cpu, s_time_t now)
 {
     struct csched_private *prv = CSCHED_PRIV(ops);
     int i, max_delta_rqi = -1;
+    s_time_t max_weighted_delta;
     struct list_head *push_iter, *pull_iter;
 
     balance_state_t st = { .best_push_svc = NULL, .best_pull_svc = NULL };
@@ -1218,10 +1449,11 @@ retry:
         return;
 
     st.load_delta = 0;
+    max_weighted_delta = 0;
 
     for_each_cpu(i, &prv->active_queues)
     {
-        s_time_t delta;
+        s_time_t delta, weighted_delta;
         
         st.orqd = prv->rqd + i;
 
@@ -1235,8 +1467,20 @@ retry:
         if ( delta < 0 )
             delta = -delta;
 
-        if ( delta > st.load_delta )
+        /*
+         * Across nodes, an imbalance only counts for as much as it is
+         * worth after paying for the remote memory: pick the runqueue,
+         * and decide whether to balance at all, on the weighted delta.
+         * consider() still works with the real one.
+         */
+        weighted_delta = delta;
+        if ( prv->numa_balance && st.orqd->node != st.lrqd->node )
+            weighted_delta = delta * NODE_LOCAL_DISTANCE
+                / rqd_distance(st.lrqd, st.orqd);
+
+        if ( weighted_delta > max_weighted_delta )
         {
+            max_weighted_delta = weighted_delta;
             st.load_delta = delta;
             max_delta_rqi = i;
         }
@@ -1253,7 +1497,9 @@ retry:
         s_time_t load_max;
         int cpus_max;
 
-        
+        /* st.orqd is whatever the loop above looked at last */
+        st.orqd = prv->rqd + max_delta_rqi;
+
         load_max = st.lrqd->b_avgload;
         if ( st.orqd->b_avgload > load_max )
             load_max = st.orqd->b_avgload;
@@ -1266,11 +1512,11 @@ retry:
          * is > 1.  otherwise, shift if under 12.5% */
         if ( load_max < (1ULL<<(prv->load_window_shift))*cpus_max )
         {
-            if ( st.load_delta < (1ULL<<(prv->load_window_shift+opt_underload_balance_tolerance) ) )
+            if ( max_weighted_delta < (1ULL<<(prv->load_window_shift+opt_underload_balance_tolerance) ) )
                  goto out;
         }
         else
-            if ( st.load_delta < (1ULL<<(prv->load_window_shift+opt_overload_balance_tolerance)) )
+            if ( max_weighted_delta < (1ULL<<(prv->load_window_shift+opt_overload_balance_tolerance)) )
                 goto out;
     }
              
@@ -1384,6 +1630,10 @@ csched_dom_cntl(
     struct csched_private *prv = CSCHED_PRIV(ops);
     unsigned long flags;
 
+    if ( op->cmd == XEN_DOMCTL_SCHEDOP_putinfo
+         && op->u.credit2.gang > XEN_DOMCTL_CREDIT2_GANG_ON )
+        return -EINVAL;
+
     /* Must hold csched_priv lock to read and update sdom,
      * runq lock to update csvcs. */
     spin_lock_irqsave(&prv->lock, flags);
@@ -1391,11 +1641,22 @@ csched_dom_cntl(
     if ( op->cmd == XEN_DOMCTL_SCHEDOP_getinfo )
     {
         op->u.credit2.weight = sdom->weight;
+        op->u.credit2.gang = sdom->gang ? XEN_DOMCTL_CREDIT2_GANG_ON
+                                        : XEN_DOMCTL_CREDIT2_GANG_OFF;
     }
     else
     {
         ASSERT(op->cmd == XEN_DOMCTL_SCHEDOP_putinfo);
 
+        if ( op->u.credit2.gang == XEN_DOMCTL_CREDIT2_GANG_ON )
+            sdom->gang = 1;
+        else if ( op->u.credit2.gang == XEN_DOMCTL_CREDIT2_GANG_OFF
+                  && sdom->gang )
+        {
+            sdom->gang = 0;
+            gang_forget(prv, sdom);
+        }
+
         if ( op->u.credit2.weight != 0 )
         {
             struct list_head *iter;
@@ -1431,6 +1692,45 @@ csched_dom_cntl(
     return 0;
 }
 
+static int
+csched_sys_cntl(const struct scheduler *ops,
+                struct xen_sysctl_scheduler_op *sc)
+{
+    int rc = -EINVAL;
+    xen_sysctl_credit2_schedule_t *params = &sc->u.sched_credit2;
+    struct csched_private *prv = CSCHED_PRIV(ops);
+    unsigned long flags;
+
+    spin_lock_irqsave(&prv->lock, flags);
+
+    switch ( sc->cmd )
+    {
+    case XEN_SYSCTL_SCHEDOP_putinfo:
+        if ( params->runqueue < XEN_SYSCTL_CSCHED2_RUNQ_CORE
+             || params->runqueue > XEN_SYSCTL_CSCHED2_RUNQ_ALL )
+            goto out;
+        /* Runqueues are set up as pcpus come in; can't rearrange them now. */
+        if ( params->runqueue != prv->runqueue
+             && !cpumask_empty(&prv->initialized) )
+        {
+            rc = -EBUSY;
+            goto out;
+        }
+        prv->runqueue = params->runqueue;
+        prv->numa_balance = !!params->numa_balance;
+        /* FALLTHRU */
+    case XEN_SYSCTL_SCHEDOP_getinfo:
+        params->runqueue = prv->runqueue;
+        params->numa_balance = prv->numa_balance;
+        rc = 0;
+        break;
+    }
+ out:
+    spin_unlock_irqrestore(&prv->lock, flags);
+
+    return rc;
+}
+
 static void *
 csched_alloc_domdata(const struct scheduler *ops, struct domain *dom)
 {
@@ -1495,9 +1795,17 @@ static void
 csched_dom_destroy(const struct scheduler *ops, struct domain *dom)
 {
     struct csched_dom *sdom = CSCHED_DOM(dom);
+    unsigned long flags;
 
     BUG_ON(!list_empty(&sdom->vcpu));
 
+    if ( sdom->gang )
+    {
+        spin_lock_irqsave(&CSCHED_PRIV(ops)->lock, flags);
+        gang_forget(CSCHED_PRIV(ops), sdom);
+        spin_unlock_irqrestore(&CSCHED_PRIV(ops)->lock, flags);
+    }
+
     csched_free_domdata(ops, CSCHED_DOM(dom));
 }
 
@@ -1669,7 +1977,10 @@ csched_schedule(
         snext = CSCHED_VCPU(idle_vcpu[cpu]);
     }
     else
-        snext=runq_candidate(rqd, scurr, cpu, now);
+    {
+        snext = runq_candidate(rqd, scurr, cpu, now);
+        snext = gang_candidate(rqd, scurr, snext, now);
+    }
 
     /* If switching from a non-idle runnable vcpu, put it
      * back on the runqueue. */
@@ -1733,10 +2044,15 @@ csched_schedule(
         update_load(ops, rqd, NULL, 0, now);
     }
 
+    gang_update(rqd, snext, cpu, now);
+
     /*
      * Return task to run next...
      */
-    ret.time = csched_runtime(ops, cpu, snext);
+    if ( gang_member(rqd, snext) )
+        ret.time = rqd->gang_end - now;
+    else
+        ret.time = csched_runtime(ops, cpu, snext);
     ret.task = snext->vcpu;
 
     CSCHED_VCPU_CHECK(ret.task);
@@ -1802,9 +2118,13 @@ csched_dump(const struct scheduler *ops)
     int i, loop;
 
     printk("Active queues: %d\n"
-           "\tdefault-weight     = %d\n",
+           "\tdefault-weight     = %d\n"
+           "\trunqueue           = %s\n"
+           "\tnuma_balance       = %d\n",
            cpumask_weight(&prv->active_queues),
-           CSCHED_DEFAULT_WEIGHT);
+           CSCHED_DEFAULT_WEIGHT,
+           runqueue_names[prv->runqueue],
+           prv->numa_balance);
     for_each_cpu(i, &prv->active_queues)
     {
         s_time_t fraction;
@@ -1812,15 +2132,21 @@ csched_dump(const struct scheduler *ops)
         fraction = prv->rqd[i].avgload * 100 / (1ULL<<prv->load_window_shift);
 
         printk("Runqueue %d:\n"
+               "\tnode               = %d\n"
                "\tncpus              = %u\n"
                "\tmax_weight         = %d\n"
                "\tinstload           = %d\n"
                "\taveload            = %3"PRI_stime"\n",
                i,
+               prv->rqd[i].node,
                cpumask_weight(&prv->rqd[i].active),
                prv->rqd[i].max_weight,
                prv->rqd[i].load,
                fraction);
+        if ( prv->rqd[i].gang != NULL )
+            printk("\tgang               = d%d on %u cpus\n",
+                   prv->rqd[i].gang->dom->domain_id,
+                   cpumask_weight(&prv->rqd[i].gang_cpus));
 
     }
     /* FIXME: Locking! */
@@ -1832,10 +2158,11 @@ csched_dump(const struct scheduler *ops)
         struct csched_dom *sdom;
         sdom = list_entry(iter_sdom, struct csched_dom, sdom_elem);
 
-       printk("\tDomain: %d w %d v %d\n\t", 
+       printk("\tDomain: %d w %d v %d%s\n\t", 
               sdom->dom->domain_id, 
               sdom->weight, 
-              sdom->nr_vcpus);
+              sdom->nr_vcpus,
+              sdom->gang ? " gang" : "");
 
         list_for_each( iter_svc, &sdom->vcpu )
         {
@@ -1848,7 +2175,7 @@ csched_dump(const struct scheduler *ops)
     }
 }
 
-static void activate_runqueue(struct csched_private *prv, int rqi)
+static void activate_runqueue(struct csched_private *prv, int rqi, int cpu)
 {
     struct csched_runqueue_data *rqd;
 
@@ -1858,9 +2185,11 @@ static void activate_runqueue(struct csched_private *prv, int rqi)
 
     rqd->max_weight = 1;
     rqd->id = rqi;
+    rqd->node = cpu_to_node(cpu);
     INIT_LIST_HEAD(&rqd->svc);
     INIT_LIST_HEAD(&rqd->runq);
     spin_lock_init(&rqd->lock);
+    gang_close(rqd);
 
     cpumask_set_cpu(rqi, &prv->active_queues);
 }
@@ -1878,6 +2207,45 @@ static void deactivate_runqueue(struct csched_private *prv, int rqi)
     cpumask_clear_cpu(rqi, &prv->active_queues);
 }
 
+/* Should these two cpus share a runqueue, under this pool's arrangement? */
+static bool_t
+same_runqueue(const struct csched_private *prv, int cpu, int peer)
+{
+    switch ( prv->runqueue )
+    {
+    case XEN_SYSCTL_CSCHED2_RUNQ_CORE:
+        /* Core ids are only unique within a socket */
+        return cpu_to_socket(cpu) == cpu_to_socket(peer)
+            && cpu_to_core(cpu) == cpu_to_core(peer);
+    case XEN_SYSCTL_CSCHED2_RUNQ_NODE:
+        return cpu_to_node(cpu) == cpu_to_node(peer);
+    case XEN_SYSCTL_CSCHED2_RUNQ_ALL:
+        return 1;
+    case XEN_SYSCTL_CSCHED2_RUNQ_SOCKET:
+    default:
+        return cpu_to_socket(cpu) == cpu_to_socket(peer);
+    }
+}
+
+/* Pick a runqueue for cpu: one it shares with a peer, else a fresh one. */
+static int
+cpu_to_runqueue(const struct csched_private *prv, int cpu)
+{
+    int rqi;
+
+    for_each_cpu(rqi, &prv->active_queues)
+        if ( same_runqueue(prv, cpu, cpumask_first(&prv->rqd[rqi].active)) )
+            return rqi;
+
+    for ( rqi = 0; rqi < nr_cpu_ids; rqi++ )
+        if ( !cpumask_test_cpu(rqi, &prv->active_queues) )
+            break;
+
+    BUG_ON(rqi >= nr_cpu_ids);
+
+    return rqi;
+}
+
 static void init_pcpu(const struct scheduler *ops, int cpu)
 {
     int rqi, flags;
@@ -1894,30 +2262,25 @@ static void init_pcpu(const struct scheduler *ops, int cpu)
         return;
     }
 
-    /* Figure out which runqueue to put it in */
-    rqi = 0;
-
-    /* Figure out which runqueue to put it in */
-    /* NB: cpu 0 doesn't get a STARTING callback, so we hard-code it to runqueue 0. */
-    if ( cpu == 0 )
-        rqi = 0;
-    else
-        rqi = cpu_to_socket(cpu);
-
-    if ( rqi < 0 )
+    /* NB: cpu 0 doesn't get a STARTING callback, but its topology is
+     * known by the time any other cpu is added. */
+    if ( cpu != 0 && cpu_to_socket(cpu) < 0 )
     {
         printk("%s: cpu_to_socket(%d) returned %d!\n",
-               __func__, cpu, rqi);
+               __func__, cpu, cpu_to_socket(cpu));
         BUG();
     }
 
+    /* Figure out which runqueue to put it in */
+    rqi = cpu_to_runqueue(prv, cpu);
+
     rqd=prv->rqd + rqi;
 
     printk("Adding cpu %d to runqueue %d\n", cpu, rqi);
     if ( ! cpumask_test_cpu(rqi, &prv->active_queues) )
     {
         printk(" First cpu on runqueue, activating\n");
-        activate_runqueue(prv, rqi);
+        activate_runqueue(prv, rqi, cpu);
     }
     
     /* IRQs already disabled */
@@ -2042,6 +2405,17 @@ static struct notifier_block cpu_credit2_nfb = {
 static int
 csched_global_init(void)
 {
+    unsigned int i;
+
+    for ( i = XEN_SYSCTL_CSCHED2_RUNQ_CORE; i <= XEN_SYSCTL_CSCHED2_RUNQ_ALL; i++ )
+        if ( !strcmp(opt_runqueue_str, runqueue_names[i]) )
+            break;
+    if ( i > XEN_SYSCTL_CSCHED2_RUNQ_ALL )
+        printk("credit2_runqueue: unknown arrangement '%s', using '%s'\n",
+               opt_runqueue_str, runqueue_names[opt_runqueue]);
+    else
+        opt_runqueue = i;
+
     register_cpu_notifier(&cpu_credit2_nfb);
     return 0;
 }
@@ -2059,6 +2433,8 @@ csched_init(struct scheduler *ops)
     printk(" load_window_shift: %d\n", opt_load_window_shift);
     printk(" underload_balance_tolerance: %d\n", opt_underload_balance_tolerance);
     printk(" overload_balance_tolerance: %d\n", opt_overload_balance_tolerance);
+    printk(" runqueues: per %s%s\n", runqueue_names[opt_runqueue],
+           opt_numa_balance ? ", NUMA-weighted balancing" : "");
 
     if ( opt_load_window_shift < LOADAVG_WINDOW_SHIFT_MIN )
     {
@@ -2086,6 +2462,8 @@ csched_init(struct scheduler *ops)
     }
 
     prv->load_window_shift = opt_load_window_shift;
+    prv->runqueue = opt_runqueue;
+    prv->numa_balance = opt_numa_balance;
 
     return 0;
 }
@@ -2119,6 +2497,7 @@ const struct scheduler sched_credit2_def = {
     .wake           = csched_vcpu_wake,
 
     .adjust         = csched_dom_cntl,
+    .adjust_global  = csched_sys_cntl,
 
     .pick_cpu       = csched_cpu_pick,
     .migrate        = csched_vcpu_migrate,
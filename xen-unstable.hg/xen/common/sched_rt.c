@@ -0,0 +1,1304 @@
+/****************************************************************************
+ *
+ *        File: common/sched_rt.c
+ *
+ * Description: Multi-core real-time scheduler: earliest deadline first
+ * over per-vcpu budget/period reservations.
+ */
+
+#include <xen/config.h>
+#include <xen/init.h>
+#include <xen/lib.h>
+#include <xen/sched.h>
+#include <xen/domain.h>
+#include <xen/delay.h>
+#include <xen/event.h>
+#include <xen/time.h>
+#include <xen/perfc.h>
+#include <xen/sched-if.h>
+#include <xen/softirq.h>
+#include <asm/atomic.h>
+#include <xen/errno.h>
+#include <xen/trace.h>
+#include <xen/cpu.h>
+
+/*
+ * Design:
+ *
+ * Every vcpu has a budget of CPU time it may use in each of its periods.
+ * It is a deferrable server: the budget is topped up at the start of each
+ * period (whatever was left is lost), and what it doesn't use while
+ * blocked stays available until the end of the period, so a vcpu that
+ * wakes late in its period can still run straight away.  Runnable vcpus
+ * with budget left run earliest deadline (end of their period) first;
+ * those that ran out wait on the depleted queue for their next period,
+ * and a timer puts them back.
+ *
+ * Vcpus without a reservation (period 0, the default) are best effort:
+ * they get the time no reserved vcpu wants, round robin in slices.  They
+ * are kept on the runqueue with an infinite deadline.
+ *
+ * The pcpus of a cpupool share one runqueue (global EDF: the earliest
+ * deadlines run, wherever they are) or have one each (partitioned EDF: a
+ * vcpu belongs to one pcpu).  A runqueue's lock is the schedule lock of
+ * all its pcpus.
+ *
+ * Admission control: setting a reservation fails with -ENOSPC unless
+ * every deadline can still be met.  Partitioned, the reserved utilisation
+ * (budget/period summed over the vcpus) of each pcpu must not go above
+ * one, and a vcpu with a reservation stays on the pcpu it was admitted on
+ * whatever its affinity; to move it, drop the reservation first.  Global
+ * EDF can miss deadlines well below a utilisation of one per pcpu (Dhall's
+ * effect), so it is checked with the sufficient test of Goossens, Funk and
+ * Baruah: U <= m - (m - 1) * u_max on m pcpus, u_max being the largest
+ * utilisation of a single vcpu.
+ */
+
+/*
+ * Basic constants
+ */
+/* Round robin slice of best effort vcpus */
+#define RT_BE_SLICE         MILLISECS(10)
+/* Utilisation fixed point: one pcpu */
+#define RT_UTIL_ONE         1000000
+
+/*
+ * Flags
+ */
+/* RT_FLAG_scheduled: Is this vcpu either running on, or context-switching
+ * off, a physical cpu?  Set when chosen by rt_schedule(), cleared by
+ * rt_context_saved(). */
+#define __RT_FLAG_scheduled       1
+/* RT_FLAG_delayed_runq_add: Do we need to add this to the runqueue once
+ * its context has been saved? */
+#define __RT_FLAG_delayed_runq_add 2
+
+static char __read_mostly opt_mode_str[16] = "global";
+string_param("sched_rt_mode", opt_mode_str);
+static unsigned int __read_mostly opt_mode = XEN_SYSCTL_RT_GLOBAL;
+static const char *const mode_names[] = {
+    [XEN_SYSCTL_RT_GLOBAL]      = "global",
+    [XEN_SYSCTL_RT_PARTITIONED] = "partitioned",
+};
+
+/*
+ * Useful macros
+ */
+#define RT_PRIV(_ops)   \
+    ((struct rt_private *)((_ops)->sched_data))
+#define RT_VCPU(_vcpu)  ((struct rt_vcpu *) (_vcpu)->sched_priv)
+#define RT_DOM(_dom)    ((struct rt_dom *) (_dom)->sched_priv)
+#define RQ(_cpu)        \
+    ((struct rt_runq *)per_cpu(schedule_data, _cpu).sched_priv)
+
+/*
+ * A runqueue: all the pcpus of the pool, or a single one
+ */
+struct rt_runq {
+    spinlock_t lock;           /* Schedule lock of its pcpus */
+    struct list_head runq;     /* Runnable with budget, by deadline */
+    struct list_head depletedq;/* Out of budget, by deadline */
+    cpumask_t cpus;            /* Pcpus in it */
+    cpumask_t idlers;          /* ... running the idle vcpu */
+    cpumask_t tickled;         /* ... told to reschedule */
+    struct timer repl_timer;   /* Next replenishment on the depletedq */
+};
+
+/*
+ * System-wide private data
+ */
+struct rt_private {
+    spinlock_t lock;           /* Reservations; taken before runq locks */
+    struct list_head sdom;     /* Used mostly for dump keyhandler. */
+    unsigned int mode;         /* XEN_SYSCTL_RT_* */
+    cpumask_t cpus;            /* Pcpus of the pool */
+    struct rt_runq grq;        /* The runqueue of global EDF */
+};
+
+/*
+ * Virtual CPU
+ */
+struct rt_vcpu {
+    struct list_head q_elem;   /* On the runq or the depletedq */
+    struct list_head sdom_elem;/* On the domain vcpu list */
+    struct rt_dom *sdom;
+    struct vcpu *vcpu;
+    unsigned flags;
+
+    /* Reservation; both 0 for best effort */
+    s_time_t period;
+    s_time_t budget;
+
+    s_time_t cur_budget;       /* Left in this period (best effort: slice) */
+    s_time_t cur_deadline;     /* End of this period */
+    s_time_t last_start;       /* Last time budget was charged */
+    unsigned int cpu;          /* Partitioned: pcpu it was admitted on */
+
+    uint32_t misses;           /* Periods ended runnable, short of budget */
+    bool_t late_wake;          /* Woke too late in this period to use it */
+};
+
+/*
+ * Domain
+ */
+struct rt_dom {
+    struct list_head vcpu;
+    struct list_head sdom_elem;
+    struct domain *dom;
+};
+
+/*
+ * Time-to-deadline and queue helpers
+ */
+static inline s_time_t
+rt_deadline(const struct rt_vcpu *svc)
+{
+    return svc->period ? svc->cur_deadline : STIME_MAX;
+}
+
+static inline uint64_t
+rt_util(const struct rt_vcpu *svc)
+{
+    return svc->period ? svc->budget * RT_UTIL_ONE / svc->period : 0;
+}
+
+/* Partitioned: the pcpu a vcpu's reservation counts against */
+static inline unsigned int
+rt_home(const struct rt_vcpu *svc)
+{
+    return svc->period ? svc->cpu : svc->vcpu->processor;
+}
+
+static inline int
+__vcpu_on_q(const struct rt_vcpu *svc)
+{
+    return !list_empty(&svc->q_elem);
+}
+
+static inline struct rt_vcpu *
+__q_elem(struct list_head *elem)
+{
+    return list_entry(elem, struct rt_vcpu, q_elem);
+}
+
+/* Insert by deadline; after those with the same one, for round robin. */
+static void
+__q_insert(struct list_head *q, struct rt_vcpu *svc)
+{
+    struct list_head *iter;
+
+    BUG_ON(__vcpu_on_q(svc));
+
+    list_for_each( iter, q )
+        if ( rt_deadline(__q_elem(iter)) > rt_deadline(svc) )
+            break;
+
+    list_add_tail(&svc->q_elem, iter);
+}
+
+static inline void
+__q_remove(struct rt_vcpu *svc)
+{
+    BUG_ON( !__vcpu_on_q(svc) );
+    list_del_init(&svc->q_elem);
+}
+
+/* Move a reserved vcpu on to the period that contains now, budget full. */
+static void
+rt_update_deadline(struct rt_vcpu *svc, s_time_t now)
+{
+    s_time_t count;
+
+    ASSERT(svc->period && now >= svc->cur_deadline);
+
+    count = (now - svc->cur_deadline) / svc->period + 1;
+    svc->cur_deadline += count * svc->period;
+    svc->cur_budget = svc->budget;
+    svc->late_wake = 0;
+    SCHED_STAT_CRANK(rt_replenish);
+}
+
+/* Charge a running vcpu for the time since it was last charged. */
+static void
+burn_budget(struct rt_vcpu *svc, s_time_t now)
+{
+    s_time_t delta = now - svc->last_start;
+
+    if ( is_idle_vcpu(svc->vcpu) || delta <= 0 )
+        return;
+
+    svc->cur_budget -= delta;
+    if ( svc->cur_budget < 0 )
+        svc->cur_budget = 0;
+    svc->last_start = now;
+}
+
+/*
+ * Tell a pcpu of the runqueue to pick up a vcpu that has just become
+ * eligible: an idle one it may run on, its own first, or else the one
+ * running the latest deadline, if that is later than the vcpu's.  Pcpus
+ * already tickled are left alone; they'll look at the whole queue.
+ */
+static void
+runq_tickle(struct rt_runq *rq, struct rt_vcpu *new)
+{
+    int cpu, ipid = -1;
+    cpumask_t mask;
+    s_time_t latest = rt_deadline(new);
+
+    cpumask_and(&mask, &rq->cpus, new->vcpu->cpu_affinity);
+    cpumask_andnot(&mask, &mask, &rq->tickled);
+
+    if ( cpumask_intersects(&mask, &rq->idlers) )
+    {
+        cpumask_and(&mask, &mask, &rq->idlers);
+        ipid = cpumask_test_cpu(new->vcpu->processor, &mask)
+            ? new->vcpu->processor : cpumask_first(&mask);
+        goto tickle;
+    }
+
+    for_each_cpu ( cpu, &mask )
+    {
+        struct vcpu *curr = curr_on_cpu(cpu);
+
+        /* Busy with tasklet work, it'll be back */
+        if ( is_idle_vcpu(curr) )
+            continue;
+
+        if ( rt_deadline(RT_VCPU(curr)) > latest )
+        {
+            latest = rt_deadline(RT_VCPU(curr));
+            ipid = cpu;
+        }
+    }
+
+    if ( ipid == -1 )
+        return;
+
+ tickle:
+    cpumask_set_cpu(ipid, &rq->tickled);
+    cpu_raise_softirq(ipid, SCHEDULE_SOFTIRQ);
+}
+
+/*
+ * Put a runnable vcpu that isn't running on the queue it belongs to, and
+ * get a pcpu to look at it if that's the runq.
+ */
+static void
+rt_enqueue(struct rt_runq *rq, struct rt_vcpu *svc, s_time_t now)
+{
+    if ( !svc->period )
+    {
+        if ( svc->cur_budget <= 0 )
+            svc->cur_budget = RT_BE_SLICE;
+    }
+    else if ( now >= svc->cur_deadline )
+        rt_update_deadline(svc, now);
+
+    if ( svc->cur_budget > 0 )
+    {
+        __q_insert(&rq->runq, svc);
+        runq_tickle(rq, svc);
+    }
+    else
+    {
+        SCHED_STAT_CRANK(rt_depleted);
+        __q_insert(&rq->depletedq, svc);
+        if ( rq->depletedq.next == &svc->q_elem )
+            set_timer(&rq->repl_timer, svc->cur_deadline);
+    }
+}
+
+/*
+ * Bring the queues up to date: vcpus still waiting on the runq when their
+ * period ended missed their deadline and start the next one, and depleted
+ * vcpus whose next period has come are eligible again.  Both sit at the
+ * front of their queue.
+ */
+static void
+rt_update(struct rt_runq *rq, s_time_t now)
+{
+    struct rt_vcpu *svc;
+
+    while ( !list_empty(&rq->runq) )
+    {
+        svc = __q_elem(rq->runq.next);
+        if ( rt_deadline(svc) > now )
+            break;
+
+        __q_remove(svc);
+        if ( !svc->late_wake )
+        {
+            svc->misses++;
+            SCHED_STAT_CRANK(rt_deadline_miss);
+        }
+        rt_update_deadline(svc, now);
+        __q_insert(&rq->runq, svc);
+    }
+
+    while ( !list_empty(&rq->depletedq) )
+    {
+        svc = __q_elem(rq->depletedq.next);
+        if ( svc->cur_deadline > now )
+            break;
+
+        __q_remove(svc);
+        rt_update_deadline(svc, now);
+        __q_insert(&rq->runq, svc);
+        runq_tickle(rq, svc);
+    }
+
+    if ( !list_empty(&rq->depletedq) )
+        set_timer(&rq->repl_timer, __q_elem(rq->depletedq.next)->cur_deadline);
+}
+
+static void
+repl_timer_fn(void *data)
+{
+    struct rt_runq *rq = data;
+    unsigned long flags;
+
+    spin_lock_irqsave(&rq->lock, flags);
+    rt_update(rq, NOW());
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+static void *
+rt_alloc_vdata(const struct scheduler *ops, struct vcpu *vc, void *dd)
+{
+    struct rt_vcpu *svc;
+
+    svc = xzalloc(struct rt_vcpu);
+    if ( svc == NULL )
+        return NULL;
+
+    INIT_LIST_HEAD(&svc->q_elem);
+    INIT_LIST_HEAD(&svc->sdom_elem);
+    svc->sdom = dd;
+    svc->vcpu = vc;
+    svc->flags = 0U;
+
+    /* Best effort until the toolstack gives it a reservation */
+    svc->cur_budget = RT_BE_SLICE;
+
+    BUG_ON( is_idle_vcpu(vc) != (svc->sdom == NULL) );
+
+    SCHED_STAT_CRANK(vcpu_init);
+
+    return svc;
+}
+
+static void
+rt_free_vdata(const struct scheduler *ops, void *priv)
+{
+    struct rt_vcpu *svc = priv;
+
+    xfree(svc);
+}
+
+static void
+rt_vcpu_insert(const struct scheduler *ops, struct vcpu *vc)
+{
+    struct rt_vcpu *svc = RT_VCPU(vc);
+    unsigned long flags;
+
+    if ( is_idle_vcpu(vc) )
+        return;
+
+    spin_lock_irqsave(&RT_PRIV(ops)->lock, flags);
+    list_add_tail(&svc->sdom_elem, &svc->sdom->vcpu);
+    spin_unlock_irqrestore(&RT_PRIV(ops)->lock, flags);
+}
+
+static void
+rt_vcpu_remove(const struct scheduler *ops, struct vcpu *vc)
+{
+    struct rt_vcpu * const svc = RT_VCPU(vc);
+    unsigned long flags;
+
+    BUG_ON( is_idle_vcpu(vc) );
+
+    SCHED_STAT_CRANK(vcpu_destroy);
+
+    vcpu_schedule_lock_irq(vc);
+    if ( __vcpu_on_q(svc) )
+        __q_remove(svc);
+    vcpu_schedule_unlock_irq(vc);
+
+    spin_lock_irqsave(&RT_PRIV(ops)->lock, flags);
+    list_del_init(&svc->sdom_elem);
+    spin_unlock_irqrestore(&RT_PRIV(ops)->lock, flags);
+}
+
+static void
+rt_vcpu_sleep(const struct scheduler *ops, struct vcpu *vc)
+{
+    struct rt_vcpu * const svc = RT_VCPU(vc);
+
+    BUG_ON( is_idle_vcpu(vc) );
+
+    SCHED_STAT_CRANK(vcpu_sleep);
+
+    if ( curr_on_cpu(vc->processor) == vc )
+        cpu_raise_softirq(vc->processor, SCHEDULE_SOFTIRQ);
+    else if ( __vcpu_on_q(svc) )
+        __q_remove(svc);
+    else if ( test_bit(__RT_FLAG_delayed_runq_add, &svc->flags) )
+        clear_bit(__RT_FLAG_delayed_runq_add, &svc->flags);
+}
+
+static void
+rt_vcpu_wake(const struct scheduler *ops, struct vcpu *vc)
+{
+    struct rt_vcpu * const svc = RT_VCPU(vc);
+    s_time_t now;
+
+    BUG_ON( is_idle_vcpu(vc) );
+
+    if ( unlikely(curr_on_cpu(vc->processor) == vc) )
+    {
+        SCHED_STAT_CRANK(vcpu_wake_running);
+        return;
+    }
+
+    if ( unlikely(__vcpu_on_q(svc)) )
+    {
+        SCHED_STAT_CRANK(vcpu_wake_onrunq);
+        return;
+    }
+
+    if ( likely(vcpu_runnable(vc)) )
+        SCHED_STAT_CRANK(vcpu_wake_runnable);
+    else
+        SCHED_STAT_CRANK(vcpu_wake_not_runnable);
+
+    /* Still context switching off a pcpu: rt_context_saved() queues it. */
+    if ( unlikely(test_bit(__RT_FLAG_scheduled, &svc->flags)) )
+    {
+        set_bit(__RT_FLAG_delayed_runq_add, &svc->flags);
+        return;
+    }
+
+    now = NOW();
+    rt_enqueue(RQ(vc->processor), svc, now);
+
+    /* Not a miss if there wasn't time for the budget left */
+    svc->late_wake = svc->period && now + svc->cur_budget > svc->cur_deadline;
+}
+
+static void
+rt_context_saved(const struct scheduler *ops, struct vcpu *vc)
+{
+    struct rt_vcpu * const svc = RT_VCPU(vc);
+
+    vcpu_schedule_lock_irq(vc);
+
+    clear_bit(__RT_FLAG_scheduled, &svc->flags);
+
+    if ( test_and_clear_bit(__RT_FLAG_delayed_runq_add, &svc->flags)
+         && likely(vcpu_runnable(vc)) )
+        rt_enqueue(RQ(vc->processor), svc, NOW());
+
+    vcpu_schedule_unlock_irq(vc);
+}
+
+/*
+ * Global EDF: stay put if that pcpu is idle, else go to an idle one.
+ * Partitioned: a vcpu with a reservation stays on the pcpu it was
+ * admitted on, as long as that is in the pool.  Others stay put unless
+ * affinity says otherwise, and then go to the pcpu with the least
+ * reserved on it.
+ */
+static int
+rt_cpu_pick(const struct scheduler *ops, struct vcpu *vc)
+{
+    struct rt_private *prv = RT_PRIV(ops);
+    struct rt_vcpu *svc = RT_VCPU(vc);
+    cpumask_t cpus;
+    int cpu = vc->processor, best;
+    uint64_t util, best_util = ~0ULL;
+    struct list_head *iter_sdom, *iter_svc;
+
+    cpumask_and(&cpus, cpupool_scheduler_cpumask(vc->domain->cpupool),
+                vc->cpu_affinity);
+    if ( cpumask_empty(&cpus) )
+        return cpu;
+
+    if ( prv->mode == XEN_SYSCTL_RT_GLOBAL )
+    {
+        cpumask_t idlers;
+
+        if ( cpumask_test_cpu(cpu, &cpus)
+             && cpumask_test_cpu(cpu, &prv->grq.idlers) )
+            return cpu;
+        cpumask_and(&idlers, &cpus, &prv->grq.idlers);
+        if ( !cpumask_empty(&idlers) )
+            return cpumask_cycle(cpu, &idlers);
+        return cpumask_test_cpu(cpu, &cpus) ? cpu : cpumask_cycle(cpu, &cpus);
+    }
+
+    if ( svc->period &&
+         cpumask_test_cpu(svc->cpu,
+                          cpupool_scheduler_cpumask(vc->domain->cpupool)) )
+        return svc->cpu;
+
+    if ( cpumask_test_cpu(cpu, &cpus) )
+        return cpu;
+
+    /* Called with a schedule lock held, which nests inside ours. */
+    if ( !spin_trylock(&prv->lock) )
+        return cpumask_cycle(cpu, &cpus);
+
+    best = cpumask_first(&cpus);
+    for_each_cpu ( cpu, &cpus )
+    {
+        util = 0;
+        list_for_each( iter_sdom, &prv->sdom )
+        {
+            struct rt_dom *sdom = list_entry(iter_sdom, struct rt_dom,
+                                             sdom_elem);
+
+            list_for_each( iter_svc, &sdom->vcpu )
+            {
+                struct rt_vcpu *other = list_entry(iter_svc, struct rt_vcpu,
+                                                   sdom_elem);
+
+                if ( other != svc && rt_home(other) == cpu )
+                    util += rt_util(other);
+            }
+        }
+        if ( util < best_util )
+        {
+            best_util = util;
+            best = cpu;
+        }
+    }
+
+    /* Its pcpu left the pool: the reservation moves along with it */
+    if ( svc->period )
+        svc->cpu = best;
+
+    spin_unlock(&prv->lock);
+
+    return best;
+}
+
+/*
+ * Would the reservations still fit if the vcpus of sdom selected by vcpuid
+ * got this one?  Global EDF is checked against the whole pool, partitioned
+ * against each pcpu one of those vcpus is on.  Called with prv->lock held.
+ */
+static int
+rt_admit(const struct rt_private *prv, const struct rt_dom *target,
+         unsigned int vcpuid, s_time_t period, s_time_t budget)
+{
+    const uint64_t new_util = period ? budget * RT_UTIL_ONE / period : 0;
+    struct list_head *iter_sdom, *iter_svc, *iter_tgt;
+    uint64_t util, u, u_max, limit;
+    unsigned int ncpus = cpumask_weight(&prv->cpus);
+    int cpu;
+
+#define TARGETED(_sdom, _svc) \
+    ((_sdom) == target && (vcpuid == XEN_DOMCTL_SCHED_RT_ALL_VCPUS || \
+                           (_svc)->vcpu->vcpu_id == vcpuid))
+
+    /* Partitioned, this goes round once for each pcpu with a target on it
+     * (possibly more than once for the same pcpu, which is harmless). */
+    list_for_each( iter_tgt, &target->vcpu )
+    {
+        struct rt_vcpu *tgt = list_entry(iter_tgt, struct rt_vcpu, sdom_elem);
+
+        if ( !TARGETED(target, tgt) )
+            continue;
+
+        /* A target is admitted on the pcpu it is on now */
+        cpu = tgt->vcpu->processor;
+
+        util = u_max = 0;
+        list_for_each( iter_sdom, &prv->sdom )
+        {
+            struct rt_dom *sdom = list_entry(iter_sdom, struct rt_dom,
+                                             sdom_elem);
+
+            list_for_each( iter_svc, &sdom->vcpu )
+            {
+                struct rt_vcpu *svc = list_entry(iter_svc, struct rt_vcpu,
+                                                 sdom_elem);
+
+                if ( TARGETED(sdom, svc) )
+                {
+                    if ( prv->mode == XEN_SYSCTL_RT_PARTITIONED
+                         && svc->vcpu->processor != cpu )
+                        continue;
+                    u = new_util;
+                }
+                else
+                {
+                    if ( prv->mode == XEN_SYSCTL_RT_PARTITIONED
+                         && rt_home(svc) != cpu )
+                        continue;
+                    u = rt_util(svc);
+                }
+                util += u;
+                if ( u > u_max )
+                    u_max = u;
+            }
+        }
+
+        if ( prv->mode == XEN_SYSCTL_RT_GLOBAL )
+        {
+            limit = (uint64_t)ncpus * RT_UTIL_ONE;
+            /* GFB: m - (m - 1) * u_max, at least u_max itself */
+            if ( ncpus > 1 )
+                limit -= (ncpus - 1) * u_max;
+        }
+        else
+            limit = RT_UTIL_ONE;
+
+        if ( util > limit )
+            return -ENOSPC;
+
+        /* One check covers the whole pool */
+        if ( prv->mode == XEN_SYSCTL_RT_GLOBAL )
+            break;
+    }
+
+#undef TARGETED
+
+    return 0;
+}
+
+/* Change a vcpu's reservation; it starts a new period now. */
+static void
+rt_set_reservation(struct rt_vcpu *svc, s_time_t period, s_time_t budget,
+                   s_time_t now)
+{
+    struct vcpu *vc = svc->vcpu;
+    int on_q = __vcpu_on_q(svc);
+
+    if ( on_q )
+        __q_remove(svc);
+
+    svc->period = period;
+    svc->budget = budget;
+    svc->cpu = vc->processor;
+    svc->cur_deadline = now + period;
+    svc->cur_budget = period ? budget : RT_BE_SLICE;
+    svc->last_start = now;
+    svc->late_wake = 0;
+
+    if ( on_q )
+        rt_enqueue(RQ(vc->processor), svc, now);
+    else if ( curr_on_cpu(vc->processor) == vc )
+        cpu_raise_softirq(vc->processor, SCHEDULE_SOFTIRQ);
+}
+
+static int
+rt_dom_cntl(
+    const struct scheduler *ops,
+    struct domain *d,
+    struct xen_domctl_scheduler_op *op)
+{
+    struct rt_private *prv = RT_PRIV(ops);
+    struct rt_dom * const sdom = RT_DOM(d);
+    struct xen_domctl_sched_rt *params = &op->u.rt;
+    struct list_head *iter;
+    struct rt_vcpu *svc;
+    s_time_t period, budget, now;
+    unsigned long flags;
+    int rc = 0;
+
+    if ( params->vcpuid != XEN_DOMCTL_SCHED_RT_ALL_VCPUS
+         && (params->vcpuid >= d->max_vcpus
+             || d->vcpu[params->vcpuid] == NULL) )
+        return -EINVAL;
+
+    if ( op->cmd == XEN_DOMCTL_SCHEDOP_putinfo
+         && (params->period != 0 || params->budget != 0)
+         && (params->period < XEN_DOMCTL_SCHED_RT_PERIOD_MIN
+             || params->period > XEN_DOMCTL_SCHED_RT_PERIOD_MAX
+             || params->budget < XEN_DOMCTL_SCHED_RT_BUDGET_MIN
+             || params->budget > params->period) )
+        return -EINVAL;
+
+    period = MICROSECS(params->period);
+    budget = MICROSECS(params->budget);
+
+    /* Must hold the private lock to read and update reservations, the
+     * runq lock to requeue vcpus. */
+    spin_lock_irqsave(&prv->lock, flags);
+
+    if ( op->cmd == XEN_DOMCTL_SCHEDOP_getinfo )
+    {
+        unsigned int vcpuid = params->vcpuid == XEN_DOMCTL_SCHED_RT_ALL_VCPUS
+            ? 0 : params->vcpuid;
+
+        rc = -EINVAL;
+        list_for_each( iter, &sdom->vcpu )
+        {
+            svc = list_entry(iter, struct rt_vcpu, sdom_elem);
+            if ( svc->vcpu->vcpu_id != vcpuid )
+                continue;
+            params->period = svc->period / MICROSECS(1);
+            params->budget = svc->budget / MICROSECS(1);
+            params->misses = svc->misses;
+            rc = 0;
+            break;
+        }
+        goto out;
+    }
+
+    ASSERT(op->cmd == XEN_DOMCTL_SCHEDOP_putinfo);
+
+    rc = rt_admit(prv, sdom, params->vcpuid, period, budget);
+    if ( rc )
+        goto out;
+
+    now = NOW();
+    list_for_each( iter, &sdom->vcpu )
+    {
+        svc = list_entry(iter, struct rt_vcpu, sdom_elem);
+        if ( params->vcpuid != XEN_DOMCTL_SCHED_RT_ALL_VCPUS
+             && svc->vcpu->vcpu_id != params->vcpuid )
+            continue;
+
+        /* IRQs are already disabled */
+        vcpu_schedule_lock(svc->vcpu);
+        rt_set_reservation(svc, period, budget, now);
+        vcpu_schedule_unlock(svc->vcpu);
+    }
+
+ out:
+    spin_unlock_irqrestore(&prv->lock, flags);
+
+    return rc;
+}
+
+static int
+rt_sys_cntl(const struct scheduler *ops,
+            struct xen_sysctl_scheduler_op *sc)
+{
+    int rc = -EINVAL;
+    xen_sysctl_rt_schedule_t *params = &sc->u.sched_rt;
+    struct rt_private *prv = RT_PRIV(ops);
+    struct list_head *iter_sdom, *iter_svc;
+    uint64_t util = 0;
+    unsigned long flags;
+
+    spin_lock_irqsave(&prv->lock, flags);
+
+    switch ( sc->cmd )
+    {
+    case XEN_SYSCTL_SCHEDOP_putinfo:
+        if ( params->mode < XEN_SYSCTL_RT_GLOBAL
+             || params->mode > XEN_SYSCTL_RT_PARTITIONED )
+            goto out;
+        /* Runqueues are set up as pcpus come in; can't rearrange them now. */
+        if ( params->mode != prv->mode && !cpumask_empty(&prv->cpus) )
+        {
+            rc = -EBUSY;
+            goto out;
+        }
+        prv->mode = params->mode;
+        /* FALLTHRU */
+    case XEN_SYSCTL_SCHEDOP_getinfo:
+        list_for_each( iter_sdom, &prv->sdom )
+        {
+            struct rt_dom *sdom = list_entry(iter_sdom, struct rt_dom,
+                                             sdom_elem);
+
+            list_for_each( iter_svc, &sdom->vcpu )
+                util += rt_util(list_entry(iter_svc, struct rt_vcpu,
+                                           sdom_elem));
+        }
+        params->mode = prv->mode;
+        params->reserved = util * 1000 / RT_UTIL_ONE;
+        rc = 0;
+        break;
+    }
+ out:
+    spin_unlock_irqrestore(&prv->lock, flags);
+
+    return rc;
+}
+
+static void *
+rt_alloc_domdata(const struct scheduler *ops, struct domain *dom)
+{
+    struct rt_dom *sdom;
+    unsigned long flags;
+
+    sdom = xzalloc(struct rt_dom);
+    if ( sdom == NULL )
+        return NULL;
+
+    INIT_LIST_HEAD(&sdom->vcpu);
+    INIT_LIST_HEAD(&sdom->sdom_elem);
+    sdom->dom = dom;
+
+    spin_lock_irqsave(&RT_PRIV(ops)->lock, flags);
+    list_add_tail(&sdom->sdom_elem, &RT_PRIV(ops)->sdom);
+    spin_unlock_irqrestore(&RT_PRIV(ops)->lock, flags);
+
+    return sdom;
+}
+
+static int
+rt_dom_init(const struct scheduler *ops, struct domain *dom)
+{
+    struct rt_dom *sdom;
+
+    if ( is_idle_domain(dom) )
+        return 0;
+
+    sdom = rt_alloc_domdata(ops, dom);
+    if ( sdom == NULL )
+        return -ENOMEM;
+
+    dom->sched_priv = sdom;
+
+    return 0;
+}
+
+static void
+rt_free_domdata(const struct scheduler *ops, void *data)
+{
+    struct rt_dom *sdom = data;
+    unsigned long flags;
+
+    spin_lock_irqsave(&RT_PRIV(ops)->lock, flags);
+    list_del_init(&sdom->sdom_elem);
+    spin_unlock_irqrestore(&RT_PRIV(ops)->lock, flags);
+
+    xfree(data);
+}
+
+static void
+rt_dom_destroy(const struct scheduler *ops, struct domain *dom)
+{
+    BUG_ON(!list_empty(&RT_DOM(dom)->vcpu));
+
+    rt_free_domdata(ops, RT_DOM(dom));
+}
+
+/* The earliest deadline on the runq that may run here, if any */
+static struct rt_vcpu *
+runq_pick(struct rt_runq *rq, int cpu)
+{
+    struct list_head *iter;
+
+    list_for_each( iter, &rq->runq )
+    {
+        struct rt_vcpu *svc = __q_elem(iter);
+
+        if ( cpumask_test_cpu(cpu, svc->vcpu->cpu_affinity) )
+            return svc;
+    }
+
+    return NULL;
+}
+
+/*
+ * This function is in the critical path. It is designed to be simple and
+ * fast for the common case.
+ */
+static struct task_slice
+rt_schedule(
+    const struct scheduler *ops, s_time_t now, bool_t tasklet_work_scheduled)
+{
+    const int cpu = smp_processor_id();
+    struct rt_runq *rq = RQ(cpu);
+    struct rt_vcpu * const scurr = RT_VCPU(current);
+    struct rt_vcpu *snext = NULL;
+    struct task_slice ret;
+
+    SCHED_STAT_CRANK(schedule);
+
+    cpumask_clear_cpu(cpu, &rq->tickled);
+
+    /* Charge the current vcpu, and move it on if its period is over */
+    if ( !is_idle_vcpu(current) )
+    {
+        burn_budget(scurr, now);
+        if ( scurr->period && now >= scurr->cur_deadline )
+        {
+            if ( scurr->cur_budget > 0 && vcpu_runnable(current)
+                 && !scurr->late_wake )
+            {
+                scurr->misses++;
+                SCHED_STAT_CRANK(rt_deadline_miss);
+            }
+            rt_update_deadline(scurr, now);
+        }
+    }
+
+    rt_update(rq, now);
+
+    /*
+     * The earliest deadline on the runq competes with the current vcpu, if
+     * it is runnable and has budget left.  A best effort vcpu at the end of
+     * its slice gets a new one but loses ties, so they take turns.
+     */
+    if ( tasklet_work_scheduled )
+        snext = RT_VCPU(idle_vcpu[cpu]);
+    else
+    {
+        snext = runq_pick(rq, cpu);
+
+        if ( !is_idle_vcpu(current) && vcpu_runnable(current) )
+        {
+            bool_t expired = scurr->cur_budget <= 0;
+
+            if ( expired && !scurr->period )
+                scurr->cur_budget = RT_BE_SLICE;
+
+            if ( (!expired || !scurr->period)
+                 && (snext == NULL
+                     || rt_deadline(scurr) < rt_deadline(snext)
+                     || (rt_deadline(scurr) == rt_deadline(snext)
+                         && !expired)) )
+                snext = scurr;
+        }
+
+        if ( snext == NULL )
+            snext = RT_VCPU(idle_vcpu[cpu]);
+    }
+
+    /* If switching from a non-idle runnable vcpu, put it back on a queue
+     * once its context is saved. */
+    if ( snext != scurr
+         && !is_idle_vcpu(current)
+         && vcpu_runnable(current) )
+        set_bit(__RT_FLAG_delayed_runq_add, &scurr->flags);
+
+    ret.migrated = 0;
+
+    if ( !is_idle_vcpu(snext->vcpu) )
+    {
+        if ( snext != scurr )
+        {
+            __q_remove(snext);
+            set_bit(__RT_FLAG_scheduled, &snext->flags);
+        }
+
+        cpumask_clear_cpu(cpu, &rq->idlers);
+        snext->last_start = now;
+
+        /* Safe because lock for old processor is held */
+        if ( snext->vcpu->processor != cpu )
+        {
+            snext->vcpu->processor = cpu;
+            ret.migrated = 1;
+        }
+
+        /* Run until out of budget, or the end of the period */
+        ret.time = snext->cur_budget;
+        if ( snext->period && snext->cur_deadline - now < ret.time )
+            ret.time = snext->cur_deadline - now;
+    }
+    else
+    {
+        if ( tasklet_work_scheduled )
+            cpumask_clear_cpu(cpu, &rq->idlers);
+        else
+            cpumask_set_cpu(cpu, &rq->idlers);
+        ret.time = -1;
+    }
+
+    ret.task = snext->vcpu;
+
+    return ret;
+}
+
+static void
+rt_dump_vcpu(const struct rt_vcpu *svc)
+{
+    printk("[%i.%i] flags=%x cpu=%i",
+           svc->vcpu->domain->domain_id,
+           svc->vcpu->vcpu_id,
+           svc->flags,
+           svc->vcpu->processor);
+
+    if ( svc->period )
+        printk(" budget=%"PRI_stime"/%"PRI_stime" left=%"PRI_stime
+               " deadline=%"PRI_stime" misses=%u",
+               svc->budget / MICROSECS(1), svc->period / MICROSECS(1),
+               svc->cur_budget / MICROSECS(1), svc->cur_deadline,
+               svc->misses);
+    else
+        printk(" best effort");
+
+    printk("\n");
+}
+
+static void
+rt_dump_runq(struct rt_runq *rq)
+{
+    struct list_head *iter;
+    int loop = 0;
+
+    list_for_each( iter, &rq->runq )
+    {
+        printk("\t%3d: ", ++loop);
+        rt_dump_vcpu(__q_elem(iter));
+    }
+    list_for_each( iter, &rq->depletedq )
+    {
+        printk("\t%3d: depleted ", ++loop);
+        rt_dump_vcpu(__q_elem(iter));
+    }
+}
+
+/*
+ * Called with the pcpu's schedule lock, i.e. its runqueue lock, held,
+ * which covers everything dumped here.  prv->lock nests outside it.
+ */
+static void
+rt_dump_pcpu(const struct scheduler *ops, int cpu)
+{
+    struct vcpu *curr = curr_on_cpu(cpu);
+
+    if ( curr && !is_idle_vcpu(curr) )
+    {
+        printk("\trun: ");
+        rt_dump_vcpu(RT_VCPU(curr));
+    }
+
+    if ( RT_PRIV(ops)->mode == XEN_SYSCTL_RT_PARTITIONED )
+        rt_dump_runq(RQ(cpu));
+}
+
+static void
+rt_dump(const struct scheduler *ops)
+{
+    struct list_head *iter_sdom, *iter_svc;
+    struct rt_private *prv = RT_PRIV(ops);
+    uint64_t util = 0;
+    unsigned long flags;
+    int loop;
+
+    spin_lock_irqsave(&prv->lock, flags);
+
+    list_for_each( iter_sdom, &prv->sdom )
+    {
+        struct rt_dom *sdom = list_entry(iter_sdom, struct rt_dom, sdom_elem);
+
+        list_for_each( iter_svc, &sdom->vcpu )
+            util += rt_util(list_entry(iter_svc, struct rt_vcpu, sdom_elem));
+    }
+
+    printk("\tmode               = %s\n"
+           "\tncpus              = %u\n"
+           "\treserved           = %"PRIu64".%03"PRIu64" pcpus\n",
+           mode_names[prv->mode],
+           cpumask_weight(&prv->cpus),
+           util / RT_UTIL_ONE, util % RT_UTIL_ONE / 1000);
+
+    if ( prv->mode == XEN_SYSCTL_RT_GLOBAL )
+    {
+        printk("Runqueue:\n");
+        spin_lock(&prv->grq.lock);
+        rt_dump_runq(&prv->grq);
+        spin_unlock(&prv->grq.lock);
+    }
+
+    printk("Domain info:\n");
+    loop = 0;
+    list_for_each( iter_sdom, &prv->sdom )
+    {
+        struct rt_dom *sdom = list_entry(iter_sdom, struct rt_dom, sdom_elem);
+
+        printk("\tDomain: %d\n", sdom->dom->domain_id);
+
+        list_for_each( iter_svc, &sdom->vcpu )
+        {
+            printk("\t%3d: ", ++loop);
+            rt_dump_vcpu(list_entry(iter_svc, struct rt_vcpu, sdom_elem));
+        }
+    }
+
+    spin_unlock_irqrestore(&prv->lock, flags);
+}
+
+static void
+rt_runq_init(struct rt_runq *rq)
+{
+    spin_lock_init(&rq->lock);
+    INIT_LIST_HEAD(&rq->runq);
+    INIT_LIST_HEAD(&rq->depletedq);
+    cpumask_clear(&rq->cpus);
+    cpumask_clear(&rq->idlers);
+    cpumask_clear(&rq->tickled);
+}
+
+static void *
+rt_alloc_pdata(const struct scheduler *ops, int cpu)
+{
+    struct rt_private *prv = RT_PRIV(ops);
+    struct rt_runq *rq;
+    spinlock_t *old_lock;
+    unsigned long flags;
+
+    if ( prv->mode == XEN_SYSCTL_RT_PARTITIONED )
+    {
+        rq = xzalloc(struct rt_runq);
+        if ( rq == NULL )
+            return NULL;
+        rt_runq_init(rq);
+    }
+    else
+        rq = &prv->grq;
+
+    spin_lock_irqsave(&prv->lock, flags);
+
+    /* The replenishment timer lives on the first pcpu of the runqueue */
+    if ( cpumask_empty(&rq->cpus) )
+        init_timer(&rq->repl_timer, repl_timer_fn, rq, cpu);
+
+    /* IRQs already disabled */
+    old_lock = pcpu_schedule_lock(cpu);
+
+    /* Move spinlock to the runqueue lock. */
+    per_cpu(schedule_data, cpu).schedule_lock = &rq->lock;
+
+    cpumask_set_cpu(cpu, &rq->cpus);
+    cpumask_set_cpu(cpu, &rq->idlers);
+    cpumask_set_cpu(cpu, &prv->cpus);
+
+    spin_unlock(old_lock);
+
+    spin_unlock_irqrestore(&prv->lock, flags);
+
+    /* Start off the boot cpu; schedule_cpu_switch() does the others. */
+    if ( per_cpu(schedule_data, cpu).sched_priv == NULL )
+        per_cpu(schedule_data, cpu).sched_priv = rq;
+
+    return rq;
+}
+
+static void
+rt_free_pdata(const struct scheduler *ops, void *pcpu, int cpu)
+{
+    struct rt_private *prv = RT_PRIV(ops);
+    struct rt_runq *rq = pcpu;
+    struct schedule_data *sd = &per_cpu(schedule_data, cpu);
+    unsigned long flags;
+    int empty, timer_cpu = -1;
+
+    spin_lock_irqsave(&prv->lock, flags);
+
+    /* No need to save IRQs here, they're already disabled */
+    spin_lock(&rq->lock);
+
+    cpumask_clear_cpu(cpu, &rq->cpus);
+    cpumask_clear_cpu(cpu, &rq->idlers);
+    cpumask_clear_cpu(cpu, &rq->tickled);
+    cpumask_clear_cpu(cpu, &prv->cpus);
+
+    empty = cpumask_empty(&rq->cpus);
+    if ( !empty && rq->repl_timer.cpu == cpu )
+        timer_cpu = cpumask_first(&rq->cpus);
+
+    /* Move spinlock to the original lock.  */
+    ASSERT(sd->schedule_lock == &rq->lock);
+    ASSERT(!spin_is_locked(&sd->_lock));
+    sd->schedule_lock = &sd->_lock;
+
+    spin_unlock(&rq->lock);
+
+    spin_unlock_irqrestore(&prv->lock, flags);
+
+    /* The timer handler takes rq->lock, so not while holding it */
+    if ( empty )
+    {
+        kill_timer(&rq->repl_timer);
+        if ( rq != &prv->grq )
+            xfree(rq);
+    }
+    else if ( timer_cpu >= 0 )
+        migrate_timer(&rq->repl_timer, timer_cpu);
+}
+
+static int
+rt_global_init(void)
+{
+    unsigned int i;
+
+    for ( i = XEN_SYSCTL_RT_GLOBAL; i <= XEN_SYSCTL_RT_PARTITIONED; i++ )
+        if ( !strcmp(opt_mode_str, mode_names[i]) )
+            break;
+    if ( i > XEN_SYSCTL_RT_PARTITIONED )
+        printk("sched_rt_mode: unknown mode '%s', using '%s'\n",
+               opt_mode_str, mode_names[opt_mode]);
+    else
+        opt_mode = i;
+
+    return 0;
+}
+
+static int
+rt_init(struct scheduler *ops)
+{
+    struct rt_private *prv;
+
+    printk("Initializing RT scheduler: %s EDF\n", mode_names[opt_mode]);
+
+    prv = xzalloc(struct rt_private);
+    if ( prv == NULL )
+        return -ENOMEM;
+    ops->sched_data = prv;
+    spin_lock_init(&prv->lock);
+    INIT_LIST_HEAD(&prv->sdom);
+    rt_runq_init(&prv->grq);
+    prv->mode = opt_mode;
+
+    return 0;
+}
+
+static void
+rt_deinit(const struct scheduler *ops)
+{
+    struct rt_private *prv;
+
+    prv = RT_PRIV(ops);
+    if ( prv != NULL )
+        xfree(prv);
+}
+
+
+static struct rt_private _rt_priv;
+
+const struct scheduler sched_rt_def = {
+    .name           = "SMP Real-Time EDF Scheduler",
+    .opt_name       = "rt",
+    .sched_id       = XEN_SCHEDULER_RT,
+    .sched_data     = &_rt_priv,
+
+    .init_domain    = rt_dom_init,
+    .destroy_domain = rt_dom_destroy,
+
+    .insert_vcpu    = rt_vcpu_insert,
+    .remove_vcpu    = rt_vcpu_remove,
+
+    .sleep          = rt_vcpu_sleep,
+    .wake           = rt_vcpu_wake,
+
+    .adjust         = rt_dom_cntl,
+    .adjust_global  = rt_sys_cntl,
+
+    .pick_cpu       = rt_cpu_pick,
+    .do_schedule    = rt_schedule,
+    .context_saved  = rt_context_saved,
+
+    .dump_cpu_state = rt_dump_pcpu,
+    .dump_settings  = rt_dump,
+    .global_init    = rt_global_init,
+    .init           = rt_init,
+    .deinit         = rt_deinit,
+    .alloc_vdata    = rt_alloc_vdata,
+    .free_vdata     = rt_free_vdata,
+    .alloc_pdata    = rt_alloc_pdata,
+    .free_pdata     = rt_free_pdata,
+    .alloc_domdata  = rt_alloc_domdata,
+    .free_domdata   = rt_free_domdata,
+};
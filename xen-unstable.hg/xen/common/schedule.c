@@ -33,6 +33,7 @@
 #include <xen/multicall.h>
 #include <xen/cpu.h>
 #include <xen/preempt.h>
+#include <xen/grant_table.h>
 #include <public/sched.h>
 #include <xsm/xsm.h>
 
@@ -67,6 +68,7 @@ static const struct scheduler *schedulers[] = {
     &sched_credit_def,
     &sched_credit2_def,
     &sched_arinc653_def,
+    &sched_rt_def,
 };
 
 static struct scheduler __read_mostly ops;
@@ -135,6 +137,52 @@ static inline void vcpu_urgent_count_update(struct vcpu *v)
     }
 }
 
+/*
+ * Account the wait that ends when a runnable vcpu starts running in the
+ * latency histograms.  Buckets are powers of two of 1024ns, which keeps
+ * this to a shift and an fls() on the context switch path.
+ */
+static inline void vcpu_latency_update(
+    struct vcpu *v, int new_state, s_time_t new_entry_time)
+{
+    struct xen_sysctl_sched_latency_vcpu *lat = &v->sched_lat;
+    s_time_t wait;
+    unsigned int bucket;
+
+    if ( unlikely(is_idle_vcpu(v)) )
+        return;
+
+    if ( new_state == RUNSTATE_runnable )
+    {
+        v->sched_lat_woken = (v->runstate.state != RUNSTATE_running);
+        return;
+    }
+
+    if ( v->runstate.state != RUNSTATE_runnable )
+        return;
+
+    if ( new_state == RUNSTATE_running )
+    {
+        wait = max_t(s_time_t, new_entry_time - v->runstate.state_entry_time,
+                     0);
+        bucket = fls(min_t(s_time_t, wait >> 10,
+                           1 << (XEN_SYSCTL_SCHED_LAT_BUCKETS - 2)));
+
+        lat->runq[bucket]++;
+        if ( wait > lat->runq_max )
+            lat->runq_max = wait;
+
+        if ( v->sched_lat_woken )
+        {
+            lat->wake[bucket]++;
+            if ( wait > lat->wake_max )
+                lat->wake_max = wait;
+        }
+    }
+
+    v->sched_lat_woken = 0;
+}
+
 static inline void vcpu_runstate_change(
     struct vcpu *v, int new_state, s_time_t new_entry_time)
 {
@@ -144,6 +192,7 @@ static inline void vcpu_runstate_change(
     ASSERT(spin_is_locked(per_cpu(schedule_data,v->processor).schedule_lock));
 
     vcpu_urgent_count_update(v);
+    vcpu_latency_update(v, new_state, new_entry_time);
 
     trace_runstate_change(v, new_state);
 
@@ -693,7 +742,8 @@ static long do_poll(struct sched_poll *sched_poll)
             goto out;
 
         rc = 0;
-        if ( test_bit(port, &shared_info(d, evtchn_pending)) )
+        if ( port_is_valid(d, port) &&
+             evtchn_port_is_pending(d, evtchn_from_port(d, port)) )
             goto out;
     }
 
@@ -1049,6 +1099,51 @@ long sched_adjust_global(struct xen_sysctl_scheduler_op *op)
     return rc;
 }
 
+/* Copy out (and optionally reset) a domain's latency histograms. */
+long sched_latency_get(struct xen_sysctl_sched_latency *op)
+{
+    struct domain *d;
+    struct vcpu *v;
+    struct xen_sysctl_sched_latency_vcpu lat;
+    unsigned int i, nr_vcpus;
+    long rc = 0;
+
+    if ( op->flags & ~XEN_SYSCTL_SCHED_LAT_reset )
+        return -EINVAL;
+
+    d = rcu_lock_domain_by_id(op->domid);
+    if ( d == NULL )
+        return -ESRCH;
+
+    nr_vcpus = min(op->nr_vcpus, d->max_vcpus);
+
+    for ( i = 0; i < nr_vcpus; i++ )
+    {
+        memset(&lat, 0, sizeof(lat));
+
+        if ( (v = d->vcpu[i]) != NULL )
+        {
+            vcpu_schedule_lock_irq(v);
+            lat = v->sched_lat;
+            if ( op->flags & XEN_SYSCTL_SCHED_LAT_reset )
+                memset(&v->sched_lat, 0, sizeof(v->sched_lat));
+            vcpu_schedule_unlock_irq(v);
+        }
+
+        if ( copy_to_guest_offset(op->vcpus, i, &lat, 1) )
+        {
+            rc = -EFAULT;
+            break;
+        }
+    }
+
+    op->nr_vcpus = i;
+
+    rcu_unlock_domain(d);
+
+    return rc;
+}
+
 static void vcpu_periodic_timer_work(struct vcpu *v)
 {
     s_time_t now = NOW();
@@ -1087,6 +1182,8 @@ static void schedule(void)
     int cpu = smp_processor_id();
 
     ASSERT_NOT_IN_ATOMIC();
+    /* Queued unmaps belong to the vcpu being switched out. */
+    ASSERT(!gnttab_deferred_unmaps_pending());
 
     SCHED_STAT_CRANK(sched_run);
 
@@ -250,6 +250,14 @@ long do_sysctl(XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
         ret = sched_adjust_global(&op->u.scheduler_op);
         break;
 
+    case XEN_SYSCTL_sched_latency:
+        ret = sched_latency_get(&op->u.sched_latency);
+        break;
+
+    case XEN_SYSCTL_evtchn_op:
+        ret = evtchn_sysctl(&op->u.evtchn_op);
+        break;
+
     case XEN_SYSCTL_physinfo:
     {
         xen_sysctl_physinfo_t *pi = &op->u.physinfo;
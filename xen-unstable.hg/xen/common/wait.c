@@ -23,6 +23,7 @@
 #include <xen/config.h>
 #include <xen/sched.h>
 #include <xen/wait.h>
+#include <xen/grant_table.h>
 #include <xen/errno.h>
 
 struct waitqueue_vcpu {
@@ -212,6 +213,8 @@ void prepare_to_wait(struct waitqueue_head *wq)
     struct waitqueue_vcpu *wqv = curr->waitqueue_vcpu;
 
     ASSERT_NOT_IN_ATOMIC();
+    /* A multicall may sleep here with unmaps of earlier calls queued. */
+    gnttab_flush_deferred_unmaps();
     __prepare_to_wait(wqv);
 
     ASSERT(list_empty(&wqv->list));
@@ -22,6 +22,7 @@
 
 
 int mem_paging_memop(struct domain *d, xen_mem_event_op_t *meo);
+int mem_paging_batch_memop(struct domain *d, xen_mem_paging_batch_op_t *mpb);
 
 
 /*
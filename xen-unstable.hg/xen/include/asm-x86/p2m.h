@@ -216,6 +216,21 @@ struct p2m_domain {
      * host p2m's lock. */
     int                defer_nested_flush;
 
+    /* Host p2m: batched updates, see p2m_batch_begin().  While a vcpu
+     * owns the batch, TLB flushes for its p2m changes are only recorded
+     * in need_flush, and p2m tables and guest pages that may still be
+     * cached in the TLBs are held back until the flush is done. */
+#define P2M_BATCH_PAGES    64
+    struct {
+        struct vcpu       *owner;
+        unsigned int       depth;
+        unsigned int       suspended;
+        bool_t             need_flush;
+        unsigned int       nr_pages;
+        struct page_info  *pages[P2M_BATCH_PAGES];
+        struct page_list_head ptps;
+    } batch;
+
     /* Pages used to construct the p2m */
     struct page_list_head pages;
 
@@ -502,6 +517,31 @@ void p2m_change_type_range(struct domain *d,
                            unsigned long start, unsigned long end,
                            p2m_type_t ot, p2m_type_t nt);
 
+/* Batched p2m updates.  Between p2m_batch_begin() and p2m_batch_end()
+ * the current vcpu's updates to the host p2m don't flush the TLBs one by
+ * one; a single flush is issued at the end (or when the batch fills up).
+ * Callers which free a guest page after removing its p2m entry must hand
+ * their last reference to p2m_batch_put_page() so it is dropped only after
+ * the flush.  Only one vcpu owns a batch at a time, updates from anybody
+ * else are flushed immediately as usual.
+ * Code which hands pages on right after unmapping them (e.g. into the PoD
+ * cache) brackets that with p2m_batch_suspend()/p2m_batch_resume(): the
+ * pending flush is issued and updates in between flush immediately. */
+void p2m_batch_begin(struct p2m_domain *p2m);
+void p2m_batch_end(struct p2m_domain *p2m);
+void p2m_batch_suspend(struct p2m_domain *p2m);
+void p2m_batch_resume(struct p2m_domain *p2m);
+void p2m_batch_put_page(struct p2m_domain *p2m, struct page_info *page);
+
+static inline bool_t p2m_batch_active(const struct p2m_domain *p2m)
+{
+    return p2m->batch.owner == current && !p2m->batch.suspended;
+}
+
+/* Promote fully populated, private 2M ranges back to superpages */
+int p2m_coalesce_range(struct domain *d, unsigned long start,
+                       unsigned long nr, unsigned long *done);
+
 /* Compare-exchange the type of a single p2m entry */
 p2m_type_t p2m_change_type(struct domain *d, unsigned long gfn,
                            p2m_type_t ot, p2m_type_t nt);
@@ -36,7 +36,7 @@
 #include "grant_table.h"
 #include "hvm/save.h"
 
-#define XEN_DOMCTL_INTERFACE_VERSION 0x00000008
+#define XEN_DOMCTL_INTERFACE_VERSION 0x00000009
 
 /*
  * NB. xen_domctl.domain is an IN/OUT parameter for this operation.
@@ -304,6 +304,7 @@ DEFINE_XEN_GUEST_HANDLE(xen_domctl_max_vcpus_t);
 #define XEN_SCHEDULER_CREDIT   5
 #define XEN_SCHEDULER_CREDIT2  6
 #define XEN_SCHEDULER_ARINC653 7
+#define XEN_SCHEDULER_RT       8
 /* Set or get info? */
 #define XEN_DOMCTL_SCHEDOP_putinfo 0
 #define XEN_DOMCTL_SCHEDOP_getinfo 1
@@ -324,7 +325,29 @@ struct xen_domctl_scheduler_op {
         } credit;
         struct xen_domctl_sched_credit2 {
             uint16_t weight;
+            uint16_t gang;      /* XEN_DOMCTL_CREDIT2_GANG_* */
+#define XEN_DOMCTL_CREDIT2_GANG_KEEP 0  /* putinfo: leave unchanged */
+#define XEN_DOMCTL_CREDIT2_GANG_OFF  1
+#define XEN_DOMCTL_CREDIT2_GANG_ON   2  /* co-schedule the domain's vcpus */
         } credit2;
+        struct xen_domctl_sched_rt {
+            /*
+             * One vcpu, or all of them (getinfo then reports vcpu 0).
+             * Period and budget are in microseconds; both 0 makes the
+             * vcpu best effort, running only when no reservation needs
+             * the pcpu.
+             */
+#define XEN_DOMCTL_SCHED_RT_ALL_VCPUS  (~0U)
+            uint32_t vcpuid;
+#define XEN_DOMCTL_SCHED_RT_PERIOD_MIN 100
+#define XEN_DOMCTL_SCHED_RT_PERIOD_MAX 10000000
+#define XEN_DOMCTL_SCHED_RT_BUDGET_MIN 10
+            uint32_t period;
+            uint32_t budget;
+            /* getinfo: periods that ended with the vcpu runnable but
+             * short of its budget */
+            uint32_t misses;
+        } rt;
     } u;
 };
 typedef struct xen_domctl_scheduler_op xen_domctl_scheduler_op_t;
@@ -310,6 +310,9 @@ typedef uint16_t grant_status_t;
 #define GNTTABOP_get_version          10
 #define GNTTABOP_swap_grant_ref	      11
 #endif /* __XEN_INTERFACE_VERSION__ */
+#if __XEN_INTERFACE_VERSION__ >= 0x00040300
+#define GNTTABOP_copy_segs            12
+#endif /* __XEN_INTERFACE_VERSION__ */
 /* ` } */
 
 /*
@@ -578,6 +581,51 @@ DEFINE_XEN_GUEST_HANDLE(gnttab_swap_grant_ref_t);
 
 #endif /* __XEN_INTERFACE_VERSION__ */
 
+#if __XEN_INTERFACE_VERSION__ >= 0x00040300
+
+/*
+ * GNTTABOP_copy_segs: Hypervisor based scatter-gather copy
+ * Like GNTTABOP_copy, but each descriptor copies up to GNTCOPY_MAX_SEGS
+ * pieces between one source and one destination frame, for instance the
+ * fragments of a packet into a receive buffer.  The frames' grants are
+ * acquired, and the frames mapped, once per descriptor; consecutive
+ * descriptors (and consecutive GNTTABOP_copy operations) of one batch
+ * naming the same frames share them.
+ *
+ * source, dest and flags have the same meaning as in GNTTABOP_copy.  The
+ * segments are copied in order; status reports the first one that
+ * failed, nr_done how many were copied before it.
+ */
+#define GNTCOPY_MAX_SEGS          16
+
+struct gnttab_copy_seg {
+    uint16_t      source_offset;
+    uint16_t      dest_offset;
+    uint16_t      len;
+};
+typedef struct gnttab_copy_seg gnttab_copy_seg_t;
+
+struct gnttab_copy_segs {
+    /* IN parameters. */
+    struct {
+        union {
+            grant_ref_t ref;
+            xen_pfn_t   gmfn;
+        } u;
+        domid_t  domid;
+    } source, dest;
+    uint16_t      flags;          /* GNTCOPY_* */
+    uint16_t      nr_segs;
+    struct gnttab_copy_seg seg[GNTCOPY_MAX_SEGS];
+    /* OUT parameters. */
+    int16_t       status;
+    uint16_t      nr_done;
+};
+typedef struct gnttab_copy_segs gnttab_copy_segs_t;
+DEFINE_XEN_GUEST_HANDLE(gnttab_copy_segs_t);
+
+#endif /* __XEN_INTERFACE_VERSION__ */
+
 /*
  * Bitfield values for gnttab_map_grant_ref.flags.
  */
@@ -371,6 +371,42 @@ struct xen_mem_event_op {
 typedef struct xen_mem_event_op xen_mem_event_op_t;
 DEFINE_XEN_GUEST_HANDLE(xen_mem_event_op_t);
 
+/*
+ * Batched paging operations on nr_gfns contiguous gfns starting at gfn.
+ * Processing stops at the first gfn that fails; nr_done reports how many
+ * gfns were handled before it, and is written back even on failure.  The
+ * hypervisor may also stop early (with a zero return code) when preempted,
+ * in which case the caller is expected to reissue the operation for the
+ * remaining gfns.
+ */
+#define XENMEM_paging_batch_op              26
+#define XENMEM_paging_op_nominate_batch     3
+#define XENMEM_paging_op_evict_batch        4
+#define XENMEM_paging_op_prep_batch         5
+/*
+ * Promote 2M ranges within [gfn, gfn + nr_gfns) whose gfns are all plain,
+ * private RAM again (e.g. after paging them back in or unsharing them) to
+ * superpage mappings, moving their contents into a contiguous extent if
+ * needed.  gfn and nr_gfns must be 2M aligned.  The guest is paused while
+ * the ranges are scanned.  Does not require a pager to be attached, so it
+ * may be used by sharing tools as well.  Progress is reported in nr_done
+ * as for the batched operations.
+ */
+#define XENMEM_paging_op_coalesce           6
+
+struct xen_mem_paging_batch_op {
+    uint8_t     op;         /* XENMEM_paging_op_*_batch, _coalesce */
+    domid_t     domain;
+
+    /* PREP_BATCH IN: buffer of nr_gfns pages, in gfn order */
+    uint64_aligned_t    buffer;
+    uint64_aligned_t    gfn;           /* IN:  first gfn */
+    uint32_t    nr_gfns;               /* IN:  number of contiguous gfns */
+    uint32_t    nr_done;               /* OUT: number of gfns processed */
+};
+typedef struct xen_mem_paging_batch_op xen_mem_paging_batch_op_t;
+DEFINE_XEN_GUEST_HANDLE(xen_mem_paging_batch_op_t);
+
 #define XENMEM_sharing_op                   22
 #define XENMEM_sharing_op_nominate_gfn      0
 #define XENMEM_sharing_op_nominate_gref     1
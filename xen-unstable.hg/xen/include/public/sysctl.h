@@ -34,7 +34,7 @@
 #include "xen.h"
 #include "domctl.h"
 
-#define XEN_SYSCTL_INTERFACE_VERSION 0x00000009
+#define XEN_SYSCTL_INTERFACE_VERSION 0x0000000A
 
 /*
  * Read console content from Xen buffer ring.
@@ -578,6 +578,37 @@ struct xen_sysctl_credit_schedule {
 typedef struct xen_sysctl_credit_schedule xen_sysctl_credit_schedule_t;
 DEFINE_XEN_GUEST_HANDLE(xen_sysctl_credit_schedule_t);
 
+struct xen_sysctl_credit2_schedule {
+    /*
+     * Which pcpus share a runqueue.  Only settable while the cpupool has
+     * no pcpus; put them in afterwards.
+     */
+#define XEN_SYSCTL_CSCHED2_RUNQ_CORE   1
+#define XEN_SYSCTL_CSCHED2_RUNQ_SOCKET 2
+#define XEN_SYSCTL_CSCHED2_RUNQ_NODE   3
+#define XEN_SYSCTL_CSCHED2_RUNQ_ALL    4
+    uint32_t runqueue;
+    /* Non-zero: make load balancing across NUMA nodes cost by distance */
+    uint32_t numa_balance;
+};
+typedef struct xen_sysctl_credit2_schedule xen_sysctl_credit2_schedule_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_credit2_schedule_t);
+
+struct xen_sysctl_rt_schedule {
+    /*
+     * Earliest deadline first over all pcpus of the cpupool, or over each
+     * pcpu on its own, every vcpu belonging to the pcpu it is on.  Only
+     * settable while the cpupool has no pcpus; put them in afterwards.
+     */
+#define XEN_SYSCTL_RT_GLOBAL      1
+#define XEN_SYSCTL_RT_PARTITIONED 2
+    uint32_t mode;
+    /* getinfo: sum of the vcpus' budget/period, 1000 being one pcpu */
+    uint32_t reserved;
+};
+typedef struct xen_sysctl_rt_schedule xen_sysctl_rt_schedule_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_rt_schedule_t);
+
 /* XEN_SYSCTL_scheduler_op */
 /* Set or get info? */
 #define XEN_SYSCTL_SCHEDOP_putinfo 0
@@ -591,6 +622,8 @@ struct xen_sysctl_scheduler_op {
             XEN_GUEST_HANDLE_64(xen_sysctl_arinc653_schedule_t) schedule;
         } sched_arinc653;
         struct xen_sysctl_credit_schedule sched_credit;
+        struct xen_sysctl_credit2_schedule sched_credit2;
+        struct xen_sysctl_rt_schedule sched_rt;
     } u;
 };
 typedef struct xen_sysctl_scheduler_op xen_sysctl_scheduler_op_t;
@@ -631,6 +664,96 @@ struct xen_sysctl_coverage_op {
 typedef struct xen_sysctl_coverage_op xen_sysctl_coverage_op_t;
 DEFINE_XEN_GUEST_HANDLE(xen_sysctl_coverage_op_t);
 
+/* XEN_SYSCTL_sched_latency */
+/*
+ * Per-vcpu histograms of how long the vcpus of a domain waited for a pcpu.
+ * 'wake' counts the time from a vcpu being woken (leaving the blocked or
+ * offline state) until it runs; 'runq' counts every runnable-to-running
+ * wait, including those after a preemption.  Bucket 0 holds waits under
+ * 1024ns, bucket i holds waits in [2^(i+9), 2^(i+10)) ns and the last
+ * bucket holds everything longer.
+ */
+#define XEN_SYSCTL_SCHED_LAT_BUCKETS 20
+struct xen_sysctl_sched_latency_vcpu {
+    uint64_aligned_t wake[XEN_SYSCTL_SCHED_LAT_BUCKETS];
+    uint64_aligned_t runq[XEN_SYSCTL_SCHED_LAT_BUCKETS];
+    uint64_aligned_t wake_max;      /* longest wakeup latency (ns) */
+    uint64_aligned_t runq_max;      /* longest runqueue wait (ns) */
+};
+typedef struct xen_sysctl_sched_latency_vcpu xen_sysctl_sched_latency_vcpu_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_sched_latency_vcpu_t);
+struct xen_sysctl_sched_latency {
+    /* IN variables. */
+    domid_t  domid;
+    uint16_t flags;
+#define XEN_SYSCTL_SCHED_LAT_reset 1    /* Zero the histograms once read. */
+    /* IN: size of the buffer (in vcpus); OUT: number of vcpus written. */
+    uint32_t nr_vcpus;
+    XEN_GUEST_HANDLE_64(xen_sysctl_sched_latency_vcpu_t) vcpus;
+};
+typedef struct xen_sysctl_sched_latency xen_sysctl_sched_latency_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_sched_latency_t);
+
+/* XEN_SYSCTL_evtchn_op */
+/*
+ * Debug statistics and rate limits of the event channels of a domain.
+ *
+ * Per port, 'sent' counts sends on the port (EVTCHNOP_send, or Xen for a
+ * Xen-attached port), 'raised' counts events raised on the port from any
+ * source (the remote end, a VIRQ, a PIRQ or an IPI), 'coalesced' the raised
+ * events that found the port already pending and 'deferred' the sends held
+ * back by the port's rate limit.  The counters are not updated atomically
+ * and may undercount under heavy contention.
+ *
+ * A rate limit lets at most 'burst' sends on a port through per period;
+ * further sends in the same period are coalesced into one notification
+ * raised at the end of it.  A limit can only be set on a port in use and
+ * goes with its binding: closing the port, or setting a period of 0,
+ * removes it.
+ */
+#define XEN_SYSCTL_EVTCHNOP_get_stats     0
+#define XEN_SYSCTL_EVTCHNOP_set_ratelimit 1
+struct xen_sysctl_evtchn_stats {
+    uint32_t port;
+    uint8_t  status;          /* EVTCHNSTAT_* */
+    uint8_t  pad;
+    uint16_t vcpu;            /* VCPU the port notifies */
+    uint32_t rl_period_us;    /* Rate limit, or 0 if there is none. */
+    uint32_t rl_burst;
+    uint64_aligned_t sent;
+    uint64_aligned_t raised;
+    uint64_aligned_t coalesced;
+    uint64_aligned_t deferred;
+};
+typedef struct xen_sysctl_evtchn_stats xen_sysctl_evtchn_stats_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_evtchn_stats_t);
+struct xen_sysctl_evtchn_op {
+    uint32_t cmd;             /* XEN_SYSCTL_EVTCHNOP_* */
+    domid_t  domid;
+    uint16_t flags;
+#define XEN_SYSCTL_EVTCHN_reset 1 /* get_stats: zero the counters once read */
+    union {
+        struct {
+            /*
+             * IN: first port to look at; OUT: port to continue from, or 0
+             * once all ports have been looked at.
+             */
+            uint32_t start_port;
+            /* IN: size of the buffer; OUT: number of records written. */
+            uint32_t nr_ports;
+            /* One record per port that is in use (not closed). */
+            XEN_GUEST_HANDLE_64(xen_sysctl_evtchn_stats_t) stats;
+        } get_stats;
+        struct {
+            uint32_t port;
+            uint32_t period_us;   /* 0 removes the limit. */
+            uint32_t burst;       /* Sends let through per period (>= 1). */
+        } set_ratelimit;
+    } u;
+};
+typedef struct xen_sysctl_evtchn_op xen_sysctl_evtchn_op_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_evtchn_op_t);
+
 
 struct xen_sysctl {
     uint32_t cmd;
@@ -653,6 +776,8 @@ struct xen_sysctl {
 #define XEN_SYSCTL_cpupool_op                    18
 #define XEN_SYSCTL_scheduler_op                  19
 #define XEN_SYSCTL_coverage_op                   20
+#define XEN_SYSCTL_sched_latency                 21
+#define XEN_SYSCTL_evtchn_op                     22
     uint32_t interface_version; /* XEN_SYSCTL_INTERFACE_VERSION */
     union {
         struct xen_sysctl_readconsole       readconsole;
@@ -674,6 +799,8 @@ struct xen_sysctl {
         struct xen_sysctl_cpupool_op        cpupool_op;
         struct xen_sysctl_scheduler_op      scheduler_op;
         struct xen_sysctl_coverage_op       coverage_op;
+        struct xen_sysctl_sched_latency     sched_latency;
+        struct xen_sysctl_evtchn_op         evtchn_op;
         uint8_t                             pad[128];
     } u;
 };
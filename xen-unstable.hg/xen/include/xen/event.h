@@ -9,6 +9,7 @@
 #ifndef __XEN_EVENT_H__
 #define __XEN_EVENT_H__
 
+#include <xen/errno.h>
 #include <xen/sched.h>
 #include <xen/smp.h>
 #include <xen/softirq.h>
@@ -69,14 +70,117 @@ int guest_enabled_event(struct vcpu *v, uint32_t virq);
 /* Notify remote end of a Xen-attached event channel.*/
 void notify_via_xen_event_channel(struct domain *ld, int lport);
 
+/* Wake any VCPUs polling (SCHEDOP_poll) a port that became pending. */
+void evtchn_check_pollers(struct domain *d, unsigned int port);
+
+/* Per-port statistics and rate limits (XEN_SYSCTL_evtchn_op). */
+struct xen_sysctl_evtchn_op;
+long evtchn_sysctl(struct xen_sysctl_evtchn_op *op);
+
 /* Internal event channel object accessors */
+#define group_from_port(d,p) \
+    ((d)->evtchn_group[(p)/EVTCHNS_PER_GROUP])
 #define bucket_from_port(d,p) \
-    ((d)->evtchn[(p)/EVTCHNS_PER_BUCKET])
-#define port_is_valid(d,p)    \
-    (((p) >= 0) && ((p) < MAX_EVTCHNS(d)) && \
-     (bucket_from_port(d,p) != NULL))
-#define evtchn_from_port(d,p) \
-    (&(bucket_from_port(d,p))[(p)&(EVTCHNS_PER_BUCKET-1)])
+    ((group_from_port(d,p))[((p)%EVTCHNS_PER_GROUP)/EVTCHNS_PER_BUCKET])
+
+static inline bool_t port_is_valid(struct domain *d, unsigned int p)
+{
+    if ( p >= MAX_EVTCHNS(d) )
+        return 0;
+    if ( !group_from_port(d, p) )
+        return 0;
+    return bucket_from_port(d, p) != NULL;
+}
+
+static inline struct evtchn *evtchn_from_port(struct domain *d, unsigned int p)
+{
+    return &bucket_from_port(d, p)[p & (EVTCHNS_PER_BUCKET-1)];
+}
+
+/*
+ * Event channel port ABIs: how pending and masked state is kept and how
+ * events are delivered to the guest.  Called with the channel's lock held;
+ * all but set_pending are also called with the domain's event lock held.
+ */
+struct evtchn_port_ops {
+    void (*init)(struct domain *d, struct evtchn *evtchn);
+    void (*set_pending)(struct vcpu *v, struct evtchn *evtchn);
+    void (*clear_pending)(struct domain *d, struct evtchn *evtchn);
+    void (*unmask)(struct domain *d, struct evtchn *evtchn);
+    bool_t (*is_pending)(struct domain *d, const struct evtchn *evtchn);
+    bool_t (*is_masked)(struct domain *d, const struct evtchn *evtchn);
+    /* A port that is still busy (e.g. linked) must not be reused yet. */
+    bool_t (*is_busy)(struct domain *d, const struct evtchn *evtchn);
+    int (*set_priority)(struct domain *d, struct evtchn *evtchn,
+                        unsigned int priority);
+    void (*print_state)(struct domain *d, const struct evtchn *evtchn);
+};
+
+/* The 2-level ABI every domain starts with (event_2l.c). */
+void evtchn_2l_init(struct domain *d);
+
+static inline void evtchn_port_init(struct domain *d, struct evtchn *evtchn)
+{
+    if ( d->evtchn_port_ops->init )
+        d->evtchn_port_ops->init(d, evtchn);
+}
+
+static inline void evtchn_port_set_pending(struct vcpu *v,
+                                           struct evtchn *evtchn)
+{
+    const struct evtchn_port_ops *ops = v->domain->evtchn_port_ops;
+
+    evtchn->stats.raised++;
+    if ( ops->is_pending(v->domain, evtchn) )
+        evtchn->stats.coalesced++;
+    ops->set_pending(v, evtchn);
+}
+
+static inline void evtchn_port_clear_pending(struct domain *d,
+                                             struct evtchn *evtchn)
+{
+    d->evtchn_port_ops->clear_pending(d, evtchn);
+}
+
+static inline void evtchn_port_unmask(struct domain *d,
+                                      struct evtchn *evtchn)
+{
+    d->evtchn_port_ops->unmask(d, evtchn);
+}
+
+static inline bool_t evtchn_port_is_pending(struct domain *d,
+                                            const struct evtchn *evtchn)
+{
+    return d->evtchn_port_ops->is_pending(d, evtchn);
+}
+
+static inline bool_t evtchn_port_is_masked(struct domain *d,
+                                           const struct evtchn *evtchn)
+{
+    return d->evtchn_port_ops->is_masked(d, evtchn);
+}
+
+static inline bool_t evtchn_port_is_busy(struct domain *d,
+                                         const struct evtchn *evtchn)
+{
+    return d->evtchn_port_ops->is_busy &&
+           d->evtchn_port_ops->is_busy(d, evtchn);
+}
+
+static inline int evtchn_port_set_priority(struct domain *d,
+                                           struct evtchn *evtchn,
+                                           unsigned int priority)
+{
+    if ( !d->evtchn_port_ops->set_priority )
+        return -ENOSYS;
+    return d->evtchn_port_ops->set_priority(d, evtchn, priority);
+}
+
+static inline void evtchn_port_print_state(struct domain *d,
+                                           const struct evtchn *evtchn)
+{
+    d->evtchn_port_ops->print_state(d, evtchn);
+}
 
 
 /* Wait on a Xen-attached event channel. */
@@ -24,6 +24,7 @@
 #ifndef __XEN_GRANT_TABLE_H__
 #define __XEN_GRANT_TABLE_H__
 
+#include <xen/radix-tree.h>
 #include <public/grant_table.h>
 #include <asm/page.h>
 #include <asm/grant_table.h>
@@ -62,6 +63,8 @@ struct grant_mapping {
     u32      ref;           /* grant ref */
     u16      flags;         /* 0-4: GNTMAP_* ; 5-15: unused */
     domid_t  domid;         /* granting domain */
+    u16      vcpu;          /* vcpu whose free list the entry goes back to */
+    u16      counted;       /* counted in the mapper's maptrack_mfns */
 };
 
 /* Fairly arbitrary. [POLICY] */
@@ -83,12 +86,21 @@ struct grant_table {
     grant_status_t       **status;
     /* Active grant table. */
     struct active_grant_entry **active;
-    /* Mapping tracking table. */
+    /* Mapping tracking table (free entries are on per-vcpu lists). */
     struct grant_mapping **maptrack;
-    unsigned int          maptrack_head;
     unsigned int          maptrack_limit;
-    /* Lock protecting updates to active and shared grant tables. */
-    spinlock_t            lock;
+    /* Lock protecting growing the mapping tracking table. */
+    spinlock_t            maptrack_lock;
+    /* Mapping counts by frame, for the IOMMU (see mapcount()). */
+    struct radix_tree_root maptrack_mfns;
+    /* Lock protecting the IOMMU mapping counts (maptrack_mfns). */
+    spinlock_t            mapcount_lock;
+    /*
+     * Lock protecting the grant table's size and version.  It is taken for
+     * reading by operations on individual entries, which then lock the
+     * entry itself, and for writing by changes to the table as a whole.
+     */
+    rwlock_t              lock;
     /* The defined versions are 1 and 2.  Set to 0 if we don't know
        what version to use yet. */
     unsigned              gt_version;
@@ -99,6 +111,12 @@ int grant_table_create(
     struct domain *d);
 void grant_table_destroy(
     struct domain *d);
+void grant_table_init_vcpu(
+    struct vcpu *v);
+
+/* Complete the unmaps queued by this cpu, flushing TLBs as needed. */
+void gnttab_flush_deferred_unmaps(void);
+bool_t gnttab_deferred_unmaps_pending(void);
 
 /* Domain death release of granted mappings of other domains' memory. */
 void
@@ -106,7 +124,7 @@ gnttab_release_mappings(
     struct domain *d);
 
 /* Increase the size of a domain's grant table.
- * Caller must hold d's grant table lock.
+ * Caller must hold d's grant table lock for writing.
  */
 int
 gnttab_grow_table(struct domain *d, unsigned int req_nr_frames);
@@ -8,6 +8,7 @@
 #include <xen/list.h>
 #include <asm/regs.h>
 #include <asm/hardirq.h>
+#include <public/event_channel.h>
 
 struct irqaction {
     void (*handler)(int, void *, struct cpu_user_regs *);
@@ -108,7 +109,7 @@ struct vcpu;
 
 struct pirq {
     int pirq;
-    u16 evtchn;
+    evtchn_port_t evtchn;
     bool_t masked;
     struct rcu_head rcu_head;
     struct arch_pirq arch;
@@ -32,6 +32,7 @@ PERFCOUNTER(acct_reorder,           "csched: acct_reorder")
 PERFCOUNTER(acct_min_credit,        "csched: acct_min_credit")
 PERFCOUNTER(acct_vcpu_active,       "csched: acct_vcpu_active")
 PERFCOUNTER(acct_vcpu_idle,         "csched: acct_vcpu_idle")
+PERFCOUNTER(acct_pcpu_retry,        "csched: acct_pcpu_retry")
 PERFCOUNTER(vcpu_sleep,             "csched: vcpu_sleep")
 PERFCOUNTER(vcpu_wake_running,      "csched: vcpu_wake_running")
 PERFCOUNTER(vcpu_wake_onrunq,       "csched: vcpu_wake_onrunq")
@@ -50,6 +51,24 @@ PERFCOUNTER(migrate_queued,         "csched: migrate_queued")
 PERFCOUNTER(migrate_running,        "csched: migrate_running")
 PERFCOUNTER(migrate_kicked_away,    "csched: migrate_kicked_away")
 PERFCOUNTER(vcpu_hot,               "csched: vcpu_hot")
+PERFCOUNTER(yield_to_local,         "csched: yield_to_local")
+PERFCOUNTER(yield_to_remote,        "csched: yield_to_remote")
+PERFCOUNTER(yield_to_none,          "csched: yield_to_none")
+PERFCOUNTER(tick_stop,              "csched: tick_stop")
+PERFCOUNTER(tick_restart,           "csched: tick_restart")
+
+PERFCOUNTER(gang_slot,              "csched2: gang slots opened")
+PERFCOUNTER(gang_pull,              "csched2: gang vcpus pulled in")
+
+PERFCOUNTER(rt_replenish,           "rt: budgets replenished")
+PERFCOUNTER(rt_depleted,            "rt: vcpus out of budget")
+PERFCOUNTER(rt_deadline_miss,       "rt: deadlines missed")
+
+PERFCOUNTER(maptrack_steal,         "gnttab: maptrack entries stolen")
+PERFCOUNTER(gnttab_unmap_flush,     "gnttab: unmap TLB flushes")
+PERFCOUNTER(gnttab_unmap_flush_avoided, "gnttab: unmap TLB flushes avoided")
+PERFCOUNTER(gnttab_copy_buf_hit,    "gnttab: copy frames reused in a batch")
+PERFCOUNTER(gnttab_copy_buf_miss,   "gnttab: copy frames acquired")
 
 PERFCOUNTER(need_flush_tlb_flush,   "PG_need_flush tlb flushes")
 
@@ -21,6 +21,14 @@ extern cpumask_t cpupool_free_cpus;
 #define SCHED_DEFAULT_RATELIMIT_US 1000
 extern int sched_ratelimit_us;
 
+/*
+ * Last level cache misses taken on this pcpu so far, which schedulers use
+ * to estimate the cache footprint of vcpus; LLC_MISSES_UNKNOWN where they
+ * aren't counted.  Provided by the architecture.
+ */
+#define LLC_MISSES_UNKNOWN (~0ULL)
+uint64_t arch_llc_misses(void);
+
 
 /*
  * In order to allow a scheduler to remap the lock->cpu mapping,
@@ -195,6 +203,7 @@ extern const struct scheduler sched_sedf_def;
 extern const struct scheduler sched_credit_def;
 extern const struct scheduler sched_credit2_def;
 extern const struct scheduler sched_arinc653_def;
+extern const struct scheduler sched_rt_def;
 
 
 struct cpupool
@@ -23,6 +23,7 @@
 #include <public/domctl.h>
 #include <public/sysctl.h>
 #include <public/vcpu.h>
+#include <public/event_channel.h>
 #include <public/mem_event.h>
 
 #ifdef CONFIG_COMPAT
@@ -50,12 +51,21 @@ extern struct domain *dom0;
 #else
 #define BITS_PER_EVTCHN_WORD(d) (has_32bit_shinfo(d) ? 32 : BITS_PER_LONG)
 #endif
-#define MAX_EVTCHNS(d) (BITS_PER_EVTCHN_WORD(d) * BITS_PER_EVTCHN_WORD(d))
+/* Ports the domain's event channel ABI can address. */
+#define MAX_EVTCHNS(d) ((d)->evtchn_fifo ? EVTCHN_FIFO_NR_CHANNELS : \
+                        BITS_PER_EVTCHN_WORD(d) * BITS_PER_EVTCHN_WORD(d))
+#define MAX_NR_EVTCHNS     EVTCHN_FIFO_NR_CHANNELS
+/* Ports are allocated in buckets; a page of bucket pointers is a group. */
 #define EVTCHNS_PER_BUCKET 128
-#define NR_EVTCHN_BUCKETS  (NR_EVENT_CHANNELS / EVTCHNS_PER_BUCKET)
+#define BUCKETS_PER_GROUP  (PAGE_SIZE / sizeof(struct evtchn *))
+#define EVTCHNS_PER_GROUP  (BUCKETS_PER_GROUP * EVTCHNS_PER_BUCKET)
+#define NR_EVTCHN_GROUPS   DIV_ROUND_UP(MAX_NR_EVTCHNS, EVTCHNS_PER_GROUP)
+
+struct evtchn_ratelimit;
 
 struct evtchn
 {
+    spinlock_t lock;       /* Protects state and binding; see event_channel.c */
 #define ECS_FREE         0 /* Channel is available for use.                  */
 #define ECS_RESERVED     1 /* Channel is reserved.                           */
 #define ECS_UNBOUND      2 /* Channel is waiting to bind to a remote domain. */
@@ -66,21 +76,33 @@ struct evtchn
     u8  state;             /* ECS_* */
     u8  xen_consumer;      /* Consumer in Xen, if any? (0 = send to guest) */
     u16 notify_vcpu_id;    /* VCPU for local delivery notification */
+    evtchn_port_t port;
     union {
         struct {
             domid_t remote_domid;
         } unbound;     /* state == ECS_UNBOUND */
         struct {
-            u16            remote_port;
+            evtchn_port_t  remote_port;
             struct domain *remote_dom;
         } interdomain; /* state == ECS_INTERDOMAIN */
         struct {
             u16            irq;
-            u16            next_port;
-            u16            prev_port;
+            evtchn_port_t  next_port;
+            evtchn_port_t  prev_port;
         } pirq;        /* state == ECS_PIRQ */
         u16 virq;      /* state == ECS_VIRQ */
     } u;
+    u8 priority;           /* FIFO ABI: queue the event is linked into */
+    u8 pending:1;          /* FIFO ABI: pending with no event word yet */
+    u16 last_vcpu_id;      /* FIFO ABI: VCPU of the queue last linked to */
+    u8 last_priority;      /* FIFO ABI: priority of that queue */
+    struct {
+        unsigned long sent;      /* Sends on this port */
+        unsigned long raised;    /* Events raised on this port... */
+        unsigned long coalesced; /* ...that were already pending */
+        unsigned long deferred;  /* Sends held back by the rate limit */
+    } stats;               /* See XEN_SYSCTL_evtchn_op */
+    struct evtchn_ratelimit *ratelimit; /* NULL unless rate limited */
 #ifdef FLASK_ENABLE
     void *ssid;
 #endif
@@ -91,6 +113,9 @@ void evtchn_destroy(struct domain *d); /* from domain_kill */
 void evtchn_destroy_final(struct domain *d); /* from complete_domain_destroy */
 
 struct waitqueue_vcpu;
+struct evtchn_port_ops;
+struct evtchn_fifo_domain;
+struct evtchn_fifo_vcpu;
 
 struct vcpu 
 {
@@ -128,6 +153,11 @@ struct vcpu
     /* last time when vCPU is scheduled out */
     uint64_t last_run_time;
 
+    /* Wakeup and runqueue wait histograms (see vcpu_runstate_change()). */
+    struct xen_sysctl_sched_latency_vcpu sched_lat;
+    /* Did the current runnable period start with a wakeup? */
+    bool_t           sched_lat_woken;
+
     /* Has the FPU been initialised? */
     bool_t           fpu_initialised;
     /* Has the FPU been used since it was last saved? */
@@ -168,9 +198,12 @@ struct vcpu
     atomic_t         pause_count;
 
     /* IRQ-safe virq_lock protects against delivering VIRQ to stale evtchn. */
-    u16              virq_to_evtchn[NR_VIRQS];
+    evtchn_port_t    virq_to_evtchn[NR_VIRQS];
     spinlock_t       virq_lock;
 
+    /* FIFO event channel ABI: control block and queues. */
+    struct evtchn_fifo_vcpu *evtchn_fifo;
+
     /* Bitmask of CPUs on which this VCPU may run. */
     cpumask_var_t    cpu_affinity;
     /* Used to change affinity temporarily. */
@@ -185,6 +218,10 @@ struct vcpu
     /* Multicall information. */
     struct mc_state  mc_state;
 
+    /* Free maptrack entries of the domain's grant table kept by this VCPU. */
+    spinlock_t       maptrack_freelist_lock;
+    unsigned int     maptrack_head;
+
     struct waitqueue_vcpu *waitqueue_vcpu;
 
     struct arch_vcpu arch;
@@ -260,8 +297,10 @@ struct domain
     spinlock_t       rangesets_lock;
 
     /* Event channel information. */
-    struct evtchn   *evtchn[NR_EVTCHN_BUCKETS];
+    struct evtchn  **evtchn_group[NR_EVTCHN_GROUPS];
     spinlock_t       event_lock;
+    const struct evtchn_port_ops *evtchn_port_ops;
+    struct evtchn_fifo_domain *evtchn_fifo;
 
     struct grant_table *grant_table;
 
@@ -549,6 +588,7 @@ void sched_destroy_domain(struct domain *d);
 int sched_move_domain(struct domain *d, struct cpupool *c);
 long sched_adjust(struct domain *, struct xen_domctl_scheduler_op *);
 long sched_adjust_global(struct xen_sysctl_scheduler_op *);
+long sched_latency_get(struct xen_sysctl_sched_latency *);
 int  sched_id(void);
 void sched_tick_suspend(void);
 void sched_tick_resume(void);